@@ -5,11 +5,21 @@
 #include <glad.h>
 #include <time.h>
 #include "CameraArcball.h"
+#include "Capture.h"
 #include "Draw.h"
 #include "GLXtras.h"
+#include "Headless.h"
 #include "Mesh.h"
 #include "Misc.h"
+#include "MultiDraw.h"
+#include "Parallel.h"
+#include "Readback.h"
+#include "Regress.h"
+#include "SceneFile.h"
+#include "SceneGraph.h"
+#include "TextureStream.h"
 #include "Widgets.h"
+#include <ctype.h>
 #include <stdio.h>
 #include <Draw.h>
 #include "Quaternion.h"
@@ -17,7 +27,9 @@
 #include "imgui.h"
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
+#include <algorithm>
 #include <chrono>
+#include <map>
 #include <GL/gl3w.h> 
 #include <GLFW/glfw3.h>
 
@@ -46,6 +58,11 @@ Framer      framer;     // to position/orient individual mesh
 Mover       mover;      // to position light
 void       *picked = &camera;
 
+// mesh transforms, as a hierarchy
+SceneGraph  sceneGraph;
+int         framedNode = -1;    // node the framer edits
+mat4        framedWorld;        // framer's copy of its world matrix, set back to the node on drag/wheel
+
 
 // Mesh Class
 
@@ -59,18 +76,28 @@ public:
     vector<vec3> normals;
     vector<vec2> uvs;
     vector<int3> triangles;
-    // object to world space
-    mat4 xform;
+    // object to world space: node in sceneGraph
+    int node;
+    const mat4 &Xform() { return sceneGraph.World(node); }
     // GPU vertex buffer and texture
     GLuint vBufferId, textureId, textureId2, textureId3, textureId4, textureId5;
     GLuint textureId6, textureId7, textureId8, textureId9, textureId10, textureId11;
     // operations
     void Buffer();
     void Draw();
+    void BindTextures();
+    void SetMaterial(int part);
+        // part 0: guitar body (first nBodyTriangles), part 1: remainder
     bool Read(int id, char *fileame, mat4 *m = NULL);
         // read in object file (with normals, uvs) and texture map, initialize matrix, build vertex buffer
+    bool ReadObject(string objectFilename);
+        // parse and normalize object file; no GL, so may run on a worker thread
+    void Finish(int id, char *name, mat4 *m = NULL, int parentNode = -1);
+        // with object read: build vertex buffer, request textures, add scene graph node with world m (main thread)
 };
 
+const int nBodyTriangles = 2050;
+
 
 
 // Shaders
@@ -120,6 +147,45 @@ const char *vertexShader = R"(
     }
 )";
 
+// as above, but modelview is fetched per draw from the MultiDraw storage buffer
+const char *multiDrawVertexShader = R"(
+    #version 430
+    struct DrawData {
+        layout (row_major) mat4 modelview;
+        int material;
+    };
+    layout (std430, binding = 0) buffer DrawBlock {
+        DrawData draws[];
+    };
+    in vec3 point;
+    in vec3 normal;
+    in vec2 uv;
+    in int drawId;
+    out vec3 vPoint;
+    out vec3 vNormal;
+    out vec2 vUv;
+    uniform mat4 persp;
+    uniform float current_time;
+    uniform bool move_guitar_updown;
+    uniform bool move_guitar_xyaxis;
+    uniform bool move_guitar_xzaxis;
+    void main() {
+        mat4 modelview = draws[drawId].modelview;
+        vPoint = (modelview*vec4(point, 1)).xyz;
+        if (move_guitar_updown)
+            vPoint.y += 0.2*sin(current_time);
+        if (move_guitar_xyaxis)
+            vPoint = vec3(vPoint.x * cos(current_time) - vPoint.y * sin(current_time),
+                          vPoint.y * cos(current_time) + vPoint.x * sin(current_time), vPoint.z);
+        if (move_guitar_xzaxis)
+            vPoint = vec3(vPoint.x * cos(current_time) - vPoint.z * sin(current_time),
+                          vPoint.y, vPoint.z * cos(current_time) + vPoint.x * sin(current_time));
+        vNormal = (modelview*vec4(normal, 0)).xyz;
+        gl_Position = persp*vec4(vPoint, 1);
+        vUv = uv;
+    }
+)";
+
 const char *pixelShader = R"(
     #version 130
     in vec3 vPoint;
@@ -135,7 +201,6 @@ const char *pixelShader = R"(
     uniform sampler2D Metallic_Map;
     uniform sampler2D Roughness_Map;
     uniform mat4 modelview;
-    uniform bool use_albedo_body;
     uniform bool show_normal_map;
     uniform bool show_ao_map;
 
@@ -209,18 +274,7 @@ const char *pixelShader = R"(
         //Extension 19
         vec3 Normal = texture(Normal_Map, vec2(vUv.x,vUv.y)).rgb;
         vec3 AOTexture = texture(AO_Map, vec2(vUv.x,vUv.y)).rgb;
-        vec3 albedo;        
-
-        if (use_albedo_body)
-        {
-            albedo = texture(Albedo_Map, vec2(vUv.x,1-vUv.y)).rgb;
-        }
-        else
-        {
-            //test
-            albedo = texture(Albedo_Map, vec2(vUv.x,vUv.y)).rgb;
-            //EOT
-        }
+        vec3 albedo = texture(Albedo_Map, vec2(vUv.x,vUv.y)).rgb; // ReadTarga orients rows per the file header
         
         vec3 metallicTexture = texture(Metallic_Map, vec2(vUv.x,vUv.y)).rgb;
         vec3 roughnessTexture = texture(Roughness_Map, vec2(vUv.x,vUv.y)).rgb;
@@ -546,7 +600,14 @@ const char  *directory = "./";
 const char  *defaultNames[] = {"HousePlant", "Rose", "Cat", "Cerberus"};
 vector<Mesh> meshes;
 
+// multi-draw: all meshes in shared buffers, one indirect draw per material
+GLuint      perMeshShader = 0, multiDrawShader = 0;
+MultiDraw   multiDraw;
+bool        useMultiDraw = false, multiDrawDirty = true;
+vector<int2> materials; // (mesh index, part) whose textures represent the material
+
 void NewMesh(char *filename, mat4 *m) {
+    multiDrawDirty = true;
     int nmeshes = meshes.size();
     meshes.resize(nmeshes+1);
     Mesh &mesh = meshes[nmeshes];
@@ -554,72 +615,110 @@ void NewMesh(char *filename, mat4 *m) {
         meshes.resize(nmeshes);
 }
 
-void WriteMatrix(FILE *file, mat4 &m) {
-    fprintf(file, "%f %f %f %f %f %f %f %f %f %f %f %f %f %f %f %f\n",
-        m[0][0], m[0][1], m[0][2], m[0][3],
-        m[1][0], m[1][1], m[1][2], m[1][3],
-        m[2][0], m[2][1], m[2][2], m[2][3],
-        m[3][0], m[3][1], m[3][2], m[3][3]);
+void SaveScene(bool binary = false) {
+    // text or binary to sceneFilename; ReadScene reads either
+    // text scenes are flat (world matrices only); binary scenes keep parents
+    SceneFile scene;
+    scene.modelview = camera.modelview;
+    map<int, int> nodeMeshes;
+    for (size_t i = 0; i < meshes.size(); i++)
+        nodeMeshes[meshes[i].node] = i;
+    for (size_t i = 0; i < meshes.size(); i++) {
+        SceneEntry e;
+        e.name = meshes[i].filename;
+        e.xform = meshes[i].Xform();
+        int parent = sceneGraph.Parent(meshes[i].node);
+        e.parent = parent < 0? -1 : nodeMeshes[parent];
+        scene.entries.push_back(e);
+    }
+    if (WriteSceneFile(sceneFilename, scene, binary))
+        printf("Saved %i meshes (%s)\n", (int) meshes.size(), binary? "binary" : "text");
 }
 
-bool ReadMatrix(FILE *file, mat4 &m) {
-    char buf[500];
-    if (fgets(buf, 500, file) == NULL)
-        return false;
-    int nitems = sscanf(buf, "%f%f%f%f%f%f%f%f%f%f%f%f%f%f%f%f",
-        &m[0][0], &m[0][1], &m[0][2], &m[0][3],
-        &m[1][0], &m[1][1], &m[1][2], &m[1][3],
-        &m[2][0], &m[2][1], &m[2][2], &m[2][3],
-        &m[3][0], &m[3][1], &m[3][2], &m[3][3]);
-    return nitems == 16;
+string ObjectFilename(const char *meshName) {
+    // a mesh named for an object file (eg "Models/rose.obj") reads that file; others are, as yet, the guitar
+    string name(meshName);
+    size_t n = name.size();
+    bool obj = n > 4 && name[n-4] == '.' && tolower(name[n-3]) == 'o' && tolower(name[n-2]) == 'b' && tolower(name[n-1]) == 'j';
+    return obj? name : string("lespaul.obj");
 }
 
-void SaveScene() {
-    FILE *file = fopen(sceneFilename, "w");
-    if (!file) {
-        printf("Can't write %s\n", sceneFilename);
-        return;
-    }
-    WriteMatrix(file, camera.modelview);
-    for (size_t i = 0; i < meshes.size(); i++) {
-        Mesh &mesh = meshes[i];
-        fprintf(file, "%s\n", mesh.filename.c_str());
-        WriteMatrix(file, mesh.xform);
-    }
-    fclose(file);
-    printf("Saved %i meshes\n", meshes.size());
+struct SceneLoad {
+    vector<string> objects;     // unique object filenames
+    vector<int> readers;        // per object, the mesh that parses it
+    vector<char> ok;            // per object (not vector<bool>: written concurrently)
+};
+
+void ReadObjectJob(int i, void *data) {
+    SceneLoad *load = (SceneLoad *) data;
+    load->ok[i] = meshes[load->readers[i]].ReadObject(load->objects[i]);
 }
 
 bool ReadScene(const char *filename) {
-    char meshName[500];
-    FILE *file = fopen(filename, "r");
-    if (!file)
+    // parse each object once, in parallel; then copy to meshes sharing it, buffer and request textures serially
+    SceneFile scene;
+    if (!ReadSceneFile(filename, scene))
         return false;
-    mat4 mv;
-    if (!ReadMatrix(file, mv)) {
-        printf("Can't read modelview\n");
-        return false;
-    }
-    camera.SetModelview(mv);
+    auto start = chrono::steady_clock::now();
+    camera.SetModelview(scene.modelview);
+    int nEntries = scene.entries.size();
     meshes.resize(0);
-    while (fgets(meshName, 500, file) != NULL) {
-        meshName[strlen(meshName)-1] = 0; // remove carriage-return
-        mat4 m;
-        if (!ReadMatrix(file, m)) {
-            printf("Can't read matrix\n");
-            return false;
+    meshes.resize(nEntries);
+    multiDrawDirty = true;
+    sceneGraph.Clear();
+    framedNode = -1;
+    SceneLoad load;
+    map<string, int> objectIds;
+    vector<int> entryObjects(nEntries);
+    for (int i = 0; i < nEntries; i++) {
+        string object = ObjectFilename(scene.entries[i].name.c_str());
+        auto it = objectIds.find(object);
+        if (it == objectIds.end()) {
+            it = objectIds.insert(make_pair(object, (int) load.objects.size())).first;
+            load.objects.push_back(object);
+            load.readers.push_back(i);
+        }
+        entryObjects[i] = it->second;
+    }
+    load.ok.assign(load.objects.size(), 0);
+    ParallelJobs(load.objects.size(), ReadObjectJob, &load);
+    for (int i = 0; i < nEntries; i++) {
+        Mesh &reader = meshes[load.readers[entryObjects[i]]];
+        if (load.ok[entryObjects[i]] && &reader != &meshes[i]) {
+            meshes[i].points = reader.points;
+            meshes[i].normals = reader.normals;
+            meshes[i].uvs = reader.uvs;
+            meshes[i].triangles = reader.triangles;
         }
-        NewMesh(meshName, &m);
     }
-    fclose(file);
+    int n = 0;
+    vector<int> entryNodes(nEntries, -1);   // parents are earlier entries
+    for (int i = 0; i < nEntries; i++)
+        if (load.ok[entryObjects[i]]) {     // else drop mesh, as NewMesh
+            if (n != i)
+                std::swap(meshes[n], meshes[i]);
+            SceneEntry &e = scene.entries[i];
+            meshes[n].Finish(n, (char *) e.name.c_str(), &e.xform, e.parent < 0? -1 : entryNodes[e.parent]);
+            entryNodes[i] = meshes[n].node;
+            n++;
+        }
+    meshes.resize(n);
+    float dt = chrono::duration<float, milli>(chrono::steady_clock::now()-start).count();
+    printf("Read %i meshes (%i objects) in %.1f ms\n", (int) meshes.size(), (int) load.objects.size(), dt);
     return true;
 }
 
 void ListScene() {
     int nmeshes = meshes.size();
     printf("%i meshes:\n", nmeshes);
-    for (int i = 0; i < nmeshes; i++)
-        printf("  %i: %s\n", i, meshes[i].filename.c_str());
+    for (int i = 0; i < nmeshes; i++) {
+        int parent = sceneGraph.Parent(meshes[i].node);
+        printf("  %i: %s", i, meshes[i].filename.c_str());
+        for (int k = 0; k < nmeshes; k++)
+            if (parent >= 0 && meshes[k].node == parent)
+                printf(" (child of %i)", k);
+        printf("\n");
+    }
 }
 
 void DeleteMesh() {
@@ -629,7 +728,26 @@ void DeleteMesh() {
     gets_s(buf);
     if (sscanf(buf, "%i", &n) == 1 && n >= 0 && n < (int) meshes.size()) {
         printf("deleted mesh[%i]\n", n);
+        if (framedNode == meshes[n].node)
+            framedNode = -1;
+        sceneGraph.Remove(meshes[n].node);
         meshes.erase(meshes.begin()+n);
+        multiDrawDirty = true;
+    }
+}
+
+void ParentMesh() {
+    // attach a mesh to another, keeping where it is; it then follows its parent
+    char buf[500];
+    int child = -1, parent = -1, nmeshes = meshes.size();
+    printf("child and parent mesh numbers (parent -1: none): ");
+    gets_s(buf);
+    if (sscanf(buf, "%i%i", &child, &parent) == 2 && child >= 0 && child < nmeshes && parent < nmeshes) {
+        sceneGraph.Update();
+        if (sceneGraph.SetParent(meshes[child].node, parent < 0? -1 : meshes[parent].node))
+            printf("mesh[%i] parent is %i\n", child, parent);
+        else
+            printf("mesh[%i] is an ancestor of mesh[%i]\n", child, parent);
     }
 }
 
@@ -640,12 +758,15 @@ void AddMesh() {
     int nMeshes = meshes.size();
     meshes.resize(nMeshes+1);
     sprintf(meshName, "%s/%s", directory, buf);
-    meshes[nMeshes].Read(nMeshes, meshName);
+    if (!meshes[nMeshes].Read(nMeshes, meshName))
+        meshes.resize(nMeshes);
+    multiDrawDirty = true;
 }
 
 // Mesh
 
 Mesh::Mesh() {
+    node = -1;
     vBufferId = textureId = id = 0;
     textureId2 = id2 = 1;
     textureId3 = id3 = 2;
@@ -675,16 +796,7 @@ void Mesh::Buffer() {
     glBufferSubData(GL_ARRAY_BUFFER, sizePoints+sizeNormals, sizeUvs, &uvs[0]);
 }
 
-void Mesh::Draw() {
-    // use vertex buffer for this mesh
-    glBindBuffer(GL_ARRAY_BUFFER, vBufferId);
-    // connect shader inputs to GPU buffer
-    int sizePoints = points.size()*sizeof(vec3);
-    int sizeNormals = normals.size()*sizeof(vec3);
-    // vertex feeder
-    VertexAttribPointer(shader, "point", 3, 0, (void *) 0);
-    VertexAttribPointer(shader, "normal", 3, 0, (void *) sizePoints);
-    VertexAttribPointer(shader, "uv", 2, 0, (void *) (sizePoints+sizeNormals));
+void Mesh::BindTextures() {
     // set custom transform (xform = mesh transforms X view transform)
     glActiveTexture(GL_TEXTURE1+id);
     // active texture corresponds with textureUnit
@@ -722,41 +834,98 @@ void Mesh::Draw() {
     //AO map
     glActiveTexture(GL_TEXTURE1 + id11);
     glBindTexture(GL_TEXTURE_2D, textureId11);
+}
 
-    SetUniform(shader, "Albedo_Map", (int)textureId);
-    SetUniform(shader, "Normal_Map", (int)textureId2);
-    SetUniform(shader, "AO_Map", (int)textureId3);
-    SetUniform(shader, "Metallic_Map", (int)textureId4);
-    SetUniform(shader, "Roughness_Map", (int)textureId5);
-    SetUniform(shader, "use_albedo_body", 1);
-    // all 20 textures go here
-    //SetUniform(shader, "textureImage_internal_AO", (int)textureId11);
+void Mesh::SetMaterial(int part) {
+    if (part == 0) {
+        SetUniform(shader, "Albedo_Map", (int)textureId);
+        SetUniform(shader, "Normal_Map", (int)textureId2);
+        SetUniform(shader, "AO_Map", (int)textureId3);
+        SetUniform(shader, "Metallic_Map", (int)textureId4);
+        SetUniform(shader, "Roughness_Map", (int)textureId5);
+        // all 20 textures go here
+        //SetUniform(shader, "textureImage_internal_AO", (int)textureId11);
+    }
+    else {
+        SetUniform(shader, "Albedo_Map", (int)textureId6);
+        SetUniform(shader, "Normal_Map", (int)textureId7);
+        SetUniform(shader, "AO_Map", (int)textureId8);
+        SetUniform(shader, "Metallic_Map", (int)textureId9);
+        SetUniform(shader, "Roughness_Map", (int)textureId10);
+    }
+}
 
-    SetUniform(shader, "modelview", camera.modelview*xform);
+void Mesh::Draw() {
+    // use vertex buffer for this mesh
+    glBindBuffer(GL_ARRAY_BUFFER, vBufferId);
+    // connect shader inputs to GPU buffer
+    int sizePoints = points.size()*sizeof(vec3);
+    int sizeNormals = normals.size()*sizeof(vec3);
+    // vertex feeder
+    VertexAttribPointer(shader, "point", 3, 0, (void *) 0);
+    VertexAttribPointer(shader, "normal", 3, 0, (void *) sizePoints);
+    VertexAttribPointer(shader, "uv", 2, 0, (void *) (sizePoints+sizeNormals));
+    BindTextures();
+    SetMaterial(0);
+
+    SetUniform(shader, "modelview", camera.modelview*Xform());
     SetUniform(shader, "persp", camera.persp);
     //glDrawElements(GL_TRIANGLES, 3 * triangles.size(), GL_UNSIGNED_INT, &triangles[0]);
 
-    glDrawElements(GL_TRIANGLES, 3 * 2050, GL_UNSIGNED_INT, &triangles[0]);
+    glDrawElements(GL_TRIANGLES, 3 * nBodyTriangles, GL_UNSIGNED_INT, &triangles[0]);
 
-    SetUniform(shader, "Albedo_Map", (int)textureId6);
-    SetUniform(shader, "Normal_Map", (int)textureId7);
-    SetUniform(shader, "AO_Map", (int)textureId8);
-    SetUniform(shader, "Metallic_Map", (int)textureId9);
-    SetUniform(shader, "Roughness_Map", (int)textureId10);
-    SetUniform(shader, "use_albedo_body", 0);
+    SetMaterial(1);
 
     /*SetUniform(shader, "modelview", camera.modelview * xform);
     SetUniform(shader, "persp", camera.persp);*/
 
 
-    glDrawElements(GL_TRIANGLES, 3 * (triangles.size() - 2050), GL_UNSIGNED_INT, &triangles[2050]);
+    glDrawElements(GL_TRIANGLES, 3 * (triangles.size() - nBodyTriangles), GL_UNSIGNED_INT, &triangles[nBodyTriangles]);
+}
+
+// textures stream in: a file is decoded on a worker thread while its material renders a 1x1 placeholder,
+// then uploaded over several frames; meshes reading the same file share one GL texture, so they share a multi-draw material
+
+TextureStreamer textureStream;
+
+const unsigned char flatNormal[] = {128, 128, 255}, white[] = {255, 255, 255}, black[] = {0, 0, 0};
+
+GLuint LoadSharedTexture(string &filename, int textureUnit, const unsigned char *placeholder = NULL, TexMap map = TexMapColor,
+                         string *normalMap = NULL) {
+    return textureStream.Request(filename.c_str(), textureUnit, placeholder, true, map, normalMap? normalMap->c_str() : NULL);
+}
+
+bool Mesh::ReadObject(string objectFilename) {
+    //string objectFilename =  "lespaul_details.obj";
+    if (!ReadAsciiObj((char *) objectFilename.c_str(), points, triangles, &normals, &uvs)) {
+        printf("can't read %s\n", objectFilename.c_str());
+        return false;
+    }
+    Normalize(points, .8f);
+    return true;
 }
 
 bool Mesh::Read(int mid, char *name, mat4 *m) {
+    if (!ReadObject(ObjectFilename(name)))
+        return false;
+    Finish(mid, name, m);
+    return true;
+}
+
+void FrameNode(int node) {
+    framedNode = node;
+    framedWorld = sceneGraph.World(node);
+    framer.Set(&framedWorld, 100, camera.persp*camera.modelview);
+}
+
+void FramerEdited() {
+    if (framedNode >= 0)
+        sceneGraph.SetWorld(framedNode, framedWorld);
+}
+
+void Mesh::Finish(int mid, char *name, mat4 *m, int parentNode) {
     id = mid;
     filename = string(name);
-    string objectFilename = "lespaul.obj";
-    //string objectFilename =  "lespaul_details.obj";
     string textureFilename = "lespaul_Albedo.tga";
     string textureFilename2 = "lespaulnormal.tga";
     string textureFilename3 = "lespaul_19_AO.tga";
@@ -768,34 +937,147 @@ bool Mesh::Read(int mid, char *name, mat4 *m) {
     string textureFilename9 = "lespaul_20_Metallic.tga";
     string textureFilename10 = "lespaul_20_Roughness.tga";
     //string textureFilename11 = "lespaul_internal_AO.tga";
-    if (!ReadAsciiObj((char *) objectFilename.c_str(), points, triangles, &normals, &uvs)) {
-        printf("can't read %s\n", objectFilename.c_str());
-        return false;
-    }
-    Normalize(points, .8f);
     Buffer();
-    textureId = LoadTexture((char *) textureFilename.c_str(), id);
-    textureId2 = LoadTexture((char*)textureFilename2.c_str(), id2);
-    textureId3 = LoadTexture((char*)textureFilename3.c_str(), id3);
-    textureId4 = LoadTexture((char*)textureFilename4.c_str(), id4);
-    textureId5 = LoadTexture((char*)textureFilename5.c_str(), id5);
-    textureId6 = LoadTexture((char*)textureFilename6.c_str(), id6);
-    textureId7 = LoadTexture((char*)textureFilename7.c_str(), id7);
-    textureId8 = LoadTexture((char*)textureFilename8.c_str(), id8);
-    textureId9 = LoadTexture((char*)textureFilename9.c_str(), id9);
-    textureId10 = LoadTexture((char*)textureFilename10.c_str(), id10);
+    textureId = LoadSharedTexture(textureFilename, id);
+    textureId2 = LoadSharedTexture(textureFilename2, id2, flatNormal, TexMapNormal);
+    textureId3 = LoadSharedTexture(textureFilename3, id3, white, TexMapGray);
+    textureId4 = LoadSharedTexture(textureFilename4, id4, black, TexMapGray);
+    textureId5 = LoadSharedTexture(textureFilename5, id5, NULL, TexMapRoughness, &textureFilename2);
+    textureId6 = LoadSharedTexture(textureFilename6, id6);
+    textureId7 = LoadSharedTexture(textureFilename7, id7, flatNormal, TexMapNormal);
+    textureId8 = LoadSharedTexture(textureFilename8, id8, white, TexMapGray);
+    textureId9 = LoadSharedTexture(textureFilename9, id9, black, TexMapGray);
+    textureId10 = LoadSharedTexture(textureFilename10, id10, NULL, TexMapRoughness, &textureFilename7);
     //textureId11 = LoadTexture((char*)textureFilename11.c_str(), id11);
+    node = sceneGraph.Add(parentNode);
     if (m)
-        xform = *m;
-    framer.Set(&xform, 100, camera.persp*camera.modelview);
-    return true;
+        sceneGraph.SetWorld(node, *m);
+    sceneGraph.Update();
+    FrameNode(node);
+}
+
+// Multi-Draw
+
+int MaterialId(int meshId, int part) {
+    // meshes whose part uses the same albedo texture share a material
+    Mesh &mesh = meshes[meshId];
+    GLuint albedo = part == 0? mesh.textureId : mesh.textureId6;
+    for (size_t i = 0; i < materials.size(); i++) {
+        Mesh &m = meshes[materials[i].i1];
+        if (materials[i].i2 == part && albedo == (part == 0? m.textureId : m.textureId6))
+            return i;
+    }
+    materials.push_back(int2(meshId, part));
+    return materials.size()-1;
+}
+
+void BufferMultiDraw() {
+    multiDraw.Clear();
+    materials.resize(0);
+    for (size_t i = 0; i < meshes.size(); i++) {
+        Mesh &m = meshes[i];
+        int nTriangles = m.triangles.size(), nBody = nBodyTriangles < nTriangles? nBodyTriangles : nTriangles;
+        int meshId = multiDraw.AddMesh(m.points, m.normals, m.uvs, m.triangles);
+        multiDraw.AddDraw(meshId, 0, nBody, MaterialId(i, 0));
+        multiDraw.AddDraw(meshId, nBody, nTriangles-nBody, MaterialId(i, 1));
+    }
+    multiDraw.Buffer();
+    multiDrawDirty = false;
+}
+
+void DrawMultiDraw() {
+    if (multiDrawDirty)
+        BufferMultiDraw();
+    for (size_t i = 0; i < meshes.size(); i++)
+        multiDraw.SetTransform(i, meshes[i].Xform());
+    SetUniform(shader, "persp", camera.persp);
+    // one indirect submission per material, regardless of mesh count
+    for (size_t i = 0; i < materials.size(); i++) {
+        Mesh &m = meshes[materials[i].i1];
+        m.BindTextures();
+        m.SetMaterial(materials[i].i2);
+        multiDraw.Draw(shader, camera.modelview, i);
+    }
+}
+
+void CopyUniforms(GLuint from, GLuint to) {
+    // give program to the values of the uniforms it shares with program from (eg, the ImGui settings); leave to in use
+    glUseProgram(to);
+    GLint nUniforms = 0;
+    glGetProgramiv(from, GL_ACTIVE_UNIFORMS, &nUniforms);
+    for (int i = 0; i < nUniforms; i++) {
+        char name[200];
+        GLint size = 0, v[16];
+        GLenum type;
+        GLfloat f[16];
+        glGetActiveUniform(from, i, sizeof(name), NULL, &size, &type, name);
+        GLint src = glGetUniformLocation(from, name), dst = glGetUniformLocation(to, name);
+        if (src < 0 || dst < 0 || size != 1)
+            continue;
+        switch (type) {
+            case GL_FLOAT:      glGetUniformfv(from, src, f); glUniform1fv(dst, 1, f); break;
+            case GL_FLOAT_VEC2: glGetUniformfv(from, src, f); glUniform2fv(dst, 1, f); break;
+            case GL_FLOAT_VEC3: glGetUniformfv(from, src, f); glUniform3fv(dst, 1, f); break;
+            case GL_FLOAT_VEC4: glGetUniformfv(from, src, f); glUniform4fv(dst, 1, f); break;
+            case GL_FLOAT_MAT4: glGetUniformfv(from, src, f); glUniformMatrix4fv(dst, 1, GL_FALSE, f); break;
+            case GL_INT: case GL_BOOL: case GL_SAMPLER_2D:
+                glGetUniformiv(from, src, v); glUniform1iv(dst, 1, v); break;
+            default: break;
+        }
+    }
+}
+
+// Redraw scheduling
+
+// the scene is redrawn only when something changed: input, a timed overlay change, or animation
+// ImGui needs a few frames to settle after input (hover, active item), so input schedules several
+
+int framesToDraw = 3;           // frames remaining before going idle
+double wakeTime = -1;           // if >= 0, time at which to redraw without input
+const double idleTimeout = 1.;  // longest sleep while idle, in seconds
+
+void Invalidate(int nFrames = 3) {
+    if (framesToDraw < nFrames)
+        framesToDraw = nFrames;
+}
+
+void WaitForRedraw() {
+    // poll if a frame is due, otherwise sleep until an event arrives or wakeTime is reached
+    if (framesToDraw > 0) {
+        glfwPollEvents();
+        return;
+    }
+    double now = glfwGetTime(), timeout = idleTimeout;
+    if (wakeTime >= 0)
+        timeout = wakeTime > now? std::min(wakeTime-now, idleTimeout) : 0;
+    glfwWaitEventsTimeout(timeout);
+    if (wakeTime >= 0 && glfwGetTime() >= wakeTime) {
+        wakeTime = -1;
+        Invalidate(1);
+    }
+}
+
+// Capture
+
+FrameCapture capture;
+
+void ToggleCapture() {
+    // video through ffmpeg if installed, else numbered Targa files
+    if (capture.Active())
+        capture.Stop();
+    else if (capture.Start("capture", CaptureFFmpeg))
+        printf("capturing to %s\n", capture.Format() == CaptureFFmpeg? "capture.mp4" : "capture0000.tga ...");
 }
 
 // Display
 
-time_t mouseMoved;
+double mouseMoved = -1;         // glfwGetTime() of last mouse move
+const double overlayTime = 1.;  // seconds to display lights and frames after mouse move
 
 void Display() {
+    // world matrices of edited subtrees only; keep the framer on its node if an ancestor moved
+    if (sceneGraph.Update() && framedNode >= 0 && sceneGraph.Changed(framedNode))
+        framedWorld = sceneGraph.World(framedNode);
     // clear screen, depth test, blend
     glClearColor(.5f, .5f, .5f, 1);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -814,12 +1096,16 @@ void Display() {
     // EOT
 
     // display objects
-    for (size_t i = 0; i < meshes.size(); i++)
-        meshes[i].Draw();
+    if (useMultiDraw)
+        DrawMultiDraw();
+    else
+        for (size_t i = 0; i < meshes.size(); i++)
+            meshes[i].Draw();
     // lights and frames
-    if ((clock()-mouseMoved)/CLOCKS_PER_SEC < 1.f) {
+    if (mouseMoved >= 0 && glfwGetTime()-mouseMoved < overlayTime) {
         glDisable(GL_DEPTH_TEST);
         UseDrawShader(camera.fullview);
+        BeginDrawBatch();
         //Disk(light, 9, vec3(1,1,0));
         
         // Change the color of the dot to green
@@ -830,7 +1116,7 @@ void Display() {
         ArrowV(light2, endArrow, camera.modelview, camera.persp, vec3(1, 1, 0), 1, 6);
 
         for (size_t i = 0; i < meshes.size(); i++) {
-            mat4 &f = meshes[i].xform;
+            const mat4 &f = meshes[i].Xform();
             vec3 base(f[0][3], f[1][3], f[2][3]);
             Disk(base, 9, vec3(1,1,1));
         }
@@ -838,6 +1124,7 @@ void Display() {
             framer.Draw(camera.fullview);
         if (picked == &camera)
             camera.arcball.Draw(); // camera.fullview);
+        EndDrawBatch();
 
         //vec4 p1(light2, .5f), p2(lightAt, .1f);
         Cylinder(light2, light2 + .5f * endArrow, 0, .3f, camera.modelview, camera.persp, vec4(1, 0, 0, .5f));
@@ -882,6 +1169,7 @@ bool isMouseInMenu(int x, int y)
 
 }
 void MouseButton(GLFWwindow *w, int butn, int action, int mods) {
+    Invalidate();
     double x, y;
     glfwGetCursorPos(w, &x, &y);
     CorrectMouse(w, &x, &y);
@@ -906,10 +1194,11 @@ void MouseButton(GLFWwindow *w, int butn, int action, int mods) {
             // test for mesh base hit
             for (size_t i = 0; i < meshes.size(); i++) {
                 Mesh &m = meshes[i];
-                vec3 base(m.xform[0][3], m.xform[1][3], m.xform[2][3]);
+                const mat4 &f = m.Xform();
+                vec3 base(f[0][3], f[1][3], f[2][3]);
                 if (MouseOver(x, y, base, camera.fullview)) {
                     newPicked = &framer;
-                    framer.Set(&m.xform, 100, camera.fullview);
+                    FrameNode(m.node);
                     framer.Down(x, y, camera.modelview, camera.persp);
                 }
             }
@@ -932,7 +1221,9 @@ void MouseButton(GLFWwindow *w, int butn, int action, int mods) {
 }
 
 void MouseMove(GLFWwindow *w, double x, double y) {
-    mouseMoved = clock();
+    mouseMoved = glfwGetTime();
+    wakeTime = mouseMoved+overlayTime; // redraw once more to hide lights and frames
+    Invalidate();
     // insert code here
     if (isMouseInMenu(x, y))
     {
@@ -943,16 +1234,21 @@ void MouseMove(GLFWwindow *w, double x, double y) {
         y = WindowHeight(w)-y;
         if (picked == &mover)
             mover.Drag(x, y, camera.modelview, camera.persp);
-        if  (picked == &framer)
+        if  (picked == &framer) {
             framer.Drag(x, y, camera.modelview, camera.persp);
+            FramerEdited();
+        }
         if (picked == &camera)
             camera.MouseDrag(x, y, Shift(w));
     }
 }
 
 void MouseWheel(GLFWwindow *w, double xoffset, double direction) {
-    if (picked == &framer)
+    Invalidate();
+    if (picked == &framer) {
         framer.Wheel(direction, Shift(w));
+        FramerEdited();
+    }
     if (picked == &camera)
         camera.MouseWheel(direction, Shift(w));
 }
@@ -962,16 +1258,26 @@ void MouseWheel(GLFWwindow *w, double xoffset, double direction) {
 void Resize(GLFWwindow *w, int width, int height) {
     glViewport(0, 0, winW = width, winH = height);
     camera.Resize(width, height);
+    Invalidate();
+}
+
+void Refresh(GLFWwindow *w) {
+    // window exposed or damaged
+    Invalidate(1);
 }
 
 void Keyboard(GLFWwindow *w, int c, int scancode, int action, int mods) {
+    Invalidate();
     if (action == GLFW_PRESS)
         switch (c) {
             case 'R': ReadScene(sceneFilename); break;
             case 'S': SaveScene(); break;
+            case 'B': SaveScene(true); break;
             case 'L': ListScene(); break;
             case 'D': DeleteMesh(); break;
             case 'A': AddMesh(); break;
+            case 'P': ParentMesh(); break;
+            case 'C': ToggleCapture(); break;
             default: break;
         }
 }
@@ -991,7 +1297,166 @@ static void HelpMarker(const char* desc)
     }
 }
 
+// Batch rendering
+
+// render a scene with no window, for turntables and regression images:
+//   -batch <scene> [-frames n] [-size WxH] [-out prefix] [-turntable] [-multidraw] [-osmesa] [-set uniform value]...
+// writes prefix0000.tga, prefix0001.tga, ...
+
+int RenderBatch(int ac, char **av) {
+    const char *scene = ac > 2? av[2] : sceneFilename, *prefix = "frame";
+    int nFrames = 1, width = winW, height = winH;
+    bool turntable = false, osmesa = false;
+    vector<std::pair<const char *, int>> settings;
+    for (int i = 3; i < ac; i++) {
+        if (!strcmp(av[i], "-frames") && i+1 < ac)
+            nFrames = atoi(av[++i]);
+        else if (!strcmp(av[i], "-size") && i+1 < ac)
+            sscanf(av[++i], "%ix%i", &width, &height);
+        else if (!strcmp(av[i], "-out") && i+1 < ac)
+            prefix = av[++i];
+        else if (!strcmp(av[i], "-set") && i+2 < ac) {
+            settings.push_back(std::make_pair(av[i+1], atoi(av[i+2])));
+            i += 2;
+        }
+        else if (!strcmp(av[i], "-turntable"))
+            turntable = true;
+        else if (!strcmp(av[i], "-multidraw"))
+            useMultiDraw = true;
+        else if (!strcmp(av[i], "-osmesa"))
+            osmesa = true;
+        else
+            printf("unknown option %s\n", av[i]);
+    }
+    if (!HeadlessInit(width, height, osmesa? HeadlessOSMesa : HeadlessEGL))
+        return 1;
+    shader = perMeshShader = LinkProgramViaCode(&vertexShader, &pixelShader);
+    if (MultiDrawSupported())
+        multiDrawShader = LinkProgramViaCode(&multiDrawVertexShader, &pixelShader);
+    useMultiDraw = useMultiDraw && multiDrawShader;
+    if (useMultiDraw)
+        shader = multiDrawShader;
+    textureStream.EnableCompression();
+    if (!ReadScene(scene)) {
+        printf("Can't read %s\n", scene);
+        HeadlessShutdown();
+        return 1;
+    }
+    textureStream.Finish();     // render with final textures, not placeholders
+    Resize(NULL, width, height);
+    mat4 modelview = camera.modelview;
+    char filename[500];
+    int nWritten = 0;
+    for (int f = 0; f < nFrames; f++) {
+        if (turntable)
+            camera.SetModelview(modelview*RotateY(360.f*f/nFrames));
+        glUseProgram(shader);
+        for (size_t i = 0; i < settings.size(); i++)
+            SetUniform(shader, settings[i].first, settings[i].second);
+        SetUniform(shader, "current_time", .01f*f); // as in the interactive loop
+        Display();
+        glFinish();
+        sprintf(filename, "%s%04i.tga", prefix, f);
+        if (!HeadlessWrite(filename))
+            break;
+        nWritten++;
+    }
+    printf("wrote %i of %i frames\n", nWritten, nFrames);
+    for (size_t i = 0; i < meshes.size(); i++)
+        glDeleteBuffers(1, &meshes[i].vBufferId);
+    multiDraw.Free();
+    textureStream.Free();
+    HeadlessShutdown();
+    return nWritten == nFrames? 0 : 1;
+}
+
+// Regression
+
+// render every shading combination of the settings panel and compare with golden images:
+//   -regress <scene> [-size WxH] [-multidraw] [-osmesa] [-golden dir] [-out dir] [-report file.json] [-update]
+//            [-psnr min] [-flip max] [-warmup n] [-frames n]
+
+struct ShadingCase {
+    int diffuse;    // 0: none, 1: Lambert, 2: Disney
+    int specular;   // 0: none, 1: Blinn-Phong, 2: Cook-Torrance
+    int spotLight, normalMap, aoMap;
+};
+
+void RenderShadingCase(void *data) {
+    ShadingCase *c = (ShadingCase *) data;
+    vec3 spotColor(1, .9f, .8f);
+    glUseProgram(shader);
+    SetUniform(shader, "show_lambert_model", c->diffuse == 1? 1 : 0);
+    SetUniform(shader, "show_disney_model", c->diffuse == 2? 1 : 0);
+    SetUniform(shader, "show_blinnphong_model", c->specular == 1? 1 : 0);
+    SetUniform(shader, "show_cooktorrance_model", c->specular == 2? 1 : 0);
+    SetUniform(shader, "enable_spot_light1", c->spotLight);
+    SetUniform(shader, "spot_light1_intensity", 4.f);
+    SetUniform(shader, "spot_light1_color", spotColor);
+    SetUniform(shader, "show_normal_map", c->normalMap);
+    SetUniform(shader, "show_ao_map", c->aoMap);
+    SetUniform(shader, "current_time", 0.f);
+    Display();
+}
+
+int RenderRegression(int ac, char **av) {
+    const char *scene = ac > 2? av[2] : sceneFilename;
+    const char *diffuseNames[] = {"none", "lambert", "disney"}, *specularNames[] = {"none", "blinn", "cook"};
+    int width = winW, height = winH;
+    bool osmesa = false;
+    RegressOptions options;
+    for (int i = 3; i < ac; i++) {
+        if (ParseRegressOption(options, ac, av, i))
+            continue;
+        if (!strcmp(av[i], "-size") && i+1 < ac)
+            sscanf(av[++i], "%ix%i", &width, &height);
+        else if (!strcmp(av[i], "-multidraw"))
+            useMultiDraw = true;
+        else if (!strcmp(av[i], "-osmesa"))
+            osmesa = true;
+        else
+            printf("unknown option %s\n", av[i]);
+    }
+    if (!HeadlessInit(width, height, osmesa? HeadlessOSMesa : HeadlessEGL))
+        return 1;
+    shader = perMeshShader = LinkProgramViaCode(&vertexShader, &pixelShader);
+    if (MultiDrawSupported())
+        multiDrawShader = LinkProgramViaCode(&multiDrawVertexShader, &pixelShader);
+    useMultiDraw = useMultiDraw && multiDrawShader;
+    if (useMultiDraw)
+        shader = multiDrawShader;
+    textureStream.EnableCompression();
+    if (!ReadScene(scene)) {
+        printf("Can't read %s\n", scene);
+        HeadlessShutdown();
+        return 1;
+    }
+    textureStream.Finish();     // render with final textures, not placeholders
+    Resize(NULL, width, height);
+    Regress regress("15-Solution-MultiMeshCopy-ImGui", options);
+    char name[100];
+    for (int d = 0; d < 3; d++)
+        for (int sp = 0; sp < 3; sp++)
+            for (int flags = 0; flags < 8; flags++) {
+                ShadingCase c = {d, sp, flags & 1, (flags >> 1) & 1, (flags >> 2) & 1};
+                sprintf(name, "brdf-%s-%s%s%s%s", diffuseNames[d], specularNames[sp],
+                        c.spotLight? "-spot" : "", c.normalMap? "-normal" : "", c.aoMap? "-ao" : "");
+                regress.Case(name, RenderShadingCase, &c, width, height);
+            }
+    bool ok = regress.Finish();
+    for (size_t i = 0; i < meshes.size(); i++)
+        glDeleteBuffers(1, &meshes[i].vBufferId);
+    multiDraw.Free();
+    textureStream.Free();
+    HeadlessShutdown();
+    return ok? 0 : 1;
+}
+
 int main(int ac, char **av) { 
+    if (ac > 1 && !strcmp(av[1], "-batch"))
+        return RenderBatch(ac, av);
+    if (ac > 1 && !strcmp(av[1], "-regress"))
+        return RenderRegression(ac, av);
     
     // Setup window
     glfwSetErrorCallback(glfw_error_callback);
@@ -1073,9 +1538,12 @@ int main(int ac, char **av) {
 
 
     // build shader program, read scene file
-    shader = LinkProgramViaCode(&vertexShader, &pixelShader);
+    shader = perMeshShader = LinkProgramViaCode(&vertexShader, &pixelShader);
+    if (MultiDrawSupported())
+        multiDrawShader = LinkProgramViaCode(&multiDrawVertexShader, &pixelShader);
+    textureStream.EnableCompression();  // block-compress maps once, then load from TextureCache
     if (ReadScene(sceneFilename))
-        printf("Read %i meshes\n", meshes.size());
+        printf("Read %i meshes\n", (int) meshes.size());
     else {
         printf("Can't read %s, using default scene\n", sceneFilename);
         // read default meshes
@@ -1090,13 +1558,14 @@ int main(int ac, char **av) {
     }
 
     Resize(w, winW, winH); // initialize camera.arcball.fixedBase
-    printf("Usage:\n  R: read scene\n  S: save scene\n  L: list scene\n  D: delete mesh\n  A: add mesh\n");
+    printf("Usage:\n  R: read scene\n  S: save scene\n  B: save scene (binary)\n  L: list scene\n  D: delete mesh\n  A: add mesh\n  P: parent mesh\n  C: start/stop capture\n");
     // callbacks
     glfwSetCursorPosCallback(w, MouseMove);
     glfwSetMouseButtonCallback(w, MouseButton);
     glfwSetScrollCallback(w, MouseWheel);
     glfwSetKeyCallback(w, Keyboard);
     glfwSetWindowSizeCallback(w, Resize);
+    glfwSetWindowRefreshCallback(w, Refresh);
 
     /* ImGUI Stuff*/
     bool show_demo_window = false;
@@ -1124,8 +1593,11 @@ int main(int ac, char **av) {
     // event loop
     glfwSwapInterval(1);
     while (!glfwWindowShouldClose(w)) {
+        WaitForRedraw();
+        if (!framesToDraw)
+            continue;
+        framesToDraw--;
         Display();
-        glfwPollEvents();
 
         /*************** IMGUI Code *************************/
         // Start the Dear ImGui frame
@@ -1136,6 +1608,9 @@ int main(int ac, char **av) {
         if (show_demo_window)
             ImGui::ShowDemoWindow(&show_demo_window);
 
+        // SetUniform sets the program in use: Display may have left the overlay shader
+        glUseProgram(shader);
+
         // Show the Lambert Model
         if (show_lambert_model)
         {
@@ -1333,16 +1808,34 @@ int main(int ac, char **av) {
                 {
                     SetUniform(shader, "move_guitar_xzaxis", 0);
                 }
+                // submit all meshes with one indirect draw per material (GL 4.3)
+                if (multiDrawShader)
+                {
+                    if (ImGui::Checkbox("Multi-Draw", &useMultiDraw)) {
+                        // carry this frame's settings over, so the next frame draws with them
+                        GLuint previous = shader;
+                        shader = useMultiDraw? multiDrawShader : perMeshShader;
+                        CopyUniforms(previous, shader);
+                    }
+                }
             }
 
             ImGui::End();
 
-            // Move the guitar up and down
+            // Move the guitar up and down (time advances only while animating)
             SetUniform(shader, "current_time", angle);
-            angle += 0.01f;
+            if (move_guitar_updown || move_guitar_xyaxis || move_guitar_xzaxis)
+            {
+                angle += 0.01f;
+                Invalidate(1);
+            }
             
         }
             
+        // keep drawing while a widget is held (eg, slider drag with no mouse motion)
+        if (ImGui::IsAnyItemActive())
+            Invalidate(1);
+
         // Rendering
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
@@ -1350,13 +1843,35 @@ int main(int ac, char **av) {
         /*************** End IMGUI Code *************************/
  
         glFlush();
+        if (capture.Active()) {
+            capture.Frame(); // read back buffer before swap
+            Invalidate(1);   // record every frame, even if idle
+        }
         glfwSwapBuffers(w);
 
+        // deliver completed asynchronous reads (eg, WriteTargaAsync); wake until all are delivered
+        FrameReadback().Poll();
+        if (FrameReadback().Pending())
+            Invalidate(1);
+
+        // upload a bounded share of decoded textures; redraw as each replaces its placeholder
+        int nResident = textureStream.Update();
+        if (nResident && !textureStream.Pending()) {
+            TextureStreamStats ts = textureStream.Stats();
+            printf("%i textures resident (%.1f MB) %.2f s after request\n", ts.nResident, ts.megabytes, ts.seconds);
+        }
+        if (nResident || textureStream.Pending())
+            Invalidate(1);
+
     }
     // unbind vertex buffer, free GPU memory
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     for (size_t i = 0; i < meshes.size(); i++)
         glDeleteBuffers(1, &meshes[i].vBufferId);
+    multiDraw.Free();
+    FrameReadback().Free();
+    textureStream.Free();
+    capture.Stop();
 
     // Cleanup
     ImGui_ImplOpenGL3_Shutdown();
@@ -6,17 +6,230 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <chrono>
 #include <vector>
+#include "Blur.h"
 #include "Camera.h"
+#include "Displace.h"
 #include "Draw.h"
 #include "GLXtras.h"
+#include "Headless.h"
 #include "Misc.h"
+#include "MipGen.h"
+#include "Regress.h"
+#include "Remap.h"
 #include "Text.h"
 #include "VecMat.h"
 #include "Widgets.h"
 
 const int nScenes = 5;
 
+// GPU bumps: with GL 4.3+, the height field stays resident and compute shaders derive the normal map,
+// its mips, and blur, with no CPU round trip; else GetNormals and texture uploads as before
+
+bool            gpuBumps = false;       // set by GpuBumpsInit
+GLuint          normalProgram = 0, normalMipProgram = 0, blurProgram = 0;
+GLuint          bumpTimer = 0;          // GL_TIME_ELAPSED of the last GPU update
+bool            bumpTimerPending = false;
+float           bumpMs = 0;             // duration of the last normal map update, CPU or GPU
+
+// normals as GetNormals: central, Sobel or Scharr weights across rows (x) and columns (y), borders clamped
+const char *normalCode = R"(
+    #version 430 core
+    layout (local_size_x = 16, local_size_y = 16) in;
+    uniform sampler2D heightField;
+    layout (rgba8) writeonly uniform image2D bumpMap;
+    uniform float pixelScale = 25;
+    uniform vec3 weights = vec3(0, 1, 0);
+    float H(int i, int j) { return texelFetch(heightField, ivec2(i, j), 0).r; }
+    void main() {
+        ivec2 size = textureSize(heightField, 0), p = ivec2(gl_GlobalInvocationID.xy);
+        if (p.x >= size.x || p.y >= size.y)
+            return;
+        int i = p.x, j = p.y, i1 = max(i-1, 0), i2 = min(i+1, size.x-1), j1 = max(j-1, 0), j2 = min(j+1, size.y-1);
+        float dzx = weights[0]*(H(i2, j1)-H(i1, j1))+weights[1]*(H(i2, j)-H(i1, j))+weights[2]*(H(i2, j2)-H(i1, j2));
+        float dzy = weights[0]*(H(i1, j2)-H(i1, j1))+weights[1]*(H(i, j2)-H(i, j1))+weights[2]*(H(i2, j2)-H(i2, j1));
+        float ax = max(i2-i1, 1)/pixelScale, by = max(j2-j1, 1)/pixelScale;
+        vec3 n = normalize(vec3(-dzx*by, -ax*dzy, ax*by));
+        imageStore(bumpMap, p, vec4(.5*n.xy+.5, n.z, 1));
+    }
+)";
+
+// one mip level from the one above: 2x2 average, renormalized
+const char *normalMipCode = R"(
+    #version 430 core
+    layout (local_size_x = 16, local_size_y = 16) in;
+    uniform sampler2D bumpMap;
+    uniform int level = 1;
+    layout (rgba8) writeonly uniform image2D mip;
+    void main() {
+        ivec2 size = imageSize(mip), src = textureSize(bumpMap, level-1), p = ivec2(gl_GlobalInvocationID.xy);
+        if (p.x >= size.x || p.y >= size.y)
+            return;
+        vec3 sum = vec3(0);
+        for (int k = 0; k < 4; k++) {
+            vec4 t = texelFetch(bumpMap, min(2*p+ivec2(k&1, k>>1), src-1), level-1);
+            sum += vec3(2*t.xy-1, t.z);
+        }
+        vec3 n = length(sum) > 0? normalize(sum) : vec3(0, 0, 1);
+        imageStore(mip, p, vec4(.5*n.xy+.5, max(n.z, 0), 1));
+    }
+)";
+
+// box blur as Scene::UpdateBlur: integer average over the clamped window
+const char *blurCode = R"(
+    #version 430 core
+    layout (local_size_x = 16, local_size_y = 16) in;
+    uniform sampler2D heightField;
+    uniform int radius = 3;
+    layout (r8) writeonly uniform image2D blurred;
+    void main() {
+        ivec2 size = textureSize(heightField, 0), p = ivec2(gl_GlobalInvocationID.xy);
+        if (p.x >= size.x || p.y >= size.y)
+            return;
+        ivec2 p0 = max(p-radius, 0), p1 = min(p+radius, size-1);
+        int sum = 0, num = 0;
+        for (int j = p0.y; j <= p1.y; j++)
+            for (int i = p0.x; i <= p1.x; i++, num++)
+                sum += int(round(255*texelFetch(heightField, ivec2(i, j), 0).r));
+        imageStore(blurred, p, vec4(float(sum/num)/255));
+    }
+)";
+
+bool GpuBumpsInit() {
+    // compute shaders and image load/store are core in 4.3
+    if (!GLAD_GL_VERSION_4_3)
+        return false;
+    normalProgram = LinkComputeProgramViaCode(&normalCode);
+    normalMipProgram = LinkComputeProgramViaCode(&normalMipCode);
+    blurProgram = LinkComputeProgramViaCode(&blurCode);
+    if (!normalProgram || !normalMipProgram || !blurProgram)
+        return false;
+    glGenQueries(1, &bumpTimer);
+    return true;
+}
+
+int MipLevels(int width, int height) {
+    int n = 1;
+    for (int s = width > height? width : height; s > 1; s /= 2)
+        n++;
+    return n;
+}
+
+void Dispatch(int width, int height) {
+    glDispatchCompute((width+15)/16, (height+15)/16, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+void GpuNormals(GLuint depthName, GLuint depthUnit, GLuint bumpName, int width, int height, float pixelScale, NormalFilter filter) {
+    // level 0 from the height field, then each mip from the one above
+    const vec3 weights[] = {vec3(0, 1, 0), vec3(.25f, .5f, .25f), vec3(3/16.f, 10/16.f, 3/16.f)};
+    if (!bumpTimerPending)
+        glBeginQuery(GL_TIME_ELAPSED, bumpTimer);
+    glActiveTexture(GL_TEXTURE0+depthUnit);
+    glBindTexture(GL_TEXTURE_2D, depthName);
+    glUseProgram(normalProgram);
+    SetUniform(normalProgram, "heightField", (int) depthUnit);
+    SetUniform(normalProgram, "bumpMap", 0);
+    SetUniform(normalProgram, "pixelScale", pixelScale);
+    SetUniform(normalProgram, "weights", weights[filter]);
+    glBindImageTexture(0, bumpName, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+    Dispatch(width, height);
+    glUseProgram(normalMipProgram);
+    glActiveTexture(GL_TEXTURE0+depthUnit); // borrow the unit: the caller rebinds for display
+    glBindTexture(GL_TEXTURE_2D, bumpName);
+    SetUniform(normalMipProgram, "bumpMap", (int) depthUnit);
+    SetUniform(normalMipProgram, "mip", 0);
+    for (int level = 1, n = MipLevels(width, height); level < n; level++) {
+        width = width > 1? width/2 : 1;
+        height = height > 1? height/2 : 1;
+        SetUniform(normalMipProgram, "level", level);
+        glBindImageTexture(0, bumpName, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+        Dispatch(width, height);
+    }
+    glBindTexture(GL_TEXTURE_2D, depthName);
+    glUseProgram(0);
+    if (!bumpTimerPending) {
+        glEndQuery(GL_TIME_ELAPSED);
+        bumpTimerPending = true;
+    }
+}
+
+void GpuBlur(GLuint depthName, GLuint depthUnit, GLuint blurName, int width, int height, int radius) {
+    glActiveTexture(GL_TEXTURE0+depthUnit);
+    glBindTexture(GL_TEXTURE_2D, depthName);
+    glUseProgram(blurProgram);
+    SetUniform(blurProgram, "heightField", (int) depthUnit);
+    SetUniform(blurProgram, "blurred", 0);
+    SetUniform(blurProgram, "radius", radius);
+    glBindImageTexture(0, blurName, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R8);
+    Dispatch(width, height);
+    glUseProgram(0);
+}
+
+void UpdateBumpTimer() {
+    // read the GPU time without stalling: once available
+    GLint available = 0;
+    if (!bumpTimerPending)
+        return;
+    glGetQueryObjectiv(bumpTimer, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(bumpTimer, GL_QUERY_RESULT, &ns);
+        bumpMs = 1e-6f*(float) ns;
+        bumpTimerPending = false;
+    }
+}
+
+typedef std::chrono::steady_clock Clock;
+
+float Milliseconds(Clock::time_point t0) {
+    return std::chrono::duration<float, std::milli>(Clock::now()-t0).count();
+}
+
+// Baked Meshes: without tessellation (GL 3.3, llvmpipe), the displaced shape is baked on the CPU
+
+class Mesh {
+public:
+    vector<vec3> points, normals;
+    vector<vec2> uvs;
+    vector<int3> triangles;
+    GLuint vBufferId, iBufferId;
+    Mesh() : vBufferId(0), iBufferId(0) { }
+    void Buffer() {
+        // points, normals, uvs in one vertex buffer; triangles in an index buffer
+        if (!vBufferId) {
+            glGenBuffers(1, &vBufferId);
+            glGenBuffers(1, &iBufferId);
+        }
+        size_t sizePoints = points.size()*sizeof(vec3), sizeNormals = normals.size()*sizeof(vec3), sizeUvs = uvs.size()*sizeof(vec2);
+        glBindBuffer(GL_ARRAY_BUFFER, vBufferId);
+        glBufferData(GL_ARRAY_BUFFER, sizePoints+sizeNormals+sizeUvs, NULL, GL_STATIC_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizePoints, &points[0]);
+        glBufferSubData(GL_ARRAY_BUFFER, sizePoints, sizeNormals, &normals[0]);
+        glBufferSubData(GL_ARRAY_BUFFER, sizePoints+sizeNormals, sizeUvs, &uvs[0]);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBufferId);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, triangles.size()*sizeof(int3), &triangles[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+    void Draw(GLuint shader) {
+        size_t sizePoints = points.size()*sizeof(vec3), sizeNormals = normals.size()*sizeof(vec3);
+        glBindBuffer(GL_ARRAY_BUFFER, vBufferId);
+        VertexAttribPointer(shader, "point", 3, 0, (void *) 0);
+        VertexAttribPointer(shader, "normal", 3, 0, (void *) sizePoints);
+        VertexAttribPointer(shader, "uv", 2, 0, (void *) (sizePoints+sizeNormals));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBufferId);
+        glDrawElements(GL_TRIANGLES, 3*triangles.size(), GL_UNSIGNED_INT, (void *) 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        DisableVertexAttribute(shader, "point");
+        DisableVertexAttribute(shader, "normal");
+        DisableVertexAttribute(shader, "uv");
+    }
+};
+
+bool            bakeMeshes = false;     // draw CPU-baked meshes even if tessellation is available
+float           bakeMs = 0;
+
 class Scene {
 public:
     std::string    depthFile, textureFile;
@@ -24,8 +237,12 @@ public:
     unsigned char *bumpPixels, *depthPixels;
     int            textureUnit, bumpUnit, depthUnit;
     GLuint         textureName, bumpName, depthName;
+    GLuint         blurName;            // gpu: blur destination, then swapped with depthName
+    bool           gpu;                 // gpu: depth, bump maps computed and kept on the GPU, depthPixels stale
+    bool           bumpMipsPending;     // bump map mips by glGenerateMipmap during a key edit; CPU chain when released
     int            view;  // 0:scene, 1:texture map, 2:normal map, 3: depth map
     float          pixelScale, displaceScale;
+    NormalFilter   normalFilter;        // height to normal: central differences, Sobel, or Scharr
     int            disableBumpMap;      // 0: use bump map, 1: no bump map
     int            disableTextureMap;
     int            disableDiffuse;
@@ -34,13 +251,23 @@ public:
     int            oneSided;
     int            showLines;
     int            uberRes;
+    int            adaptive;            // 1: tessellate by projected edge length and height variance, 0: res
+    float          edgePixels;          // adaptive: target triangle edge length
     int            hiliteColor;
     float          lineWidth, outlineTransition;
     bool           stripesTexture, warpTexture;
+    Mesh           mesh;                // baked: displaced on the CPU, as the tessellation shaders would
+    BakeOptions    meshOptions;
+    bool           meshDirty;           // height field changed since the last bake
     Scene() {
         depthPixels = bumpPixels = NULL;
+        blurName = 0;
+        gpu = bumpMipsPending = false;
         pixelScale = 25;
+        normalFilter = NormalCentral;
         uberRes = 1;
+        adaptive = 1;
+        edgePixels = 8;
         hiliteColor = 1;
         displaceScale = 0;
         res = 70;
@@ -51,45 +278,135 @@ public:
         lineWidth = 1;
         outlineTransition = 1;
         stripesTexture = warpTexture = false;
+        meshDirty = true;
+    }
+    void LoadBumps() {
+        // GetNormals writes RGB; mips are renormalized, unlike those of glGenerateMipmap
+        MipOptions normals(MipNormal, MipKaiser, false);
+        LoadMipmappedTexture(bumpPixels, depthWidth, depthHeight, bumpUnit, bumpName, false, 3, normals);
     }
-    void UpdateBumps() {
-        delete [] bumpPixels; // ugh
-        bumpPixels = GetNormals(depthPixels, depthWidth, depthHeight, pixelScale);
-        LoadTexture(bumpPixels, depthWidth, depthHeight, bumpUnit, bumpName);
+    void UpdateBumps(bool interactive = false) {
+        // depth unchanged: recompute in place
+        // interactive: hardware mips, as the key may repeat; FinishBumps builds the CPU chain
+        if (gpu) {
+            GpuNormals(depthName, depthUnit, bumpName, depthWidth, depthHeight, pixelScale, normalFilter);
+            return;
+        }
+        Clock::time_point t0 = Clock::now();
+        GetNormals(depthPixels, depthWidth, depthHeight, bumpPixels, pixelScale, normalFilter);
+        if (interactive)
+            LoadTexture(bumpPixels, depthWidth, depthHeight, bumpUnit, bumpName, false, true);
+        else
+            LoadBumps();
+        bumpMipsPending = interactive;
+        bumpMs = Milliseconds(t0);
+    }
+    void FinishBumps() {
+        // end of a key edit: replace the hardware mips
+        if (bumpMipsPending && !gpu)
+            LoadBumps();
+        bumpMipsPending = false;
     }
     void UpdateBlur() {
         int blur = 3;
-        int nBytes = 3*depthWidth*depthHeight;
-        unsigned char *tmp = new unsigned char[nBytes];
-        memcpy(tmp, depthPixels, nBytes);
-        for (int y = 0; y < depthHeight; y++) {
-            int j0 = y > blur? y-blur : 0, j1 = y < depthHeight-blur? y+blur : depthHeight-1;
-            for (int x = 0; x < depthWidth; x++) {
-                int i0 = x > blur? x-blur : 0, i1 = x < depthWidth-blur? x+blur : depthWidth-1;
-                unsigned int val[] = {0, 0, 0}, num = 0;
-                for (int j = j0; j <= j1; j++) {
-                    for (int i = i0; i <= i1; i++) {
-                        int off = 3*(j*depthWidth+i);
-                        for (int k = 0; k < 3; k++)
-                            val[k] += (unsigned int) tmp[off+k];
-                        num++;
-                    }
-                }
-                for (int k = 0; k < 3; k++)
-                    depthPixels[3*(y*depthWidth+x)+k] = (unsigned char) (val[k]/num);
-            }
+        if (gpu) {
+            GpuBlur(depthName, depthUnit, blurName, depthWidth, depthHeight, blur);
+            std::swap(depthName, blurName);
+            UpdateBumps();
+            return;
         }
-        delete [] tmp;
+        // running sums: cost independent of blur radius; gray: one channel
+        Blur(depthPixels, depthWidth, depthHeight, 3, blur, BlurBox, true);
         UpdateDepth();
     }
     void ResetDepth() {
+        delete [] depthPixels;
         depthPixels = ReadTarga(depthFile.c_str(), depthWidth, depthHeight);
         UpdateDepth();
     }
     void UpdateDepth() {
-        LoadTexture(depthPixels, depthWidth, depthHeight, depthUnit, depthName, true); // BGR true?
-        bumpPixels = GetNormals(depthPixels, depthWidth, depthHeight, pixelScale);
-        LoadTexture(bumpPixels, depthWidth, depthHeight, bumpUnit, bumpName, true);
+        meshDirty = true;
+        if (gpu) {
+            // gray: one channel suffices, shown as gray by swizzle
+            GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+            glActiveTexture(GL_TEXTURE0+depthUnit);
+            glBindTexture(GL_TEXTURE_2D, depthName);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, depthWidth, depthHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, depthPixels);
+            glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            UpdateBumps();
+            return;
+        }
+        glActiveTexture(GL_TEXTURE0+depthUnit);
+        glBindTexture(GL_TEXTURE_2D, depthName);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);   // as if never a GPU image
+        LoadTexture(depthPixels, depthWidth, depthHeight, depthUnit, depthName, true);
+        delete [] bumpPixels;
+        Clock::time_point t0 = Clock::now();
+        bumpPixels = GetNormals(depthPixels, depthWidth, depthHeight, pixelScale, normalFilter);
+        LoadBumps();
+        bumpMs = Milliseconds(t0);
+    }
+    void UseGpu(bool on) {
+        // switch bump map computation between CPU and GPU
+        if (on == gpu || (on && !gpuBumps))
+            return;
+        if (gpu) {
+            // the GPU may have blurred the height field: read it back, one channel to three
+            int n = depthWidth*depthHeight;
+            glActiveTexture(GL_TEXTURE0+depthUnit);
+            glBindTexture(GL_TEXTURE_2D, depthName);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_UNSIGNED_BYTE, depthPixels);
+            for (int i = n-1; i >= 0; i--)
+                depthPixels[3*i] = depthPixels[3*i+1] = depthPixels[3*i+2] = depthPixels[i];
+        }
+        if (on) {
+            // bump map as an image (RGBA8, all levels); blur destination as the height field
+            int w = depthWidth, h = depthHeight;
+            glActiveTexture(GL_TEXTURE0+bumpUnit);
+            glBindTexture(GL_TEXTURE_2D, bumpName);
+            for (int level = 0, n = MipLevels(w, h); level < n; level++, w = w > 1? w/2 : 1, h = h > 1? h/2 : 1)
+                glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, MipLevels(depthWidth, depthHeight)-1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            if (!blurName)
+                glGenTextures(1, &blurName);
+            glBindTexture(GL_TEXTURE_2D, blurName);
+            GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, depthWidth, depthHeight, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+            glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        }
+        gpu = on;
+        UpdateDepth();
+    }
+    void UpdateMesh(DisplaceShape shape, float pixelSize) {
+        // rebake if the height field or any level of detail parameter changed
+        // adaptive: edgePixels converted to object space by pixelSize (at the rotation center), as the GPU levels
+        BakeOptions o(shape, displaceScale);
+        o.patches = uberRes;
+        o.maxLevel = adaptive? 64 : res;
+        o.edgeLength = adaptive? edgePixels*pixelSize : 0;
+        o.fieldNormals = approxNormals == 1;
+        BakeOptions &m = meshOptions;
+        if (!meshDirty && o.shape == m.shape && o.displaceScale == m.displaceScale && o.patches == m.patches &&
+            o.maxLevel == m.maxLevel && o.edgeLength == m.edgeLength && o.fieldNormals == m.fieldNormals)
+            return;
+        if (gpu)
+            UseGpu(false);              // the bake reads depthPixels
+        Clock::time_point t0 = Clock::now();
+        BakeDisplacedMesh(depthPixels, depthWidth, depthHeight, 3, o, mesh.points, mesh.normals, mesh.uvs, mesh.triangles);
+        bakeMs = Milliseconds(t0);
+        mesh.Buffer();
+        meshOptions = o;
+        meshDirty = false;
     }
     void Init(int id, std::string depthFilename, std::string textureFilename) {
         if (id == 2)
@@ -101,16 +418,25 @@ public:
         depthUnit = textureUnit+2;
         textureName = LoadTexture(textureFile.c_str(), textureUnit);
         depthPixels = ReadTarga(depthFile.c_str(), depthWidth, depthHeight);
-        bumpPixels = GetNormals(depthPixels, depthWidth, depthHeight, pixelScale);
-        depthName = LoadTexture(depthPixels, depthWidth, depthHeight, depthUnit, true);
-        bumpName = LoadTexture(bumpPixels, depthWidth, depthHeight, bumpUnit, true);
+        glGenTextures(1, &depthName);
+        glGenTextures(1, &bumpName);
+        if (gpuBumps)
+            UseGpu(true);
+        else
+            UpdateDepth();
     }
     ~Scene() {
         delete [] depthPixels;
         delete [] bumpPixels;
-        glDeleteBuffers(1, &textureName);
-        glDeleteBuffers(1, &bumpName);
-        glDeleteBuffers(1, &depthName);
+        glDeleteTextures(1, &textureName);
+        glDeleteTextures(1, &bumpName);
+        glDeleteTextures(1, &depthName);
+        if (blurName)
+            glDeleteTextures(1, &blurName);
+        if (mesh.vBufferId) {
+            glDeleteBuffers(1, &mesh.vBufferId);
+            glDeleteBuffers(1, &mesh.iBufferId);
+        }
     }
 } scenes[nScenes];
 
@@ -149,26 +475,25 @@ Mover           mover;
 time_t          mouseMove = clock();
 
 // shader indices
-GLuint          shapeShader, imageShader;
+GLuint          shapeShader, bakedShader, imageShader;
 
-// vertex shader
-const char *vShaderCode = "void main() { gl_Position = vec4(0); }";
+// vertex shader: pass the patch corner uv
+const char *vShaderCode = R"(
+    #version 400 core
+    in vec2 uv;
+    out vec2 vUv;
+    void main() {
+        vUv = uv;
+        gl_Position = vec4(0);
+    }
+)";
 
-// tessellation evaluation: set vertex position/normal/uv for sphere, tube, height field
-const char *teShaderCode = R"(
+// shape and displacement, shared by tessellation control (edge lengths) and evaluation (vertices)
+const char *shapeCode = R"(
     #version 400 core
-    layout (quads, equal_spacing, ccw) in;
-    uniform mat4 modelview;
-    uniform mat4 persp;
     uniform sampler2D heightField;
     uniform float displaceScale = 0;
     uniform int shape = 0; // 0: quad, 1: ball, 2: tube
-    uniform int approxNormals = 0;
-    uniform vec2 uvOffset = vec2(0);
-    uniform float uvScale = 1;
-    out vec3 tePoint;
-    out vec3 teNormal;
-    out vec2 teUv;
     vec3 PtFromSphere(float u, float v) {
         // u is longitude, v is latitude (PI/2 = N. pole, 0 = equator, -PI/2 = S. pole)
         float _PI = 3.141592;
@@ -203,9 +528,80 @@ const char *teShaderCode = R"(
         PN(u, v, p, n);
         return p;
     }
+)";
+
+// tessellation control: per-edge levels from projected length and height variance, or uniform res
+// an edge's level depends only on its end points, given in the same order by both patches sharing it: no cracks
+const char *tcShaderCode = R"(
+    layout (vertices = 4) out;
+    in vec2 vUv[];
+    out vec2 tcUv[];
+    uniform mat4 modelview;
+    uniform mat4 persp;
+    uniform mat4 viewptM;
+    uniform int adaptive = 1;
+    uniform float res = 70;
+    uniform float edgePixels = 8;   // target triangle edge length
+    uniform float detail = 16;      // more triangles where displaced height varies
+    vec2 Screen(vec2 uv) {
+        vec4 c = persp*modelview*vec4(P(uv.s, uv.t), 1);
+        return c.w > 1e-4? (viewptM*(c/c.w)).xy : vec2(1e6);
+    }
+    float EdgeLevel(vec2 a, vec2 b) {
+        // length in pixels of the displaced edge (through 5 samples), scaled up by its height deviation
+        float len = 0, h[5], mean = 0, variance = 0;
+        vec2 prev = Screen(a);
+        for (int i = 0; i < 5; i++) {
+            vec2 uv = mix(a, b, i/4.);
+            h[i] = texture(heightField, uv).r;
+            mean += h[i]/5;
+            if (i > 0) {
+                vec2 p = Screen(uv);
+                len += length(p-prev);
+                prev = p;
+            }
+        }
+        for (int i = 0; i < 5; i++)
+            variance += (h[i]-mean)*(h[i]-mean)/5;
+        return clamp(len/edgePixels*(1+detail*displaceScale*sqrt(variance)), 1, 64);
+    }
+    void main() {
+        tcUv[gl_InvocationID] = vUv[gl_InvocationID];
+        if (gl_InvocationID == 0) {
+            vec2 uv0 = vUv[0], uv1 = vUv[2];
+            if (adaptive == 0) {
+                gl_TessLevelOuter[0] = gl_TessLevelOuter[1] = gl_TessLevelOuter[2] = gl_TessLevelOuter[3] = res;
+                gl_TessLevelInner[0] = gl_TessLevelInner[1] = res;
+                return;
+            }
+            // outer 0: u = u0, 1: v = v0, 2: u = u1, 3: v = v1
+            gl_TessLevelOuter[0] = EdgeLevel(uv0, vec2(uv0.s, uv1.t));
+            gl_TessLevelOuter[1] = EdgeLevel(uv0, vec2(uv1.s, uv0.t));
+            gl_TessLevelOuter[2] = EdgeLevel(vec2(uv1.s, uv0.t), uv1);
+            gl_TessLevelOuter[3] = EdgeLevel(vec2(uv0.s, uv1.t), uv1);
+            // inner: also the midlines (not shared, so no cracks), for patches whose edges collapse (poles)
+            vec2 mid = .5*(uv0+uv1);
+            float midU = EdgeLevel(vec2(uv0.s, mid.t), vec2(uv1.s, mid.t));
+            float midV = EdgeLevel(vec2(mid.s, uv0.t), vec2(mid.s, uv1.t));
+            gl_TessLevelInner[0] = max(midU, max(gl_TessLevelOuter[1], gl_TessLevelOuter[3]));
+            gl_TessLevelInner[1] = max(midV, max(gl_TessLevelOuter[0], gl_TessLevelOuter[2]));
+        }
+    }
+)";
+
+// tessellation evaluation: set vertex position/normal/uv for sphere, tube, height field
+const char *teShaderCode = R"(
+    layout (quads, equal_spacing, ccw) in;
+    in vec2 tcUv[];
+    uniform mat4 modelview;
+    uniform mat4 persp;
+    uniform int approxNormals = 0;
+    out vec3 tePoint;
+    out vec3 teNormal;
+    out vec2 teUv;
     vec3 NormalFromField(float u, float v) {
-        // approximate normal with central differencing
-        float du = 1/gl_TessLevelInner[0], dv = 1/gl_TessLevelInner[1];
+        // approximate normal with central differencing, a tessellation step apart
+        float du = (tcUv[2].s-tcUv[0].s)/gl_TessLevelInner[0], dv = (tcUv[2].t-tcUv[0].t)/gl_TessLevelInner[1];
         vec3 texL = P(max(0,u-du), v);
         vec3 texR = P(min(1,u+du), v);
         vec3 texT = P(u, max(0,v-dv));
@@ -213,7 +609,7 @@ const char *teShaderCode = R"(
         return -normalize(cross(texB-texT, texR-texL));
     }
     void main() {
-        teUv = uvOffset+uvScale*gl_TessCoord.st;
+        teUv = mix(tcUv[0], tcUv[2], gl_TessCoord.st);
         float u = teUv.s, v = teUv.t;
         vec3 p, n;
         PN(u, v, p, n);
@@ -253,7 +649,7 @@ const char *gShaderCode = R"(
         hb = abs(c*sin(alpha));
         hc = abs(b*sin(alpha));
         // send triangle vertices and edge distances
-        vec3 edgeDists[3] = { vec3(ha, 0, 0), vec3(0, hb, 0), vec3(0, 0, hc) };
+        vec3 edgeDists[3] = vec3[3](vec3(ha, 0, 0), vec3(0, hb, 0), vec3(0, 0, hc));
         for (int i = 0; i < 3; i++) {
             gEdgeDistance = edgeDists[i];
             gPoint = tePoint[i];
@@ -266,9 +662,28 @@ const char *gShaderCode = R"(
     }
 )";
 
+// vertex shader for baked meshes: outputs named as the tessellation evaluation shader's
+const char *bakedVShaderCode = R"(
+    #version 330 core
+    in vec3 point;
+    in vec3 normal;
+    in vec2 uv;
+    out vec3 tePoint;
+    out vec3 teNormal;
+    out vec2 teUv;
+    uniform mat4 modelview;
+    uniform mat4 persp;
+    void main() {
+        tePoint = (modelview*vec4(point, 1)).xyz;
+        teNormal = (modelview*vec4(normal, 0)).xyz;
+        teUv = uv;
+        gl_Position = persp*vec4(tePoint, 1);
+    }
+)";
+
 // pixel shader
 const char *pShaderCode = R"(
-    #version 410 core
+    #version 330 core
     in vec3 gPoint;
     in vec3 gNormal;
     in vec2 gUv;
@@ -393,24 +808,82 @@ const char *imagePShader = R"(
     }
 )";
 
-// Texture Warp
+GLuint LinkShapeShader() {
+    // tessellation stages share the shape code
+    std::string tc = std::string(shapeCode)+tcShaderCode, te = std::string(shapeCode)+teShaderCode;
+    const char *tcCode = tc.c_str(), *teCode = te.c_str();
+    return LinkProgramViaCode(&vShaderCode, &tcCode, &teCode, &gShaderCode, &pShaderCode);
+}
 
-void Warp() {
-    int width, height;
-    unsigned char *pixels = ReadTarga(stripesFilename, width, height);
-    int bytesPerPixel = 3, bytesPerImage = width*height*bytesPerPixel;
-    unsigned char *warp = new unsigned char[bytesPerImage], *w = warp;
-    for (int j = 0; j < height; j++) {
-        float h = (float) j / (float) (height-1), a = (h-.5f)*3.141592f, c = cos(a);
-        for (int i = 0; i < width; i++) {
-            float f = (((float)i/(float)(width-1))-.5f)*c, x = .5f+f;
-            int ix = (int) (x*(width-1));
-            unsigned char *p = pixels+bytesPerPixel*(j*width+ix);
-            for (int k = 0; k < bytesPerPixel; k++)
-                *w++ = *p++;
+GLuint LinkBakedShader() {
+    return LinkProgramViaCode(&bakedVShaderCode, NULL, NULL, &gShaderCode, &pShaderCode);
+}
+
+bool SoftwareRenderer() {
+    // llvmpipe, softpipe: the tessellation shaders link, but (Mesa 22) read the height field as 0
+    const char *renderer = (const char *) glGetString(GL_RENDERER);
+    return renderer && (strstr(renderer, "llvmpipe") || strstr(renderer, "softpipe"));
+}
+
+// Patches
+
+GLuint          patchBuffer = 0;
+int             patchRes = 0;           // patches per side in patchBuffer
+GLuint          triangleQuery = 0;      // GL_PRIMITIVES_GENERATED by the last scene draw
+bool            triangleQueryPending = false;
+int             nTriangles = 0;
+
+void UpdatePatches(int uberRes) {
+    // uberRes^2 patches, corners (u0,v0), (u1,v0), (u1,v1), (u0,v1); shared corners computed identically
+    if (patchRes == uberRes)
+        return;
+    std::vector<vec2> uvs;
+    for (int i = 0; i < uberRes; i++)
+        for (int j = 0; j < uberRes; j++) {
+            float u0 = (float) i/uberRes, u1 = (float) (i+1)/uberRes, v0 = (float) j/uberRes, v1 = (float) (j+1)/uberRes;
+            vec2 corners[] = {vec2(u0, v0), vec2(u1, v0), vec2(u1, v1), vec2(u0, v1)};
+            uvs.insert(uvs.end(), corners, corners+4);
         }
+    if (!patchBuffer)
+        glGenBuffers(1, &patchBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, patchBuffer);
+    glBufferData(GL_ARRAY_BUFFER, uvs.size()*sizeof(vec2), &uvs[0], GL_STATIC_DRAW);
+    patchRes = uberRes;
+}
+
+void UpdateTriangleCount() {
+    // read the count without stalling: once available
+    GLint available = 0;
+    if (!triangleQueryPending)
+        return;
+    glGetQueryObjectiv(triangleQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+        GLuint n = 0;
+        glGetQueryObjectuiv(triangleQuery, GL_QUERY_RESULT, &n);
+        nTriangles = (int) n;
+        triangleQueryPending = false;
     }
-    warpTextureName = LoadTexture(warp, width, height, warpTextureUnit, true, true);
+}
+
+// Texture Warp
+
+void StripesWarp(int i, int j, float &x, float &y, void *data) {
+    // squeeze each row toward the center by cos(latitude), as the sphere does
+    int *size = (int *) data, width = size[0], height = size[1];
+    float h = (float) j/(float) (height-1), c = cos((h-.5f)*3.141592f);
+    x = .5f*(width-1)+((float) i-.5f*(width-1))*c;
+    y = (float) j;
+}
+
+void Warp() {
+    int width, height, bytesPerPixel;
+    unsigned char *pixels = ReadTarga(stripesFilename, width, height, bytesPerPixel);
+    if (!pixels)
+        return;
+    unsigned char *warp = new unsigned char[width*height*bytesPerPixel];
+    int size[] = {width, height};
+    Remap(pixels, width, height, bytesPerPixel, warp, width, height, StripesWarp, size, RemapBilinear);
+    warpTextureName = LoadTexture(warp, width, height, warpTextureUnit, true, true, bytesPerPixel);
     delete [] pixels;
     delete [] warp;
 }
@@ -432,7 +905,10 @@ void Display(GLFWwindow *w) {
     glHint(GL_FRAGMENT_SHADER_DERIVATIVE_HINT, GL_NICEST);
     // setup scene, shader
     Scene &s = scenes[scene]; // scene = 0: ball, 1: tube, 2, 3, 4: quad
-    GLuint shader = s.view == 0? shapeShader : imageShader;
+    UpdateBumpTimer();
+    UpdateTriangleCount();
+    bool baked = bakeMeshes || !shapeShader;
+    GLuint shader = s.view > 0? imageShader : baked? bakedShader : shapeShader;
     glUseProgram(shader);
     // texture, bump maps
     int tUnit = s.stripesTexture? (s.warpTexture? warpTextureUnit : stripesTextureUnit) : s.textureUnit;
@@ -446,11 +922,11 @@ void Display(GLFWwindow *w) {
     // height field
     glActiveTexture(GL_TEXTURE0+s.depthUnit);
     glBindTexture(GL_TEXTURE_2D, s.depthName);
-    SetUniform(shader, "heightField", s.depthUnit);
+    if (shader != bakedShader)
+        SetUniform(shader, "heightField", s.depthUnit);
     if (s.view == 0) {
         SetUniform(shader, "modelview", camera.modelview);
         SetUniform(shader, "persp", camera.persp);
-        SetUniform(shader, "shape", scene > 2? 2 : scene);
         // HLE params
         SetUniform(shader, "outlineOn", s.showLines);
         SetUniform(shader, "outlineWidth", s.lineWidth);
@@ -460,15 +936,13 @@ void Display(GLFWwindow *w) {
         SetUniform(shader, "rightEdge", rightEdge);
         SetUniform(shader, "topEdge", topEdge);
         SetUniform(shader, "bottomEdge", bottomEdge);
-        // displacement/bump params
-        SetUniform(shader, "displaceScale", s.displaceScale);
+        // bump params
         SetUniform(shader, "disableBumpMap", s.disableBumpMap);
         // shading params
         SetUniform(shader, "hiliteColor", s.hiliteColor);
         SetUniform(shader, "disableTextureMap", s.disableTextureMap);
         SetUniform(shader, "disableDiffuse", s.disableDiffuse);
         SetUniform(shader, "disableSpecular", s.disableSpecular);
-        SetUniform(shader, "approxNormals", s.approxNormals);
         SetUniform(shader, "oneSided", s.oneSided);
         // update matrices
         SetUniform(shader, "viewptM", Viewport());
@@ -484,23 +958,43 @@ void Display(GLFWwindow *w) {
         SetUniform(shader, "nlights", nlights);
         glUniform3fv(glGetUniformLocation(shader, "lights"), nlights, (float *) &xLights[0]);
         glUniform3fv(glGetUniformLocation(shader, "lightColors"), nlights, (float *) &lColors[0]);
-        // LOD params
-        float r = (float) s.res;
-        float outerLevels[] = {r, r, r, r}, innerLevels[] = {r, r};
-        glPatchParameterfv(GL_PATCH_DEFAULT_OUTER_LEVEL, outerLevels);
-        glPatchParameterfv(GL_PATCH_DEFAULT_INNER_LEVEL, innerLevels);
-        // draw patch at uber resolution
-        glPatchParameteri(GL_PATCH_VERTICES, 4);
-        SetUniform(shader, "uvScale", 1.f/s.uberRes);
-        for (int i = 0; i < s.uberRes; i++)
-            for (int j = 0; j < s.uberRes; j++) {
-                SetUniform(shader, "uvOffset", 1.f/s.uberRes*vec2(i, j));
-                glDrawArrays(GL_PATCHES, 0, 4);
-            }
+        if (!triangleQuery)
+            glGenQueries(1, &triangleQuery);
+        if (!triangleQueryPending)
+            glBeginQuery(GL_PRIMITIVES_GENERATED, triangleQuery);
+        if (baked) {
+            // object size of a pixel at the rotation center, for edge lengths comparable to the GPU's
+            GLint vp[4];
+            glGetIntegerv(GL_VIEWPORT, vp);
+            float pixelSize = 2*fabs(camera.GetTran().z)*tan(camera.GetFOV()*3.141592f/360)/vp[3];
+            s.UpdateMesh((DisplaceShape) (scene > 2? 2 : scene), pixelSize);
+            s.mesh.Draw(shader);
+        }
+        else {
+            // displacement, LOD params
+            SetUniform(shader, "shape", scene > 2? 2 : scene);
+            SetUniform(shader, "displaceScale", s.displaceScale);
+            SetUniform(shader, "approxNormals", s.approxNormals);
+            SetUniform(shader, "adaptive", s.adaptive);
+            SetUniform(shader, "res", (float) s.res);
+            SetUniform(shader, "edgePixels", s.edgePixels);
+            // draw all patches at uber resolution
+            UpdatePatches(s.uberRes);
+            glBindBuffer(GL_ARRAY_BUFFER, patchBuffer);
+            VertexAttribPointer(shader, "uv", 2, 0, (void *) 0);
+            glPatchParameteri(GL_PATCH_VERTICES, 4);
+            glDrawArrays(GL_PATCHES, 0, 4*s.uberRes*s.uberRes);
+            DisableVertexAttribute(shader, "uv");
+        }
+        if (!triangleQueryPending) {
+            glEndQuery(GL_PRIMITIVES_GENERATED);
+            triangleQueryPending = true;
+        }
         glDisable(GL_DEPTH_TEST);
         // draw light source
         if ((clock()-mouseMove)/CLOCKS_PER_SEC < .9f) {
             UseDrawShader(camera.fullview);
+            BeginDrawBatch();
             for (size_t i = 0; i < lights.size(); i++) {
                 Light &l = lights[i];
                 int dia = hover == &lights[i]? 18 : 12;
@@ -508,6 +1002,7 @@ void Display(GLFWwindow *w) {
                 Disk(l.p, dia+3,  visible? vec3(0,0,0) : vec3(1,1,1));
                 Disk(l.p, dia,  visible? colors[l.cid] : vec3(0,0,0));
             }
+            EndDrawBatch();
         }
     }
     if (s.view > 0) {
@@ -520,6 +1015,7 @@ void Display(GLFWwindow *w) {
         UseDrawShader(ScreenMode());
         glDisable(GL_DEPTH_TEST);
         Quad(vec3(0,0,0), vec3(0,150,0), vec3(330,150,0), vec3(330,0,0), true, vec3(1,1,1));
+        BeginTextBatch();
         if (showLightInfo) {
             int nlights = lights.size(), textHeight = 10+20*(nlights-1);
             for (int i = 0; i < nlights; i++) {
@@ -530,12 +1026,20 @@ void Display(GLFWwindow *w) {
         else {
             Text(10, 130, vec3(0,0,0), 8, "left %3.2f, right %3.2f, top %3.2f, bottom %3.2f", leftEdge, rightEdge, topEdge, bottomEdge);
             Text(10, 110, vec3(0,0,0), 8, "scene %i, light[0]=(%3.2f,%3.2f,%3.2f)", scene, p0.x, p0.y, p0.z);
-            Text(10, 90, vec3(0,0,0), 8, "res %i, %i quads, %i triangles", s.res, s.uberRes, 2*s.res*s.res*s.uberRes*s.uberRes);
-            Text(10, 70, vec3(0,0,0), 8, "displace scale: %4.3f, pixel scale: %4.3f", s.displaceScale, s.pixelScale);
+            char bake[100] = "";
+            if (bakeMeshes || !shapeShader)
+                sprintf(bake, " (baked %3.1f ms)", bakeMs);
+            if (s.adaptive)
+                Text(10, 90, vec3(0,0,0), 8, "adaptive %3.1f pixels, %i patches, %i triangles%s", s.edgePixels, s.uberRes*s.uberRes, nTriangles, bake);
+            else
+                Text(10, 90, vec3(0,0,0), 8, "res %i, %i patches, %i triangles%s", s.res, s.uberRes*s.uberRes, nTriangles, bake);
+            Text(10, 70, vec3(0,0,0), 8, "displace scale: %4.3f, pixel scale: %4.3f (%s)", s.displaceScale, s.pixelScale,
+                 s.normalFilter == NormalSobel? "Sobel" : s.normalFilter == NormalScharr? "Scharr" : "central");
             Text(10, 50, vec3(0,0,0), 8, "texture %s, bump %s", s.disableTextureMap? "disabled" : "enabled", s.disableBumpMap? "disabled" : "enabled");
             Text(10, 30, vec3(0,0,0), 8, "diffuse %s, specular %s", s.disableDiffuse? "off" : "on", s.disableSpecular? "off" : "on");
-            Text(10, 10, vec3(0,0,0), 8, "approx normals: %s", s.approxNormals? "on" : "off");
+            Text(10, 10, vec3(0,0,0), 8, "approx normals: %s, bumps: %s %3.2f ms", s.approxNormals? "on" : "off", s.gpu? "GPU" : "CPU", bumpMs);
         }
+        EndTextBatch();
     }
     glFlush();
 }
@@ -618,7 +1122,10 @@ void Resize(GLFWwindow *w, int width, int height) {
 }
 
 void Keyboard(GLFWwindow *w, int k, int scancode, int action, int mods) {
-    if (action == GLFW_PRESS) {
+    if (action == GLFW_RELEASE && (k == 'P' || k == 'M'))
+        for (int i = 0; i < nScenes; i++)
+            scenes[i].FinishBumps();
+    if (action == GLFW_PRESS || (action == GLFW_REPEAT && k == 'P')) {
         bool shift = mods & GLFW_MOD_SHIFT;
         Scene &s = scenes[scene];
         int nlights = lights.size();
@@ -646,6 +1153,9 @@ void Keyboard(GLFWwindow *w, int k, int scancode, int action, int mods) {
             case 'K': showLightInfo = !showLightInfo;               break;
             case 'O': s.stripesTexture = !s.stripesTexture;         break;
             case 'Q': s.warpTexture = !s.warpTexture;               break;
+            case 'Y': s.UseGpu(!s.gpu);                             break;
+            case '2': bakeMeshes = !bakeMeshes;                     break;
+            case 'I': s.adaptive = 1-s.adaptive;                    break;
             case 'C':
                 if (light) {
                     Light *l = (Light *) light;
@@ -671,13 +1181,23 @@ void Keyboard(GLFWwindow *w, int k, int scancode, int action, int mods) {
                 }
                 break;
             case'R':
-                s.res += shift? -1 : 1;
-                s.res = s.res < 1? 1 : s.res;
+                if (s.adaptive) {
+                    s.edgePixels *= shift? 1.25f : .8f;
+                    s.edgePixels = s.edgePixels < 1? 1 : s.edgePixels > 100? 100 : s.edgePixels;
+                }
+                else {
+                    s.res += shift? -1 : 1;
+                    s.res = s.res < 1? 1 : s.res;
+                }
                 break;
             case 'P':
                 s.pixelScale *= Shift(w)? .8f : 1.5f;
                 s.pixelScale = s.pixelScale < 1? 1 : s.pixelScale > 500? 500 : s.pixelScale;
-                s.UpdateBumps();
+                s.UpdateBumps(true);
+                break;
+            case 'M':
+                s.normalFilter = (NormalFilter) ((s.normalFilter+1)%3);
+                s.UpdateBumps(true);
                 break;
             case 'H':
                 s.uberRes += shift? -1 : 1;
@@ -699,8 +1219,8 @@ void Keyboard(GLFWwindow *w, int k, int scancode, int action, int mods) {
     }
 }
 
-// taken: a, b, c, d, e, f, g, h, j, k, l, n, p, r, s, t, u, v, w, x, 1
-// free: i, m, q, y, 2+
+// taken: a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p, q, r, s, t, u, v, w, x, y, z, 1, 2
+// free: 3+
 const char *usage = "\
     general:\n\
       S: cycle scene\n\
@@ -714,9 +1234,11 @@ const char *usage = "\
       t/T: +/- line transition\n\
       w/W: +/- line width\n\
       p/P: +/- pixelScale\n\
+      M: cycle central/Sobel/Scharr normals\n\
       d/D: +/- depth\n\
-      r/R: +/- res\n\
-      h/H: +/- ubeRes\n\
+      I: toggle adaptive/uniform tessellation\n\
+      r/R: +/- res (adaptive: finer/coarser)\n\
+      h/H: +/- ubeRes (patches per side)\n\
       G: toggle hiLite color\n\
       B: toggle bump map\n\
       E: toggle texture map\n\
@@ -727,10 +1249,88 @@ const char *usage = "\
       Z: toggle gray/white background\n\
       1: one/two sided\n\
       U: blur\n\
+      Y: toggle GPU/CPU bump maps (GL 4.3+)\n\
+      2: toggle CPU-baked mesh/GPU tessellation\n\
       Q: warp texture\n\
 ";
 
+// Regression
+
+// render each scene with no window and compare with golden images:
+//   -regress [-dir textureDir] [-size WxH] [-osmesa] [-bake] [-golden dir] [-out dir] [-report file.json] [-update]
+//            [-psnr min] [-flip max] [-warmup n] [-frames n]
+
+struct SceneCase {
+    int scene;
+    int variant;    // 0: as loaded, 1: no bump map, 2: no texture map, 3: outlines
+};
+
+void RenderSceneCase(void *data) {
+    SceneCase *c = (SceneCase *) data;
+    Scene &s = scenes[scene = c->scene];
+    s.disableBumpMap = c->variant == 1;
+    s.disableTextureMap = c->variant == 2;
+    s.showLines = c->variant == 3? 1 : 0;
+    // edges as set by Keyboard
+    leftEdge = 0;
+    rightEdge = 1;
+    topEdge = scene == 2? -.02f : 0;
+    bottomEdge = scene == 2? .9f : 1;
+    Display(NULL);
+}
+
+int RenderRegression(int argc, char **argv) {
+    const char *sceneNames[] = {"ball", "tube", "yosemite", "penny", "ripples"};
+    const char *variantNames[] = {"", "-nobump", "-notexture", "-lines"};
+    std::string dir = "C:/Users/jules/CodeBlocks/Aids/";
+    int width = winWidth, height = winHeight;
+    bool osmesa = false;
+    RegressOptions options;
+    for (int i = 2; i < argc; i++) {
+        if (ParseRegressOption(options, argc, argv, i))
+            continue;
+        if (!strcmp(argv[i], "-dir") && i+1 < argc)
+            dir = std::string(argv[++i])+"/";
+        else if (!strcmp(argv[i], "-size") && i+1 < argc)
+            sscanf(argv[++i], "%ix%i", &width, &height);
+        else if (!strcmp(argv[i], "-osmesa"))
+            osmesa = true;
+        else if (!strcmp(argv[i], "-bake"))
+            bakeMeshes = true;
+        else
+            printf("unknown option %s\n", argv[i]);
+    }
+    if (!HeadlessInit(width, height, osmesa? HeadlessOSMesa : HeadlessEGL))
+        return 1;
+    imageShader = LinkProgramViaCode(&imageVShader, &imagePShader);
+    shapeShader = GLAD_GL_VERSION_4_0? LinkShapeShader() : 0;
+    bakedShader = LinkBakedShader();
+    bakeMeshes = bakeMeshes || SoftwareRenderer();
+    scenes[0].Init(0, dir+"EarthHeight.tga", dir+"Earth.tga");
+    scenes[1].Init(1, dir+"BarkHeight.tga", dir+"UsFlag.tga");
+    scenes[2].Init(2, dir+"YosemiteHeight.tga", dir+"YosemiteValley.tga");
+    scenes[3].Init(3, dir+"PennyDepth.tga", dir+"PennyTexture.tga");
+    scenes[4].Init(4, dir+"RipplesDepth.tga", dir+"Gray.tga");
+    Resize(NULL, width, height);
+    // no text (font dependent) and no light disks (shown only after mouse motion)
+    showText = false;
+    mouseMove = clock()-10*CLOCKS_PER_SEC;
+    Regress regress("20-Solution-DispBumpTexSTH-Simple", options);
+    char name[100];
+    for (int sc = 0; sc < nScenes; sc++)
+        for (int v = 0; v < 4; v++) {
+            SceneCase c = {sc, v};
+            sprintf(name, "%s%s", sceneNames[sc], variantNames[v]);
+            regress.Case(name, RenderSceneCase, &c, width, height);
+        }
+    bool ok = regress.Finish();
+    HeadlessShutdown();
+    return ok? 0 : 1;
+}
+
 int main(int argc, char **argv) {
+    if (argc > 1 && !strcmp(argv[1], "-regress"))
+        return RenderRegression(argc, argv);
     // init app window and GL context
     glfwInit();
     glfwWindowHint(GLFW_SAMPLES, 4); // anti-alias
@@ -740,8 +1340,14 @@ int main(int argc, char **argv) {
     gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
     // build, use shader programs
     imageShader = LinkProgramViaCode(&imageVShader, &imagePShader);
-    shapeShader = LinkProgramViaCode(&vShaderCode, NULL, &teShaderCode, &gShaderCode, &pShaderCode);
-    // init scenes
+    shapeShader = GLAD_GL_VERSION_4_0? LinkShapeShader() : 0;
+    bakedShader = LinkBakedShader();
+    bakeMeshes = bakeMeshes || SoftwareRenderer();
+    // init scenes, on the GPU if possible
+    gpuBumps = GpuBumpsInit();
+    printf("bump maps computed on the %s\n", gpuBumps? "GPU" : "CPU");
+    if (!shapeShader || bakeMeshes)
+        printf("displaced meshes baked on the CPU\n");
     std::string dir = "C:/Users/jules/CodeBlocks/Aids/";
     scenes[0].Init(0, dir+"EarthHeight.tga", dir+"Earth.tga");
     scenes[1].Init(1, dir+"BarkHeight.tga", dir+"UsFlag.tga");
@@ -0,0 +1,131 @@
+// SoftRaster.cpp: render a scene with the CPU rasterizer, report throughput
+// a GPU-free reference for the 15-Solution BRDF shader; see Lib/SoftRaster.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Mesh.h"
+#include "SoftRaster.h"
+#include "SceneFile.h"
+
+// Scene
+
+struct SceneMesh {
+    vector<vec3> points, normals;
+    vector<vec2> uvs;
+    vector<int3> triangles;
+    mat4 xform;
+};
+
+const char  *objectFilename = "lespaul.obj";
+const int    nBodyTriangles = 2050;     // part 0: guitar body (as in 15-Solution)
+const char  *textureNames[2][5] = {     // albedo, normal, ao, metallic, roughness
+    {"lespaul_Albedo.tga", "lespaulnormal.tga", "lespaul_19_AO.tga", "lespaul_19_Metallic.tga", "lespaul_19_Roughness.tga"},
+    {"lespaul_20_Base_Color.tga", "lespaul_20_Default_Normal.tga", "lespaul_20_AO.tga", "lespaul_20_Metallic.tga", "lespaul_20_Roughness.tga"}
+};
+vec3         light2(.2f, .4f, .3f);
+
+bool ReadScene(const char *filename, mat4 &modelview, vector<SceneMesh> &meshes) {
+    // as 15-Solution ReadScene (text or binary): every mesh entry loads the guitar, so read it once
+    SceneFile scene;
+    if (!ReadSceneFile(filename, scene))
+        return false;
+    modelview = scene.modelview;
+    meshes.resize(0);
+    if (scene.entries.empty())
+        return true;
+    SceneMesh guitar;
+    if (!ReadAsciiObj(objectFilename, guitar.points, guitar.triangles, &guitar.normals, &guitar.uvs)) {
+        printf("can't read %s\n", objectFilename);
+        return false;
+    }
+    Normalize(guitar.points, .8f);
+    meshes.assign(scene.entries.size(), guitar);
+    for (size_t i = 0; i < meshes.size(); i++)
+        meshes[i].xform = scene.entries[i].xform;
+    return true;
+}
+
+// Application
+
+int main(int ac, char **av) {
+    const char *sceneName = "Test.scene", *outName = "SoftRaster.tga";
+    int width = 1650, height = 800, nThreads = 0, nFrames = 10;
+    RasterShading shading;
+    shading.lambert = shading.blinnPhong = true;
+    shading.spotColor = vec3(1, 1, 1);
+    shading.spotIntensity = 1;
+    for (int i = 1; i < ac; i++) {
+        const char *a = av[i], *next = i+1 < ac? av[i+1] : "";
+        if (!strcmp(a, "-scene") && i+1 < ac) { sceneName = next; i++; }
+        else if (!strcmp(a, "-out") && i+1 < ac) { outName = next; i++; }
+        else if (!strcmp(a, "-frames") && i+1 < ac) { nFrames = atoi(next); i++; }
+        else if (!strcmp(a, "-threads") && i+1 < ac) { nThreads = atoi(next); i++; }
+        else if (!strcmp(a, "-size") && i+1 < ac) { sscanf(next, "%ix%i", &width, &height); i++; }
+        else if (!strcmp(a, "-diffuse") && i+1 < ac) {
+            shading.lambert = !strcmp(next, "lambert");
+            shading.disney = !strcmp(next, "disney");
+            i++;
+        }
+        else if (!strcmp(a, "-specular") && i+1 < ac) {
+            shading.blinnPhong = !strcmp(next, "blinn");
+            shading.cookTorrance = !strcmp(next, "cook");
+            i++;
+        }
+        else if (!strcmp(a, "-spot")) shading.spotLight = true;
+        else if (!strcmp(a, "-ao")) shading.aoMap = true;
+        else if (!strcmp(a, "-normalmap")) shading.normalMap = true;
+        else {
+            printf("usage: %s [-scene file] [-out file.tga] [-frames n] [-threads n] [-size WxH]\n", av[0]);
+            printf("  [-diffuse lambert|disney|none] [-specular blinn|cook|none] [-spot] [-ao] [-normalmap]\n");
+            return 1;
+        }
+    }
+    mat4 modelview;
+    vector<SceneMesh> meshes;
+    if (!ReadScene(sceneName, modelview, meshes)) {
+        printf("can't read %s\n", sceneName);
+        return 1;
+    }
+    // textures shared by all meshes
+    RasterTexture textures[2][5];
+    RasterMaterial materials[2];
+    for (int p = 0; p < 2; p++) {
+        RasterTexture **maps[] = {&materials[p].albedo, &materials[p].normal, &materials[p].ao,
+                                  &materials[p].metallic, &materials[p].roughness};
+        for (int k = 0; k < 5; k++)
+            if (textures[p][k].Read(textureNames[p][k]))  // ReadTarga reports failure
+                *maps[k] = &textures[p][k];
+    }
+    vec4 xlight2 = modelview*vec4(light2, 1);
+    shading.light2 = vec3(xlight2.x, xlight2.y, xlight2.z);
+    mat4 persp = Perspective(30, (float) width/height, .001f, 500);
+    // render
+    SoftRaster raster(width, height, nThreads);
+    double seconds = 0;
+    long long nTriangles = 0, nPixels = 0;
+    for (int f = 0; f < nFrames; f++) {
+        raster.Clear(vec3(.5f, .5f, .5f));
+        for (size_t i = 0; i < meshes.size(); i++) {
+            SceneMesh &m = meshes[i];
+            int nTris = m.triangles.size(), nBody = nBodyTriangles < nTris? nBodyTriangles : nTris;
+            mat4 mv = modelview*m.xform;
+            raster.Draw(m.points, m.normals, m.uvs, m.triangles, 0, nBody, mv, persp, materials[0], shading);
+            raster.Draw(m.points, m.normals, m.uvs, m.triangles, nBody, nTris-nBody, mv, persp, materials[1], shading);
+        }
+        raster.Finish();
+        RasterStats s = raster.Stats();
+        seconds += s.seconds;
+        nTriangles += s.nTriangles;
+        nPixels += s.nPixels;
+    }
+    printf("%i meshes, %ix%i, %i frames: %.2f ms/frame, %.2f Mtris/s, %.2f Mpix/s\n",
+           (int) meshes.size(), width, height, nFrames, nFrames? 1000*seconds/nFrames : 0.,
+           seconds > 0? 1e-6*nTriangles/seconds : 0., seconds > 0? 1e-6*nPixels/seconds : 0.);
+    if (!raster.Write(outName)) {
+        printf("can't write %s\n", outName);
+        return 1;
+    }
+    printf("wrote %s\n", outName);
+    return 0;
+}
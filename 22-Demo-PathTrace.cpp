@@ -0,0 +1,131 @@
+// PathTrace.cpp: path trace a scene progressively, for comparison with the realtime BRDF shader
+// lights and materials as in 15-Solution; see Lib/PathTrace.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Mesh.h"
+#include "PathTrace.h"
+#include "SceneFile.h"
+
+// Scene
+
+struct SceneMesh {
+    vector<vec3> points, normals;
+    vector<vec2> uvs;
+    vector<int3> triangles;
+    mat4 xform;
+};
+
+const char  *objectFilename = "lespaul.obj";
+const int    nBodyTriangles = 2050;     // part 0: guitar body (as in 15-Solution)
+const char  *textureNames[2][5] = {     // albedo, normal, ao, metallic, roughness
+    {"lespaul_Albedo.tga", "lespaulnormal.tga", "lespaul_19_AO.tga", "lespaul_19_Metallic.tga", "lespaul_19_Roughness.tga"},
+    {"lespaul_20_Base_Color.tga", "lespaul_20_Default_Normal.tga", "lespaul_20_AO.tga", "lespaul_20_Metallic.tga", "lespaul_20_Roughness.tga"}
+};
+vec3         light2(.2f, .4f, .3f);
+
+bool ReadScene(const char *filename, mat4 &modelview, vector<SceneMesh> &meshes) {
+    // as 15-Solution ReadScene (text or binary): every mesh entry loads the guitar, so read it once
+    SceneFile scene;
+    if (!ReadSceneFile(filename, scene))
+        return false;
+    modelview = scene.modelview;
+    meshes.resize(0);
+    if (scene.entries.empty())
+        return true;
+    SceneMesh guitar;
+    if (!ReadAsciiObj(objectFilename, guitar.points, guitar.triangles, &guitar.normals, &guitar.uvs)) {
+        printf("can't read %s\n", objectFilename);
+        return false;
+    }
+    Normalize(guitar.points, .8f);
+    meshes.assign(scene.entries.size(), guitar);
+    for (size_t i = 0; i < meshes.size(); i++)
+        meshes[i].xform = scene.entries[i].xform;
+    return true;
+}
+
+// Application
+
+int main(int ac, char **av) {
+    const char *sceneName = "Test.scene", *outName = "PathTrace.tga";
+    int width = 1650, height = 800, nThreads = 0, nPasses = 64, writeEvery = 16, maxBounces = 4;
+    RasterShading shading;
+    shading.disney = shading.cookTorrance = true;
+    shading.spotColor = vec3(1, 1, 1);
+    shading.spotIntensity = 1;
+    for (int i = 1; i < ac; i++) {
+        const char *a = av[i], *next = i+1 < ac? av[i+1] : "";
+        if (!strcmp(a, "-scene") && i+1 < ac) { sceneName = next; i++; }
+        else if (!strcmp(a, "-out") && i+1 < ac) { outName = next; i++; }
+        else if (!strcmp(a, "-passes") && i+1 < ac) { nPasses = atoi(next); i++; }
+        else if (!strcmp(a, "-every") && i+1 < ac) { writeEvery = atoi(next); i++; }
+        else if (!strcmp(a, "-bounces") && i+1 < ac) { maxBounces = atoi(next); i++; }
+        else if (!strcmp(a, "-threads") && i+1 < ac) { nThreads = atoi(next); i++; }
+        else if (!strcmp(a, "-size") && i+1 < ac) { sscanf(next, "%ix%i", &width, &height); i++; }
+        else if (!strcmp(a, "-diffuse") && i+1 < ac) {
+            shading.lambert = !strcmp(next, "lambert");
+            shading.disney = !strcmp(next, "disney");
+            i++;
+        }
+        else if (!strcmp(a, "-specular") && i+1 < ac) {
+            shading.blinnPhong = !strcmp(next, "blinn");
+            shading.cookTorrance = !strcmp(next, "cook");
+            i++;
+        }
+        else if (!strcmp(a, "-spot")) shading.spotLight = true;
+        else if (!strcmp(a, "-intensity") && i+1 < ac) { shading.spotIntensity = (float) atof(next); i++; }
+        else if (!strcmp(a, "-ao")) shading.aoMap = true;
+        else if (!strcmp(a, "-normalmap")) shading.normalMap = true;
+        else {
+            printf("usage: %s [-scene file] [-out file.tga] [-passes n] [-every n] [-bounces n] [-threads n] [-size WxH]\n", av[0]);
+            printf("  [-diffuse lambert|disney|none] [-specular blinn|cook|none] [-spot] [-intensity f] [-ao] [-normalmap]\n");
+            return 1;
+        }
+    }
+    mat4 modelview;
+    vector<SceneMesh> meshes;
+    if (!ReadScene(sceneName, modelview, meshes)) {
+        printf("can't read %s\n", sceneName);
+        return 1;
+    }
+    RasterTexture textures[2][5];
+    RasterMaterial materials[2];
+    for (int p = 0; p < 2; p++) {
+        RasterTexture **maps[] = {&materials[p].albedo, &materials[p].normal, &materials[p].ao,
+                                  &materials[p].metallic, &materials[p].roughness};
+        for (int k = 0; k < 5; k++)
+            if (textures[p][k].Read(textureNames[p][k]))  // ReadTarga reports failure
+                *maps[k] = &textures[p][k];
+    }
+    vec4 xlight2 = modelview*vec4(light2, 1);
+    shading.light2 = vec3(xlight2.x, xlight2.y, xlight2.z);
+    // scene
+    PathTracer tracer(width, height, nThreads);
+    tracer.SetCamera(30);
+    tracer.SetShading(shading);
+    tracer.SetMaxBounces(maxBounces);
+    for (size_t i = 0; i < meshes.size(); i++) {
+        SceneMesh &m = meshes[i];
+        int nTris = m.triangles.size(), nBody = nBodyTriangles < nTris? nBodyTriangles : nTris;
+        mat4 mv = modelview*m.xform;
+        tracer.AddMesh(m.points, m.normals, m.uvs, m.triangles, 0, nBody, mv, materials[0]);
+        tracer.AddMesh(m.points, m.normals, m.uvs, m.triangles, nBody, nTris-nBody, mv, materials[1]);
+    }
+    tracer.Build();
+    // progressive passes, writing intermediate images
+    for (int pass = 1; pass <= nPasses; pass++) {
+        tracer.Pass();
+        if (pass == nPasses || (writeEvery > 0 && pass%writeEvery == 0)) {
+            TraceStats s = tracer.Stats();
+            printf("pass %i: %.1f s, %.2f Mrays/s\n", s.nPasses, s.seconds, s.MRaysPerSecond());
+            if (!tracer.Write(outName)) {
+                printf("can't write %s\n", outName);
+                return 1;
+            }
+        }
+    }
+    printf("wrote %s\n", outName);
+    return 0;
+}
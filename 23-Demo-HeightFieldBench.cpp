@@ -0,0 +1,156 @@
+// HeightFieldBench.cpp: time height-field processing (GetNormals, Blur) on 4K and 8K maps
+// the single-threaded references are the original per-pixel GetNormals and box blur, used to check the fast paths
+
+#include <glad.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "Blur.h"
+#include "Misc.h"
+
+using std::vector;
+
+// Height Fields
+
+vector<unsigned char> MakeHeightField(int width, int height) {
+    // rolling terrain with ridges and noise, gray BGR as ReadTarga returns
+    vector<unsigned char> pixels(3*width*height);
+    unsigned int seed = 1;
+    for (int j = 0; j < height; j++)
+        for (int i = 0; i < width; i++) {
+            float x = (float) i/width, y = (float) j/height;
+            float h = .5f+.25f*sinf(12*x)*cosf(9*y)+.15f*sinf(70*(x+y))+.05f*cosf(300*x*y);
+            seed = seed*1664525u+1013904223u;
+            h += ((seed >> 16) & 255)/255.f*.02f;
+            unsigned char v = (unsigned char) (255*(h < 0? 0 : h > 1? 1 : h));
+            unsigned char *p = &pixels[3*(j*width+i)];
+            p[0] = p[1] = p[2] = v;
+        }
+    return pixels;
+}
+
+// Reference
+
+vec3 ReferenceNormal(unsigned char *depth, int width, int height, int i, int j, float pixelScale) {
+    // the original GetNormals
+    int i1 = i > 0? i-1 : i, i2 = i < width-1? i+1 : i;
+    int j1 = j > 0? j-1 : j, j2 = j < height-1? j+1 : j;
+    float dzx = depth[3*(j*width+i2)]/255.f-depth[3*(j*width+i1)]/255.f;
+    float dzy = depth[3*(j2*width+i)]/255.f-depth[3*(j1*width+i)]/255.f;
+    vec3 vx((float)(i2-i1)/pixelScale, 0, dzx), vy(0, (float)(j2-j1)/pixelScale, dzy);
+    vec3 v = normalize(cross(vx, vy));
+    return v.z < 0? -v : v;
+}
+
+void ReferenceNormals(unsigned char *depth, int width, int height, unsigned char *bump, float pixelScale) {
+    for (int j = 0; j < height; j++)
+        for (int i = 0; i < width; i++) {
+            vec3 v = ReferenceNormal(depth, width, height, i, j, pixelScale);
+            *bump++ = (unsigned char) (127.5f*(v[0]+1));
+            *bump++ = (unsigned char) (127.5f*(v[1]+1));
+            *bump++ = (unsigned char) (255.f*v[2]);
+        }
+}
+
+void ReferenceBlur(unsigned char *depth, int width, int height, unsigned char *blurred, int blur) {
+    // the original Scene::UpdateBlur, on one channel
+    for (int y = 0; y < height; y++) {
+        int j0 = y > blur? y-blur : 0, j1 = y < height-blur? y+blur : height-1;
+        for (int x = 0; x < width; x++) {
+            int i0 = x > blur? x-blur : 0, i1 = x < width-blur? x+blur : width-1;
+            unsigned int val = 0, num = 0;
+            for (int j = j0; j <= j1; j++)
+                for (int i = i0; i <= i1; i++, num++)
+                    val += depth[3*(j*width+i)];
+            blurred[y*width+x] = (unsigned char) (val/num);
+        }
+    }
+}
+
+// Timing
+
+typedef std::chrono::steady_clock Clock;
+
+double Milliseconds(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now()-t0).count();
+}
+
+int main(int ac, char **av) {
+    int sizes[] = {4096, 8192}, nRuns = 3, nThreads = 0;
+    float pixelScale = 25;
+    const char *names[] = {"central", "Sobel", "Scharr"};
+    for (int i = 1; i < ac; i++) {
+        if (!strcmp(av[i], "-runs") && i+1 < ac) nRuns = atoi(av[++i]);
+        else if (!strcmp(av[i], "-threads") && i+1 < ac) nThreads = atoi(av[++i]);
+        else if (!strcmp(av[i], "-scale") && i+1 < ac) pixelScale = (float) atof(av[++i]);
+        else {
+            printf("usage: %s [-runs n] [-threads n] [-scale pixelScale]\n", av[0]);
+            return 1;
+        }
+    }
+    bool ok = true;
+    for (int s = 0; s < 2; s++) {
+        int w = sizes[s], h = sizes[s];
+        double mpix = 1e-6*w*h;
+        vector<unsigned char> depth = MakeHeightField(w, h), reference(3*w*h), bump(3*w*h);
+        printf("%ix%i height field\n", w, h);
+        Clock::time_point t0 = Clock::now();
+        ReferenceNormals(&depth[0], w, h, &reference[0], pixelScale);
+        double ms = Milliseconds(t0);
+        printf("  GetNormals reference, 1 thread:  %8.1f ms  %7.1f Mpix/s\n", ms, mpix*1000/ms);
+        for (int f = 0; f < 3; f++)
+            for (int t = 0; t < 2; t++) {
+                int n = t == 0? 1 : nThreads;
+                double best = 1e30;
+                for (int r = 0; r < nRuns; r++) {
+                    t0 = Clock::now();
+                    GetNormals(&depth[0], w, h, &bump[0], pixelScale, (NormalFilter) f, 3, n);
+                    ms = Milliseconds(t0);
+                    best = ms < best? ms : best;
+                }
+                printf("  GetNormals %-8s %s:  %8.1f ms  %7.1f Mpix/s\n", names[f], t == 0? "1 thread " : "threaded", best, mpix*1000/best);
+                if (f == NormalCentral) {
+                    int nDiffer = 0;
+                    for (size_t k = 0; k < bump.size(); k++)
+                        nDiffer += abs(bump[k]-reference[k]) > 1;
+                    if (nDiffer) {
+                        printf("  %i bytes differ from the reference\n", nDiffer);
+                        ok = false;
+                    }
+                }
+            }
+        // blur one channel of the height field; the reference only at the smallest radius and size
+        int radii[] = {3, 32, 256};
+        vector<unsigned char> gray(w*h), blurred(w*h), check(w*h);
+        for (int i = 0; i < w*h; i++)
+            gray[i] = depth[3*i];
+        if (s == 0) {
+            t0 = Clock::now();
+            ReferenceBlur(&depth[0], w, h, &check[0], radii[0]);
+            ms = Milliseconds(t0);
+            printf("  Blur box r%-3i reference, 1 thread: %8.1f ms  %7.1f Mpix/s\n", radii[0], ms, mpix*1000/ms);
+        }
+        for (int f = 0; f < 2; f++)
+            for (int r = 0; r < 3; r++)
+                for (int t = 0; t < 2; t++) {
+                    int n = t == 0? 1 : nThreads;
+                    double best = 1e30;
+                    for (int k = 0; k < nRuns; k++) {
+                        t0 = Clock::now();
+                        BlurPlane(&gray[0], &blurred[0], w, h, radii[r], (BlurFilter) f, n);
+                        ms = Milliseconds(t0);
+                        best = ms < best? ms : best;
+                    }
+                    printf("  Blur %-8s r%-3i %s:  %8.1f ms  %7.1f Mpix/s\n", f == BlurBox? "box" : "Gaussian", radii[r],
+                           t == 0? "1 thread " : "threaded", best, mpix*1000/best);
+                    if (s == 0 && f == BlurBox && r == 0 && memcmp(&blurred[0], &check[0], w*h)) {
+                        printf("  box blur differs from the reference\n");
+                        ok = false;
+                    }
+                }
+    }
+    return ok? 0 : 1;
+}
@@ -0,0 +1,185 @@
+// VecMatBench.cpp: time mat4 products, point transforms and view-frustum culling of 100k bounding spheres
+// the references are the original scalar mat4 operators, used to check the SIMD paths
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "VecMat.h"
+
+using std::vector;
+
+// Reference
+
+mat4 ReferenceMultiply(const mat4 &a, const mat4 &b) {
+    // the original mat4::operator*
+    mat4 m(0);
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            for (int k = 0; k < 4; k++)
+                m[i][j] += a[i][k]*b[k][j];
+    return m;
+}
+
+vec4 ReferenceTransform(const mat4 &m, const vec4 &v) {
+    return vec4(dot(m[0], v), dot(m[1], v), dot(m[2], v), dot(m[3], v));
+}
+
+// Scene
+
+float Random(unsigned int &seed) {
+    seed = seed*1664525u+1013904223u;
+    return (seed >> 8)/16777216.f;
+}
+
+struct Frustum {
+    // symmetric perspective, in eye space (looking down -z)
+    float tx, ty, kx, ky, zNear, zFar;
+    Frustum(float fov, float aspect, float zNear, float zFar) : zNear(zNear), zFar(zFar) {
+        ty = tanf(fov*3.1415926f/360);
+        tx = aspect*ty;
+        kx = 1/sqrtf(1+tx*tx);
+        ky = 1/sqrtf(1+ty*ty);
+    }
+    bool Visible(const vec3 &c, float r) const {
+        // sphere not wholly outside any plane; & rather than &&, so the loop has no branches
+        return ((c.x+c.z*tx)*kx <= r) & ((-c.x+c.z*tx)*kx <= r) &
+               ((c.y+c.z*ty)*ky <= r) & ((-c.y+c.z*ty)*ky <= r) &
+               (c.z <= r-zNear) & (c.z >= -zFar-r);
+    }
+};
+
+int ReferenceCull(const mat4 &modelview, const Frustum &f, vector<vec3> &centers, vector<float> &radii, vector<char> &visible) {
+    int n = centers.size(), nVisible = 0;
+    for (int i = 0; i < n; i++) {
+        vec4 e = ReferenceTransform(modelview, vec4(centers[i], 1));
+        nVisible += visible[i] = f.Visible(vec3(e.x, e.y, e.z), radii[i]);
+    }
+    return nVisible;
+}
+
+int Cull(const mat4 &modelview, const Frustum &f, vector<vec3> &centers, vector<float> &radii, vector<char> &visible, vector<vec3> &eye) {
+    // batched: centers to eye space in one pass, then the plane tests
+    int n = centers.size(), nVisible = 0;
+    TransformPoints(modelview, &centers[0], &eye[0], n);
+    for (int i = 0; i < n; i++)
+        nVisible += visible[i] = f.Visible(eye[i], radii[i]);
+    return nVisible;
+}
+
+// Timing
+
+typedef std::chrono::steady_clock Clock;
+
+double Milliseconds(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now()-t0).count();
+}
+
+template <typename F> double Best(int nRuns, F f) {
+    double best = 1e30;
+    for (int r = 0; r < nRuns; r++) {
+        Clock::time_point t0 = Clock::now();
+        f();
+        double ms = Milliseconds(t0);
+        best = ms < best? ms : best;
+    }
+    return best;
+}
+
+void Report(const char *name, double reference, double fast, int n) {
+    printf("  %-28s reference %8.2f ms  SIMD %8.2f ms  (%.1fx, %.0f M/s)\n", name, reference, fast, reference/fast, 1e-3*n/fast);
+}
+
+int main(int ac, char **av) {
+    int nSpheres = 100000, nFrames = 10, nRuns = 5;
+    for (int i = 1; i < ac; i++) {
+        if (!strcmp(av[i], "-spheres") && i+1 < ac) nSpheres = atoi(av[++i]);
+        else if (!strcmp(av[i], "-frames") && i+1 < ac) nFrames = atoi(av[++i]);
+        else if (!strcmp(av[i], "-runs") && i+1 < ac) nRuns = atoi(av[++i]);
+        else {
+            printf("usage: %s [-spheres n] [-frames n] [-runs n]\n", av[0]);
+            return 1;
+        }
+    }
+#if defined(VECMAT_SSE)
+    printf("VecMat: SSE\n");
+#elif defined(VECMAT_NEON)
+    printf("VecMat: NEON\n");
+#else
+    printf("VecMat: scalar\n");
+#endif
+    bool ok = true;
+    unsigned int seed = 1;
+    // per-object transforms, as camera.modelview*xform per mesh
+    vector<mat4> xforms(nSpheres), products(nSpheres), check(nSpheres);
+    for (int i = 0; i < nSpheres; i++)
+        xforms[i] = Translate(20*Random(seed)-10, 20*Random(seed)-10, 20*Random(seed)-10)*RotateY(360*Random(seed))*Scale(.5f+Random(seed));
+    mat4 modelview = Translate(0, 0, -12)*RotateX(20)*RotateY(30);
+    double ref = Best(nRuns, [&]() {
+        for (int i = 0; i < nSpheres; i++)
+            check[i] = ReferenceMultiply(modelview, xforms[i]);
+    });
+    double fast = Best(nRuns, [&]() {
+        for (int i = 0; i < nSpheres; i++)
+            products[i] = modelview*xforms[i];
+    });
+    Report("mat4*mat4", ref, fast, nSpheres);
+    float worst = 0;
+    for (int i = 0; i < nSpheres; i++)
+        for (int j = 0; j < 4; j++)
+            for (int k = 0; k < 4; k++)
+                worst = fmaxf(worst, fabsf(products[i][j][k]-check[i][j][k]));
+    double inverse = Best(nRuns, [&]() {
+        for (int i = 0; i < nSpheres; i++)
+            check[i] = AffineInverse(xforms[i]);
+    });
+    for (int i = 0; i < nSpheres; i += 97) {
+        mat4 id = xforms[i]*check[i];
+        for (int j = 0; j < 4; j++)
+            for (int k = 0; k < 4; k++)
+                worst = fmaxf(worst, fabsf(id[j][k]-(j == k)));
+    }
+    printf("  %-28s %8.2f ms  (%.0f M/s)\n", "AffineInverse", inverse, 1e-3*nSpheres/inverse);
+    // points
+    vector<vec3> centers(nSpheres), eye(nSpheres);
+    vector<vec4> clip(nSpheres), clipCheck(nSpheres);
+    vector<float> radii(nSpheres);
+    for (int i = 0; i < nSpheres; i++) {
+        centers[i] = vec3(40*Random(seed)-20, 40*Random(seed)-20, 40*Random(seed)-20);
+        radii[i] = .05f+.5f*Random(seed);
+    }
+    mat4 fullview = Perspective(30, 1.5f, .1f, 50)*modelview;
+    ref = Best(nRuns, [&]() {
+        for (int i = 0; i < nSpheres; i++)
+            clipCheck[i] = ReferenceTransform(fullview, vec4(centers[i], 1));
+    });
+    fast = Best(nRuns, [&]() { TransformPoints(fullview, &centers[0], &clip[0], nSpheres); });
+    Report("TransformPoints (clip)", ref, fast, nSpheres);
+    for (int i = 0; i < nSpheres; i++)
+        for (int k = 0; k < 4; k++)
+            worst = fmaxf(worst, fabsf(clip[i][k]-clipCheck[i][k])/(1+fabsf(clipCheck[i][k])));
+    // culling, camera orbiting
+    Frustum frustum(30, 1.5f, .1f, 50);
+    vector<char> visible(nSpheres), visibleCheck(nSpheres);
+    int nVisible = 0, nCheck = 0, nDiffer = 0;
+    ref = Best(nRuns, [&]() {
+        for (int f = 0; f < nFrames; f++)
+            nCheck = ReferenceCull(Translate(0, 0, -12)*RotateY(36.f*f), frustum, centers, radii, visibleCheck);
+    });
+    fast = Best(nRuns, [&]() {
+        for (int f = 0; f < nFrames; f++)
+            nVisible = Cull(Translate(0, 0, -12)*RotateY(36.f*f), frustum, centers, radii, visible, eye);
+    });
+    Report("cull spheres", ref/nFrames, fast/nFrames, nSpheres);
+    for (int i = 0; i < nSpheres; i++)
+        nDiffer += visible[i] != visibleCheck[i];
+    printf("  %i of %i spheres visible (reference %i, %i borderline differ)\n", nVisible, nSpheres, nCheck, nDiffer);
+    printf("  largest difference from the reference %g\n", worst);
+    if (worst > 1e-4f || nDiffer > nSpheres/10000) {
+        printf("  SIMD results differ from the reference\n");
+        ok = false;
+    }
+    return ok? 0 : 1;
+}
@@ -0,0 +1,181 @@
+// BatchBench.cpp: time bounds, normalization and transforms of multi-million-point arrays (vec3, VertexSTL, separate x/y/z)
+// the references are the original per-component MinMax and Normalize loops, used to check the batch kernels
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "Batch.h"
+#include "Mesh.h"
+
+using std::vector;
+
+// Reference
+
+void ReferenceMinMax(vector<vec3> &points, vec3 &min, vec3 &max) {
+    // the original MinMax
+    min[0] = min[1] = min[2] = FLT_MAX;
+    max[0] = max[1] = max[2] = -FLT_MAX;
+    for (int i = 0; i < (int) points.size(); i++) {
+        vec3 &v = points[i];
+        for (int k = 0; k < 3; k++) {
+            if (v[k] < min[k]) min[k] = v[k];
+            if (v[k] > max[k]) max[k] = v[k];
+        }
+    }
+}
+
+void ReferenceNormalize(vector<vec3> &points, float scale) {
+    // the original Normalize
+    vec3 min, max;
+    ReferenceMinMax(points, min, max);
+    vec3 center(.5f*(min[0]+max[0]), .5f*(min[1]+max[1]), .5f*(min[2]+max[2]));
+    float maxrange = 0;
+    for (int k = 0; k < 3; k++)
+        if ((max[k]-min[k]) > maxrange)
+            maxrange = max[k]-min[k];
+    float s = scale*2.f/maxrange;
+    for (int i = 0; i < (int) points.size(); i++) {
+        vec3 &v = points[i];
+        for (int k = 0; k < 3; k++)
+            v[k] = s*(v[k]-center[k]);
+    }
+}
+
+// Timing
+
+typedef std::chrono::steady_clock Clock;
+
+double Milliseconds(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now()-t0).count();
+}
+
+template <typename F> double Best(int nRuns, F f) {
+    double best = 1e30;
+    for (int r = 0; r < nRuns; r++) {
+        Clock::time_point t0 = Clock::now();
+        f();
+        double ms = Milliseconds(t0);
+        best = ms < best? ms : best;
+    }
+    return best;
+}
+
+void Report(const char *name, double ms, double bytes) {
+    printf("  %-36s %8.2f ms  %6.1f GB/s\n", name, ms, 1e-6*bytes/ms);
+}
+
+int main(int ac, char **av) {
+    int nPoints = 4000000, nRuns = 5, nThreads = 0;
+    for (int i = 1; i < ac; i++) {
+        if (!strcmp(av[i], "-points") && i+1 < ac) nPoints = atoi(av[++i]);
+        else if (!strcmp(av[i], "-runs") && i+1 < ac) nRuns = atoi(av[++i]);
+        else if (!strcmp(av[i], "-threads") && i+1 < ac) nThreads = atoi(av[++i]);
+        else {
+            printf("usage: %s [-points n] [-runs n] [-threads n]\n", av[0]);
+            return 1;
+        }
+    }
+    bool ok = true;
+    unsigned int seed = 1;
+    vector<vec3> points(nPoints), work(nPoints), check(nPoints);
+    for (int i = 0; i < nPoints; i++) {
+        float f[3];
+        for (int k = 0; k < 3; k++) {
+            seed = seed*1664525u+1013904223u;
+            f[k] = 100*((seed >> 8)/16777216.f)-30;
+        }
+        points[i] = vec3(f[0], f[1], f[2]);
+    }
+    double bytes = (double) nPoints*sizeof(vec3);
+    printf("%i points\n", nPoints);
+    // bounds
+    vec3 min, max, refMin, refMax;
+    Report("MinMax vec3 reference", Best(nRuns, [&]() { ReferenceMinMax(points, refMin, refMax); }), bytes);
+    for (int t = 0; t < 2; t++) {
+        double ms = Best(nRuns, [&]() { BatchMinMax(Vec3Span(points), min, max, t == 0? 1 : nThreads); });
+        Report(t == 0? "BatchMinMax vec3, 1 thread" : "BatchMinMax vec3, threaded", ms, bytes);
+        if (memcmp(&min, &refMin, sizeof(vec3)) || memcmp(&max, &refMax, sizeof(vec3))) {
+            printf("  bounds differ from the reference\n");
+            ok = false;
+        }
+    }
+    // normalize, timed on fresh copies
+    double refMs = 1e30, ms = 1e30;
+    for (int r = 0; r < nRuns; r++) {
+        check = points;
+        Clock::time_point t0 = Clock::now();
+        ReferenceNormalize(check, .8f);
+        refMs = fmin(refMs, Milliseconds(t0));
+        work = points;
+        t0 = Clock::now();
+        Normalize(work, .8f);
+        ms = fmin(ms, Milliseconds(t0));
+    }
+    Report("Normalize vec3 reference", refMs, 3*bytes);
+    Report("Normalize vec3 (batch, threaded)", ms, 3*bytes);
+    if (memcmp(&work[0], &check[0], nPoints*sizeof(vec3))) {
+        printf("  Normalize differs from the reference\n");
+        ok = false;
+    }
+    // interleaved with normals, as ReadSTL
+    vector<VertexSTL> stl(nPoints);
+    for (int i = 0; i < nPoints; i++)
+        stl[i].point = points[i];
+    Vec3Span stlSpan(&stl[0].point, nPoints, sizeof(VertexSTL)/sizeof(float));
+    Report("BatchMinMax VertexSTL, threaded", Best(nRuns, [&]() { BatchMinMax(stlSpan, min, max, nThreads); }),
+           (double) nPoints*sizeof(VertexSTL));
+    Normalize(stl, .8f);
+    for (int i = 0; i < nPoints && ok; i++)
+        if (memcmp(&stl[i].point, &check[i], sizeof(vec3))) {
+            printf("  Normalize (VertexSTL) differs from the reference\n");
+            ok = false;
+        }
+    // separate arrays
+    vector<float> xs(nPoints), ys(nPoints), zs(nPoints);
+    for (int i = 0; i < nPoints; i++) {
+        xs[i] = points[i].x;
+        ys[i] = points[i].y;
+        zs[i] = points[i].z;
+    }
+    Vec3Span soa(&xs[0], &ys[0], &zs[0], nPoints);
+    for (int t = 0; t < 2; t++) {
+        ms = Best(nRuns, [&]() { BatchMinMax(soa, min, max, t == 0? 1 : nThreads); });
+        Report(t == 0? "BatchMinMax x/y/z, 1 thread" : "BatchMinMax x/y/z, threaded", ms, bytes);
+    }
+    if (memcmp(&min, &refMin, sizeof(vec3)) || memcmp(&max, &refMax, sizeof(vec3))) {
+        printf("  bounds (x/y/z) differ from the reference\n");
+        ok = false;
+    }
+    // transforms
+    mat4 m = Translate(1, 2, 3)*RotateY(30)*RotateX(20)*Scale(.5f);
+    Report("transform vec3 reference", Best(nRuns, [&]() {
+        for (int i = 0; i < nPoints; i++) {
+            vec4 p = m*vec4(points[i], 1);
+            check[i] = vec3(p.x, p.y, p.z);
+        }
+    }), 2*bytes);
+    Report("BatchTransform vec3, threaded", Best(nRuns, [&]() { BatchTransform(Vec3Span(points), Vec3Span(work), m, nThreads); }), 2*bytes);
+    float worst = 0;
+    for (int i = 0; i < nPoints; i++)
+        for (int k = 0; k < 3; k++)
+            worst = fmaxf(worst, fabsf(work[i][k]-check[i][k])/(1+fabsf(check[i][k])));
+    Report("BatchTransform x/y/z in place, threaded", Best(nRuns, [&]() { BatchTransform(soa, soa, m, nThreads); }), 2*bytes);
+    for (int i = 0; i < nPoints; i += 101) {
+        vec3 p(points[i]);
+        for (int r = 0; r < nRuns; r++) {
+            vec4 q = m*vec4(p, 1);
+            p = vec3(q.x, q.y, q.z);
+        }
+        worst = fmaxf(worst, fabsf(xs[i]-p.x)/(1+fabsf(p.x)));
+    }
+    printf("  largest transform difference from the reference %g\n", worst);
+    if (worst > 1e-5f) {
+        printf("  transforms differ from the reference\n");
+        ok = false;
+    }
+    return ok? 0 : 1;
+}
@@ -0,0 +1,49 @@
+// TargaOrigin.cpp: mark Targa files as stored top row first (descriptor bit 5), in place
+// for maps saved top-down without the bit, such as lespaul_Albedo.tga: ReadTarga then returns them upright
+// pixels are untouched, so raw and run-length encoded files alike are converted losslessly
+
+#include <stdio.h>
+#include <string.h>
+
+bool MarkTopLeft(const char *filename, bool clear) {
+    FILE *f = fopen(filename, "r+b");
+    if (!f) {
+        printf("%s: can't open\n", filename);
+        return false;
+    }
+    unsigned char h[18];
+    bool ok = fread(h, 1, 18, f) == 18;
+    int type = h[2] & ~8;
+    if (!ok || type < 1 || type > 3) {
+        printf("%s: not a Targa file\n", filename);
+        fclose(f);
+        return false;
+    }
+    unsigned char descriptor = clear? h[17] & ~0x20 : h[17] | 0x20;
+    if (descriptor == h[17])
+        printf("%s: already %s\n", filename, clear? "bottom row first" : "top row first");
+    else {
+        fseek(f, 17, SEEK_SET);
+        ok = fwrite(&descriptor, 1, 1, f) == 1;
+        printf("%s: %s\n", filename, !ok? "can't write" : clear? "now bottom row first" : "now top row first");
+    }
+    fclose(f);
+    return ok;
+}
+
+int main(int ac, char **av) {
+    bool clear = false, ok = ac > 1;
+    int nFiles = 0;
+    for (int i = 1; i < ac; i++)
+        if (!strcmp(av[i], "-clear"))
+            clear = true;
+        else {
+            ok = MarkTopLeft(av[i], clear) && ok;
+            nFiles++;
+        }
+    if (!nFiles) {
+        printf("usage: %s [-clear] file.tga ...\n", av[0]);
+        return 1;
+    }
+    return ok? 0 : 1;
+}
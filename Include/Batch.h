@@ -0,0 +1,32 @@
+// Batch.h - kernels over many 3D points, interleaved or in separate arrays: bounds, scale-translate, transform
+
+#ifndef BATCH_HDR
+#define BATCH_HDR
+
+#include <vector>
+#include "VecMat.h"
+
+struct Vec3Span {
+	float *x, *y, *z;				// coordinates of the first point
+	int n;							// # points
+	int stride;						// floats from one point to the next: 1 if separate arrays, 3 for vec3, 6 for VertexSTL
+	Vec3Span(vec3 *p, int n, int stride = 3) : x(&p->x), y(&p->y), z(&p->z), n(n), stride(stride) { }
+		// interleaved (AoS), eg Vec3Span(&vertices[0].point, n, sizeof(VertexSTL)/sizeof(float))
+	Vec3Span(std::vector<vec3> &p) : x(&p.data()->x), y(&p.data()->y), z(&p.data()->z), n((int) p.size()), stride(3) { }
+	Vec3Span(float *x, float *y, float *z, int n) : x(x), y(y), z(z), n(n), stride(1) { }
+		// separate arrays (SoA)
+};
+
+// SSE on x86/x64 (interleaved or separate); scalar elsewhere, written for the compiler to vectorize
+// spans of more than 256K points are split among nThreads (0: hardware concurrency)
+
+void BatchMinMax(Vec3Span points, vec3 &min, vec3 &max, int nThreads = 0);
+	// bounds of the points (NaN coordinates ignored); FLT_MAX, -FLT_MAX if none
+
+void BatchScaleTranslate(Vec3Span points, float scale, vec3 translate, int nThreads = 0);
+	// p = scale*(p+translate), ie translate then scale
+
+void BatchTransform(Vec3Span in, Vec3Span out, const mat4 &m, int nThreads = 0);
+	// out = m*in, m affine (no divide); in and out have the same n, and may be the same span
+
+#endif
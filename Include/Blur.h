@@ -0,0 +1,20 @@
+// Blur.h - image blur: box by running sums (constant cost per pixel at any radius), separable Gaussian
+
+#ifndef BLUR_HDR
+#define BLUR_HDR
+
+enum BlurFilter { BlurBox = 0, BlurGaussian };
+	// box: average over the (2*radius+1)^2 window cut to the image, as a direct sum would give
+	// Gaussian: sigma = radius/3; up to radius 8, separable with edge pixels repeated, beyond that
+	// three box passes of matching variance (constant cost per pixel, windows cut at the edges)
+
+void BlurPlane(unsigned char *src, unsigned char *dst, int width, int height, int radius,
+			   BlurFilter filter = BlurBox, int nThreads = 0);
+	// one channel, src and dst distinct; bands of rows are shared among nThreads (0: hardware concurrency)
+
+void Blur(unsigned char *pixels, int width, int height, int bytesPerPixel, int radius,
+		  BlurFilter filter = BlurBox, bool gray = false, int nThreads = 0);
+	// in place, each channel separately; if gray (r == g == b, as height fields), blur channel 0 only
+	// and copy it to channels 1 and 2 (alpha untouched)
+
+#endif
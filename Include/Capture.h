@@ -0,0 +1,60 @@
+// Capture.h - record frame sequences: asynchronous readback, bounded queue, background writer
+
+#ifndef CAPTURE_HDR
+#define CAPTURE_HDR
+
+#include "Readback.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum CaptureFormat { CaptureTarga = 0, CapturePNG, CaptureFFmpeg };
+
+class FrameCapture {
+public:
+	FrameCapture();
+	~FrameCapture();
+	bool Start(const char *prefix, CaptureFormat format = CaptureTarga, int fps = 60, int maxQueued = 16, int maxMegabytes = 1024);
+		// begin capture; files are prefix0000.tga (or .png), or prefix.mp4 if format is CaptureFFmpeg
+		// CaptureFFmpeg falls back to CaptureTarga if ffmpeg can't be run
+		// maxQueued frames are always buffered; if the writer falls further behind, more frame buffers are
+		// allocated, up to maxMegabytes in all: only then does Frame wait (a stall), so no frame is dropped
+	void Frame();
+		// call once per frame after drawing, before swap: queue read of the viewport
+	void Stop();
+		// deliver pending reads, finish writing, join writer thread
+	bool Active();
+	int Captured();
+	int Stalls();
+		// # frames for which rendering waited on the writer, with maxMegabytes of buffers in use
+	CaptureFormat Format();
+private:
+	struct Image { std::vector<unsigned char> bgr; int width, height, number; };
+	Readback readback;
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable queueChanged;
+	std::deque<Image *> queue, pool;	// frames to write, free frame buffers
+	int maxQueued, nCaptured, nStalls, nAllocated;
+	size_t maxBytes, nBytes;			// cap on and size of all frame buffers
+	bool active, stopping;
+	std::atomic<CaptureFormat> format;	// the writer may fall back to CaptureTarga while Format is read
+	std::string prefix;
+	int fps;
+	FILE *pipe;							// to ffmpeg
+	int pipeWidth, pipeHeight;			// video size, set by first frame
+	static void Receive(unsigned char *bgr, int width, int height, void *capture);
+	void Push(unsigned char *bgr, int width, int height);
+	void Write();						// writer thread
+	bool WriteImage(Image *image);
+};
+
+bool WritePNG(const char *filename, unsigned char *bgr, int width, int height);
+	// write uncompressed (stored deflate) 24-bit PNG; bgr bottom row first, as for Targa
+
+#endif
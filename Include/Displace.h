@@ -0,0 +1,40 @@
+// Displace.h - bake displaced sphere/tube/quad meshes from height fields on the CPU, for contexts without tessellation
+
+#ifndef DISPLACE_HDR
+#define DISPLACE_HDR
+
+#include <vector>
+#include "VecMat.h"
+
+using std::vector;
+
+enum DisplaceShape { DisplaceBall = 0, DisplaceTube, DisplaceQuad };
+	// as the shape uniform of the tessellation shaders (20-Solution-DispBumpTexSTH-Simple)
+
+void ShapePoint(DisplaceShape shape, float u, float v, vec3 &p, vec3 &n);
+	// undisplaced point and unit normal at (u, v), as Ball, Tube and Quad in the shaders
+
+float SampleHeight(unsigned char *heights, int width, int height, int bytesPerPixel, float u, float v);
+	// channel 0 in [0, 1], bilinear, repeated beyond [0, 1] (as texture(heightField, uv).r, GL_REPEAT)
+
+struct BakeOptions {
+	DisplaceShape shape;
+	float displaceScale;		// point = shape point+displaceScale*height*shape normal
+	int patches;				// per side (as uberRes): each edge of a patch gets its own level
+	int maxLevel;				// segments per patch edge at most; all edges if edgeLength is 0
+	float edgeLength;			// target triangle edge length in object space, 0: uniform
+	float detail;				// levels scaled up by 1+detail*displaceScale*(height deviation along the edge)
+	bool fieldNormals;			// normals of the displaced surface (as approxNormals), else of the shape
+	BakeOptions(DisplaceShape shape = DisplaceBall, float displaceScale = 0) : shape(shape), displaceScale(displaceScale),
+		patches(8), maxLevel(64), edgeLength(.02f), detail(16), fieldNormals(false) { }
+};
+
+int BakeDisplacedMesh(unsigned char *heights, int width, int height, int bytesPerPixel, BakeOptions &options,
+					  vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles,
+					  int nThreads = 0);
+	// fill an indexed mesh (as Mesh::Buffer expects) of the displaced shape; return # triangles
+	// levels as the adaptive tessellation control shader, but from object-space lengths: each edge's level depends
+	// only on its end points, so patches agree and shared edge vertices are welded (no cracks)
+	// patches are shared among nThreads (0: hardware concurrency)
+
+#endif
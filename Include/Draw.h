@@ -48,6 +48,14 @@ void ArrowV(vec3 base, vec3 v, mat4 modelview, mat4 persp, vec3 color, float lin
 void Cylinder(vec3 p1, vec3 p2, float r1, float r2, mat4 modelview, mat4 persp, vec4 color);
 	// p1 and p2 specify x,y,z for cylinder endpoints, and w for radius
 
+// batching
+void BeginDrawBatch();
+	// defer Disk, Line, LineStrip, Quad, Arrow, ArrowV, and Triangle until EndDrawBatch
+	// each primitive keeps the view transformation current when it was called
+void EndDrawBatch();
+	// draw deferred primitives, one draw call per shader and state (calls may nest)
+	// without a batch, each primitive is drawn immediately
+
 // triangle operations
 void UseTriangleShader();
 void UseTriangleShader(mat4 viewMatrix);
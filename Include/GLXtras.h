@@ -24,6 +24,8 @@ GLuint LinkProgramViaCode(const char **vertexCode, const char **tessellationCont
 GLuint LinkProgram(GLuint vshader, GLuint pshader);
 GLuint LinkProgram(GLuint vshader, GLuint tcshader, GLuint teshader, GLuint gshader, GLuint pshader);
 GLuint LinkProgramViaFile(const char *vertexShaderFile, const char *pixelShaderFile);
+GLuint LinkComputeProgramViaCode(const char **computeCode);
+	// GL 4.3+; return 0 if compilation or linking fails
 
 int CurrentProgram();
 
@@ -0,0 +1,27 @@
+// Headless.h - offscreen GL context (EGL or OSMesa) rendering into a framebuffer object
+
+#ifndef HEADLESS_HDR
+#define HEADLESS_HDR
+
+enum HeadlessAPI { HeadlessEGL = 0, HeadlessOSMesa };
+
+bool HeadlessSupported(HeadlessAPI api);
+	// true if support for api was compiled in (see HEADLESS_EGL_OK, HEADLESS_OSMESA_OK in Headless.cpp)
+
+bool HeadlessInit(int width, int height, HeadlessAPI api = HeadlessEGL);
+	// create a context with no window (surfaceless EGL, or OSMesa such as llvmpipe), load GL,
+	// bind a width x height color+depth FBO and set the viewport; return false on failure
+
+bool HeadlessResize(int width, int height);
+	// reallocate FBO attachments, set viewport
+
+bool HeadlessRead(unsigned char *bgr);
+	// copy FBO color to bgr (3*width*height bytes, bottom row first, as for Targa)
+
+bool HeadlessWrite(const char *filename);
+	// write FBO color as a Targa file
+
+void HeadlessShutdown();
+	// release FBO and context
+
+#endif
@@ -65,4 +65,32 @@ int IntersectWithLine(vec3 p1, vec3 p2, vector<TriInfo> &triInfos, float &alpha)
 	// return triangle index of nearest intersected triangle, or -1 if none
 	// intersection = p1+alpha*(p2-p1)
 
+// Bounding Volume Hierarchy
+
+struct BVHHit {
+	int triangle;		// index into the triangles given to Build
+	float t, u, v;		// ray parameter, barycentric coordinates of the second and third vertices
+};
+
+class BVH {
+public:
+	void Build(vector<vec3> &points, vector<int3> &triangles);
+		// binned surface area heuristic build; keeps its own copy of triangle vertices
+	bool Intersect(vec3 origin, vec3 dir, float tMax, BVHHit &hit);
+		// nearest triangle hit with 0 < t < tMax (either side of the triangle)
+	bool Occluded(vec3 origin, vec3 dir, float tMax);
+		// true if any triangle hit with 0 < t < tMax
+	int NNodes();
+private:
+	struct Node {
+		vec3 min, max;
+		int first, count;	// leaf: triangles order[first, first+count); interior (count 0): right child first, left child next
+	};
+	vector<Node> nodes;
+	vector<int> order;
+	vector<vec3> p0, e1, e2;	// per triangle, indexed as order
+	int Split(int node, vector<vec3> &centers, vector<vec3> &mins, vector<vec3> &maxs, int depth);
+	template<bool Any> bool Traverse(vec3 origin, vec3 dir, float tMax, BVHHit *hit);
+};
+
 #endif
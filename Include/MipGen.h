@@ -0,0 +1,42 @@
+// MipGen.h - CPU mip chains: Kaiser or Lanczos filtering, sRGB-correct color, renormalized normals, Toksvig roughness
+
+#ifndef MIP_GEN_HDR
+#define MIP_GEN_HDR
+
+#include <glad.h>
+#include <vector>
+
+enum MipKind { MipColor = 0, MipLinear, MipNormal, MipRoughness };
+	// color: sRGB-encoded, filtered in linear light (alpha linear); linear: AO, metallic, height, filtered as stored
+	// normal: red, green in [-1, 1], blue in [0, 1] (as GetNormals and the shaders), averaged then renormalized
+	// roughness: GGX alpha (as the shader), widened per Toksvig by the shortening of the averaged normal map
+
+enum MipFilter { MipBox = 0, MipKaiser, MipLanczos };
+	// box: 2x2 average; Kaiser: sinc windowed by Kaiser (alpha 4), 3 lobes; Lanczos: 3 lobes
+
+struct MipLevel {
+	int width, height;
+	std::vector<unsigned char> pixels;	// bytesPerPixel as the source
+};
+
+struct MipOptions {
+	MipKind kind;
+	MipFilter filter;
+	bool bgr;							// byte order of color channels (Targa: true, GetNormals: false)
+	unsigned char *normals;				// roughness: the normal map whose variance widens the lobe, else NULL
+	int normalWidth, normalHeight, normalBytesPerPixel;
+	bool normalBgr;
+	MipOptions(MipKind kind = MipLinear, MipFilter filter = MipKaiser, bool bgr = true) : kind(kind), filter(filter), bgr(bgr),
+		normals(NULL), normalWidth(0), normalHeight(0), normalBytesPerPixel(3), normalBgr(true) { }
+};
+
+void GenerateMips(unsigned char *pixels, int width, int height, int bytesPerPixel, MipOptions &options,
+				  std::vector<MipLevel> &levels, int nThreads = 0);
+	// fill levels with the full chain, level 0 (the source, Toksvig-adjusted for roughness) to 1x1
+	// each level is filtered from the previous one at float precision; rows are shared among nThreads (0: hardware concurrency)
+
+void LoadMipmappedTexture(unsigned char *pixels, int width, int height, GLuint textureUnit, GLuint textureName,
+						  bool bgr, int bytesPerPixel, MipOptions &options);
+	// as LoadTexture, but upload a CPU-generated chain instead of calling glGenerateMipmap
+
+#endif
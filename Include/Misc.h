@@ -23,15 +23,23 @@ float RaySphere(vec3 base, vec3 v, vec3 center, float radius);
 unsigned char *ReadTarga(const char *filename, int &width, int &height);
     // allocate width*height pixels, set them from file, return pointer
     // this memory should be freed by the caller
-    // expects 24 bpp
+    // reads raw or run-length encoded 8, 15/16, 24, or 32 bpp true-color, grayscale, or color-mapped files,
+    // converted to 24 bpp; rows are reordered per the header so the bottom row is first
     // *** pixel data is BGR format ***
 
-bool WriteTarga(const char *filename, unsigned char *pixels, int width, int height);
-    // save raster to named Targa file
+unsigned char *ReadTarga(const char *filename, int &width, int &height, int &bytesPerPixel);
+    // as above but keep channels: bytesPerPixel 1 (gray), 3 (BGR), or 4 (BGRA)
+
+bool WriteTarga(const char *filename, unsigned char *pixels, int width, int height, int bytesPerPixel = 3, bool rle = false);
+    // save raster (gray, BGR, or BGRA, bottom row first) to named Targa file, optionally run-length encoded
 
 bool WriteTarga(char *filename);
     // as above but with entire application raster
 
+bool WriteTargaAsync(const char *filename);
+    // as above, but read without stalling: the file is written a frame or two later,
+    // when FrameReadback().Poll() (see Readback.h) finds the read complete
+
 // Texture
 
 // textureUnit is assigned by the programmer: it is the OpenGL texture resource used
@@ -40,16 +48,26 @@ bool WriteTarga(char *filename);
 //      to an active texture and by glDeleteBuffers
 
 GLuint LoadTexture(const char *targaFilename, GLuint textureUnit, bool mipmap = true);
-    // load .tga file as given texture unit; return texture name (ID)
+    // load .tga file as given texture unit; return texture name (ID), 0 if unreadable
+    // files with alpha load as RGBA, grayscale files as a single channel sampled as gray
 
-GLuint LoadTexture(unsigned char *pixels, int width, int height, GLuint textureUnit, bool bgr = false, bool mipmap = true);
-    // load pixels as given texture unit; return texture name (ID)
+GLuint LoadTexture(unsigned char *pixels, int width, int height, GLuint textureUnit, bool bgr = false, bool mipmap = true, int bytesPerPixel = 3);
+    // load pixels (1, 3, or 4 bytes per pixel) as given texture unit; return texture name (ID)
 
-void LoadTexture(unsigned char *pixels, int width, int height, GLuint textureUnit, GLuint textureName, bool bgr, bool mipmap);
+void LoadTexture(unsigned char *pixels, int width, int height, GLuint textureUnit, GLuint textureName, bool bgr, bool mipmap, int bytesPerPixel = 3);
 
 // Bump map
-unsigned char *GetNormals(unsigned char *depthPixels, int &width, int &height, float pixelScale = 25);
+enum NormalFilter { NormalCentral = 0, NormalSobel, NormalScharr };
+    // central: differences of neighbors; Sobel, Scharr: also smoothed across the difference (1 2 1, 3 10 3)
+
+unsigned char *GetNormals(unsigned char *depthPixels, int &width, int &height, float pixelScale = 25, NormalFilter filter = NormalCentral);
     // return normal pixels that correspond with depth pixels
     // this memory should be freed by the caller
 
+void GetNormals(unsigned char *depthPixels, int width, int height, unsigned char *bumpPixels, float pixelScale,
+                NormalFilter filter = NormalCentral, int bytesPerPixel = 3, int nThreads = 0);
+    // write 3*width*height normal bytes (red, grn in [-1,1], blu in [0,1]) into bumpPixels
+    // rows are shared among nThreads (0: hardware concurrency), vectorized with SSE2 where available
+    // depth is read from the first byte of each pixel; borders use one-sided differences
+
 #endif
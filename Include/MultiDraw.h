@@ -0,0 +1,68 @@
+// MultiDraw.h - pack meshes into shared buffers, submit with glMultiDrawElementsIndirect
+
+#ifndef MULTI_DRAW_HDR
+#define MULTI_DRAW_HDR
+
+#include <glad.h>
+#include <vector>
+#include "VecMat.h"
+
+using std::vector;
+
+// layout of DrawElementsIndirectCommand, as read by GL from the indirect buffer
+struct DrawCommand {
+	GLuint count, instanceCount, firstIndex, baseVertex, baseInstance;
+};
+
+// per-draw record in the shader storage buffer (std430: 80 bytes)
+struct DrawData {
+	mat4 modelview;		// view*mesh transform, row-major (as with SetUniform)
+	int material, pad[3];
+};
+
+// the vertex shader reads the per-draw record through an instanced integer attribute:
+//     layout (std430, binding = 0) buffer DrawBlock { DrawData draws[]; };
+//     in int drawId;
+//     ... mat4 modelview = draws[drawId].modelview;
+// where DrawData is declared with a row_major modelview
+
+class MultiDraw {
+public:
+	MultiDraw();
+	void Clear();
+		// remove all meshes and draws (GPU buffers are kept for reuse)
+	void Free();
+		// release GPU buffers (call while the GL context is current)
+	int AddMesh(vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles);
+		// append mesh vertices and triangles to the shared arenas; return mesh id
+	int AddDraw(int meshId, int firstTriangle, int nTriangles, int material = 0);
+		// add draw of a contiguous range of the mesh's triangles; return draw id
+		// the id is the draw's index until Buffer, which sorts draws by material: ids are then stale
+	void SetTransform(int meshId, mat4 m);
+		// object to world transform for all draws of the mesh
+	void Buffer();
+		// upload arenas and indirect commands; draws are sorted by material
+	void Draw(int program, mat4 view, int material = -1);
+		// write per-draw data, submit all draws with given material (or all if material < 0)
+		// program must have drawId, point, normal, uv attributes and a DrawBlock at binding 0
+	int NDraws();
+	int NTriangles();
+	bool Buffered();
+private:
+	struct Range { int baseVertex, firstIndex, nIndices; };
+	struct Record { int meshId, firstIndex, nIndices, material; };
+	vector<vec3> points, normals;					// shared vertex arena (CPU copy)
+	vector<vec2> uvs;
+	vector<int> indices;							// shared index arena, mesh relative
+	vector<Range> meshes;
+	vector<mat4> xforms;							// per mesh
+	vector<Record> records;							// per draw, sorted by material on Buffer
+	vector<DrawData> drawData;						// per-frame staging for drawBuffer
+	GLuint vBuffer, iBuffer, cmdBuffer, drawBuffer, idBuffer;
+	bool buffered;
+};
+
+bool MultiDrawSupported();
+	// true if GL 4.3 (indirect multi-draw and shader storage buffers) available
+
+#endif
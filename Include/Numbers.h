@@ -11,4 +11,10 @@ void Number(vec3 p, mat4 m, unsigned int n, vec3 color = vec3(0, 0, 0), float pt
 void Number(int x, int y, unsigned int n, vec3 color = vec3(0, 0, 0), float ptSize = 10);
 	// x and y in pixels
 
+void BeginNumberBatch();
+	// defer Number calls until EndNumberBatch (screen mode is that of the viewport at EndNumberBatch)
+void EndNumberBatch();
+	// draw all deferred numbers with one call (calls may nest)
+	// without a batch, each number is drawn with one call
+
 #endif
@@ -0,0 +1,47 @@
+// Parallel.h - share work among threads, the caller among them
+
+#ifndef PARALLEL_HDR
+#define PARALLEL_HDR
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+inline int ThreadCount(int nThreads = 0) {
+	// nThreads, or hardware concurrency if 0; at least 1
+	if (nThreads <= 0)
+		nThreads = (int) std::thread::hardware_concurrency();
+	return nThreads < 1? 1 : nThreads;
+}
+
+template <class F> void ParallelFor(int begin, int end, int chunk, int nThreads, F f) {
+	// f(b, e) for each chunk [b, e) of [begin, end), chunk long but for the last
+	// chunks are taken in turn by nThreads (0: hardware concurrency), never more threads than chunks
+	// return once all have finished
+	if (chunk < 1)
+		chunk = 1;
+	int nChunks = end > begin? (end-begin+chunk-1)/chunk : 0;
+	nThreads = ThreadCount(nThreads);
+	nThreads = nThreads < nChunks? nThreads : nChunks;
+	std::atomic<int> next(0);
+	auto work = [&]() {
+		for (int c; (c = next++) < nChunks; ) {
+			int b = begin+c*chunk;
+			f(b, end-b > chunk? b+chunk : end);
+		}
+	};
+	std::vector<std::thread> threads;
+	for (int t = 1; t < nThreads; t++)
+		threads.push_back(std::thread(work));
+	work();
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+}
+
+typedef void (*ParallelJob)(int i, void *data);
+
+void ParallelJobs(int nJobs, ParallelJob job, void *data, int nThreads = 0);
+	// call job(i, data) for i in [0, nJobs) on nThreads (0: hardware concurrency), the caller among them
+	// return once all have finished; jobs must not touch GL
+
+#endif
@@ -0,0 +1,77 @@
+// PathTrace.h - multithreaded progressive path tracer, ground truth for the BRDF pixel shader
+
+#ifndef PATH_TRACE_HDR
+#define PATH_TRACE_HDR
+
+#include <vector>
+#include "Mesh.h"
+#include "SoftRaster.h"
+#include "VecMat.h"
+
+using std::vector;
+
+// the scene is built in eye space, as in the pixel shader: camera at the origin looking down -Z
+// lights match the shader: directional light (0, 0, 1) of intensity 4, and, if shading.spotLight,
+// a point light at shading.light2 with shading.spotIntensity and shading.spotColor (no distance falloff)
+// materials use the same maps; BRDFs are the energy-correct forms of the shader's models:
+//   diffuse: Lambert or Disney (Burley); specular: normalized Blinn-Phong (exponent 4) or GGX Cook-Torrance,
+//   with f0 from the metallic map; the AO map, if enabled, scales diffuse reflection
+
+struct TraceStats {
+	int nPasses;
+	long long nRays;					// camera, bounce, and shadow rays, all passes
+	double seconds;						// time in Pass, all passes
+	double MRaysPerSecond() { return seconds > 0? 1e-6*nRays/seconds : 0; }
+};
+
+class PathTracer {
+public:
+	PathTracer(int width = 0, int height = 0, int nThreads = 0);
+		// nThreads 0: use hardware concurrency
+	void Resize(int width, int height);
+	void SetThreads(int nThreads);
+	void SetCamera(float fov);
+		// vertical field of view, degrees (as with Perspective)
+	void SetShading(RasterShading &shading);
+	void SetBackground(vec3 color);
+		// seen by camera rays that miss; bounce rays that miss receive no light
+	void SetMaxBounces(int n);
+	void AddMesh(vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles,
+				 int firstTriangle, int nTriangles, mat4 modelview, RasterMaterial &material);
+		// copy a triangle range into the scene, transformed to eye space; material must remain valid
+	void Build();
+		// build the BVH over all added triangles and clear accumulation
+	void Pass();
+		// trace one sample per pixel in parallel and add to the float accumulation buffer
+	void Reset();
+		// clear accumulation (after changing camera, shading, or scene)
+	vec3 *Accumulation();
+		// sum over passes, bottom row first
+	bool Write(const char *targaFilename);
+		// write mean radiance, clamped to [0, 1] as is the shader output
+	TraceStats Stats();
+	int Width();
+	int Height();
+private:
+	struct Surface {
+		int material;
+		vec3 n0, n1, n2;
+		vec2 uv0, uv1, uv2;
+		vec3 dpdu, dpdv;				// tangent frame for normal maps
+	};
+	int width, height, nThreads, maxBounces;
+	float fov;
+	vec3 background;
+	RasterShading shading;
+	vector<vec3> points;
+	vector<int3> triangles;
+	vector<Surface> surfaces;			// per triangle
+	vector<RasterMaterial *> materials;
+	BVH bvh;
+	vector<vec3> accumulation;
+	TraceStats stats;
+	vec3 Radiance(vec3 origin, vec3 dir, unsigned int &seed, long long &nRays);
+	long long TraceTile(int tile, int nxTiles);
+};
+
+#endif
@@ -0,0 +1,43 @@
+// Readback.h - asynchronous framebuffer readback through pixel pack buffers
+
+#ifndef READBACK_HDR
+#define READBACK_HDR
+
+#include <glad.h>
+#include <vector>
+
+typedef void (*ReadbackCallback)(unsigned char *bgr, int width, int height, void *data);
+	// bgr is tightly packed, bottom row first (as for Targa); valid only during the call
+
+class Readback {
+public:
+	Readback(int nBuffers = 3);
+	bool Request(int x, int y, int width, int height, ReadbackCallback cb, void *data = NULL, bool waitIfFull = true);
+		// start read of rectangle from current read framebuffer as GL_BGR, GL_UNSIGNED_BYTE
+		// if all buffers are in flight, deliver the oldest first (waitIfFull) or drop the request
+		// return true if request queued
+	int Poll(bool wait = false);
+		// deliver completed reads to their callbacks, oldest first; return # delivered
+		// call once per frame; wait forces delivery of all pending reads
+	void Flush();
+		// same as Poll(true)
+	int Pending();
+	void Free();
+		// deliver pending reads and release buffers (call while the GL context is current)
+private:
+	struct Slot {
+		GLuint pbo;
+		GLsync fence;
+		int x, y, width, height, capacity;
+		ReadbackCallback cb;
+		void *data;
+	};
+	std::vector<Slot> slots;		// ring of buffers
+	int head, count;				// oldest pending slot, # pending
+	bool Deliver(bool wait);
+};
+
+Readback &FrameReadback();
+	// shared triple-buffered service used by WriteTargaAsync; poll it once per frame
+
+#endif
@@ -0,0 +1,62 @@
+// Regress.h - image-diff regression runs: render cases headless, compare with golden files, report timings
+
+#ifndef REGRESS_HDR
+#define REGRESS_HDR
+
+#include <string>
+#include <vector>
+
+// Image Comparison
+
+struct ImageDiff {
+	double psnr;						// dB over BGR bytes, capped at 100 (identical images)
+	double flip;						// mean perceptual error in [0, 1], after the FLIP metric
+	double maxFlip;						// worst pixel
+};
+
+bool DiffImages(unsigned char *a, unsigned char *b, int width, int height, ImageDiff &d, unsigned char *errorMap = NULL);
+	// compare two BGR images of equal size; if non-null, errorMap (3*width*height) receives a heat map of the error
+	// the FLIP approximation assumes 67 pixels per degree: spatial filtering in YCxCz, HyAB color distance,
+	// edge and point feature differences on luminance
+
+// Regression Runs
+
+struct RegressOptions {
+	std::string goldenDir;				// golden images, <goldenDir>/<case>.tga
+	std::string outDir;					// rendered images, diff heat maps
+	std::string reportFile;				// JSON timings and metrics
+	bool update;						// write rendered images as the new golden images
+	float minPSNR, maxFlip;				// pass thresholds
+	int nWarmup, nFrames;				// untimed and timed frames per case
+	RegressOptions() : goldenDir("Golden"), outDir("Regress"), reportFile("Regress.json"),
+		update(false), minPSNR(40), maxFlip(.02f), nWarmup(2), nFrames(10) { }
+};
+
+bool ParseRegressOption(RegressOptions &o, int ac, char **av, int &i);
+	// parse av[i] if it is -golden dir, -out dir, -report file, -update, -psnr min, -flip max, -warmup n, or -frames n
+	// advance i past any argument; return false if av[i] is not a regression option
+
+typedef void (*RegressRender)(void *data);
+	// draw one frame of a case into the current (headless) framebuffer
+
+class Regress {
+public:
+	Regress(const char *appName, RegressOptions &options);
+	bool Case(const char *name, RegressRender render, void *data, int width, int height);
+		// render warmup and timed frames (glFinish after each), read the framebuffer, compare with golden image
+		// a missing golden image is written and counts as new; return false if thresholds not met
+	bool Finish();
+		// write the JSON report, print a summary; return true if no case failed
+	int NFailed();
+private:
+	struct Result {
+		std::string name, status;		// status: "pass", "fail", "new", "updated", or "error"
+		double msMean, msMin, msMax;
+		ImageDiff diff;
+	};
+	std::string app;
+	RegressOptions options;
+	std::vector<Result> results;
+};
+
+#endif
@@ -0,0 +1,32 @@
+// Remap.h - image remapping (warps, projection changes): nearest, bilinear or bicubic, tiles in parallel
+
+#ifndef REMAP_HDR
+#define REMAP_HDR
+
+#include <vector>
+
+enum RemapFilter { RemapNearest = 0, RemapBilinear, RemapBicubic };
+	// bicubic: Catmull-Rom, clamped to [0, 255]
+
+typedef void (*RemapFunction)(int i, int j, float &x, float &y, void *data);
+	// destination pixel (i, j) to source position (x, y), in source pixels with pixel centers at integers
+
+struct RemapLUT {
+	int width, height;				// destination size
+	std::vector<float> x, y;		// source position per destination pixel, rows in memory order
+	RemapLUT() : width(0), height(0) { }
+};
+
+void MakeRemapLUT(int width, int height, RemapFunction f, void *data, RemapLUT &lut, int nThreads = 0);
+	// evaluate f once per pixel, for mappings applied repeatedly or costly to evaluate
+
+void Remap(unsigned char *src, int srcWidth, int srcHeight, int bytesPerPixel,
+		   unsigned char *dst, int dstWidth, int dstHeight, RemapFunction f, void *data,
+		   RemapFilter filter = RemapBilinear, bool wrapX = false, int nThreads = 0);
+void Remap(unsigned char *src, int srcWidth, int srcHeight, int bytesPerPixel, unsigned char *dst, RemapLUT &lut,
+		   RemapFilter filter = RemapBilinear, bool wrapX = false, int nThreads = 0);
+	// dst[i, j] = src sampled at f(i, j) or the LUT; 1 to 4 bytes per pixel (gray, BGR, BGRA as ReadTarga), same in dst
+	// positions outside the source are clamped to the edge, or wrapped horizontally if wrapX (longitude)
+	// 64x64 tiles are shared among nThreads (0: hardware concurrency)
+
+#endif
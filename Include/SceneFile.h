@@ -0,0 +1,34 @@
+// SceneFile.h - scene files (camera modelview, then a name and transform per mesh), text or versioned binary
+
+#ifndef SCENEFILE_HDR
+#define SCENEFILE_HDR
+
+#include <string>
+#include <vector>
+#include "VecMat.h"
+
+using std::string;
+using std::vector;
+
+struct SceneEntry {
+	string name;
+	mat4 xform;					// object to world
+	int parent;					// index of an earlier entry, -1: none (binary only; text scenes are flat)
+	SceneEntry() : parent(-1) { }
+};
+
+struct SceneFile {
+	mat4 modelview;
+	vector<SceneEntry> entries;
+};
+
+bool ReadSceneFile(const char *filename, SceneFile &scene);
+	// binary if the file begins with the binary header, else text (as 15-Solution SaveScene):
+	// a line of 16 floats (modelview), then per mesh a line with its name and a line of 16 floats
+	// a binary file of a later version is refused
+
+bool WriteSceneFile(const char *filename, SceneFile &scene, bool binary = false);
+	// binary: "SCNB", version, # entries, modelview, then per entry name length, name, transform and parent
+	// little-endian 32-bit integers and floats; transforms are exact (text keeps 6 decimals)
+
+#endif
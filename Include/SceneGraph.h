@@ -0,0 +1,53 @@
+// SceneGraph.h - transform hierarchy: flat node array in parent-before-child order, local/world matrices, dirty flags
+
+#ifndef SCENEGRAPH_HDR
+#define SCENEGRAPH_HDR
+
+#include <vector>
+#include "VecMat.h"
+
+using std::vector;
+
+class SceneGraph {
+public:
+	SceneGraph();
+	int Add(int parent = -1, const mat4 &local = mat4());
+		// new node, child of node parent (-1: root); return its id
+		// ids are stable; nodes are stored depth-first, so each subtree is a contiguous run of the arrays
+		// its world is set at once (from the parent's), so SetWorld may follow
+	void Remove(int node);
+		// node's children move to its parent, keeping their world matrices
+	bool SetParent(int node, int parent, bool keepWorld = true);
+		// reattach node (and its subtree) to parent (-1: root); false if parent is node or a descendant
+	void Clear();
+	bool Valid(int node);
+	int Parent(int node);
+	int NNodes();
+	mat4 &Local(int node);
+		// after editing in place, call Touch(node)
+	void SetLocal(int node, const mat4 &m);
+	void SetWorld(int node, const mat4 &m);
+		// set local so world becomes m; uses the parent's world as of the last Update
+	void Touch(int node);
+		// mark node's local changed: its subtree is recomputed by the next Update
+	const mat4 &World(int node);
+		// object to world, as of the last Update
+	int Update();
+		// recompute world matrices of touched subtrees only; return # recomputed (0 if nothing changed)
+	bool Changed(int node);
+		// world recomputed by the last Update
+private:
+	vector<int> ids;				// per slot, node id
+	vector<int> parents;			// per slot, parent slot (less than slot) or -1
+	vector<int> ends;				// per slot, one past the last slot of its subtree
+	vector<mat4> locals, worlds;	// per slot
+	vector<char> dirty;				// per slot, local changed since last Update
+	vector<int> stamps;				// per slot, Update count when world was last recomputed
+	vector<int> slots;				// per id, slot or -1 if removed
+	int firstDirty, nUpdates;
+	int Slot(int node);
+	void Reorder(vector<int> &parentIds);
+		// rebuild depth-first order from per-slot parent ids (-1: root), keeping sibling order
+};
+
+#endif
@@ -0,0 +1,88 @@
+// SoftRaster.h - multithreaded tile-based CPU rasterizer, a reference for the BRDF pixel shader
+
+#ifndef SOFT_RASTER_HDR
+#define SOFT_RASTER_HDR
+
+#include <vector>
+#include "VecMat.h"
+
+using std::vector;
+
+// texture sampled bilinearly with repeat wrap, as a GL_RGB texture made from a Targa
+struct RasterTexture {
+	int width, height;
+	vector<unsigned char> bgr;			// bottom row first
+	RasterTexture() : width(0), height(0) { }
+	bool Read(const char *targaFilename);
+	vec3 Sample(float u, float v) const;
+		// rgb in [0, 1]; texel centers at half-integers, as GL_LINEAR on level 0; black if empty
+};
+
+// texture maps of the pixel shader (NULL maps sample as black)
+struct RasterMaterial {
+	RasterTexture *albedo, *normal, *ao, *metallic, *roughness;
+	RasterMaterial() : albedo(NULL), normal(NULL), ao(NULL), metallic(NULL), roughness(NULL) { }
+};
+
+// pixel shader uniforms
+struct RasterShading {
+	bool lambert, disney;				// diffuse model
+	bool blinnPhong, cookTorrance;		// specular model
+	bool spotLight, normalMap, aoMap;
+	float spotIntensity;
+	vec3 spotColor;
+	vec3 light2;						// point light, in eye space
+	RasterShading() : lambert(false), disney(false), blinnPhong(false), cookTorrance(false),
+		spotLight(false), normalMap(false), aoMap(false), spotIntensity(0), spotColor(1, 1, 1) { }
+};
+
+struct RasterStats {
+	int nTriangles;						// submitted
+	int nSetup;							// after clipping and culling of empty triangles
+	long long nPixels;					// shaded (passed depth test)
+	double seconds;						// time in Finish
+	double MTrisPerSecond() { return seconds > 0? 1e-6*nTriangles/seconds : 0; }
+	double MPixelsPerSecond() { return seconds > 0? 1e-6*nPixels/seconds : 0; }
+};
+
+class SoftRaster {
+public:
+	SoftRaster(int width = 0, int height = 0, int nThreads = 0);
+		// nThreads 0: use hardware concurrency
+	void Resize(int width, int height);
+	void SetThreads(int nThreads);
+	void Clear(vec3 color, float depth = 1);
+	void Draw(vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles,
+			  int firstTriangle, int nTriangles, mat4 modelview, mat4 persp,
+			  RasterMaterial &material, RasterShading &shading);
+		// queue draw of a triangle range; arrays, material, and shading must remain valid until Finish
+	void Finish();
+		// transform, clip, and bin queued draws, then shade tiles in parallel
+		// result depends only on the draws, not on the number of threads
+	unsigned char *Pixels();
+		// BGR, bottom row first (as for Targa)
+	bool Write(const char *targaFilename);
+	RasterStats Stats();
+	int Width();
+	int Height();
+private:
+	struct DrawCall {
+		vector<vec3> *points, *normals;
+		vector<vec2> *uvs;
+		vector<int3> *triangles;
+		int firstTriangle, nTriangles;
+		mat4 modelview, persp;
+		RasterMaterial *material;
+		RasterShading *shading;
+	};
+	struct Triangle;
+	int width, height, nThreads, nxTiles, nyTiles;
+	vector<unsigned char> color;
+	vector<float> depth;
+	vector<DrawCall> draws;
+	RasterStats stats;
+	void SetupTriangles(DrawCall &d, int first, int count, vector<Triangle> &out);
+	long long ShadeTile(int tile, vector<Triangle> &tris, vector<vector<int>> &bins);
+};
+
+#endif
@@ -0,0 +1,75 @@
+// TexCompress.h - block-compressed textures: BC1/BC3/BC4/BC5/BC7 encoder, KTX cache, GL upload
+
+#ifndef TEX_COMPRESS_HDR
+#define TEX_COMPRESS_HDR
+
+#include <glad.h>
+#include "MipGen.h"
+#include <vector>
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+enum TexFormat { TexBC1 = 0, TexBC3, TexBC4, TexBC5, TexBC7, TexUncompressed };
+	// BC1: rgb, 4 bits/pixel; BC3: rgba, 8; BC4: gray, 4; BC5: normal xy, 8 (z = 1 via swizzle); BC7: rgba, 8 (mode 6)
+
+enum TexMap { TexMapColor = 0, TexMapNormal, TexMapGray, TexMapRoughness };
+	// color: albedo (BC7, else BC1 or BC3 if alpha); normal: BC5; gray: AO, metallic (BC4, BC1 if not gray)
+	// roughness: as gray, with Toksvig-widened mips if given a normal map
+
+struct CompressedLevel {
+	int width, height;
+	int offset, size;					// within CompressedTexture data
+};
+
+struct CompressedTexture {
+	TexFormat format;
+	std::vector<CompressedLevel> levels;	// level 0 first
+	std::vector<unsigned char> data;		// all levels, contiguous
+	CompressedTexture() : format(TexUncompressed) { }
+};
+
+// Encoding
+
+int TexBlockBytes(TexFormat format);
+	// 8 (BC1, BC4) or 16
+GLenum TexFormatGL(TexFormat format);
+const char *TexFormatName(TexFormat format);
+
+TexFormat SelectTexFormat(TexMap map, unsigned char *pixels, int width, int height, int bytesPerPixel, unsigned formats);
+	// formats is a mask of (1 << TexFormat); return TexUncompressed if no suitable format is in the mask
+
+void CompressBlocks(unsigned char *pixels, int width, int height, int bytesPerPixel, TexFormat format,
+					unsigned char *blocks, int nThreads = 0);
+	// encode one image (BGR(A) or gray, rows in memory order) into ((width+3)/4)*((height+3)/4) blocks
+	// rows of blocks are shared among nThreads (0: hardware concurrency)
+
+bool CompressTexture(unsigned char *pixels, int width, int height, int bytesPerPixel, TexFormat format,
+					 CompressedTexture &c, bool mipmap = true, int nThreads = 0, MipOptions *mips = NULL);
+	// encode the image and, if mipmap, its chain down to 1x1 from GenerateMips (default options: linear, Kaiser)
+
+// KTX Files
+
+bool WriteKTX(const char *filename, CompressedTexture &c);
+bool ReadKTX(const char *filename, CompressedTexture &c);
+	// KTX 1.1, one face, no key/value data
+
+bool ReadCompressedTexture(const char *filename, TexMap map, unsigned formats, CompressedTexture &c,
+						   bool mipmap = true, const char *cacheDir = "TextureCache", int nThreads = 0,
+						   const char *normalMapFilename = NULL);
+	// read <cacheDir>/<name>-<hash>.<map>.ktx (name without extension, hash of the full path) if newer than the Targa file(s) and of a format in the mask
+	// else read the Targa file, build mips filtered for the map (sRGB color, renormalized normals, Toksvig roughness
+	// against normalMapFilename), compress, and write the cache; no GL calls (safe on a worker thread)
+
+// GL
+
+unsigned CompressedFormatsSupported();
+	// mask of (1 << TexFormat) usable by the current context
+GLuint LoadCompressedTexture(CompressedTexture &c, GLuint textureUnit);
+void LoadCompressedTexture(CompressedTexture &c, GLuint textureUnit, GLuint textureName, bool fromUnpackBuffer = false);
+	// glCompressedTexImage2D for every level; if fromUnpackBuffer, data are read from the bound
+	// GL_PIXEL_UNPACK_BUFFER at the level offsets
+
+#endif
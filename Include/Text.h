@@ -6,24 +6,29 @@
 #include <glad.h>
 #include <GLFW/glfw3.h>
 #include "GLXtras.h"
+#include <map>
 
 class Character {
 public:
-    GLuint	textureID;	// glyph texture
+    vec2	uv0, uv1;	// glyph location in font atlas (uv0 at first bitmap row)
     int2	gSize;		// glyph size
     int2	bearing;    // offset from baseline to left/top of glyph
     GLuint	advance;	// offset to next glyph
-	Character() { }
-    Character(int textureID, int2 gSize, int2 bearing, GLuint advance) :
-		textureID(textureID), gSize(gSize), bearing(bearing), advance(advance) { }
+	Character() : advance(0) { }
+    Character(vec2 uv0, vec2 uv1, int2 gSize, int2 bearing, GLuint advance) :
+		uv0(uv0), uv1(uv1), gSize(gSize), bearing(bearing), advance(advance) { }
 };
 
 // character set and current pointer
 struct CharacterSet {
 	int charRes;
-	Character characters[128];
-	CharacterSet() { charRes = 0; }
-	CharacterSet(const CharacterSet &cs) { for (int i = 0; i < 128; i++) characters[i] = cs.characters[i]; }
+	GLuint atlas;							// single-channel texture holding all glyphs
+	int2 atlasSize;
+	Character ascii[128];					// direct lookup for 7-bit characters
+	std::map<unsigned, Character> extended;	// other Unicode code points
+	CharacterSet() : charRes(0), atlas(0) { }
+	const Character *Find(unsigned codepoint) const;
+		// return glyph for code point, or NULL if not in font
 };
 
 CharacterSet *SetFont(const char *fontName, int charRes = 15, int pixelRes = 15);
@@ -39,5 +44,12 @@ float TextWidth(float scale, const char *format, ...);
 
 void RenderText(const char *text, float x, float y, vec3 color, float scale, mat4 view);
 	// text with arbitrary orientation
+	// text is UTF-8; code points not in the font display as '?'
+
+void BeginTextBatch();
+	// defer Text and RenderText until EndTextBatch
+void EndTextBatch();
+	// draw all deferred text in one call per font (calls may nest)
+	// without a batch, each string is drawn with one call
 
 #endif
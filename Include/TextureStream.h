@@ -0,0 +1,81 @@
+// TextureStream.h - asynchronous texture loading: worker-thread decode, bounded per-frame upload through PBOs
+
+#ifndef TEXTURE_STREAM_HDR
+#define TEXTURE_STREAM_HDR
+
+#include <glad.h>
+#include "TexCompress.h"
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef unsigned char *(*TextureDecoder)(const char *filename, int &width, int &height, int &bytesPerPixel);
+	// return new[] pixels, bottom row first, BGR(A) or gray (bytesPerPixel 1, 3, or 4); NULL on failure
+	// called on a worker thread
+
+struct TextureStreamStats {
+	int nRequested, nResident, nFailed;
+	double megabytes;					// decoded pixels uploaded
+	double seconds;						// first request to last texture resident
+};
+
+class TextureStreamer {
+public:
+	TextureStreamer(int nThreads = 0);
+		// nThreads 0: hardware concurrency, at most 4
+	~TextureStreamer();
+	GLuint Request(const char *filename, GLuint textureUnit, const unsigned char *placeholderRGB = NULL, bool mipmap = true,
+				   TexMap map = TexMapColor, const char *normalMapFilename = NULL);
+		// return a texture name at once; it holds a 1x1 placeholder (default mid gray) until the file is resident
+		// the file is decoded on a worker thread; a file already requested returns the same name
+		// map selects the block-compressed format and mip filtering if compression is enabled;
+		// a roughness map's mips are widened by the variance of normalMapFilename
+	void EnableCompression(const char *cacheDir = "TextureCache");
+		// call on the GL thread before requests: Targa files are block compressed and cached as KTX
+		// (see ReadCompressedTexture), in formats the context supports
+	void AddDecoder(const char *extension, TextureDecoder decoder);
+		// decode files with extension (eg, ".tga", case-insensitive); Targa is built in
+	int Update(int maxBytes = 8 << 20);
+		// call once per frame on the GL thread: copy up to maxBytes of decoded pixels into pixel unpack buffers
+		// a fully staged texture replaces its placeholder in one upload; return # textures made resident
+	void Finish();
+		// upload everything requested, waiting on decodes (batch and regression runs)
+	int Pending();
+		// # requested textures not yet resident or failed
+	bool IsResident(GLuint textureName);
+	TextureStreamStats Stats();
+	void Free();
+		// release staging buffers and stop the workers (call while the GL context is current)
+private:
+	enum State { Queued = 0, Decoding, Decoded, Staging, Resident, Failed };
+	struct Texture {
+		std::string filename, normalMap;
+		GLuint name, unit, pbo;
+		bool mipmap;
+		State state;
+		TexMap map;
+		int width, height, bytesPerPixel, size, staged;
+		unsigned char *pixels;			// decoded, until staged
+		CompressedTexture compressed;	// if compressing, instead of pixels
+	};
+	std::vector<Texture *> textures;	// in request order
+	std::map<std::string, Texture *> byFilename;
+	std::map<std::string, TextureDecoder> decoders;
+	std::deque<Texture *> queue;		// awaiting decode
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable queueChanged, decoded;
+	int nThreads;
+	bool stopping;
+	unsigned compressedFormats;			// 0: upload uncompressed
+	std::string cacheDir;
+	double startTime, endTime;
+	void Decode();						// worker thread
+	bool Stage(Texture *t, int &budget);
+};
+
+#endif
@@ -6,6 +6,15 @@
 #include <math.h>
 #include <iostream>
 
+// SIMD: SSE on x86/x64, NEON on ARM64; define VECMAT_NO_SIMD for the scalar code
+#if !defined(VECMAT_NO_SIMD) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define VECMAT_SSE
+#include <xmmintrin.h>
+#elif !defined(VECMAT_NO_SIMD) && (defined(__aarch64__) || defined(_M_ARM64))
+#define VECMAT_NEON
+#include <arm_neon.h>
+#endif
+
 // integer pair and triplet
 
 struct int2 {
@@ -146,7 +155,7 @@ public:
     vec4 operator + (const vec4 &v) const { return vec4(x+v.x, y+v.y, z+v.z, w+v.w); }
     vec4 operator - (const vec4 &v) const { return vec4(x-v.x, y-v.y, z-v.z, w-v.w); }
     vec4 operator * (float s) const { return vec4(s*x, s*y, s*z, s*w); }
-    vec4 operator * (const vec4 &v) const { return vec4(x*v.x, y*v.y, z*v.z, w*v.z); }
+    vec4 operator * (const vec4 &v) const { return vec4(x*v.x, y*v.y, z*v.z, w*v.w); }
     friend vec4 operator * (float s, const vec4& v) { return v*s; }
     vec4 operator / (float s) const { float r = 1.f/s; return *this*r; }
     // reflexive
@@ -176,7 +185,9 @@ inline vec4 normalize(const vec4 &v) { return v/length(v); }
 // initializations
 //     Scale, Translate, RotateX, RotateY, RotateZ
 //     Orthographic, Perspective
-//     LookAt, Transpose
+//     LookAt, Transpose, AffineInverse
+// batches
+//     TransformPoints			// many points by one matrix
 
 class mat3 {
 public:
@@ -224,14 +235,54 @@ public:
 	mat4 operator * (float s) const { return mat4(s*row[0], s*row[1], s*row[2], s*row[3]); }
 	friend mat4 operator * (float s, const mat4 &m) { return m*s; }
 	mat4 operator * (const mat4 &m) const {
+		// row i of the product is the sum of m's rows weighted by row i of this
 		mat4 a(0);
+#if defined(VECMAT_SSE)
+		__m128 r0 = _mm_loadu_ps(&m.row[0].x), r1 = _mm_loadu_ps(&m.row[1].x);
+		__m128 r2 = _mm_loadu_ps(&m.row[2].x), r3 = _mm_loadu_ps(&m.row[3].x);
+		for (int i = 0; i < 4; i++) {
+			const vec4 &r = row[i];
+			__m128 s = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(r.x), r0), _mm_mul_ps(_mm_set1_ps(r.y), r1)),
+								  _mm_add_ps(_mm_mul_ps(_mm_set1_ps(r.z), r2), _mm_mul_ps(_mm_set1_ps(r.w), r3)));
+			_mm_storeu_ps(&a.row[i].x, s);
+		}
+#elif defined(VECMAT_NEON)
+		float32x4_t r0 = vld1q_f32(&m.row[0].x), r1 = vld1q_f32(&m.row[1].x);
+		float32x4_t r2 = vld1q_f32(&m.row[2].x), r3 = vld1q_f32(&m.row[3].x);
+		for (int i = 0; i < 4; i++) {
+			float32x4_t r = vld1q_f32(&row[i].x);
+			float32x4_t s = vmulq_laneq_f32(r0, r, 0);
+			s = vfmaq_laneq_f32(s, r1, r, 1);
+			s = vfmaq_laneq_f32(s, r2, r, 2);
+			s = vfmaq_laneq_f32(s, r3, r, 3);
+			vst1q_f32(&a.row[i].x, s);
+		}
+#else
 		for (int i = 0; i < 4; i++)
 			for (int j = 0; j < 4; j++)
 				for (int k = 0; k < 4; k++)
 					a[i][j] += row[i][k]*m[k][j];
+#endif
 		return a;
 	}
-	vec4 operator * (const vec4 &v) const { return vec4(dot(row[0], v), dot(row[1], v), dot(row[2], v), dot(row[3], v)); }
+	vec4 operator * (const vec4 &v) const {
+#if defined(VECMAT_SSE)
+		// four row products, transposed so one sum gives the four dots
+		__m128 p = _mm_loadu_ps(&v.x);
+		__m128 d0 = _mm_mul_ps(_mm_loadu_ps(&row[0].x), p), d1 = _mm_mul_ps(_mm_loadu_ps(&row[1].x), p);
+		__m128 d2 = _mm_mul_ps(_mm_loadu_ps(&row[2].x), p), d3 = _mm_mul_ps(_mm_loadu_ps(&row[3].x), p);
+		_MM_TRANSPOSE4_PS(d0, d1, d2, d3);
+		vec4 r;
+		_mm_storeu_ps(&r.x, _mm_add_ps(_mm_add_ps(d0, d1), _mm_add_ps(d2, d3)));
+		return r;
+#elif defined(VECMAT_NEON)
+		float32x4_t p = vld1q_f32(&v.x);
+		return vec4(vaddvq_f32(vmulq_f32(vld1q_f32(&row[0].x), p)), vaddvq_f32(vmulq_f32(vld1q_f32(&row[1].x), p)),
+					vaddvq_f32(vmulq_f32(vld1q_f32(&row[2].x), p)), vaddvq_f32(vmulq_f32(vld1q_f32(&row[3].x), p)));
+#else
+		return vec4(dot(row[0], v), dot(row[1], v), dot(row[2], v), dot(row[3], v));
+#endif
+	}
 };
 
 inline mat4 Scale(float x, float y, float z) {
@@ -324,4 +375,86 @@ inline mat4 Transpose(mat4 &m) {
 				vec4(m[0][3], m[1][3], m[2][3], m[3][3]));
 }
 
+inline mat4 AffineInverse(const mat4 &m) {
+	// inverse of a rotation/scale/translation (bottom row 0 0 0 1): invert the 3x3, then negate the moved translation
+	// much cheaper than a general inverse; identity if the 3x3 is singular
+	float a = m[0][0], b = m[0][1], c = m[0][2];
+	float d = m[1][0], e = m[1][1], f = m[1][2];
+	float g = m[2][0], h = m[2][1], k = m[2][2];
+	float c0 = e*k-f*h, c1 = f*g-d*k, c2 = d*h-e*g, det = a*c0+b*c1+c*c2;
+	if (det == 0)
+		return mat4();
+	float s = 1/det;
+	mat4 r;
+	r[0] = vec4(s*c0, s*(c*h-b*k), s*(b*f-c*e), 0);
+	r[1] = vec4(s*c1, s*(a*k-c*g), s*(c*d-a*f), 0);
+	r[2] = vec4(s*c2, s*(b*g-a*h), s*(a*e-b*d), 0);
+	for (int i = 0; i < 3; i++)
+		r[i][3] = -(r[i][0]*m[0][3]+r[i][1]*m[1][3]+r[i][2]*m[2][3]);
+	return r;
+}
+
+// batches: the matrix is held in registers across the points; in and out may be the same array
+
+inline void TransformPoints(const mat4 &m, const vec3 *in, vec4 *out, int n) {
+	// out[i] = m*vec4(in[i], 1), eg to clip space
+#if defined(VECMAT_SSE)
+	__m128 c0 = _mm_loadu_ps(&m.row[0].x), c1 = _mm_loadu_ps(&m.row[1].x);
+	__m128 c2 = _mm_loadu_ps(&m.row[2].x), c3 = _mm_loadu_ps(&m.row[3].x);
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);	// columns
+	for (int i = 0; i < n; i++) {
+		const vec3 &p = in[i];
+		__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.x), c0), _mm_mul_ps(_mm_set1_ps(p.y), c1)),
+							  _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.z), c2), c3));
+		_mm_storeu_ps(&out[i].x, r);
+	}
+#elif defined(VECMAT_NEON)
+	float32x4x4_t c = vld4q_f32(&m.row[0].x);	// columns
+	for (int i = 0; i < n; i++) {
+		const vec3 &p = in[i];
+		float32x4_t r = vfmaq_n_f32(vfmaq_n_f32(vfmaq_n_f32(c.val[3], c.val[0], p.x), c.val[1], p.y), c.val[2], p.z);
+		vst1q_f32(&out[i].x, r);
+	}
+#else
+	for (int i = 0; i < n; i++)
+		out[i] = m*vec4(in[i], 1);
+#endif
+}
+
+inline void TransformPoints(const mat4 &m, const vec3 *in, vec3 *out, int n) {
+	// out[i] = (m*vec4(in[i], 1)).xyz, for affine m (no divide)
+#if defined(VECMAT_SSE)
+	__m128 c0 = _mm_loadu_ps(&m.row[0].x), c1 = _mm_loadu_ps(&m.row[1].x);
+	__m128 c2 = _mm_loadu_ps(&m.row[2].x), c3 = _mm_loadu_ps(&m.row[3].x);
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+	for (int i = 0; i < n; i++) {
+		const vec3 &p = in[i];
+		__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.x), c0), _mm_mul_ps(_mm_set1_ps(p.y), c1)),
+							  _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.z), c2), c3));
+		_mm_storel_pi((__m64 *) &out[i].x, r);
+		_mm_store_ss(&out[i].z, _mm_movehl_ps(r, r));
+	}
+#elif defined(VECMAT_NEON)
+	float32x4x4_t c = vld4q_f32(&m.row[0].x);
+	for (int i = 0; i < n; i++) {
+		const vec3 &p = in[i];
+		float32x4_t r = vfmaq_n_f32(vfmaq_n_f32(vfmaq_n_f32(c.val[3], c.val[0], p.x), c.val[1], p.y), c.val[2], p.z);
+		vst1_f32(&out[i].x, vget_low_f32(r));
+		vst1q_lane_f32(&out[i].z, r, 2);
+	}
+#else
+	for (int i = 0; i < n; i++) {
+		const vec3 p = in[i];
+		out[i] = vec3(dot(m[0], vec4(p, 1)), dot(m[1], vec4(p, 1)), dot(m[2], vec4(p, 1)));
+	}
+#endif
+}
+
+inline void TransformVectors(const mat4 &m, const vec3 *in, vec3 *out, int n) {
+	// out[i] = upper 3x3 of m times in[i] (directions; for normals pass the inverse transpose)
+	mat4 l(m);
+	l[0][3] = l[1][3] = l[2][3] = 0;
+	TransformPoints(l, in, out, n);
+}
+
 #endif // VEC_MAT_HDR
@@ -5,6 +5,7 @@
 
 #include <String.h>
 #include "Quaternion.h"
+#include "Readback.h"
 #include "VecMat.h"
 
 // Cursor Support
@@ -136,6 +137,14 @@ public:
 	void Drag(int x, int y);
 	bool Hit(int x, int y);
 	void Display(int2 displayLoc, bool showSrcWindow = true);
+		// magnified pixels lag the framebuffer by a frame or two (read asynchronously)
+	void Free();
+		// release readback buffers
+private:
+	Readback readback;
+	std::vector<unsigned char> pixels;	// most recent read, BGR
+	int2 pixelsSize;
+	static void Receive(unsigned char *bgr, int width, int height, void *magnifier);
 };
 
 #endif
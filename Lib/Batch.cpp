@@ -0,0 +1,237 @@
+// Batch.cpp - kernels over many 3D points, interleaved or in separate arrays: bounds, scale-translate, transform
+
+#include "Batch.h"
+#include "Parallel.h"
+#include <float.h>
+#include <stddef.h>
+
+using std::vector;
+
+namespace {
+
+const int chunkSize = 1 << 16;      // points per job, a multiple of 4
+const int minThreaded = 1 << 18;    // smaller spans stay on the calling thread
+
+enum Layout { Separate, Packed, Strided, General };
+    // Separate: x, y, z arrays; Packed: vec3 array; Strided: x, y, z adjacent, stride > 3; General: anything else
+
+Layout GetLayout(const Vec3Span &s) {
+    if (s.stride == 1)
+        return Separate;
+    if (s.y != s.x+1 || s.z != s.x+2)
+        return General;
+    return s.stride == 3? Packed : s.stride > 3? Strided : General;
+}
+
+int Threads(int n, int nThreads) {
+    // large spans shared among nThreads (0: hardware concurrency), others kept on the calling thread
+    return n < minThreaded? 1 : nThreads;
+}
+
+// a < m? a : m, so a NaN a leaves m (as _mm_min_ps(a, m))
+inline float Min(float a, float m) { return a < m? a : m; }
+inline float Max(float a, float m) { return a > m? a : m; }
+
+// bounds
+
+void MinMaxArray(const float *a, int b, int e, float &mn, float &mx) {
+    int i = b;
+#if defined(VECMAT_SSE)
+    __m128 mn0 = _mm_set1_ps(mn), mn1 = mn0, mx0 = _mm_set1_ps(mx), mx1 = mx0;
+    for (; i+8 <= e; i += 8) {
+        __m128 v0 = _mm_loadu_ps(a+i), v1 = _mm_loadu_ps(a+i+4);
+        mn0 = _mm_min_ps(v0, mn0); mx0 = _mm_max_ps(v0, mx0);
+        mn1 = _mm_min_ps(v1, mn1); mx1 = _mm_max_ps(v1, mx1);
+    }
+    float t[8];
+    _mm_storeu_ps(t, _mm_min_ps(mn0, mn1));
+    _mm_storeu_ps(t+4, _mm_max_ps(mx0, mx1));
+    for (int k = 0; k < 4; k++) {
+        mn = Min(t[k], mn);
+        mx = Max(t[4+k], mx);
+    }
+#endif
+    for (; i < e; i++) {
+        mn = Min(a[i], mn);
+        mx = Max(a[i], mx);
+    }
+}
+
+void MinMaxRange(const Vec3Span &s, Layout layout, int b, int e, float *mn, float *mx) {
+    if (layout == Separate) {
+        MinMaxArray(s.x, b, e, mn[0], mx[0]);
+        MinMaxArray(s.y, b, e, mn[1], mx[1]);
+        MinMaxArray(s.z, b, e, mn[2], mx[2]);
+        return;
+    }
+    int i = b;
+#if defined(VECMAT_SSE)
+    if (layout == Packed) {
+        // four points are three registers: xyzx yzxy zxyz
+        const float *p = s.x+3*(size_t) b;
+        __m128 mn0 = _mm_set1_ps(FLT_MAX), mn1 = mn0, mn2 = mn0;
+        __m128 mx0 = _mm_set1_ps(-FLT_MAX), mx1 = mx0, mx2 = mx0;
+        for (; i+4 <= e; i += 4, p += 12) {
+            __m128 r0 = _mm_loadu_ps(p), r1 = _mm_loadu_ps(p+4), r2 = _mm_loadu_ps(p+8);
+            mn0 = _mm_min_ps(r0, mn0); mx0 = _mm_max_ps(r0, mx0);
+            mn1 = _mm_min_ps(r1, mn1); mx1 = _mm_max_ps(r1, mx1);
+            mn2 = _mm_min_ps(r2, mn2); mx2 = _mm_max_ps(r2, mx2);
+        }
+        float t[24];
+        _mm_storeu_ps(t, mn0); _mm_storeu_ps(t+4, mn1); _mm_storeu_ps(t+8, mn2);
+        _mm_storeu_ps(t+12, mx0); _mm_storeu_ps(t+16, mx1); _mm_storeu_ps(t+20, mx2);
+        for (int j = 0; j < 12; j++) {
+            mn[j%3] = Min(t[j], mn[j%3]);
+            mx[j%3] = Max(t[12+j], mx[j%3]);
+        }
+    }
+    if (layout == Strided) {
+        // the fourth float loaded is within the point (stride > 3), and ignored
+        __m128 vmn = _mm_set1_ps(FLT_MAX), vmx = _mm_set1_ps(-FLT_MAX);
+        for (; i < e; i++) {
+            __m128 v = _mm_loadu_ps(s.x+(size_t) i*s.stride);
+            vmn = _mm_min_ps(v, vmn);
+            vmx = _mm_max_ps(v, vmx);
+        }
+        float t[8];
+        _mm_storeu_ps(t, vmn);
+        _mm_storeu_ps(t+4, vmx);
+        for (int k = 0; k < 3; k++) {
+            mn[k] = Min(t[k], mn[k]);
+            mx[k] = Max(t[4+k], mx[k]);
+        }
+    }
+#endif
+    for (; i < e; i++) {
+        size_t o = (size_t) i*s.stride;
+        float x = s.x[o], y = s.y[o], z = s.z[o];
+        mn[0] = Min(x, mn[0]); mx[0] = Max(x, mx[0]);
+        mn[1] = Min(y, mn[1]); mx[1] = Max(y, mx[1]);
+        mn[2] = Min(z, mn[2]); mx[2] = Max(z, mx[2]);
+    }
+}
+
+// scale-translate
+
+void ScaleTranslateArray(float *a, int b, int e, float scale, float t) {
+    int i = b;
+#if defined(VECMAT_SSE)
+    __m128 vs = _mm_set1_ps(scale), vt = _mm_set1_ps(t);
+    for (; i+4 <= e; i += 4)
+        _mm_storeu_ps(a+i, _mm_mul_ps(vs, _mm_add_ps(_mm_loadu_ps(a+i), vt)));
+#endif
+    for (; i < e; i++)
+        a[i] = scale*(a[i]+t);
+}
+
+void ScaleTranslateRange(const Vec3Span &s, Layout layout, float scale, const vec3 &t, int b, int e) {
+    if (layout == Separate) {
+        ScaleTranslateArray(s.x, b, e, scale, t.x);
+        ScaleTranslateArray(s.y, b, e, scale, t.y);
+        ScaleTranslateArray(s.z, b, e, scale, t.z);
+        return;
+    }
+    int i = b;
+#if defined(VECMAT_SSE)
+    __m128 vs = _mm_set1_ps(scale);
+    if (layout == Packed) {
+        float *p = s.x+3*(size_t) b;
+        __m128 t0 = _mm_setr_ps(t.x, t.y, t.z, t.x), t1 = _mm_setr_ps(t.y, t.z, t.x, t.y), t2 = _mm_setr_ps(t.z, t.x, t.y, t.z);
+        for (; i+4 <= e; i += 4, p += 12) {
+            _mm_storeu_ps(p, _mm_mul_ps(vs, _mm_add_ps(_mm_loadu_ps(p), t0)));
+            _mm_storeu_ps(p+4, _mm_mul_ps(vs, _mm_add_ps(_mm_loadu_ps(p+4), t1)));
+            _mm_storeu_ps(p+8, _mm_mul_ps(vs, _mm_add_ps(_mm_loadu_ps(p+8), t2)));
+        }
+    }
+    if (layout == Strided) {
+        __m128 vt = _mm_setr_ps(t.x, t.y, t.z, 0);
+        for (; i < e; i++) {
+            float *p = s.x+(size_t) i*s.stride;
+            __m128 r = _mm_mul_ps(vs, _mm_add_ps(_mm_loadu_ps(p), vt));
+            _mm_storel_pi((__m64 *) p, r);
+            _mm_store_ss(p+2, _mm_movehl_ps(r, r));
+        }
+    }
+#endif
+    for (; i < e; i++) {
+        size_t o = (size_t) i*s.stride;
+        s.x[o] = scale*(s.x[o]+t.x);
+        s.y[o] = scale*(s.y[o]+t.y);
+        s.z[o] = scale*(s.z[o]+t.z);
+    }
+}
+
+// transform
+
+void TransformRange(const Vec3Span &in, Layout lin, const Vec3Span &out, Layout lout, const mat4 &m, int b, int e) {
+    int i = b;
+#if defined(VECMAT_SSE)
+    if (lin == Separate && lout == Separate) {
+        // four points per register, one coordinate per array
+        __m128 c[3][4];
+        for (int r = 0; r < 3; r++)
+            for (int k = 0; k < 4; k++)
+                c[r][k] = _mm_set1_ps(m[r][k]);
+        float *o[3] = {out.x, out.y, out.z};
+        for (; i+4 <= e; i += 4) {
+            __m128 x = _mm_loadu_ps(in.x+i), y = _mm_loadu_ps(in.y+i), z = _mm_loadu_ps(in.z+i);
+            for (int r = 0; r < 3; r++)
+                _mm_storeu_ps(o[r]+i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[r][0], x), _mm_mul_ps(c[r][1], y)),
+                                                 _mm_add_ps(_mm_mul_ps(c[r][2], z), c[r][3])));
+        }
+    }
+    if (lin != Separate && lin != General && lout != Separate && lout != General) {
+        // a point per register, as TransformPoints; three floats stored, so out may overlap in
+        __m128 c0 = _mm_loadu_ps(&m[0].x), c1 = _mm_loadu_ps(&m[1].x), c2 = _mm_loadu_ps(&m[2].x), c3 = _mm_loadu_ps(&m[3].x);
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+        for (; i < e; i++) {
+            const float *p = in.x+(size_t) i*in.stride;
+            float *q = out.x+(size_t) i*out.stride;
+            __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p[0]), c0), _mm_mul_ps(_mm_set1_ps(p[1]), c1)),
+                                  _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p[2]), c2), c3));
+            _mm_storel_pi((__m64 *) q, r);
+            _mm_store_ss(q+2, _mm_movehl_ps(r, r));
+        }
+    }
+#endif
+    for (; i < e; i++) {
+        size_t a = (size_t) i*in.stride, o = (size_t) i*out.stride;
+        float x = in.x[a], y = in.y[a], z = in.z[a];
+        out.x[o] = (m[0][0]*x+m[0][1]*y)+(m[0][2]*z+m[0][3]);
+        out.y[o] = (m[1][0]*x+m[1][1]*y)+(m[1][2]*z+m[1][3]);
+        out.z[o] = (m[2][0]*x+m[2][1]*y)+(m[2][2]*z+m[2][3]);
+    }
+}
+
+} // end namespace
+
+void BatchMinMax(Vec3Span points, vec3 &min, vec3 &max, int nThreads) {
+    Layout layout = GetLayout(points);
+    int nChunks = (points.n+chunkSize-1)/chunkSize;
+    vector<vec3> mins(nChunks, vec3(FLT_MAX)), maxs(nChunks, vec3(-FLT_MAX));
+    ParallelFor(0, points.n, chunkSize, Threads(points.n, nThreads), [&](int b, int e) {
+        MinMaxRange(points, layout, b, e, &mins[b/chunkSize].x, &maxs[b/chunkSize].x);
+    });
+    min = vec3(FLT_MAX);
+    max = vec3(-FLT_MAX);
+    for (int c = 0; c < nChunks; c++)
+        for (int k = 0; k < 3; k++) {
+            min[k] = Min(mins[c][k], min[k]);
+            max[k] = Max(maxs[c][k], max[k]);
+        }
+}
+
+void BatchScaleTranslate(Vec3Span points, float scale, vec3 translate, int nThreads) {
+    Layout layout = GetLayout(points);
+    ParallelFor(0, points.n, chunkSize, Threads(points.n, nThreads), [&](int b, int e) {
+        ScaleTranslateRange(points, layout, scale, translate, b, e);
+    });
+}
+
+void BatchTransform(Vec3Span in, Vec3Span out, const mat4 &m, int nThreads) {
+    Layout lin = GetLayout(in), lout = GetLayout(out);
+    int n = in.n < out.n? in.n : out.n;
+    ParallelFor(0, n, chunkSize, Threads(n, nThreads), [&](int b, int e) {
+        TransformRange(in, lin, out, lout, m, b, e);
+    });
+}
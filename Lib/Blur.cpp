@@ -0,0 +1,163 @@
+// Blur.cpp - image blur: box by running sums (constant cost per pixel at any radius), separable Gaussian
+
+#include "Blur.h"
+#include "Parallel.h"
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+using std::vector;
+
+namespace {
+
+void BoxBand(unsigned char *src, unsigned char *dst, int width, int height, int radius, bool round, int y0, int y1) {
+    // colSum holds, per column, the sum over the rows of the window; slide it down, then slide along each row
+    // the quotient (at most 255) is estimated by reciprocal and corrected: cheaper than a 64-bit divide
+    vector<unsigned int> colSum(width, 0);
+    for (int j = y0-radius > 0? y0-radius : 0; j <= y0+radius && j < height; j++)
+        for (int i = 0; i < width; i++)
+            colSum[i] += src[j*width+i];
+    for (int y = y0; y < y1; y++) {
+        if (y > y0) {
+            int add = y+radius, sub = y-radius-1;
+            if (add < height)
+                for (int i = 0; i < width; i++)
+                    colSum[i] += src[add*width+i];
+            if (sub >= 0)
+                for (int i = 0; i < width; i++)
+                    colSum[i] -= src[sub*width+i];
+        }
+        int ny = (y+radius < height? y+radius : height-1)-(y-radius > 0? y-radius : 0)+1;
+        // left edge, interior (window inside the row: constant count), right edge
+        unsigned long long sum = 0;
+        int x = 0, interior0 = radius+1, interior1 = width-radius;
+        unsigned char *d = dst+y*width;
+        auto put = [&](int x, unsigned long long n, double inv) {
+            unsigned long long v = round? sum+n/2 : sum, q = (unsigned long long) (v*inv);
+            q += (q+1)*n <= v;
+            q -= q*n > v;
+            d[x] = (unsigned char) q;
+        };
+        auto edge = [&](int x) {
+            unsigned long long n = (unsigned long long) ((x+radius < width? x+radius : width-1)-(x-radius > 0? x-radius : 0)+1)*ny;
+            put(x, n, 1./(double) n);
+        };
+        for (int i = 0; i <= radius && i < width; i++)
+            sum += colSum[i];
+        edge(x++);
+        for (; x < width && x < interior0; x++) {
+            if (x+radius < width)
+                sum += colSum[x+radius];
+            edge(x);
+        }
+        unsigned long long n = (unsigned long long) (2*radius+1)*ny;
+        double inv = 1./(double) n;
+        for (; x < interior1; x++) {
+            sum += colSum[x+radius];
+            sum -= colSum[x-radius-1];
+            put(x, n, inv);
+        }
+        for (; x < width; x++) {
+            if (x+radius < width)
+                sum += colSum[x+radius];
+            if (x-radius-1 >= 0)
+                sum -= colSum[x-radius-1];
+            edge(x);
+        }
+    }
+}
+
+void GaussianBand(unsigned char *src, unsigned char *dst, int width, int height, int radius,
+                  vector<float> &weights, int y0, int y1) {
+    // per row: weighted sum down the columns, then along the row (padded with its edge pixels)
+    int n = 2*radius+1;
+    vector<float> col(width), pad(width+2*radius);
+    for (int y = y0; y < y1; y++) {
+        for (int i = 0; i < width; i++)
+            col[i] = 0;
+        for (int k = 0; k < n; k++) {
+            int j = y+k-radius;
+            unsigned char *s = src+(j < 0? 0 : j >= height? height-1 : j)*width;
+            float w = weights[k];
+            for (int i = 0; i < width; i++)
+                col[i] += w*s[i];
+        }
+        for (int i = 0; i < radius; i++) {
+            pad[i] = col[0];
+            pad[radius+width+i] = col[width-1];
+        }
+        memcpy(&pad[radius], &col[0], width*sizeof(float));
+        for (int i = 0; i < width; i++)
+            col[i] = .5f;
+        for (int k = 0; k < n; k++) {
+            float w = weights[k], *p = &pad[k];
+            for (int i = 0; i < width; i++)
+                col[i] += w*p[i];
+        }
+        unsigned char *d = dst+y*width;
+        for (int x = 0; x < width; x++)
+            d[x] = (unsigned char) (col[x] > 255? 255 : col[x]);
+    }
+}
+
+template <class F> void ParallelBands(int height, int nThreads, F f) {
+    // one band of rows per thread: the box sums are primed once per band
+    nThreads = ThreadCount(nThreads);
+    if (nThreads > height/16)
+        nThreads = height/16 > 1? height/16 : 1;   // small images: not worth a thread
+    ParallelFor(0, height, (height+nThreads-1)/nThreads, nThreads, f);
+}
+
+void BoxPass(unsigned char *src, unsigned char *dst, int width, int height, int radius, bool round, int nThreads) {
+    if (radius > width && radius > height)
+        radius = width > height? width : height;    // beyond that, every window is the whole image
+    ParallelBands(height, nThreads, [&](int y0, int y1) { BoxBand(src, dst, width, height, radius, round, y0, y1); });
+}
+
+const int maxGaussianRadius = 8;    // larger: three box passes
+
+} // end namespace
+
+void BlurPlane(unsigned char *src, unsigned char *dst, int width, int height, int radius, BlurFilter filter, int nThreads) {
+    if (radius < 0)
+        radius = 0;
+    if (filter == BlurBox)
+        BoxPass(src, dst, width, height, radius, false, nThreads);
+    else if (radius <= maxGaussianRadius) {
+        float sigma = radius/3.f, sum = 0;
+        vector<float> weights(2*radius+1);
+        for (int k = -radius; k <= radius; k++)
+            sum += weights[k+radius] = sigma > 0? expf(-k*k/(2*sigma*sigma)) : 1;
+        for (size_t k = 0; k < weights.size(); k++)
+            weights[k] /= sum;
+        ParallelBands(height, nThreads, [&](int y0, int y1) { GaussianBand(src, dst, width, height, radius, weights, y0, y1); });
+    }
+    else {
+        // three boxes whose widths (odd, wl or wl+2) give variance 12*sigma^2 in sum (Kovesi)
+        float sigma = radius/3.f, ideal = sqrtf(12*sigma*sigma/3+1);
+        int wl = (int) ideal;
+        wl -= wl%2 == 0;
+        int m = (int) floorf((12*sigma*sigma-3.f*wl*wl-12.f*wl-9)/(-4.f*wl-4)+.5f);
+        vector<unsigned char> tmp(width*height);
+        unsigned char *from[] = {src, dst, &tmp[0]}, *to[] = {dst, &tmp[0], dst};
+        for (int pass = 0; pass < 3; pass++)
+            BoxPass(from[pass], to[pass], width, height, ((pass < m? wl : wl+2)-1)/2, true, nThreads);
+    }
+}
+
+void Blur(unsigned char *pixels, int width, int height, int bytesPerPixel, int radius, BlurFilter filter, bool gray, int nThreads) {
+    int n = width*height, nChannels = gray || bytesPerPixel == 1? 1 : bytesPerPixel;
+    vector<unsigned char> src(n), dst(n);
+    for (int c = 0; c < nChannels; c++) {
+        unsigned char *p = pixels+c;
+        for (int i = 0; i < n; i++, p += bytesPerPixel)
+            src[i] = *p;
+        BlurPlane(&src[0], &dst[0], width, height, radius, filter, nThreads);
+        int c2 = gray? (bytesPerPixel < 3? bytesPerPixel : 3) : c+1;
+        for (int cc = c; cc < c2; cc++) {
+            p = pixels+cc;
+            for (int i = 0; i < n; i++, p += bytesPerPixel)
+                *p = dst[i];
+        }
+    }
+}
@@ -0,0 +1,277 @@
+// Capture.cpp - record frame sequences: asynchronous readback, bounded queue, background writer
+
+#include <glad.h>
+#include "Capture.h"
+#include "Misc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#define NULL_DEVICE "nul"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+// PNG
+
+namespace {
+
+unsigned int crcTable[256];
+
+unsigned int Crc(unsigned int crc, const unsigned char *buf, size_t n) {
+    if (!crcTable[1])
+        for (unsigned int i = 0; i < 256; i++) {
+            unsigned int c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1? 0xEDB88320u^(c >> 1) : c >> 1;
+            crcTable[i] = c;
+        }
+    for (size_t i = 0; i < n; i++)
+        crc = crcTable[(crc^buf[i]) & 0xFF]^(crc >> 8);
+    return crc;
+}
+
+void Put32(std::vector<unsigned char> &v, unsigned int n) {
+    unsigned char b[] = {(unsigned char) (n >> 24), (unsigned char) (n >> 16), (unsigned char) (n >> 8), (unsigned char) n};
+    v.insert(v.end(), b, b+4);
+}
+
+void Chunk(FILE *out, const char *type, std::vector<unsigned char> &data) {
+    std::vector<unsigned char> head;
+    Put32(head, data.size());
+    head.insert(head.end(), type, type+4);
+    unsigned int crc = Crc(0xFFFFFFFFu, (unsigned char *) type, 4);
+    crc = Crc(crc, data.empty()? NULL : &data[0], data.size())^0xFFFFFFFFu;
+    std::vector<unsigned char> tail;
+    Put32(tail, crc);
+    fwrite(&head[0], 1, head.size(), out);
+    if (!data.empty())
+        fwrite(&data[0], 1, data.size(), out);
+    fwrite(&tail[0], 1, 4, out);
+}
+
+} // end namespace
+
+bool WritePNG(const char *filename, unsigned char *bgr, int width, int height) {
+    // stored (uncompressed) deflate blocks keep the writer fast; size is that of a Targa
+    FILE *out = fopen(filename, "wb");
+    if (!out) {
+        printf("can't save %s\n", filename);
+        return false;
+    }
+    unsigned char signature[] = {137, 80, 78, 71, 13, 10, 26, 10};
+    fwrite(signature, 1, 8, out);
+    std::vector<unsigned char> header;
+    Put32(header, width);
+    Put32(header, height);
+    unsigned char rest[] = {8, 2, 0, 0, 0}; // 8 bits, RGB, deflate, no filter, no interlace
+    header.insert(header.end(), rest, rest+5);
+    Chunk(out, "IHDR", header);
+    // scanlines top row first, filter byte 0, RGB
+    int rowSize = 1+3*width;
+    std::vector<unsigned char> raw(rowSize*height);
+    for (int y = 0; y < height; y++) {
+        unsigned char *dst = &raw[y*rowSize], *src = bgr+3*width*(height-1-y);
+        *dst++ = 0;
+        for (int x = 0; x < width; x++, src += 3) {
+            *dst++ = src[2];
+            *dst++ = src[1];
+            *dst++ = src[0];
+        }
+    }
+    // zlib stream of stored blocks, each at most 65535 bytes
+    std::vector<unsigned char> z;
+    z.reserve(raw.size()+raw.size()/65535*5+16);
+    z.push_back(0x78);
+    z.push_back(0x01);
+    size_t n = raw.size();
+    for (size_t i = 0; i < n || i == 0; ) {
+        size_t len = n-i < 65535? n-i : 65535;
+        z.push_back(i+len == n? 1 : 0);
+        unsigned char lens[] = {(unsigned char) len, (unsigned char) (len >> 8), (unsigned char) ~len, (unsigned char) (~len >> 8)};
+        z.insert(z.end(), lens, lens+4);
+        z.insert(z.end(), raw.begin()+i, raw.begin()+i+len);
+        i += len;
+        if (!n)
+            break;
+    }
+    unsigned int a = 1, b = 0;
+    for (size_t i = 0; i < n; i++) {
+        a = (a+raw[i])%65521;
+        b = (b+a)%65521;
+    }
+    Put32(z, (b << 16) | a);
+    Chunk(out, "IDAT", z);
+    std::vector<unsigned char> none;
+    Chunk(out, "IEND", none);
+    fclose(out);
+    return true;
+}
+
+// Capture
+
+FrameCapture::FrameCapture() : readback(3), maxQueued(16), nCaptured(0), nStalls(0), nAllocated(0),
+    maxBytes((size_t) 1024 << 20), nBytes(0), active(false), stopping(false), format(CaptureTarga), fps(60), pipe(NULL), pipeWidth(0), pipeHeight(0) { }
+
+FrameCapture::~FrameCapture() {
+    // GL buffers are released by Stop, while the context is current
+    if (writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        queueChanged.notify_all();
+        writer.join();
+    }
+    for (size_t i = 0; i < pool.size(); i++)
+        delete pool[i];
+}
+
+bool FrameCapture::Start(const char *pre, CaptureFormat fmt, int framesPerSecond, int maxQ, int maxMegabytes) {
+    if (active)
+        Stop();
+    prefix = pre;
+    format = fmt;
+    fps = framesPerSecond;
+    maxQueued = maxQ < 1? 1 : maxQ;
+    maxBytes = (size_t) (maxMegabytes < 0? 0 : maxMegabytes) << 20;
+    nCaptured = nStalls = 0;
+    stopping = false;
+    if (format == CaptureFFmpeg) {
+        char command[200];
+        sprintf(command, "ffmpeg -version > %s 2>&1", NULL_DEVICE);
+        if (system(command) != 0) {
+            printf("FrameCapture: ffmpeg not found, writing Targa files\n");
+            format = CaptureTarga;
+        }
+    }
+    writer = std::thread(&FrameCapture::Write, this);
+    active = true;
+    return true;
+}
+
+void FrameCapture::Frame() {
+    if (!active)
+        return;
+    int vp[4];
+    glGetIntegerv(GL_VIEWPORT, vp);
+    readback.Request(vp[0], vp[1], vp[2], vp[3], Receive, this);
+    readback.Poll();
+}
+
+void FrameCapture::Receive(unsigned char *bgr, int width, int height, void *capture) {
+    ((FrameCapture *) capture)->Push(bgr, width, height);
+}
+
+void FrameCapture::Push(unsigned char *bgr, int width, int height) {
+    // copy mapped pixels to a free buffer and queue it; if the writer has fallen behind, grow the pool
+    // while under the memory cap, else wait
+    size_t frameBytes = (size_t) 3*width*height;
+    std::unique_lock<std::mutex> lock(mutex);
+    auto room = [&] { return (int) queue.size() < maxQueued || !pool.empty() || nBytes+frameBytes <= maxBytes; };
+    if (!room()) {
+        nStalls++;
+        queueChanged.wait(lock, room);
+    }
+    Image *image = NULL;
+    if (pool.empty()) {
+        image = new Image;
+        nAllocated++;
+    }
+    else {
+        image = pool.front();
+        pool.pop_front();
+    }
+    size_t capacity = image->bgr.capacity();
+    lock.unlock();
+    image->bgr.assign(bgr, bgr+frameBytes);
+    image->width = width;
+    image->height = height;
+    lock.lock();
+    nBytes += image->bgr.capacity()-capacity;
+    image->number = nCaptured++;
+    queue.push_back(image);
+    lock.unlock();
+    queueChanged.notify_all();
+}
+
+void FrameCapture::Write() {
+    for (;;) {
+        std::unique_lock<std::mutex> lock(mutex);
+        queueChanged.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty())
+            break; // stopping and drained
+        Image *image = queue.front();
+        queue.pop_front();
+        lock.unlock();
+        queueChanged.notify_all();
+        WriteImage(image);
+        lock.lock();
+        pool.push_back(image);
+        lock.unlock();
+        queueChanged.notify_all(); // a free buffer, for a Push waiting at the memory cap
+    }
+    if (pipe)
+        pclose(pipe);
+    pipe = NULL;
+}
+
+bool FrameCapture::WriteImage(Image *image) {
+    char filename[500];
+    if (format == CaptureFFmpeg) {
+        if (!pipe) {
+            // raw frames are bottom row first, so flip vertically
+            char command[1000];
+            sprintf(command, "ffmpeg -loglevel error -y -f rawvideo -pix_fmt bgr24 -s %ix%i -r %i -i - "
+                "-vf vflip -c:v libx264 -preset veryfast -pix_fmt yuv420p \"%s.mp4\"",
+                image->width, image->height, fps, prefix.c_str());
+#ifdef _WIN32
+            pipe = popen(command, "wb");
+#else
+            pipe = popen(command, "w");
+#endif
+            if (!pipe) {
+                printf("FrameCapture: can't run ffmpeg, writing Targa files\n");
+                format = CaptureTarga;
+                return WriteImage(image);
+            }
+            pipeWidth = image->width;
+            pipeHeight = image->height;
+        }
+        if (image->width != pipeWidth || image->height != pipeHeight) {
+            printf("FrameCapture: frame %i size changed, skipped\n", image->number);
+            return false;
+        }
+        size_t size = image->bgr.size();
+        return fwrite(&image->bgr[0], 1, size, pipe) == size;
+    }
+    sprintf(filename, "%s%04i.%s", prefix.c_str(), image->number, format == CapturePNG? "png" : "tga");
+    return format == CapturePNG?
+        WritePNG(filename, &image->bgr[0], image->width, image->height) :
+        WriteTarga(filename, &image->bgr[0], image->width, image->height);
+}
+
+void FrameCapture::Stop() {
+    if (!active)
+        return;
+    readback.Free(); // delivers pending reads
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queueChanged.notify_all();
+    writer.join();
+    active = false;
+    printf("FrameCapture: %i frames, %i stalls, %i buffers (%.0f MB)\n", nCaptured, nStalls, nAllocated, nBytes/1048576.);
+}
+
+bool FrameCapture::Active() { return active; }
+
+int FrameCapture::Captured() { return nCaptured; }
+
+int FrameCapture::Stalls() { return nStalls; }
+
+CaptureFormat FrameCapture::Format() { return format; }
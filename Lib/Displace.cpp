@@ -0,0 +1,230 @@
+// Displace.cpp - bake displaced sphere/tube/quad meshes from height fields on the CPU, for contexts without tessellation
+
+#include "Displace.h"
+#include "Parallel.h"
+#include <math.h>
+
+// Shapes
+
+void ShapePoint(DisplaceShape shape, float u, float v, vec3 &p, vec3 &n) {
+    if (shape == DisplaceBall) {
+        // u is longitude, v is latitude (-PI/2 at v = 0, PI/2 at v = 1)
+        float _PI = 3.141592f, elevation = -_PI/2+_PI*v, eFactor = cos(elevation), angle = 2*_PI*(1-u);
+        n = vec3(eFactor*cos(angle), sin(elevation), eFactor*sin(angle));
+        p = .75f*n;
+    }
+    else if (shape == DisplaceTube) {
+        float c = cos(2*3.1415f*u), s = sin(2*3.1415f*u);
+        p = vec3(-1+2*v, .4f*c, .4f*s);
+        n = vec3(0, c, s);
+    }
+    else {
+        p = vec3(2*u-1, 2*v-1, 0);
+        n = vec3(0, 0, 1);
+    }
+}
+
+float SampleHeight(unsigned char *heights, int width, int height, int bytesPerPixel, float u, float v) {
+    // texel centers at (i+.5)/width, as GL
+    float x = u*width-.5f, y = v*height-.5f, fx = floor(x), fy = floor(y), ax = x-fx, ay = y-fy;
+    int i0 = (int) fx%width, j0 = (int) fy%height;
+    i0 += i0 < 0? width : 0;
+    j0 += j0 < 0? height : 0;
+    int i1 = i0+1 < width? i0+1 : 0, j1 = j0+1 < height? j0+1 : 0;
+    auto h = [&](int i, int j) { return (float) heights[bytesPerPixel*(j*width+i)]; };
+    float bottom = h(i0, j0)+ax*(h(i1, j0)-h(i0, j0)), top = h(i0, j1)+ax*(h(i1, j1)-h(i0, j1));
+    return (bottom+ay*(top-bottom))/255.f;
+}
+
+// Baking
+
+namespace {
+
+template <class F> void ParallelRows(int nRows, int nThreads, F f) {
+    ParallelFor(0, nRows, 1, nThreads, [&](int b, int e) {
+        for (int row = b; row < e; row++)
+            f(row);
+    });
+}
+
+class Baker {
+public:
+    unsigned char *heights;
+    int width, height, bytesPerPixel;
+    BakeOptions options;
+    float du, dv;                       // field normals: central differences this far apart
+    vec3 P(float u, float v, vec3 *normal = NULL) {
+        vec3 p, n;
+        ShapePoint(options.shape, u, v, p, n);
+        if (normal)
+            *normal = n;
+        return p+options.displaceScale*SampleHeight(heights, width, height, bytesPerPixel, u, v)*n;
+    }
+    void Vertex(float u, float v, vec3 &p, vec3 &n) {
+        p = P(u, v, &n);
+        if (options.fieldNormals) {
+            // as NormalFromField in the tessellation evaluation shader; shape normal where degenerate (poles)
+            vec3 pu = P(u+du < 1? u+du : 1, v)-P(u-du > 0? u-du : 0, v);
+            vec3 pv = P(u, v+dv < 1? v+dv : 1)-P(u, v-dv > 0? v-dv : 0);
+            vec3 c = cross(pu, pv);
+            float len = length(c);
+            if (len > 1e-12f)
+                n = c/len;
+        }
+    }
+    int EdgeLevel(vec2 a, vec2 b) {
+        // length of the displaced edge (through 5 samples), scaled up by its height deviation
+        // a, b in the same order for both patches sharing the edge: the same level, bit for bit
+        if (options.edgeLength <= 0)
+            return options.maxLevel;
+        float len = 0, h[5], mean = 0, variance = 0;
+        vec3 prev;
+        for (int i = 0; i < 5; i++) {
+            vec2 uv = a+(b-a)*(i/4.f);
+            vec3 p, n;
+            ShapePoint(options.shape, uv.x, uv.y, p, n);
+            mean += (h[i] = SampleHeight(heights, width, height, bytesPerPixel, uv.x, uv.y))/5;
+            p = p+options.displaceScale*h[i]*n;
+            if (i > 0)
+                len += length(p-prev);
+            prev = p;
+        }
+        for (int i = 0; i < 5; i++)
+            variance += (h[i]-mean)*(h[i]-mean)/5;
+        float level = ceil(len/options.edgeLength*(1+options.detail*options.displaceScale*sqrt(variance)));
+        return level < 1? 1 : level > options.maxLevel? options.maxLevel : (int) level;
+    }
+};
+
+void Zipper(int *inner, float *innerT, int nInner, int *outer, float *outerT, int nOuter, bool flip, int3 *&t) {
+    // triangulate the strip between an inner and an outer polyline, each ordered by parameter t
+    // flip: outer on the left of the direction of travel (in uv), so that all triangles are ccw
+    for (int i = 0, j = 0; i < nInner-1 || j < nOuter-1; ) {
+        bool advanceOuter = i == nInner-1 || (j < nOuter-1 && outerT[j+1] < innerT[i+1]);
+        int3 tri = advanceOuter? int3(outer[j], outer[j+1], inner[i]) : int3(outer[j], inner[i+1], inner[i]);
+        *t++ = flip? int3(tri.i3, tri.i2, tri.i1) : tri;
+        advanceOuter? j++ : i++;
+    }
+}
+
+} // end namespace
+
+int BakeDisplacedMesh(unsigned char *heights, int width, int height, int bytesPerPixel, BakeOptions &options,
+                      vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles,
+                      int nThreads) {
+    int n = options.patches < 1? 1 : options.patches, nCorners = (n+1)*(n+1);
+    Baker b;
+    b.heights = heights;
+    b.width = width;
+    b.height = height;
+    b.bytesPerPixel = bytesPerPixel;
+    b.options = options;
+    b.options.maxLevel = options.maxLevel < 1? 1 : options.maxLevel;
+    b.du = 1.f/(float) (n*b.options.maxLevel);
+    b.dv = b.du;
+    b.du = b.du > 1.f/width? b.du : 1.f/width;
+    b.dv = b.dv > 1.f/height? b.dv : 1.f/height;
+    auto Param = [n](int i) { return (float) i/n; };
+    // levels: horizontal edges (constant v) [j*n+i], vertical edges (constant u) [i*n+j], patch midlines [j*n+i]
+    vector<int> hLevel((n+1)*n), vLevel((n+1)*n), midU(n*n), midV(n*n);
+    ParallelRows(n+1, nThreads, [&](int j) {
+        for (int i = 0; i < n; i++) {
+            hLevel[j*n+i] = b.EdgeLevel(vec2(Param(i), Param(j)), vec2(Param(i+1), Param(j)));
+            vLevel[j*n+i] = b.EdgeLevel(vec2(Param(j), Param(i)), vec2(Param(j), Param(i+1)));
+            if (j < n) {
+                float um = .5f*(Param(i)+Param(i+1)), vm = .5f*(Param(j)+Param(j+1));
+                midU[j*n+i] = b.EdgeLevel(vec2(Param(i), vm), vec2(Param(i+1), vm));
+                midV[j*n+i] = b.EdgeLevel(vec2(um, Param(j)), vec2(um, Param(j+1)));
+            }
+        }
+    });
+    // inner levels (at least 2: one interior vertex), then vertex and triangle offsets
+    // vertices: corners [j*(n+1)+i], interiors of horizontal edges, of vertical edges, of patches
+    vector<int> nu(n*n), nv(n*n), hBase((n+1)*n), vBase((n+1)*n), pBase(n*n), tBase(n*n);
+    int nVertices = nCorners, nTriangles = 0;
+    for (int e = 0; e < (n+1)*n; e++) {
+        hBase[e] = nVertices;
+        nVertices += hLevel[e]-1;
+    }
+    for (int e = 0; e < (n+1)*n; e++) {
+        vBase[e] = nVertices;
+        nVertices += vLevel[e]-1;
+    }
+    for (int j = 0; j < n; j++)
+        for (int i = 0; i < n; i++) {
+            int k = j*n+i, bottom = hLevel[j*n+i], top = hLevel[(j+1)*n+i], left = vLevel[i*n+j], right = vLevel[(i+1)*n+j];
+            int a = bottom > top? bottom : top, c = left > right? left : right;
+            a = a > midU[k]? a : midU[k];
+            c = c > midV[k]? c : midV[k];
+            nu[k] = a < 2? 2 : a;
+            nv[k] = c < 2? 2 : c;
+            pBase[k] = nVertices;
+            nVertices += (nu[k]-1)*(nv[k]-1);
+            tBase[k] = nTriangles;
+            nTriangles += 2*(nu[k]-2)*(nv[k]-2)+2*(nu[k]-2)+2*(nv[k]-2)+bottom+top+left+right;
+        }
+    points.resize(nVertices);
+    normals.resize(nVertices);
+    uvs.resize(nVertices);
+    triangles.resize(nTriangles);
+    auto SetVertex = [&](int id, float u, float v) {
+        b.Vertex(u, v, points[id], normals[id]);
+        uvs[id] = vec2(u, v);
+    };
+    // each row of patches sets its corners and edges below and to the left (the last row and column: above, right too)
+    ParallelRows(n, nThreads, [&](int j) {
+        vector<int> inner, outer;
+        vector<float> innerT, outerT;
+        for (int jj = j; jj <= (j == n-1? n : j); jj++)
+            for (int i = 0; i <= n; i++) {
+                SetVertex(jj*(n+1)+i, Param(i), Param(jj));
+                if (i < n)
+                    for (int k = 1; k < hLevel[jj*n+i]; k++)
+                        SetVertex(hBase[jj*n+i]+k-1, Param(i)+(Param(i+1)-Param(i))*((float) k/hLevel[jj*n+i]), Param(jj));
+            }
+        for (int i = 0; i <= n; i++)
+            for (int k = 1; k < vLevel[i*n+j]; k++)
+                SetVertex(vBase[i*n+j]+k-1, Param(i), Param(j)+(Param(j+1)-Param(j))*((float) k/vLevel[i*n+j]));
+        for (int i = 0; i < n; i++) {
+            int p = j*n+i, a = nu[p], c = nv[p];
+            float u0 = Param(i), u1 = Param(i+1), v0 = Param(j), v1 = Param(j+1);
+            auto Inner = [&](int x, int y) { return pBase[p]+(y-1)*(a-1)+x-1; };
+            for (int y = 1; y < c; y++)
+                for (int x = 1; x < a; x++)
+                    SetVertex(Inner(x, y), u0+(u1-u0)*((float) x/a), v0+(v1-v0)*((float) y/c));
+            // interior grid
+            int3 *t = &triangles[tBase[p]];
+            for (int y = 1; y < c-1; y++)
+                for (int x = 1; x < a-1; x++) {
+                    *t++ = int3(Inner(x, y), Inner(x+1, y), Inner(x+1, y+1));
+                    *t++ = int3(Inner(x, y), Inner(x+1, y+1), Inner(x, y+1));
+                }
+            // ring: each side zipped from the inner rectangle to the edge, consecutive sides sharing a corner segment
+            auto Side = [&](bool alongU, int fixed, int level, int base, int corner0, int corner1, bool flip) {
+                int m = alongU? a : c;
+                inner.resize(m-1);
+                innerT.resize(m-1);
+                for (int s = 1; s < m; s++) {
+                    inner[s-1] = alongU? Inner(s, fixed) : Inner(fixed, s);
+                    innerT[s-1] = (float) s/m;
+                }
+                outer.resize(level+1);
+                outerT.resize(level+1);
+                outer[0] = corner0;
+                outer[level] = corner1;
+                for (int s = 0; s <= level; s++) {
+                    if (s > 0 && s < level)
+                        outer[s] = base+s-1;
+                    outerT[s] = (float) s/level;
+                }
+                Zipper(&inner[0], &innerT[0], m-1, &outer[0], &outerT[0], level+1, flip, t);
+            };
+            int c00 = j*(n+1)+i, c10 = c00+1, c01 = c00+n+1, c11 = c01+1;
+            Side(true, 1, hLevel[j*n+i], hBase[j*n+i], c00, c10, false);                    // v = v0
+            Side(false, a-1, vLevel[(i+1)*n+j], vBase[(i+1)*n+j], c10, c11, false);      // u = u1
+            Side(true, c-1, hLevel[(j+1)*n+i], hBase[(j+1)*n+i], c01, c11, true);        // v = v1
+            Side(false, 1, vLevel[i*n+j], vBase[i*n+j], c00, c01, true);                     // u = u0
+        }
+    });
+    return nTriangles;
+}
@@ -8,6 +8,7 @@
 #include <float.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 
 // Screen Mode
@@ -122,25 +123,28 @@ void ScreenLine(float xscreen, float yscreen, mat4 modelview, mat4 persp, vec3 &
 
 // Draw Shader
 
-int drawShader = 0;
+GLuint drawShader = 0;
+mat4 drawView;
 
 const char *drawVShader = R"(
     #version 130
     in vec3 position;
     in vec3 color;
-    out vec3 vColor;
+    in float opacity;
+    in float size;
+    out vec4 vColor;
     uniform mat4 view;
     void main() {
         gl_Position = view*vec4(position, 1);
-        vColor = color;
+        gl_PointSize = size;
+        vColor = vec4(color, opacity);
     }
 )";
 
 const char *drawPShader = R"(
     #version 130
-    in vec3 vColor;
+    in vec4 vColor;
     out vec4 pColor;
-    uniform float opacity = 1;
     uniform int fadeToCenter = 0;
     float Fade(float t) {
         if (t < .95) return 1;
@@ -157,10 +161,10 @@ const char *drawPShader = R"(
     void main() {
         // GL_POINT_SMOOTH deprecated, so calc here
         // needs GL_POINT_SPRITE enabled
-        float o = opacity;
+        float o = vColor.a;
         if (fadeToCenter == 1)
             o *= Fade(DistanceToCenter());
-        pColor = vec4(vColor, o);
+        pColor = vec4(vColor.rgb, o);
     }
 )";
 
@@ -178,70 +182,307 @@ int UseDrawShader() {
 
 int UseDrawShader(mat4 viewMatrix) {
     int was = UseDrawShader();
-    SetUniform(drawShader, "view", viewMatrix);
+    SetUniform(drawShader, "view", drawView = viewMatrix);
     return was;
 }
 
-// Disks
+// Triangles with optional outline
+
+GLuint triShader = 0;
+mat4 triView;
+
+// vertex shader
+const char *triVShaderCode = R"(
+    #version 330 core
+    in vec3 point;
+    in vec3 color;
+    in float opacity;
+    out vec4 vColor;
+    uniform mat4 view;
+    void main() {
+        gl_Position = view*vec4(point, 1);
+        vColor = vec4(color, opacity);
+    }
+)";
+
+// geometry shader with line-drawing
+const char *triGShaderCode = R"(
+    #version 330 core
+    layout (triangles) in;
+    layout (triangle_strip, max_vertices = 3) out;
+    in vec3 vPoint[];
+    in vec4 vColor[];
+    out vec4 gColor;
+    noperspective out vec3 gEdgeDistance;
+    uniform mat4 viewptM;
+    vec3 ViewPoint(int i) {
+        return vec3(viewptM*(gl_in[i].gl_Position/gl_in[i].gl_Position.w));
+    }
+    void main() {
+        float ha = 0, hb = 0, hc = 0;
+        // transform each vertex into viewport space
+        vec3 p0 = ViewPoint(0), p1 = ViewPoint(1), p2 = ViewPoint(2);
+        // find altitudes ha, hb, hc
+        float a = length(p2-p1), b = length(p2-p0), c = length(p1-p0);
+        float alpha = acos((b*b+c*c-a*a)/(2.*b*c));
+        float beta = acos((a*a+c*c-b*b)/(2.*a*c));
+        ha = abs(c*sin(beta));
+        hb = abs(c*sin(alpha));
+        hc = abs(b*sin(alpha));
+        // send triangle vertices and edge distances
+        vec3 edgeDists[3] = { vec3(ha, 0, 0), vec3(0, hb, 0), vec3(0, 0, hc) };
+        for (int i = 0; i < 3; i++) {
+            gEdgeDistance = edgeDists[i];
+            gColor = vColor[i];
+            gl_Position = gl_in[i].gl_Position;
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+)";
+
+// pixel shader
+const char *triPShaderCode = R"(
+    #version 410 core
+    in vec4 gColor;
+    noperspective in vec3 gEdgeDistance;
+    uniform vec4 outlineColor = vec4(0, 0, 0, 1);
+    uniform float outlineWidth = 1;
+    uniform float transition = 1;
+    uniform int outlineOn = 1;
+    out vec4 pColor;
+    void main() {
+        pColor = gColor;
+        if (outlineOn > 0) {
+            float minDist = min(gEdgeDistance.x, min(gEdgeDistance.y, gEdgeDistance.z));
+            float t = smoothstep(outlineWidth-transition, outlineWidth+transition, minDist);
+            if (outlineOn == 2) pColor = vec4(1,1,1,1);
+            pColor = mix(outlineColor, pColor, t);
+        }
+    }
+)";
+
+ void UseTriangleShader() {
+    bool init = triShader == 0;
+    if (init)
+        triShader = LinkProgramViaCode(&triVShaderCode, NULL, NULL, &triGShaderCode, &triPShaderCode);
+    glUseProgram(triShader);
+    if (init)
+        SetUniform(triShader, "view", mat4());
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_LINE_SMOOTH);
+}
+
+void UseTriangleShader(mat4 view) {
+    UseTriangleShader();
+    SetUniform(triShader, "view", triView = view);
+}
+
+// Batching
+
+// consecutive primitives with the same shader and state share a batch; a batch is drawn with a single call
+// batches are drawn in submission order, so later primitives still draw over earlier ones
+// outside BeginDrawBatch/EndDrawBatch each primitive is flushed as soon as it is appended
+
+namespace {
+
+struct DrawVertex {
+    vec3 point, color;
+    float opacity, size;    // size used only by points
+};
+
+struct DrawState {
+    GLuint *shader;         // &drawShader or &triShader
+    GLenum mode;            // GL_POINTS, GL_LINES, or GL_TRIANGLES
+    float width;            // line width
+    mat4 view;
+    bool outline;           // triangle outline parameters
+    vec4 outlineCol;
+    float outlineWidth, transition;
+    DrawState(GLuint *shader = NULL, GLenum mode = GL_POINTS, float width = 1)
+        : shader(shader), mode(mode), width(width), outline(false), outlineWidth(1), transition(1) {
+            view = shader == &drawShader? drawView : triView;
+    }
+    bool operator == (const DrawState &s) const {
+        if (shader != s.shader || mode != s.mode || width != s.width || outline != s.outline)
+            return false;
+        if (outline && (outlineWidth != s.outlineWidth || transition != s.transition ||
+                        memcmp(&outlineCol, &s.outlineCol, sizeof(vec4))))
+            return false;
+        return !memcmp(&view, &s.view, sizeof(mat4));
+    }
+};
+
+struct DrawBatch {
+    DrawState state;
+    std::vector<DrawVertex> vertices;
+};
+
+std::vector<DrawBatch> batches;             // first nBatches in use; the rest keep their memory
+std::vector<DrawVertex> staging;
+int nBatches = 0, batchDepth = 0;
+
+// vertex stream: appended to until full, then orphaned, so the GPU never waits on the CPU
+
+GLuint streamBuffer = 0;
+int streamSize = 1 << 20, streamOffset = 0;
+
+int StreamVertices(DrawVertex *v, int nVertices) {
+    // copy vertices to stream buffer, return index of first vertex
+    int nBytes = nVertices*sizeof(DrawVertex);
+    if (!streamBuffer)
+        glGenBuffers(1, &streamBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, streamBuffer);
+    if (!streamOffset || streamOffset+nBytes > streamSize) {
+        while (nBytes > streamSize)
+            streamSize *= 2;
+        glBufferData(GL_ARRAY_BUFFER, streamSize, NULL, GL_STREAM_DRAW);
+        streamOffset = 0;
+    }
+    void *dst = glMapBufferRange(GL_ARRAY_BUFFER, streamOffset, nBytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (dst) {
+        memcpy(dst, v, nBytes);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    else
+        glBufferSubData(GL_ARRAY_BUFFER, streamOffset, nBytes, v);
+    int first = streamOffset/sizeof(DrawVertex);
+    streamOffset += nBytes;
+    // keep offset a multiple of vertex size
+    streamOffset = sizeof(DrawVertex)*((streamOffset+sizeof(DrawVertex)-1)/sizeof(DrawVertex));
+    return first;
+}
+
+DrawVertex *Append(DrawState &s, int nVertices) {
+    // return pointer to nVertices new vertices, in the last batch if its state is s, else in a new batch
+    int b = nBatches > 0 && batches[nBatches-1].state == s? nBatches-1 : -1;
+    if (b < 0) {
+        if (nBatches == (int) batches.size())
+            batches.resize(nBatches+1);
+        b = nBatches++;
+        batches[b].state = s;
+        batches[b].vertices.resize(0);
+    }
+    std::vector<DrawVertex> &v = batches[b].vertices;
+    size_t n = v.size();
+    v.resize(n+nVertices);
+    return &v[n];
+}
+
+void SetVertex(DrawVertex *v, vec3 p, vec3 c, float opacity, float size = 1) {
+    v->point = p;
+    v->color = c;
+    v->opacity = opacity;
+    v->size = size;
+}
+
+void SetAttributes(GLuint shader, const char *pointName, int firstVertex) {
+    char *base = (char *) 0+firstVertex*sizeof(DrawVertex);
+    int stride = sizeof(DrawVertex);
+    VertexAttribPointer(shader, pointName, 3, stride, base);
+    VertexAttribPointer(shader, "color", 3, stride, base+sizeof(vec3));
+    VertexAttribPointer(shader, "opacity", 1, stride, base+2*sizeof(vec3));
+    if (shader == drawShader)
+        VertexAttribPointer(shader, "size", 1, stride, base+2*sizeof(vec3)+sizeof(float));
+}
+
+void Flush() {
+    if (!nBatches)
+        return;
+    // one upload for all batches
+    std::vector<int> starts(nBatches);
+    staging.resize(0);
+    for (int i = 0; i < nBatches; i++) {
+        std::vector<DrawVertex> &v = batches[i].vertices;
+        starts[i] = (int) staging.size();
+        staging.insert(staging.end(), v.begin(), v.end());
+    }
+    int nVertices = (int) staging.size();
+    int first = StreamVertices(&staging[0], nVertices);
+    // one draw per batch
+    GLuint current = 0;
+    for (int i = 0; i < nBatches; i++) {
+        DrawBatch &b = batches[i];
+        DrawState &s = b.state;
+        if (b.vertices.empty())
+            continue;
+        if (*s.shader != current || i == 0) {
+            if (s.shader == &drawShader)
+                UseDrawShader();
+            else {
+                UseTriangleShader();
+                SetUniform(triShader, "viewptM", Viewport());
+            }
+            current = *s.shader;
+            SetAttributes(current, current == drawShader? "position" : "point", first);
+        }
+        SetUniform(current, "view", s.view);
+        if (current == drawShader) {
+            bool points = s.mode == GL_POINTS;
+            SetUniform(drawShader, "fadeToCenter", points? 1 : 0);
+            if (points) {
+                glEnable(GL_PROGRAM_POINT_SIZE);
+                glEnable(0x8861); // GL_POINT_SPRITE, for gl_PointCoord [this is a 4.5 core bug]
+            }
+        }
+        else {
+            SetUniform(triShader, "outlineOn", s.outline? 1 : 0);
+            SetUniform(triShader, "outlineColor", s.outlineCol);
+            SetUniform(triShader, "outlineWidth", s.outlineWidth);
+            SetUniform(triShader, "transition", s.transition);
+        }
+        if (s.mode == GL_LINES)
+            glLineWidth(s.width);
+        glDrawArrays(s.mode, starts[i], b.vertices.size());
+        if (s.mode == GL_POINTS)
+            glDisable(GL_PROGRAM_POINT_SIZE);
+    }
+    // leave shader views as last set by the application
+    if (current == drawShader)
+        SetUniform(drawShader, "view", drawView);
+    else
+        SetUniform(triShader, "view", triView);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    for (int i = 0; i < nBatches; i++)
+        batches[i].vertices.resize(0);
+    nBatches = 0;
+}
+
+void Appended() {
+    if (!batchDepth)
+        Flush();
+}
+
+} // end namespace
 
-GLuint diskBuffer = -1;
+void BeginDrawBatch() { batchDepth++; }
+
+void EndDrawBatch() {
+    if (batchDepth > 0 && --batchDepth == 0)
+        Flush();
+}
+
+// Disks
 
 void Disk(vec3 p, float diameter, vec3 color, float opacity) {
     // diameter should be >= 0, <= 20
     UseDrawShader();
-    // create buffer for single vertex (x,y,z,r,g,b)
-    if (diskBuffer < 0) {
-        glGenBuffers(1, &diskBuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, diskBuffer);
-        int bufferSize = 6*sizeof(float);
-        glBufferData(GL_ARRAY_BUFFER, bufferSize, NULL, GL_STATIC_DRAW);
-    }
-    glBindBuffer(GL_ARRAY_BUFFER, diskBuffer); // set active buffer
-    // allocate buffer memory and load location and color data
-    glBufferData(GL_ARRAY_BUFFER, 6*sizeof(float), NULL, GL_STATIC_DRAW); // *** needed??
-    glBufferSubData(GL_ARRAY_BUFFER, 0, 3*sizeof(float), &p.x);
-    glBufferSubData(GL_ARRAY_BUFFER, 3*sizeof(float), 3*sizeof(float), &color.x);
-    // connect shader inputs
-    VertexAttribPointer(drawShader, "position", 3, 0, (void *) 0);
-    VertexAttribPointer(drawShader, "color", 3, 0, (void *) sizeof(vec3));
-    // draw
-    SetUniform(drawShader, "opacity", opacity);
-    glPointSize(diameter);
-#if defined(GL_POINT_SMOOTH)
-    glEnable(GL_POINT_SMOOTH);
-#elseif defined(GL_POINT_SPRITE)
-    glEnable(GL_POINT_SPRITE);
-#else
-    glEnable(0x8861); // same as GL_POINT_SMOOTH [this is a 4.5 core bug]
-    SetUniform(drawShader, "fadeToCenter", 1); // needed if GL_POINT_SMOOTH and GL_POINT_SPRITE fail
-#endif
-    glDrawArrays(GL_POINTS, 0, 1);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    DrawState s(&drawShader, GL_POINTS, 0);
+    SetVertex(Append(s, 1), p, color, opacity, diameter);
+    Appended();
 }
 
 // Lines
 
-GLuint lineBuffer = -1;
-
 void Line(vec3 p1, vec3 p2, float width, vec3 col1, vec3 col2, float opacity) {
     UseDrawShader();
-    // create a vertex buffer for the array
-    vec3 data[] = {p1, p2, col1, col2};
-    if (lineBuffer <= 0)
-        glGenBuffers(1, &lineBuffer);
-    // set active vertex buffer, load location and color data
-    glBindBuffer(GL_ARRAY_BUFFER, lineBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
-    // connect shader inputs, set uniforms
-    VertexAttribPointer(drawShader, "position", 3, 0, (void *) 0);
-    VertexAttribPointer(drawShader, "color", 3, 0, (void *) (2*sizeof(vec3))); // sizeof(points));
-    SetUniform(drawShader, "fadeToCenter", 0);  // gl_PointCoord fails for lines (instead, use GL_LINE_SMOOTH)
-    SetUniform(drawShader, "opacity", opacity);
-    // draw
-    glLineWidth(width);
-    glDrawArrays(GL_LINES, 0, 2);
-    // cleanup
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    DrawState s(&drawShader, GL_LINES, width);
+    DrawVertex *v = Append(s, 2);
+    SetVertex(v, p1, col1, opacity);
+    SetVertex(v+1, p2, col2, opacity);
+    Appended();
 }
 
 void Line(vec3 p1, vec3 p2, float width, vec3 col, float opacity) {
@@ -262,50 +503,40 @@ void Line(int x1, int y1, int x2, int y2, float width, vec3 col, float opacity)
     Line(p1, p2, width, col, col, opacity);
 }
 
-GLuint lineStripBuffer = 0;
-
 void LineStrip(int nPoints, vec3 *points, vec3 &color, float opacity, float width) {
-    if (!lineStripBuffer)
-        glGenBuffers(1, &lineStripBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, lineStripBuffer);
-    int pSize = nPoints*sizeof(vec3);
-    std::vector<vec3> colors(nPoints, color);
-    glBufferData(GL_ARRAY_BUFFER, 2*pSize, NULL, GL_STATIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, pSize, points);
-    glBufferSubData(GL_ARRAY_BUFFER, pSize, pSize, &colors[0]);
-    VertexAttribPointer(drawShader, "position", 3, 0, (void *) 0);
-    VertexAttribPointer(drawShader, "color", 3, 0, (void *) pSize);
-    SetUniform(drawShader, "fadeToCenter", 0);
-    SetUniform(drawShader, "opacity", opacity);
-    glLineWidth(width);
-    glDrawArrays(GL_LINE_STRIP, 0, nPoints);
+    // as separate segments, so strips batch with other lines
+    if (nPoints < 2)
+        return;
+    UseDrawShader();
+    DrawState s(&drawShader, GL_LINES, width);
+    DrawVertex *v = Append(s, 2*(nPoints-1));
+    for (int i = 1; i < nPoints; i++) {
+        SetVertex(v++, points[i-1], color, opacity);
+        SetVertex(v++, points[i], color, opacity);
+    }
+    Appended();
 }
 
 // Quads
 
-GLuint quadBuffer = 0;
-
 void Quad(vec3 p1, vec3 p2, vec3 p3, vec3 p4, bool solid, vec3 col, float opacity, float lineWidth) {
-#ifndef GL_QUADS
-	Triangle(p1, p2, p3, col, col, col, opacity, !solid, col, lineWidth);
-	Triangle(p1, p3, p4, col, col, col, opacity, !solid, col, lineWidth);
-#else
-    vec3 data[] = { p1, p2, p3, p4, col, col, col, col };
+    // as two triangles or four line segments (GL_QUADS is not core)
     UseDrawShader();
-    if (quadBuffer == 0) {
-        glGenBuffers(1, &quadBuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, quadBuffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(data), NULL, GL_STATIC_DRAW);
+    if (solid) {
+        DrawState s(&drawShader, GL_TRIANGLES, 0);
+        DrawVertex *v = Append(s, 6);
+        vec3 p[] = {p1, p2, p3, p1, p3, p4};
+        for (int i = 0; i < 6; i++)
+            SetVertex(v+i, p[i], col, opacity);
+    }
+    else {
+        DrawState s(&drawShader, GL_LINES, lineWidth);
+        DrawVertex *v = Append(s, 8);
+        vec3 p[] = {p1, p2, p2, p3, p3, p4, p4, p1};
+        for (int i = 0; i < 8; i++)
+            SetVertex(v+i, p[i], col, opacity);
     }
-    glBindBuffer(GL_ARRAY_BUFFER, quadBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
-    VertexAttribPointer(drawShader, "position", 3, 0, (void *) 0);
-    VertexAttribPointer(drawShader, "color", 3, 0, (void *) (4*sizeof(vec3)));
-    SetUniform(drawShader, "opacity", opacity);
-    SetUniform(drawShader, "fadeToCenter", 0);
-    glLineWidth(lineWidth);
-    glDrawArrays(solid? GL_QUADS : GL_LINE_LOOP, 0, 4);
-#endif
+    Appended();
 }
 
 // Arrows
@@ -419,112 +650,19 @@ void Cylinder(vec3 p1, vec3 p2, float r1, float r2, mat4 modelview, mat4 persp,
 	glDrawArrays(GL_PATCHES, 0, 4);
 }
 
-// Triangles with optional outline
-
-GLuint triShader = 0, triBuffer = 0;
-
-// vertex shader
-const char *triVShaderCode = R"(
-    #version 330 core
-    in vec3 point;
-    in vec3 color;
-    out vec3 vColor;
-    uniform mat4 view;
-    void main() {
-        gl_Position = view*vec4(point, 1);
-        vColor = color;
-    }
-)";
-
-// geometry shader with line-drawing
-const char *triGShaderCode = R"(
-    #version 330 core
-    layout (triangles) in;
-    layout (triangle_strip, max_vertices = 3) out;
-    in vec3 vPoint[];
-    in vec3 vColor[];
-    out vec3 gColor;
-    noperspective out vec3 gEdgeDistance;
-    uniform mat4 viewptM;
-    vec3 ViewPoint(int i) {
-        return vec3(viewptM*(gl_in[i].gl_Position/gl_in[i].gl_Position.w));
-    }
-    void main() {
-        float ha = 0, hb = 0, hc = 0;
-        // transform each vertex into viewport space
-        vec3 p0 = ViewPoint(0), p1 = ViewPoint(1), p2 = ViewPoint(2);
-        // find altitudes ha, hb, hc
-        float a = length(p2-p1), b = length(p2-p0), c = length(p1-p0);
-        float alpha = acos((b*b+c*c-a*a)/(2.*b*c));
-        float beta = acos((a*a+c*c-b*b)/(2.*a*c));
-        ha = abs(c*sin(beta));
-        hb = abs(c*sin(alpha));
-        hc = abs(b*sin(alpha));
-        // send triangle vertices and edge distances
-        vec3 edgeDists[3] = { vec3(ha, 0, 0), vec3(0, hb, 0), vec3(0, 0, hc) };
-        for (int i = 0; i < 3; i++) {
-            gEdgeDistance = edgeDists[i];
-            gColor = vColor[i];
-            gl_Position = gl_in[i].gl_Position;
-            EmitVertex();
-        }
-        EndPrimitive();
-    }
-)";
-
-// pixel shader
-const char *triPShaderCode = R"(
-    #version 410 core
-    in vec3 gColor;
-    noperspective in vec3 gEdgeDistance;
-    uniform vec4 outlineColor = vec4(0, 0, 0, 1);
-    uniform float opacity = 1;
-    uniform float outlineWidth = 1;
-    uniform float transition = 1;
-    uniform int outlineOn = 1;
-    out vec4 pColor;
-    void main() {
-        pColor = vec4(gColor, opacity);
-        if (outlineOn > 0) {
-            float minDist = min(gEdgeDistance.x, min(gEdgeDistance.y, gEdgeDistance.z));
-            float t = smoothstep(outlineWidth-transition, outlineWidth+transition, minDist);
-            if (outlineOn == 2) pColor = vec4(1,1,1,1);
-            pColor = mix(outlineColor, pColor, t);
-        }
-    }
-)";
-
- void UseTriangleShader() {
-    bool init = triShader == 0;
-    if (init)
-        triShader = LinkProgramViaCode(&triVShaderCode, NULL, NULL, &triGShaderCode, &triPShaderCode);
-    glUseProgram(triShader);
-    if (init)
-        SetUniform(triShader, "view", mat4());
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glEnable(GL_LINE_SMOOTH);
-}
-
-void UseTriangleShader(mat4 view) {
-    UseTriangleShader();
-    SetUniform(triShader, "view", view);
-}
+// Triangles
 
 void Triangle(vec3 p1, vec3 p2, vec3 p3, vec3 c1, vec3 c2, vec3 c3,
               float opacity, bool outline, vec4 outlineCol, float outlineWidth, float transition) {
-    vec3 data[] = { p1, p2, p3, c1, c2, c3 };
     UseTriangleShader();
-    if (triBuffer == 0)
-        glGenBuffers(1, &triBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, triBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
-    VertexAttribPointer(triShader, "point", 3, 0, (void *) 0);
-    VertexAttribPointer(triShader, "color", 3, 0, (void *) (3*sizeof(vec3)));
-    SetUniform(triShader, "viewptM", Viewport());
-    SetUniform(triShader, "opacity", opacity);
-    SetUniform(triShader, "outlineOn", outline? 1 : 0);
-    SetUniform(triShader, "outlineWidth", outlineWidth);
-    SetUniform(triShader, "transition", transition);
-    glDrawArrays(GL_TRIANGLES, 0, 3);
+    DrawState s(&triShader, GL_TRIANGLES, 0);
+    s.outline = outline;
+    s.outlineCol = outlineCol;
+    s.outlineWidth = outlineWidth;
+    s.transition = transition;
+    DrawVertex *v = Append(s, 3);
+    SetVertex(v, p1, c1, opacity);
+    SetVertex(v+1, p2, c2, opacity);
+    SetVertex(v+2, p3, c3, opacity);
+    Appended();
 }
@@ -197,6 +197,24 @@ GLuint LinkProgramViaFile(const char *vertexShaderFile, const char *pixelShaderF
 	return LinkProgram(vshader, fshader);
 }
 
+GLuint LinkComputeProgramViaCode(const char **computeCode) {
+	GLuint cshader = CompileShaderViaCode(computeCode, GL_COMPUTE_SHADER), program = 0;
+	if (cshader)
+		program = glCreateProgram();
+	if (program > 0) {
+		glAttachShader(program, cshader);
+		glLinkProgram(program);
+		GLint status;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		if (status == GL_FALSE) {
+			PrintProgramLog(program);
+			glDeleteProgram(program);
+			program = 0;
+		}
+	}
+	return program;
+}
+
 int CurrentProgram() {
 	int program = 0;
 	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
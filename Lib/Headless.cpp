@@ -0,0 +1,232 @@
+// Headless.cpp - offscreen GL context (EGL or OSMesa) rendering into a framebuffer object
+
+#include <glad.h>
+#include "Headless.h"
+#include "Misc.h"
+#include <stdio.h>
+#include <vector>
+
+// EGL and OSMesa are normally present on Linux only; comment out either to build without it
+#if defined(__linux__)
+#define HEADLESS_EGL_OK
+//#define HEADLESS_OSMESA_OK
+#endif
+
+#ifdef HEADLESS_EGL_OK
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#ifdef HEADLESS_OSMESA_OK
+#include <GL/osmesa.h>
+#endif
+
+namespace {
+
+HeadlessAPI api = HeadlessEGL;
+bool initialized = false;
+int width = 0, height = 0;
+GLuint framebuffer = 0, colorBuffer = 0, depthBuffer = 0;
+
+#ifdef HEADLESS_EGL_OK
+EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+EGLContext eglContext = EGL_NO_CONTEXT;
+
+void *EGLProc(const char *name) { return (void *) eglGetProcAddress(name); }
+
+bool InitEGL() {
+    // prefer the surfaceless platform (no X or Wayland server), else the default display
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        eglDisplay = getPlatformDisplay(0x31DD, EGL_DEFAULT_DISPLAY, NULL); // EGL_PLATFORM_SURFACELESS_MESA
+    if (eglDisplay == EGL_NO_DISPLAY)
+        eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    EGLint major, minor;
+    if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, &major, &minor)) {
+        printf("Headless: can't initialize EGL display\n");
+        return false;
+    }
+    EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_DEPTH_SIZE, 24, EGL_NONE};
+    EGLConfig config;
+    EGLint nConfigs = 0;
+    if (!eglChooseConfig(eglDisplay, configAttribs, &config, 1, &nConfigs) || nConfigs < 1) {
+        printf("Headless: no suitable EGL config\n");
+        return false;
+    }
+    eglBindAPI(EGL_OPENGL_API);
+    // the apps use the default vertex array and client-side indices, so ask for a compatibility profile
+    EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4, EGL_CONTEXT_MINOR_VERSION, 5,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT, EGL_NONE};
+    eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+    if (eglContext == EGL_NO_CONTEXT)
+        eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, NULL);
+    if (eglContext == EGL_NO_CONTEXT) {
+        printf("Headless: can't create EGL context\n");
+        return false;
+    }
+    // no surface: all drawing goes to the framebuffer object (EGL_KHR_surfaceless_context)
+    if (!eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext)) {
+        printf("Headless: can't make EGL context current\n");
+        return false;
+    }
+    return gladLoadGLLoader((GLADloadproc) EGLProc) != 0;
+}
+
+void ShutdownEGL() {
+    if (eglDisplay != EGL_NO_DISPLAY) {
+        eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (eglContext != EGL_NO_CONTEXT)
+            eglDestroyContext(eglDisplay, eglContext);
+        eglTerminate(eglDisplay);
+    }
+    eglDisplay = EGL_NO_DISPLAY;
+    eglContext = EGL_NO_CONTEXT;
+}
+#endif
+
+#ifdef HEADLESS_OSMESA_OK
+OSMesaContext osContext = NULL;
+std::vector<unsigned char> osBuffer; // OSMesa requires a default color buffer, though we draw to the FBO
+
+void *OSMesaProc(const char *name) { return (void *) OSMesaGetProcAddress(name); }
+
+bool InitOSMesa() {
+    int attribs[] = {
+        OSMESA_FORMAT, OSMESA_RGBA, OSMESA_DEPTH_BITS, 24,
+        OSMESA_PROFILE, OSMESA_COMPAT_PROFILE, OSMESA_CONTEXT_MAJOR_VERSION, 4, OSMESA_CONTEXT_MINOR_VERSION, 5, 0};
+    osContext = OSMesaCreateContextAttribs(attribs, NULL);
+    if (!osContext)
+        osContext = OSMesaCreateContextExt(OSMESA_RGBA, 24, 0, 0, NULL);
+    if (!osContext) {
+        printf("Headless: can't create OSMesa context\n");
+        return false;
+    }
+    osBuffer.resize(4*width*height);
+    if (!OSMesaMakeCurrent(osContext, &osBuffer[0], GL_UNSIGNED_BYTE, width, height)) {
+        printf("Headless: can't make OSMesa context current\n");
+        return false;
+    }
+    return gladLoadGLLoader((GLADloadproc) OSMesaProc) != 0;
+}
+
+void ShutdownOSMesa() {
+    if (osContext)
+        OSMesaDestroyContext(osContext);
+    osContext = NULL;
+    osBuffer.resize(0);
+}
+#endif
+
+bool AllocateFramebuffer() {
+    if (!framebuffer) {
+        glGenFramebuffers(1, &framebuffer);
+        glGenRenderbuffers(1, &colorBuffer);
+        glGenRenderbuffers(1, &depthBuffer);
+    }
+    glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("Headless: framebuffer incomplete\n");
+        return false;
+    }
+    glViewport(0, 0, width, height);
+    return true;
+}
+
+} // end namespace
+
+bool HeadlessSupported(HeadlessAPI a) {
+#ifdef HEADLESS_EGL_OK
+    if (a == HeadlessEGL)
+        return true;
+#endif
+#ifdef HEADLESS_OSMESA_OK
+    if (a == HeadlessOSMesa)
+        return true;
+#endif
+    return false;
+}
+
+bool HeadlessInit(int w, int h, HeadlessAPI a) {
+    if (initialized)
+        HeadlessShutdown();
+    if (!HeadlessSupported(a)) {
+        printf("Headless: %s support not compiled\n", a == HeadlessEGL? "EGL" : "OSMesa");
+        return false;
+    }
+    api = a;
+    width = w;
+    height = h;
+    bool ok = false;
+#ifdef HEADLESS_EGL_OK
+    if (api == HeadlessEGL)
+        ok = InitEGL();
+#endif
+#ifdef HEADLESS_OSMESA_OK
+    if (api == HeadlessOSMesa)
+        ok = InitOSMesa();
+#endif
+    initialized = ok;
+    if (!ok) {
+        printf("Headless: can't create GL context\n");
+        HeadlessShutdown();
+        return false;
+    }
+    printf("Headless: %s, %s\n", (char *) glGetString(GL_RENDERER), (char *) glGetString(GL_VERSION));
+    return AllocateFramebuffer();
+}
+
+bool HeadlessResize(int w, int h) {
+    if (!initialized)
+        return false;
+    width = w;
+    height = h;
+#ifdef HEADLESS_OSMESA_OK
+    if (api == HeadlessOSMesa) {
+        osBuffer.resize(4*width*height);
+        OSMesaMakeCurrent(osContext, &osBuffer[0], GL_UNSIGNED_BYTE, width, height);
+    }
+#endif
+    return AllocateFramebuffer();
+}
+
+bool HeadlessRead(unsigned char *bgr) {
+    if (!initialized)
+        return false;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, bgr); // Targa is BGR ordered
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    return true;
+}
+
+bool HeadlessWrite(const char *filename) {
+    std::vector<unsigned char> pixels(3*width*height);
+    return HeadlessRead(pixels.data()) && WriteTarga(filename, pixels.data(), width, height);
+}
+
+void HeadlessShutdown() {
+    if (framebuffer) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &framebuffer);
+        GLuint buffers[] = {colorBuffer, depthBuffer};
+        glDeleteRenderbuffers(2, buffers);
+    }
+    framebuffer = colorBuffer = depthBuffer = 0;
+#ifdef HEADLESS_EGL_OK
+    ShutdownEGL();
+#endif
+#ifdef HEADLESS_OSMESA_OK
+    ShutdownOSMesa();
+#endif
+    initialized = false;
+}
@@ -1,6 +1,8 @@
 // Mesh.cpp - mesh IO and operations
 
 #include "Mesh.h"
+#include "Batch.h"
+#include <algorithm>
 #include <assert.h>
 #include <iostream>
 #include <fstream>
@@ -116,53 +118,248 @@ float GetScaleCenter(vec3 &min, vec3 &max, float scale, vec3 &center) {
 	return scale*2.f/maxrange;
 }
 
+// bounding volume hierarchy
+
+namespace {
+
+float HalfArea(vec3 &min, vec3 &max) {
+	vec3 d = max-min;
+	return d.x*d.y+d.y*d.z+d.z*d.x;
+}
+
+bool RayBox(vec3 &origin, vec3 &invDir, vec3 &min, vec3 &max, float tMax, float &tEnter) {
+	float t0 = 0, t1 = tMax;
+	for (int k = 0; k < 3; k++) {
+		float a = (min[k]-origin[k])*invDir[k], b = (max[k]-origin[k])*invDir[k];
+		if (a > b) { float tmp = a; a = b; b = tmp; }
+		t0 = a > t0? a : t0;
+		t1 = b < t1? b : t1;
+		if (t0 > t1)
+			return false;
+	}
+	tEnter = t0;
+	return true;
+}
+
+} // end namespace
+
+int BVH::Split(int n, vector<vec3> &centers, vector<vec3> &mins, vector<vec3> &maxs, int depth) {
+	const int nBins = 12, leafSize = 4;
+	Node &node = nodes[n];
+	int first = node.first, count = node.count;
+	vec3 cmin(FLT_MAX, FLT_MAX, FLT_MAX), cmax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int i = first; i < first+count; i++)
+		UpdateMinMax(centers[order[i]], cmin, cmax);
+	vec3 extent = cmax-cmin;
+	int axis = extent.x > extent.y? (extent.x > extent.z? 0 : 2) : (extent.y > extent.z? 1 : 2);
+	if (count <= leafSize || extent[axis] <= 0 || depth > 60)
+		return n;
+	// bin centroids, sweep for least surface area cost
+	struct Bin { vec3 min, max; int count; } bins[nBins];
+	for (int b = 0; b < nBins; b++) {
+		bins[b].min = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+		bins[b].max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		bins[b].count = 0;
+	}
+	float scale = nBins/extent[axis];
+	for (int i = first; i < first+count; i++) {
+		int t = order[i], b = (int) ((centers[t][axis]-cmin[axis])*scale);
+		Bin &bin = bins[b < nBins? b : nBins-1];
+		UpdateMinMax(mins[t], bin.min, bin.max);
+		UpdateMinMax(maxs[t], bin.min, bin.max);
+		bin.count++;
+	}
+	float rightArea[nBins];
+	int rightCount[nBins];
+	vec3 rmin(FLT_MAX, FLT_MAX, FLT_MAX), rmax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int b = nBins-1, nRight = 0; b > 0; b--) {
+		UpdateMinMax(bins[b].min, rmin, rmax);
+		UpdateMinMax(bins[b].max, rmin, rmax);
+		nRight += bins[b].count;
+		rightArea[b] = nRight? HalfArea(rmin, rmax) : 0;
+		rightCount[b] = nRight;
+	}
+	vec3 lmin(FLT_MAX, FLT_MAX, FLT_MAX), lmax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	float bestCost = FLT_MAX;
+	int bestSplit = -1;
+	for (int b = 1, nLeft = 0; b < nBins; b++) {
+		UpdateMinMax(bins[b-1].min, lmin, lmax);
+		UpdateMinMax(bins[b-1].max, lmin, lmax);
+		nLeft += bins[b-1].count;
+		float cost = (nLeft? nLeft*HalfArea(lmin, lmax) : 0)+rightCount[b]*rightArea[b];
+		if (nLeft && rightCount[b] && cost < bestCost) {
+			bestCost = cost;
+			bestSplit = b;
+		}
+	}
+	if (bestSplit < 0 || bestCost >= count*HalfArea(node.min, node.max))
+		return n;
+	// partition order[first, first+count) about the split plane
+	float plane = cmin[axis]+bestSplit/scale;
+	int *lo = &order[first], *hi = lo+count-1;
+	while (lo <= hi) {
+		if (centers[*lo][axis] < plane)
+			lo++;
+		else
+			std::swap(*lo, *hi--);
+	}
+	int nLeft = lo-&order[first];
+	if (nLeft == 0 || nLeft == count)
+		return n;
+	// children: left immediately follows its parent, right follows the left subtree
+	Node children[2];
+	int ranges[2][2] = {{first, nLeft}, {first+nLeft, count-nLeft}};
+	for (int c = 0; c < 2; c++) {
+		Node &child = children[c];
+		child.min = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+		child.max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		child.first = ranges[c][0];
+		child.count = ranges[c][1];
+		for (int i = child.first; i < child.first+child.count; i++) {
+			UpdateMinMax(mins[order[i]], child.min, child.max);
+			UpdateMinMax(maxs[order[i]], child.min, child.max);
+		}
+	}
+	nodes[n].count = 0;
+	nodes.push_back(children[0]);
+	Split(nodes.size()-1, centers, mins, maxs, depth+1);
+	nodes[n].first = nodes.size();
+	nodes.push_back(children[1]);
+	Split(nodes.size()-1, centers, mins, maxs, depth+1);
+	return n;
+}
+
+void BVH::Build(vector<vec3> &points, vector<int3> &triangles) {
+	int nTriangles = triangles.size();
+	vector<vec3> centers(nTriangles), mins(nTriangles), maxs(nTriangles);
+	Node root;
+	root.min = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+	root.max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	root.first = 0;
+	root.count = nTriangles;
+	order.resize(nTriangles);
+	for (int i = 0; i < nTriangles; i++) {
+		int3 &t = triangles[i];
+		vec3 &a = points[t.i1], &b = points[t.i2], &c = points[t.i3];
+		mins[i] = maxs[i] = a;
+		UpdateMinMax(b, mins[i], maxs[i]);
+		UpdateMinMax(c, mins[i], maxs[i]);
+		UpdateMinMax(mins[i], root.min, root.max);
+		UpdateMinMax(maxs[i], root.min, root.max);
+		centers[i] = .5f*(mins[i]+maxs[i]);
+		order[i] = i;
+	}
+	nodes.resize(0);
+	nodes.reserve(2*nTriangles/4+1);
+	nodes.push_back(root);
+	Split(0, centers, mins, maxs, 0);
+	// vertices in leaf order for locality
+	p0.resize(nTriangles);
+	e1.resize(nTriangles);
+	e2.resize(nTriangles);
+	for (int i = 0; i < nTriangles; i++) {
+		int3 &t = triangles[order[i]];
+		p0[i] = points[t.i1];
+		e1[i] = points[t.i2]-points[t.i1];
+		e2[i] = points[t.i3]-points[t.i1];
+	}
+}
+
+template<bool Any> bool BVH::Traverse(vec3 origin, vec3 dir, float tMax, BVHHit *hit) {
+	if (nodes.empty() || (nodes.size() == 1 && !nodes[0].count))
+		return false;
+	vec3 invDir(1/dir.x, 1/dir.y, 1/dir.z);
+	int stack[64], nStack = 0, n = 0;
+	bool found = false;
+	float tEnter;
+	if (!RayBox(origin, invDir, nodes[0].min, nodes[0].max, tMax, tEnter))
+		return false;
+	for (;;) {
+		Node &node = nodes[n];
+		if (node.count) {
+			for (int i = node.first; i < node.first+node.count; i++) {
+				// Moller-Trumbore
+				vec3 p = cross(dir, e2[i]);
+				float det = dot(e1[i], p);
+				if (det > -1e-12f && det < 1e-12f)
+					continue;
+				float invDet = 1/det;
+				vec3 s = origin-p0[i];
+				float u = dot(s, p)*invDet;
+				if (u < 0 || u > 1)
+					continue;
+				vec3 q = cross(s, e1[i]);
+				float v = dot(dir, q)*invDet;
+				if (v < 0 || u+v > 1)
+					continue;
+				float t = dot(e2[i], q)*invDet;
+				if (t <= 0 || t >= tMax)
+					continue;
+				if (Any)
+					return true;
+				tMax = t;
+				hit->triangle = order[i];
+				hit->t = t;
+				hit->u = u;
+				hit->v = v;
+				found = true;
+			}
+		}
+		else {
+			// visit nearer child first
+			int left = n+1, right = node.first;
+			float tLeft, tRight;
+			bool hitLeft = RayBox(origin, invDir, nodes[left].min, nodes[left].max, tMax, tLeft);
+			bool hitRight = RayBox(origin, invDir, nodes[right].min, nodes[right].max, tMax, tRight);
+			if (hitLeft && hitRight) {
+				bool leftFirst = tLeft <= tRight;
+				stack[nStack++] = leftFirst? right : left;
+				n = leftFirst? left : right;
+				continue;
+			}
+			if (hitLeft || hitRight) {
+				n = hitLeft? left : right;
+				continue;
+			}
+		}
+		if (!nStack)
+			break;
+		n = stack[--nStack];
+	}
+	return found;
+}
+
+bool BVH::Intersect(vec3 origin, vec3 dir, float tMax, BVHHit &hit) { return Traverse<false>(origin, dir, tMax, &hit); }
+
+bool BVH::Occluded(vec3 origin, vec3 dir, float tMax) { return Traverse<true>(origin, dir, tMax, NULL); }
+
+int BVH::NNodes() { return nodes.size(); }
+
 // normalize STL models
 
 void MinMax(vector<VertexSTL> &points, vec3 &min, vec3 &max) {
-	min.x = min.y = min.z = FLT_MAX;
-	max.x = max.y = max.z = -FLT_MAX;
-	for (int i = 0; i < (int) points.size(); i++)
-		UpdateMinMax(points[i].point, min, max);
+	BatchMinMax(Vec3Span(&points.data()->point, points.size(), sizeof(VertexSTL)/sizeof(float)), min, max);
 }
 
 void Normalize(vector<VertexSTL> &vertices, float scale) {
 	vec3 min, max, center;
-	MinMax(vertices, min, max);
+	Vec3Span span(&vertices.data()->point, vertices.size(), sizeof(VertexSTL)/sizeof(float));
+	BatchMinMax(span, min, max);
 	float s = GetScaleCenter(min, max, scale, center);
-	for (int i = 0; i < (int) vertices.size(); i++) {
-		vec3 &v = vertices[i].point;
-		v = s*(v-center);
-	}
+	BatchScaleTranslate(span, s, -center);
 }
 
 // normalize vec3 models
 
 void MinMax(vector<vec3> &points, vec3 &min, vec3 &max) {
-	min[0] = min[1] = min[2] = FLT_MAX;
-	max[0] = max[1] = max[2] = -FLT_MAX;
-	for (int i = 0; i < (int) points.size(); i++) {
-		vec3 &v = points[i];
-		for (int k = 0; k < 3; k++) {
-			if (v[k] < min[k]) min[k] = v[k];
-			if (v[k] > max[k]) max[k] = v[k];
-		}
-	}
+	BatchMinMax(Vec3Span(points), min, max);
 }
 
 void Normalize(vector<vec3> &points, float scale) {
-	vec3 min, max;
-	MinMax(points, min, max);
-	vec3 center(.5f*(min[0]+max[0]), .5f*(min[1]+max[1]), .5f*(min[2]+max[2]));
-	float maxrange = 0;
-	for (int k = 0; k < 3; k++)
-		if ((max[k]-min[k]) > maxrange)
-			maxrange = max[k]-min[k];
-	float s = scale*2.f/maxrange;
-	for (int i = 0; i < (int) points.size(); i++) {
-		vec3 &v = points[i];
-		for (int k = 0; k < 3; k++)
-			v[k] = s*(v[k]-center[k]);
-	}
+	vec3 min, max, center;
+	BatchMinMax(Vec3Span(points), min, max);
+	float s = GetScaleCenter(min, max, scale, center);
+	BatchScaleTranslate(Vec3Span(points), s, -center);
 }
 
 void SetVertexNormals(vector<vec3> &points, vector<int3> &triangles, vector<vec3> &normals) {
@@ -357,8 +554,7 @@ bool ReadAsciiObj(const char    *filename,
 			tmpTextures.push_back(vec2(t.x, t.y));
 		}
 		else if (!_stricmp(word, "f")) {           		// read triangle or polygon
-			static vector<int> vids;
-			vids.resize(0);
+			vector<int> vids;		// not static: objects may be read on several threads
 			while (ReadWord(ptr, word, WordLim)) { 		// read arbitrary # face vid/tid/nid
 				// set texture and normal pointers to preceding /
 				char *tPtr = strchr(word+1, '/');  		// pointer to /, or null if not found
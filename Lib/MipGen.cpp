@@ -0,0 +1,272 @@
+// MipGen.cpp - CPU mip chains: Kaiser or Lanczos filtering, sRGB-correct color, renormalized normals, Toksvig roughness
+
+#include "MipGen.h"
+#include "Parallel.h"
+#include <math.h>
+
+using std::vector;
+
+namespace {
+
+const float pi = 3.14159265f;
+
+// Filter Kernels
+
+float Sinc(float x) {
+    return fabsf(x) < 1e-5f? 1 : sinf(pi*x)/(pi*x);
+}
+
+float BesselI0(float x) {
+    // power series, converges quickly for the window's range
+    float sum = 1, term = 1, q = x*x/4;
+    for (int k = 1; k < 30; k++) {
+        term *= q/(float) (k*k);
+        sum += term;
+    }
+    return sum;
+}
+
+float Kernel(MipFilter filter, float x) {
+    // x in destination pixels
+    const float lobes = 3, alpha = 4;
+    x = fabsf(x);
+    if (filter == MipBox)
+        return x <= .5f? 1.f : 0.f;
+    if (x >= lobes)
+        return 0;
+    if (filter == MipLanczos)
+        return Sinc(x)*Sinc(x/lobes);
+    float t = x/lobes;
+    return Sinc(x)*BesselI0(alpha*sqrtf(1-t*t))/BesselI0(alpha);
+}
+
+struct Taps {
+    vector<int> first, count;           // per destination pixel
+    vector<int> index;                  // source pixels, clamped to the edge
+    vector<float> weight;               // normalized
+};
+
+void MakeTaps(MipFilter filter, int n, int n2, Taps &taps) {
+    // resample n source pixels to n2: destination pixel i covers source [i*scale, (i+1)*scale)
+    float scale = (float) n/n2, support = filter == MipBox? .5f*scale : 3*scale;
+    taps.first.resize(n2);
+    taps.count.resize(n2);
+    taps.index.resize(0);
+    taps.weight.resize(0);
+    for (int i = 0; i < n2; i++) {
+        float center = (i+.5f)*scale-.5f, sum = 0;
+        int j0 = (int) floorf(center-support), j1 = (int) ceilf(center+support);
+        taps.first[i] = taps.index.size();
+        for (int j = j0; j <= j1; j++) {
+            float w = Kernel(filter, (j-center)/scale);
+            if (w == 0)
+                continue;
+            taps.index.push_back(j < 0? 0 : j >= n? n-1 : j);
+            taps.weight.push_back(w);
+            sum += w;
+        }
+        taps.count[i] = taps.index.size()-taps.first[i];
+        for (int k = taps.first[i]; k < (int) taps.index.size(); k++)
+            taps.weight[k] /= sum;
+    }
+}
+
+template <class F> void ParallelRows(int nRows, int nThreads, F f) {
+    // bands of 16 rows, so small levels stay on one thread
+    ParallelFor(0, nRows, 16, nThreads, [&](int b, int e) {
+        for (int row = b; row < e; row++)
+            f(row);
+    });
+}
+
+struct Image {
+    int width, height, nChannels;
+    vector<float> v;                    // interleaved
+    Image(int width = 0, int height = 0, int nChannels = 0)
+        : width(width), height(height), nChannels(nChannels), v(width*height*nChannels, 0) { }
+    float *Pixel(int i, int j) { return &v[nChannels*(j*width+i)]; }
+};
+
+void Downsample(Image &src, Image &dst, MipFilter filter, int nThreads) {
+    // separable: rows, then columns
+    int w2 = src.width > 1? src.width/2 : 1, h2 = src.height > 1? src.height/2 : 1, nc = src.nChannels;
+    Taps tx, ty;
+    MakeTaps(filter, src.width, w2, tx);
+    MakeTaps(filter, src.height, h2, ty);
+    Image tmp(w2, src.height, nc);
+    ParallelRows(src.height, nThreads, [&](int j) {
+        for (int i = 0; i < w2; i++) {
+            float *d = tmp.Pixel(i, j);
+            for (int k = tx.first[i]; k < tx.first[i]+tx.count[i]; k++) {
+                float *s = src.Pixel(tx.index[k], j), w = tx.weight[k];
+                for (int c = 0; c < nc; c++)
+                    d[c] += w*s[c];
+            }
+        }
+    });
+    dst.width = w2;
+    dst.height = h2;
+    dst.nChannels = nc;
+    dst.v.assign(w2*h2*nc, 0);
+    ParallelRows(h2, nThreads, [&](int j) {
+        for (int k = ty.first[j]; k < ty.first[j]+ty.count[j]; k++) {
+            float *s = tmp.Pixel(0, ty.index[k]), *d = dst.Pixel(0, j), w = ty.weight[k];
+            for (int n = 0; n < w2*nc; n++)
+                d[n] += w*s[n];
+        }
+    });
+}
+
+// Encoding
+
+struct SrgbTable {
+    float linear[256];
+    SrgbTable() {
+        for (int i = 0; i < 256; i++) {
+            float c = i/255.f;
+            linear[i] = c <= .04045f? c/12.92f : powf((c+.055f)/1.055f, 2.4f);
+        }
+    }
+};
+
+float SrgbToLinear(unsigned char c) {
+    static SrgbTable table;             // initialized once, thread-safe
+    return table.linear[c];
+}
+
+unsigned char Byte(float v) {
+    v = 255*v+.5f;
+    return (unsigned char) (v < 0? 0 : v > 255? 255 : v);
+}
+
+unsigned char LinearToSrgb(float c) {
+    c = c < 0? 0 : c > 1? 1 : c;
+    return Byte(c <= .0031308f? 12.92f*c : 1.055f*powf(c, 1/2.4f)-.055f);
+}
+
+void Decode(unsigned char *pixels, int width, int height, int bytesPerPixel, MipKind kind, bool bgr, Image &image) {
+    // normals become unit xyz in channels 0-2; color becomes linear light
+    image.width = width;
+    image.height = height;
+    image.nChannels = bytesPerPixel;
+    image.v.resize(width*height*bytesPerPixel);
+    int r = bgr? 2 : 0, b = bgr? 0 : 2;
+    for (int i = 0, n = width*height; i < n; i++) {
+        unsigned char *p = pixels+bytesPerPixel*i;
+        float *v = &image.v[bytesPerPixel*i];
+        if (kind == MipNormal && bytesPerPixel >= 3) {
+            float x = p[r]/127.5f-1, y = p[1]/127.5f-1, z = p[b]/255.f, len = sqrtf(x*x+y*y+z*z);
+            len = len > 0? 1/len : 0;
+            v[0] = x*len; v[1] = y*len; v[2] = z*len;
+            if (bytesPerPixel == 4)
+                v[3] = p[3]/255.f;
+        }
+        else
+            for (int c = 0; c < bytesPerPixel; c++)
+                v[c] = kind == MipColor && c < 3? SrgbToLinear(p[c]) : p[c]/255.f;
+    }
+}
+
+void Encode(Image &image, MipKind kind, bool bgr, MipLevel &level) {
+    int nc = image.nChannels, r = bgr? 2 : 0, b = bgr? 0 : 2;
+    level.width = image.width;
+    level.height = image.height;
+    level.pixels.resize(image.width*image.height*nc);
+    for (int i = 0, n = image.width*image.height; i < n; i++) {
+        float *v = &image.v[nc*i];
+        unsigned char *p = &level.pixels[nc*i];
+        if (kind == MipNormal && nc >= 3) {
+            // the average is shorter than unit: renormalize
+            float len = sqrtf(v[0]*v[0]+v[1]*v[1]+v[2]*v[2]);
+            len = len > 0? 1/len : 0;
+            p[r] = Byte(.5f*(v[0]*len+1));
+            p[1] = Byte(.5f*(v[1]*len+1));
+            p[b] = Byte(v[2] > 0? v[2]*len : 0);
+            if (nc == 4)
+                p[3] = Byte(v[3]);
+        }
+        else
+            for (int c = 0; c < nc; c++)
+                p[c] = kind == MipColor && c < 3? LinearToSrgb(v[c]) : Byte(v[c]);
+    }
+}
+
+void Toksvig(Image &roughness, vector<Image> &normals) {
+    // the averaged normal's length |n| < 1 measures normal variance s2 = (1-|n|)/|n|: widen alpha^2 by it
+    // sample the normal level nearest in size (the map may differ in resolution from the roughness map)
+    size_t k = 0;
+    while (k+1 < normals.size() && normals[k].width > roughness.width)
+        k++;
+    Image &n = normals[k];
+    for (int j = 0; j < roughness.height; j++)
+        for (int i = 0; i < roughness.width; i++) {
+            int ni = (int) ((i+.5f)*n.width/roughness.width), nj = (int) ((j+.5f)*n.height/roughness.height);
+            float *v = n.Pixel(ni < n.width? ni : n.width-1, nj < n.height? nj : n.height-1);
+            float len = sqrtf(v[0]*v[0]+v[1]*v[1]+v[2]*v[2]);
+            len = len < 1e-3f? 1e-3f : len > 1? 1 : len;
+            float variance = (1-len)/len, *a = roughness.Pixel(i, j);
+            for (int c = 0; c < roughness.nChannels && c < 3; c++) {
+                float alpha2 = a[c]*a[c]+variance;
+                a[c] = alpha2 < 1? sqrtf(alpha2) : 1;
+            }
+        }
+}
+
+} // end namespace
+
+void GenerateMips(unsigned char *pixels, int width, int height, int bytesPerPixel, MipOptions &o,
+                  vector<MipLevel> &levels, int nThreads) {
+    // the normal chain for Toksvig is kept unnormalized: its shortening is the variance
+    vector<Image> normals;
+    if (o.kind == MipRoughness && o.normals && o.normalBytesPerPixel >= 3) {
+        normals.resize(1);
+        Decode(o.normals, o.normalWidth, o.normalHeight, o.normalBytesPerPixel, MipNormal, o.normalBgr, normals[0]);
+        while (normals.back().width > 1 || normals.back().height > 1) {
+            Image half;
+            Downsample(normals.back(), half, o.filter, nThreads);
+            normals.push_back(half);
+        }
+    }
+    Image image, adjusted;
+    Decode(pixels, width, height, bytesPerPixel, o.kind, o.bgr, image);
+    levels.resize(0);
+    for (;;) {
+        MipLevel level;
+        if (normals.size()) {
+            // adjust a copy: the chain continues from unadjusted roughness
+            adjusted = image;
+            Toksvig(adjusted, normals);
+            Encode(adjusted, o.kind, o.bgr, level);
+        }
+        else
+            Encode(image, o.kind, o.bgr, level);
+        levels.push_back(level);
+        if (image.width == 1 && image.height == 1)
+            break;
+        Image half;
+        Downsample(image, half, o.filter, nThreads);
+        image.v.swap(half.v);
+        image.width = half.width;
+        image.height = half.height;
+    }
+}
+
+void LoadMipmappedTexture(unsigned char *pixels, int width, int height, GLuint textureUnit, GLuint textureName,
+                          bool bgr, int bytesPerPixel, MipOptions &options) {
+    vector<MipLevel> levels;
+    GenerateMips(pixels, width, height, bytesPerPixel, options, levels);
+    GLenum internal = bytesPerPixel == 4? GL_RGBA : bytesPerPixel == 1? GL_R8 : GL_RGB;
+    GLenum format = bytesPerPixel == 4? (bgr? GL_BGRA : GL_RGBA) : bytesPerPixel == 1? GL_RED : (bgr? GL_BGR : GL_RGB);
+    glActiveTexture(GL_TEXTURE0+textureUnit);
+    glBindTexture(GL_TEXTURE_2D, textureName);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (size_t i = 0; i < levels.size(); i++)
+        glTexImage2D(GL_TEXTURE_2D, (GLint) i, internal, levels[i].width, levels[i].height, 0, format, GL_UNSIGNED_BYTE, &levels[i].pixels[0]);
+    if (bytesPerPixel == 1) {
+        GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint) levels.size()-1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
@@ -4,8 +4,16 @@
 #include <stdio.h>
 #include <float.h>
 #include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
 #include "Draw.h"
 #include "Misc.h"
+#include "Parallel.h"
+#include "Readback.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
 
 // Misc
 std::string GetDirectory() {
@@ -43,76 +51,284 @@ float RaySphere(vec3 base, vec3 v, vec3 center, float radius) {
 
 // Image File
 
-unsigned char *ReadTarga(const char *filename, int &width, int &height) {
-    // open targa file, read header, return pointer to pixels
+// Targa header (18 bytes, little-endian): id length, color map type, image type, color map spec (5 bytes),
+// x/y origin, width, height, bits per pixel, descriptor (bits 0-3 alpha bits, bit 4 right-to-left, bit 5 top-down)
+// image types: 1 color-mapped, 2 true-color, 3 grayscale; +8 for run-length encoded
+
+static int Short(unsigned char *p) { return p[0] | (p[1] << 8); }
+
+static bool DecodeTarga(unsigned char *data, size_t size, unsigned char *out, int nPixels, int fileBytes, bool rle) {
+    // copy raw or run-length encoded pixels of fileBytes each; return false if data runs out
+    unsigned char *end = data+size;
+    if (!rle) {
+        if ((size_t) nPixels*fileBytes > size)
+            return false;
+        memcpy(out, data, (size_t) nPixels*fileBytes);
+        return true;
+    }
+    for (int n = 0; n < nPixels; ) {
+        if (data >= end)
+            return false;
+        int header = *data++, count = (header & 0x7f)+1;
+        count = count < nPixels-n? count : nPixels-n;
+        if (header & 0x80) {
+            // run: one pixel repeated
+            if (data+fileBytes > end)
+                return false;
+            if (fileBytes == 1)
+                memset(out, *data, count);
+            else
+                for (int i = 0; i < count; i++)
+                    memcpy(out+i*fileBytes, data, fileBytes);
+            data += fileBytes;
+        }
+        else {
+            // raw: count literal pixels
+            size_t nBytes = (size_t) count*fileBytes;
+            if (data+nBytes > end)
+                return false;
+            memcpy(out, data, nBytes);
+            data += nBytes;
+        }
+        out += count*fileBytes;
+        n += count;
+    }
+    return true;
+}
+
+unsigned char *ReadTarga(const char *filename, int &width, int &height, int &bytesPerPixel) {
     FILE *in = fopen(filename, "rb");
-    if (in) {
-        short tgaHeader[9];
-        fread(tgaHeader, sizeof(tgaHeader), 1, in);
-        // allocate, read pixels
-        int w = width = tgaHeader[6], h = height = tgaHeader[7];
-        int bitsPerPixel = tgaHeader[8], bytesPerPixel = bitsPerPixel/8, bytesPerImage = w*h*bytesPerPixel;
-        /*if (bytesPerPixel != 3) {
-            printf("bytes per pixel not 3!\n");
-            return NULL;
-        }*/
-        unsigned char *pixels = new unsigned char[bytesPerImage];
-        fread(pixels, bytesPerImage, 1, in);
-        fclose(in);
+    if (!in) {
+        printf("can't open %s\n", filename);
+        return NULL;
+    }
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    unsigned char *file = size > 18? new unsigned char[size] : NULL;
+    bool ok = file && fread(file, 1, size, in) == (size_t) size;
+    fclose(in);
+    if (!ok) {
+        printf("can't read %s\n", filename);
+        delete [] file;
+        return NULL;
+    }
+    unsigned char *h = file;
+    int idLength = h[0], mapType = h[1], type = h[2] & 7, mapFirst = Short(h+3), mapLength = Short(h+5), mapBits = h[7];
+    int w = Short(h+12), ht = Short(h+14), bits = h[16], descriptor = h[17];
+    bool rle = (h[2] & 8) != 0;
+    // the color map and (raw) pixels must lie within the file
+    size_t mapBytes = mapType? (size_t) mapLength*((mapBits+7)/8) : 0, dataStart = 18+idLength+mapBytes;
+    int fileBytes = (bits+7)/8, nPixels = w*ht;
+    bool supported = w > 0 && ht > 0 &&
+        ((type == 1 && mapType == 1 && (bits == 8 || bits == 16) && mapLength > 0 &&
+          (mapBits == 15 || mapBits == 16 || mapBits == 24 || mapBits == 32)) ||
+         (type == 2 && (bits == 15 || bits == 16 || bits == 24 || bits == 32)) ||
+         (type == 3 && bits == 8));
+    if (!supported) {
+        printf("%s: unsupported Targa (type %i, %i bits)\n", filename, h[2], bits);
+        delete [] file;
+        return NULL;
+    }
+    if (dataStart > (size_t) size || (!rle && dataStart+(size_t) nPixels*fileBytes > (size_t) size)) {
+        printf("%s: truncated\n", filename);
+        delete [] file;
+        return NULL;
+    }
+    unsigned char *map = file+18+idLength, *data = file+dataStart;
+    unsigned char *packed = new unsigned char[(size_t) nPixels*fileBytes](); // zeroed: run-length data may end early
+    if (!DecodeTarga(data, size-dataStart, packed, nPixels, fileBytes, rle))
+        printf("%s: truncated\n", filename); // keep what was read, the rest black
+    // expand to 1 (gray), 3 (BGR), or 4 (BGRA) bytes per pixel
+    // color-mapped pixels take their depth, and so their alpha, from the palette entries
+    int entryBits = type == 1? mapBits : bits;
+    bool alpha = (entryBits == 15 || entryBits == 16) && (descriptor & 15);
+    bytesPerPixel = type == 3? 1 : entryBits == 32 || alpha? 4 : 3;
+    unsigned char *pixels = packed;
+    if (type == 1 || bits == 15 || bits == 16) {
+        pixels = new unsigned char[(size_t) nPixels*bytesPerPixel];
+        int entryBytes = (entryBits+7)/8;
+        for (int i = 0; i < nPixels; i++) {
+            unsigned char *src = packed+i*fileBytes, *dst = pixels+i*bytesPerPixel;
+            int bitsHere = bits;
+            if (type == 1) {
+                int index = (fileBytes == 1? src[0] : Short(src))-mapFirst;
+                index = index < 0? 0 : index >= mapLength? mapLength-1 : index;
+                src = map+index*entryBytes;
+                bitsHere = mapBits;
+            }
+            if (bitsHere == 15 || bitsHere == 16) {
+                // A1R5G5B5
+                int v = Short(src);
+                dst[0] = (unsigned char) (((v & 31) * 255)/31);
+                dst[1] = (unsigned char) ((((v >> 5) & 31) * 255)/31);
+                dst[2] = (unsigned char) ((((v >> 10) & 31) * 255)/31);
+                if (bytesPerPixel == 4)
+                    dst[3] = v & 0x8000? 255 : 0;
+            }
+            else {
+                dst[0] = src[0];
+                dst[1] = src[1];
+                dst[2] = src[2];
+                if (bytesPerPixel == 4)
+                    dst[3] = bitsHere == 32? src[3] : 255;
+            }
+        }
+        delete [] packed;
+    }
+    delete [] file;
+    // origin: return bottom row first, left to right
+    int rowBytes = w*bytesPerPixel;
+    if (descriptor & 0x20) {
+        unsigned char *tmp = new unsigned char[rowBytes];
+        for (int j = 0; j < ht/2; j++) {
+            unsigned char *r1 = pixels+j*rowBytes, *r2 = pixels+(ht-1-j)*rowBytes;
+            memcpy(tmp, r1, rowBytes);
+            memcpy(r1, r2, rowBytes);
+            memcpy(r2, tmp, rowBytes);
+        }
+        delete [] tmp;
+    }
+    if (descriptor & 0x10)
+        for (int j = 0; j < ht; j++)
+            for (int i = 0; i < w/2; i++) {
+                unsigned char *p1 = pixels+j*rowBytes+i*bytesPerPixel, *p2 = pixels+j*rowBytes+(w-1-i)*bytesPerPixel;
+                for (int k = 0; k < bytesPerPixel; k++) {
+                    unsigned char t = p1[k];
+                    p1[k] = p2[k];
+                    p2[k] = t;
+                }
+            }
+    width = w;
+    height = ht;
+    return pixels;
+}
+
+unsigned char *ReadTarga(const char *filename, int &width, int &height) {
+    int bytesPerPixel;
+    unsigned char *pixels = ReadTarga(filename, width, height, bytesPerPixel);
+    if (!pixels || bytesPerPixel == 3)
         return pixels;
+    // convert gray or BGRA to BGR
+    int nPixels = width*height;
+    unsigned char *bgr = new unsigned char[3*nPixels];
+    for (int i = 0; i < nPixels; i++)
+        for (int k = 0; k < 3; k++)
+            bgr[3*i+k] = pixels[i*bytesPerPixel+(bytesPerPixel == 1? 0 : k)];
+    delete [] pixels;
+    return bgr;
+}
+
+static void EncodeRow(unsigned char *row, int width, int bytesPerPixel, std::string &out) {
+    // TGA packets: runs of 2-128 equal pixels, or 1-128 literal pixels; packets don't cross rows
+    for (int i = 0; i < width; ) {
+        unsigned char *p = row+i*bytesPerPixel;
+        int run = 1;
+        while (i+run < width && run < 128 && !memcmp(p, p+run*bytesPerPixel, bytesPerPixel))
+            run++;
+        if (run > 1) {
+            out += (char) (0x80 | (run-1));
+            out.append((char *) p, bytesPerPixel);
+            i += run;
+            continue;
+        }
+        // literal span ends where a run of at least two begins
+        int count = 1;
+        while (i+count < width && count < 128) {
+            unsigned char *q = row+(i+count)*bytesPerPixel;
+            if (i+count+1 < width && !memcmp(q, q+bytesPerPixel, bytesPerPixel))
+                break;
+            count++;
+        }
+        out += (char) (count-1);
+        out.append((char *) p, count*bytesPerPixel);
+        i += count;
     }
-    printf("can't open %s\n", filename);
-    return NULL;
 }
 
-bool WriteTarga(const char *filename, unsigned char *pixels, int width, int height) {
+bool WriteTarga(const char *filename, unsigned char *pixels, int width, int height, int bytesPerPixel, bool rle) {
+    if (bytesPerPixel != 1 && bytesPerPixel != 3 && bytesPerPixel != 4) {
+        printf("can't save %s: %i bytes per pixel\n", filename, bytesPerPixel);
+        return false;
+    }
     FILE *out = fopen(filename, "wb");
     if (!out) {
         printf("can't save %s\n", filename);
         return false;
     }
-    short tgaHeader[9];
-    tgaHeader[0] = 0;
-    tgaHeader[1] = 2;
-    tgaHeader[2] = 0;
-    tgaHeader[3] = 0;
-    tgaHeader[4] = 0;
-    tgaHeader[5] = 0;
-    tgaHeader[6] = width;
-    tgaHeader[7] = height;
-    tgaHeader[8] = 24; // *** assumed bits per pixel
-    fwrite(tgaHeader, sizeof(tgaHeader), 1, out);
-    fwrite(pixels, 3*width*height, 1, out);
+    unsigned char header[18] = {0};
+    header[2] = (bytesPerPixel == 1? 3 : 2)+(rle? 8 : 0);
+    header[12] = width & 255;
+    header[13] = width >> 8;
+    header[14] = height & 255;
+    header[15] = height >> 8;
+    header[16] = 8*bytesPerPixel;
+    header[17] = bytesPerPixel == 4? 8 : 0;     // alpha bits; origin lower left (bottom row first)
+    bool ok = fwrite(header, sizeof(header), 1, out) == 1;
+    int rowBytes = width*bytesPerPixel;
+    if (!rle)
+        ok = ok && fwrite(pixels, rowBytes, height, out) == (size_t) height;
+    else {
+        std::string packets;
+        packets.reserve(rowBytes+rowBytes/128+1);
+        for (int j = 0; j < height && ok; j++) {
+            packets.clear();
+            EncodeRow(pixels+j*rowBytes, width, bytesPerPixel, packets);
+            ok = fwrite(packets.data(), 1, packets.size(), out) == packets.size();
+        }
+    }
     fclose(out);
-    return true;
+    if (!ok)
+        printf("can't write %s\n", filename);
+    return ok;
 }
 
 bool WriteTarga(char *filename) {
     int width, height;
     GetViewportSize(width, height);
-    int npixels = width*height;
-    unsigned char *cPixels = new unsigned char[3*npixels], *c = cPixels;
-    float *fPixels = new float[3*npixels*sizeof(float)], *f = fPixels;
-    glReadPixels(0, 0, width, height, GL_BGR, GL_FLOAT, fPixels);   // Targa is BGR ordered
-    for (int i = 0; i < npixels; i++) {
-        *c++ = (unsigned char) (255.f*(*f++));
-        *c++ = (unsigned char) (255.f*(*f++));
-        *c++ = (unsigned char) (255.f*(*f++));
-    }
-    bool ok = WriteTarga(filename, (unsigned char *) cPixels, width, height);
-    delete [] fPixels;
-    delete [] cPixels;
+    unsigned char *pixels = new unsigned char[3*width*height];
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);                                // rows tightly packed
+    glReadPixels(0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, pixels); // Targa is BGR ordered
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    bool ok = WriteTarga(filename, pixels, width, height);
+    delete [] pixels;
+    return ok;
+}
+
+static void WriteTargaCallback(unsigned char *bgr, int width, int height, void *data) {
+    char *filename = (char *) data;
+    WriteTarga(filename, bgr, width, height);
+    delete [] filename;
+}
+
+bool WriteTargaAsync(const char *filename) {
+    int vp[4];
+    glGetIntegerv(GL_VIEWPORT, vp);
+    char *name = new char[strlen(filename)+1];
+    strcpy(name, filename);
+    bool ok = FrameReadback().Request(vp[0], vp[1], vp[2], vp[3], WriteTargaCallback, name);
+    if (!ok)
+        delete [] name; // not queued, so the callback won't free it
     return ok;
 }
 
 // Texture
 
-void LoadTexture(unsigned char *pixels, int width, int height, GLuint textureUnit, GLuint textureName, bool bgr, bool mipmap) {
+void LoadTexture(unsigned char *pixels, int width, int height, GLuint textureUnit, GLuint textureName, bool bgr, bool mipmap, int bytesPerPixel) {
     glActiveTexture(GL_TEXTURE0+textureUnit);       // active texture corresponds with textureUnit
     glBindTexture(GL_TEXTURE_2D, textureName);      // bind active texture to textureName
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);          // accommodate width not multiple of 4
     // specify target, format, dimension, transfer data
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, bgr? GL_BGR : GL_RGB, GL_UNSIGNED_BYTE, pixels);
+    if (bytesPerPixel == 4)
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, bgr? GL_BGRA : GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    else if (bytesPerPixel == 1) {
+        // single channel, sampled as gray (r = g = b, a = 1)
+        GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, pixels);
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, bgr? GL_BGR : GL_RGB, GL_UNSIGNED_BYTE, pixels);
     if (mipmap) {
         glGenerateMipmap(GL_TEXTURE_2D);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
@@ -123,57 +339,130 @@ void LoadTexture(unsigned char *pixels, int width, int height, GLuint textureUni
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 }
 
-GLuint LoadTexture(unsigned char *pixels, int width, int height, GLuint textureUnit, bool bgr, bool mipmap) {
+GLuint LoadTexture(unsigned char *pixels, int width, int height, GLuint textureUnit, bool bgr, bool mipmap, int bytesPerPixel) {
     GLuint textureName = 0;
     // allocate GPU texture buffer; copy, free pixels
     glGenTextures(1, &textureName);
-    LoadTexture(pixels, width, height, textureUnit, textureName, bgr, mipmap);
+    LoadTexture(pixels, width, height, textureUnit, textureName, bgr, mipmap, bytesPerPixel);
     return textureName;
 }
 
 GLuint LoadTexture(const char *targaFilename, GLuint textureUnit, bool mipmap) {
-    int width, height;
-    unsigned char *pixels = ReadTarga(targaFilename, width, height);
-    GLuint textureName = LoadTexture(pixels, width, height, textureUnit, true, mipmap); // Targa is BGR
+    int width, height, bytesPerPixel;
+    unsigned char *pixels = ReadTarga(targaFilename, width, height, bytesPerPixel);
+    if (!pixels)
+        return 0;
+    GLuint textureName = LoadTexture(pixels, width, height, textureUnit, true, mipmap, bytesPerPixel); // Targa is BGR(A)
     delete [] pixels;
     return textureName;
 }
 
 // Bump map
 
-unsigned char *GetNormals(unsigned char *depthPixels, int &width, int &height, float pixelScale) {
-    class Helper { public:
-        unsigned char *depthPixels, *bumpPixels;
-        int width, height;
-        float pixelScale;
-        float GetDepth(int i, int j) {
-            unsigned char *v = depthPixels+3*(j*width+i); // assume r == g == b
-            return ((float) *v)/255.f;
-        }
-        float Dz(int i1, int j1, int i2, int j2) {
-            return GetDepth(i2, j2)-GetDepth(i1, j1);
+namespace {
+
+void NormalRow(float *r[3], int width, int dy, float pixelScale, NormalFilter filter, unsigned char *bump) {
+    // normal = cross((dx, 0, dz/dx), (0, dy, dz/dy)) per pixel of a row, as by central differences
+    // r: depth of the rows above, at, and below (dy apart, 2 but for border rows)
+    // Sobel and Scharr average the x difference over the three rows and the y difference over columns
+    static const float weights[][3] = {{0, 1, 0}, {.25f, .5f, .25f}, {3/16.f, 10/16.f, 3/16.f}};
+    const float *w = weights[filter];
+    float ax = width > 1? 2/pixelScale : 1/pixelScale, by = dy > 0? (float) dy/pixelScale : 1/pixelScale;
+    float edgeAx = width > 1? 1/pixelScale : ax;
+    auto store = [&](int i, float x, float y, float z) {
+        float len = sqrt(x*x+y*y+z*z), s = 1.f/len;
+        unsigned char *n = bump+3*i;
+        n[0] = (unsigned char) (127.5f*(x*s+1));        // red in [-1,1]
+        n[1] = (unsigned char) (127.5f*(y*s+1));        // grn in [-1,1]
+        n[2] = (unsigned char) (255.f*(z*s));           // blu in [0,1]
+    };
+    auto pixel = [&](int i) {
+        // scalar, with borders clamped
+        int i1 = i > 0? i-1 : i, i2 = i < width-1? i+1 : i, im = i1, ip = i2;
+        float a = i2 > i1? (i2-i1 == 2? ax : edgeAx) : ax, dzx = 0, dzy = 0;
+        for (int k = 0; k < 3; k++)
+            dzx += w[k]*(r[k][i2]-r[k][i1]);
+        dzy = w[0]*(r[2][im]-r[0][im])+w[1]*(r[2][i]-r[0][i])+w[2]*(r[2][ip]-r[0][ip]);
+        store(i, -dzx*by, -a*dzy, a*by);
+    };
+    int i = 0;
+    if (width > 2) {
+        pixel(0);
+        i = 1;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        __m128 w0 = _mm_set1_ps(w[0]), w1 = _mm_set1_ps(w[1]), w2 = _mm_set1_ps(w[2]);
+        __m128 vAx = _mm_set1_ps(ax), vBy = _mm_set1_ps(by), z = _mm_set1_ps(ax*by), one = _mm_set1_ps(1);
+        __m128 half = _mm_set1_ps(127.5f), full = _mm_set1_ps(255.f), sign = _mm_set1_ps(-0.f);
+        for (; i+4 <= width-1; i += 4) {
+            __m128 dzx = _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(w0, _mm_sub_ps(_mm_loadu_ps(r[0]+i+1), _mm_loadu_ps(r[0]+i-1))),
+                _mm_mul_ps(w1, _mm_sub_ps(_mm_loadu_ps(r[1]+i+1), _mm_loadu_ps(r[1]+i-1)))),
+                _mm_mul_ps(w2, _mm_sub_ps(_mm_loadu_ps(r[2]+i+1), _mm_loadu_ps(r[2]+i-1))));
+            __m128 dzy = _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(w0, _mm_sub_ps(_mm_loadu_ps(r[2]+i-1), _mm_loadu_ps(r[0]+i-1))),
+                _mm_mul_ps(w1, _mm_sub_ps(_mm_loadu_ps(r[2]+i), _mm_loadu_ps(r[0]+i)))),
+                _mm_mul_ps(w2, _mm_sub_ps(_mm_loadu_ps(r[2]+i+1), _mm_loadu_ps(r[0]+i+1))));
+            __m128 x = _mm_xor_ps(_mm_mul_ps(dzx, vBy), sign), y = _mm_xor_ps(_mm_mul_ps(vAx, dzy), sign);
+            __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+            __m128 s = _mm_div_ps(one, len);
+            int red[4], grn[4], blu[4];
+            _mm_storeu_si128((__m128i *) red, _mm_cvttps_epi32(_mm_mul_ps(half, _mm_add_ps(_mm_mul_ps(x, s), one))));
+            _mm_storeu_si128((__m128i *) grn, _mm_cvttps_epi32(_mm_mul_ps(half, _mm_add_ps(_mm_mul_ps(y, s), one))));
+            _mm_storeu_si128((__m128i *) blu, _mm_cvttps_epi32(_mm_mul_ps(full, _mm_mul_ps(z, s))));
+            unsigned char *n = bump+3*i;
+            for (int k = 0; k < 4; k++, n += 3) {
+                n[0] = (unsigned char) red[k];
+                n[1] = (unsigned char) grn[k];
+                n[2] = (unsigned char) blu[k];
+            }
         }
-        vec3 Normal(int i, int j) {
-            int i1 = i > 0? i-1 : i, i2 = i < width-1? i+1 : i;
+#endif
+    }
+    for (; i < width; i++)
+        pixel(i);
+}
+
+const float *DepthTable() {
+    // depth byte to [0, 1]; a local static is initialized once, even if first called by several threads
+    static const std::vector<float> table = []() {
+        std::vector<float> t(256);
+        for (int k = 0; k < 256; k++)
+            t[k] = (float) k/255.f;
+        return t;
+    }();
+    return &table[0];
+}
+
+} // end namespace
+
+void GetNormals(unsigned char *depthPixels, int width, int height, unsigned char *bumpPixels, float pixelScale,
+                NormalFilter filter, int bytesPerPixel, int nThreads) {
+    // threads take bands of rows (small images: one band); within a band, each depth row is converted to float once
+    const int band = 32;
+    const float *toDepth = DepthTable();
+    ParallelFor(0, height, band, nThreads, [&](int j0, int j3) {
+        std::vector<float> ring(3*width);
+        int cached[] = {-1, -1, -1};
+        auto row = [&](int y) {
+            float *r = &ring[(y%3)*width];
+            if (cached[y%3] != y) {
+                unsigned char *d = depthPixels+bytesPerPixel*y*width;   // assume r == g == b
+                for (int i = 0; i < width; i++, d += bytesPerPixel)
+                    r[i] = toDepth[*d];
+                cached[y%3] = y;
+            }
+            return r;
+        };
+        for (int j = j0; j < j3; j++) {
             int j1 = j > 0? j-1 : j, j2 = j < height-1? j+1 : j;
-            vec3 vx((float)(i2-i1)/pixelScale, 0, Dz(i1, j, i2, j));
-            vec3 vy(0, (float)(j2-j1)/pixelScale, Dz(i, j1, i, j2));
-            vec3 v = cross(vx, vy);
-            v = normalize(v);
-            return v.z < 0? -v : v;
+            float *r[] = {row(j1), row(j), row(j2)};
+            NormalRow(r, width, j2-j1, pixelScale, filter, bumpPixels+3*j*width);
         }
-        Helper(unsigned char *depthPixels, int width, int height, float pixelScale) :
-            depthPixels(depthPixels), width(width), height(height), pixelScale(pixelScale) {
-                int bytesPerPixel = 3, bytesPerImage = width*height*bytesPerPixel;
-                unsigned char *n = bumpPixels = new unsigned char[bytesPerImage];
-                for (int j = 0; j < height; j++)                  // row
-                    for (int i = 0; i < width; i++) {             // column
-                        vec3 v = Normal(i, j);
-                        *n++ = (unsigned char) (127.5f*(v[0]+1)); // red in [-1,1]
-                        *n++ = (unsigned char) (127.5f*(v[1]+1)); // grn in [-1,1]
-                        *n++ = (unsigned char) (255.f*v[2]);      // blu in [0,1]
-                    }
-        }
-    } h(depthPixels, width, height, pixelScale);
-    return h.bumpPixels;
+    });
+}
+
+unsigned char *GetNormals(unsigned char *depthPixels, int &width, int &height, float pixelScale, NormalFilter filter) {
+    unsigned char *bumpPixels = new unsigned char[3*width*height];
+    GetNormals(depthPixels, width, height, bumpPixels, pixelScale, filter);
+    return bumpPixels;
 }
@@ -0,0 +1,177 @@
+// MultiDraw.cpp - scene-level indirect multi-draw
+
+#include <glad.h>
+#include "GLXtras.h"
+#include "MultiDraw.h"
+#include <algorithm>
+#include <stdio.h>
+
+bool MultiDrawSupported() { return GLAD_GL_VERSION_4_3 != 0; }
+
+MultiDraw::MultiDraw() {
+    vBuffer = iBuffer = cmdBuffer = drawBuffer = idBuffer = 0;
+    buffered = false;
+}
+
+void MultiDraw::Free() {
+    if (vBuffer) {
+        GLuint buffers[] = {vBuffer, iBuffer, cmdBuffer, drawBuffer, idBuffer};
+        glDeleteBuffers(5, buffers);
+    }
+    vBuffer = iBuffer = cmdBuffer = drawBuffer = idBuffer = 0;
+    buffered = false;
+}
+
+void MultiDraw::Clear() {
+    points.resize(0);
+    normals.resize(0);
+    uvs.resize(0);
+    indices.resize(0);
+    meshes.resize(0);
+    xforms.resize(0);
+    records.resize(0);
+    buffered = false;
+}
+
+int MultiDraw::AddMesh(vector<vec3> &pts, vector<vec3> &nrms, vector<vec2> &tex, vector<int3> &triangles) {
+    Range r;
+    r.baseVertex = points.size();
+    r.firstIndex = indices.size();
+    r.nIndices = 3*triangles.size();
+    int nverts = pts.size();
+    points.insert(points.end(), pts.begin(), pts.end());
+    // keep attribute arenas parallel even if a mesh lacks normals or uvs
+    normals.insert(normals.end(), nrms.begin(), nrms.begin()+std::min(nverts, (int) nrms.size()));
+    normals.resize(points.size(), vec3(0, 0, 1));
+    uvs.insert(uvs.end(), tex.begin(), tex.begin()+std::min(nverts, (int) tex.size()));
+    uvs.resize(points.size(), vec2(0, 0));
+    // indices stay mesh-relative; baseVertex offsets them at draw time
+    int3 *t = triangles.empty()? NULL : &triangles[0];
+    indices.insert(indices.end(), (int *) t, (int *) t+r.nIndices);
+    meshes.push_back(r);
+    xforms.push_back(mat4());
+    buffered = false;
+    return meshes.size()-1;
+}
+
+int MultiDraw::AddDraw(int meshId, int firstTriangle, int nTriangles, int material) {
+    Range &r = meshes[meshId];
+    int first = 3*firstTriangle, n = 3*nTriangles;
+    if (first+n > r.nIndices) {
+        printf("MultiDraw: draw exceeds mesh %i triangles\n", meshId);
+        n = r.nIndices > first? r.nIndices-first : 0;
+    }
+    Record rec = {meshId, r.firstIndex+first, n, material};
+    records.push_back(rec);
+    buffered = false;
+    return records.size()-1;
+}
+
+void MultiDraw::SetTransform(int meshId, mat4 m) { xforms[meshId] = m; }
+
+int MultiDraw::NDraws() { return records.size(); }
+
+int MultiDraw::NTriangles() { return indices.size()/3; }
+
+bool MultiDraw::Buffered() { return buffered; }
+
+void MultiDraw::Buffer() {
+    if (!vBuffer) {
+        GLuint buffers[5];
+        glGenBuffers(5, buffers);
+        vBuffer = buffers[0];
+        iBuffer = buffers[1];
+        cmdBuffer = buffers[2];
+        drawBuffer = buffers[3];
+        idBuffer = buffers[4];
+    }
+    // vertex arena: points, then normals, then uvs (as with Mesh::Buffer)
+    int nverts = points.size();
+    int sizePoints = nverts*sizeof(vec3), sizeNormals = sizePoints, sizeUvs = nverts*sizeof(vec2);
+    glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizePoints+sizeNormals+sizeUvs, NULL, GL_STATIC_DRAW);
+    if (nverts) {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizePoints, &points[0]);
+        glBufferSubData(GL_ARRAY_BUFFER, sizePoints, sizeNormals, &normals[0]);
+        glBufferSubData(GL_ARRAY_BUFFER, sizePoints+sizeNormals, sizeUvs, &uvs[0]);
+    }
+    // index arena
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(int), indices.empty()? NULL : &indices[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    // sort draws by material so each material is one contiguous run of commands
+    std::stable_sort(records.begin(), records.end(),
+        [](const Record &a, const Record &b) { return a.material < b.material; });
+    int ndraws = records.size();
+    vector<DrawCommand> commands(ndraws);
+    vector<int> ids(ndraws);
+    for (int i = 0; i < ndraws; i++) {
+        Record &r = records[i];
+        DrawCommand c = {(GLuint) r.nIndices, 1, (GLuint) r.firstIndex, (GLuint) meshes[r.meshId].baseVertex, (GLuint) i};
+        commands[i] = c;
+        ids[i] = i; // fetched through drawId, whose divisor makes baseInstance the draw index
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, cmdBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, ndraws*sizeof(DrawCommand), ndraws? &commands[0] : NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, idBuffer);
+    glBufferData(GL_ARRAY_BUFFER, ndraws*sizeof(int), ndraws? &ids[0] : NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // per-draw data rewritten each frame
+    drawData.resize(ndraws);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, ndraws*sizeof(DrawData), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    buffered = true;
+}
+
+void MultiDraw::Draw(int program, mat4 view, int material) {
+    if (!buffered)
+        Buffer();
+    // find run of draws for material
+    int ndraws = records.size(), first = 0, count = ndraws;
+    if (material >= 0) {
+        while (first < ndraws && records[first].material < material)
+            first++;
+        for (count = 0; first+count < ndraws && records[first+count].material == material; )
+            count++;
+    }
+    if (!count)
+        return;
+    // per-draw data: the only per-frame CPU work per mesh
+    for (int i = first; i < first+count; i++) {
+        Record &r = records[i];
+        drawData[i].modelview = view*xforms[r.meshId];
+        drawData[i].material = r.material;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, first*sizeof(DrawData), count*sizeof(DrawData), &drawData[first]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, drawBuffer);
+    // connect shader inputs to vertex arena
+    int sizePoints = points.size()*sizeof(vec3);
+    glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
+    VertexAttribPointer(program, "point", 3, 0, (void *) 0);
+    VertexAttribPointer(program, "normal", 3, 0, (void *) (size_t) sizePoints);
+    VertexAttribPointer(program, "uv", 2, 0, (void *) (size_t) (2*sizePoints));
+    // instanced draw id
+    glBindBuffer(GL_ARRAY_BUFFER, idBuffer);
+    int idAttrib = EnableVertexAttribute(program, "drawId");
+    if (idAttrib < 0)
+        printf("MultiDraw: can't find attribute drawId\n");
+    else {
+        glVertexAttribIPointer(idAttrib, 1, GL_INT, 0, (void *) 0);
+        glVertexAttribDivisor(idAttrib, 1);
+    }
+    // submit
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, cmdBuffer);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void *) (first*sizeof(DrawCommand)), count, 0);
+    // restore state expected by client-side index draws
+    if (idAttrib >= 0) {
+        glVertexAttribDivisor(idAttrib, 0);
+        glDisableVertexAttribArray(idAttrib);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
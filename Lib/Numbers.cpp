@@ -6,6 +6,8 @@
 #include "Misc.h"    // LoadTexture
 #include "Numbers.h" // Number
 #include <stdio.h>   // printf
+#include <string.h>  // strlen
+#include <vector>    // batch storage
 
 namespace {
 
@@ -22,15 +24,19 @@ B50034DDEC57007AFFFFFFC30047FFFFFFFF690089FFFFFFFFFFFFFFFFDD2300DD47000000000000
 FF340000000011DDFF47000000000047FF98000000000000FFC3000000000047FFFFFFFFFFC30089FFFF470000000011DDFFDD000000000047FFFFEC1111ECFFFFFFEC110000000000C3FF470000000069FF\
 FFEC69000057D0FFFF47000000000047FF89000000000000FFC30000003489ECFFFFFFFFFFC30089FFFF4700001169DDFFFFFFB534001169ECFFFF890089FFFFFFFFFFC334000034B5FFFF4700003498FFFF";
 
-// transform 2D vertex by view, separate uv from vec4
+// transform 2D vertex by view
 const char *vertexShader = R"(
     #version 130
-    in vec4 point;
+    in vec2 point;
+    in vec2 uv;
+    in vec3 color;
     out vec2 vUv;
+    out vec3 vColor;
     uniform mat4 view;
     void main() {
-        gl_Position = view*vec4(point.xy, 0, 1);
-        vUv = point.zw;
+        gl_Position = view*vec4(point, 0, 1);
+        vUv = uv;
+        vColor = color;
     }
 )";
 
@@ -38,76 +44,118 @@ const char *vertexShader = R"(
 const char *pixelShader = R"(
     #version 130
     in vec2 vUv;
+    in vec3 vColor;
     out vec4 pColor;
     uniform sampler2D textureImage;
-    uniform vec3 color;
     void main() {
         float a = texture(textureImage, vUv).r;
-        pColor = vec4(color, 1-a);
+        pColor = vec4(vColor, 1-a);
     }
 )";
 
 GLuint shaderProgram = 0, vertexBuffer = 0, textureName = 0;
 int textureUnit = 0;
 
-} // end namespace
+// labels collected until flushed
+struct Label {
+    int x, y;
+    unsigned int n;
+    vec3 color;
+    float ptSize;
+};
 
-void Number(int x, int y, unsigned int n, vec3 color, float ptSize) {
-    if (!textureName) {
-        // create and load texture raster
-        int nchars = strlen(image), npixels = nchars/2, height = 10, width = npixels/height;
-        unsigned char *pixels = new unsigned char[3*npixels], *p = pixels, *n = (unsigned char *) image;
-        for (int i = 0; i < npixels; i++) {
-            char c1 = *n++, c2 = *n++;
-            int k1 = c1 < 58? c1-'0' : 10+c1-'A', k2 = c2 < 58? c2-'0' : 10+c2-'A', b = 16*k1+k2;
-            for (int k = 0; k < 3; k++)
-                *p++ = (unsigned char) b;
-        }
-        textureName = LoadTexture(pixels, width, height, textureUnit);
-        delete [] pixels;
+struct NumberVertex {
+    vec2 point, uv;
+    vec3 color;
+};
+
+std::vector<Label> labels;
+std::vector<NumberVertex> vertices;
+int batchDepth = 0;
+
+void MakeTexture() {
+    // create and load texture raster
+    int nchars = strlen(image), npixels = nchars/2, height = 10, width = npixels/height;
+    unsigned char *pixels = new unsigned char[3*npixels], *p = pixels, *n = (unsigned char *) image;
+    for (int i = 0; i < npixels; i++) {
+        char c1 = *n++, c2 = *n++;
+        int k1 = c1 < 58? c1-'0' : 10+c1-'A', k2 = c2 < 58? c2-'0' : 10+c2-'A', b = 16*k1+k2;
+        for (int k = 0; k < 3; k++)
+            *p++ = (unsigned char) b;
     }
-    // if (!numberTextureName)
-    //    numberTextureName = LoadTexture(numberFilename, numberTextureUnit);
+    textureName = LoadTexture(pixels, width, height, textureUnit);
+    delete [] pixels;
     if (!textureName)
         printf("can't make numbers texture map\n");
+}
+
+void Flush() {
+    if (labels.empty())
+        return;
+    // one pass over labels: each digit is a quad (two triangles) mapped to 1/10 width of texture map
+    vertices.resize(0);
+    for (size_t i = 0; i < labels.size(); i++) {
+        Label &l = labels[i];
+        int digits[10], ndigits = 0;
+        unsigned int n = l.n;
+        do {
+            digits[ndigits++] = n%10;
+            n /= 10;
+        } while (n);
+        float w = .8f*l.ptSize, h = l.ptSize, yy = (float) l.y;
+        for (int k = 0; k < ndigits; k++) {
+            // value of digit determines horizontal position along texture
+            float xx = l.x+w*k, t = (float) digits[ndigits-k-1]/10;
+            NumberVertex q[] = {{vec2(xx, yy), vec2(t, 1), l.color}, {vec2(xx+w, yy), vec2(t+.1f, 1), l.color},
+                                {vec2(xx+w, yy+h), vec2(t+.1f, 0), l.color}, {vec2(xx, yy+h), vec2(t, 0), l.color}};
+            NumberVertex tris[] = {q[0], q[1], q[2], q[0], q[2], q[3]};
+            vertices.insert(vertices.end(), tris, tris+6);
+        }
+    }
+    labels.resize(0);
+    // program, texture, and uniforms set once per flush
+    if (!textureName)
+        MakeTexture();
     if (!shaderProgram)
         shaderProgram = LinkProgramViaCode(&vertexShader, &pixelShader);
     glUseProgram(shaderProgram);
-    if (!vertexBuffer) {
+    if (!vertexBuffer)
         glGenBuffers(1, &vertexBuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float)*4*4, NULL, GL_DYNAMIC_DRAW);
-    }
     glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    VertexAttribPointer(shaderProgram, "point", 4, 4*sizeof(float), 0);
-    glBindTexture(GL_TEXTURE_2D, textureName);
-    // set screen-mode
+    int stride = sizeof(NumberVertex);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size()*stride, &vertices[0], GL_STREAM_DRAW);
+    VertexAttribPointer(shaderProgram, "point", 2, stride, 0);
+    VertexAttribPointer(shaderProgram, "uv", 2, stride, (void *) sizeof(vec2));
+    VertexAttribPointer(shaderProgram, "color", 3, stride, (void *) (2*sizeof(vec2)));
+    // set screen-mode, activate texture
     SetUniform(shaderProgram, "view", ScreenMode());
-    // set text color and texture map, activate texture
-    SetUniform(shaderProgram, "color", color);
-//  GLint tid = glGetUniformLocation(shaderProgram, "textureImage");
-//  if (tid >= 0)
-//      glUniform1ui(tid, textureName);
     SetUniform(shaderProgram, "textureImage", textureUnit);
     glActiveTexture(GL_TEXTURE0+textureUnit);
+    glBindTexture(GL_TEXTURE_2D, textureName);
     // enable blended overwrite of color buffer
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    // convert number to string, display each digit
-    int ndigits = n? 1+log10(n) : 1;
-    for (int k = 0; k < ndigits; k++) {
-        // value of digit determines horizontal position along texture
-        int v = (n / (int) (pow(10, (ndigits-k-1)))) % 10;
-        float xx = x+.8f*ptSize*k, yy = y, w = .8f*ptSize, h = ptSize, t = (float)v/10;
-        // display each digit as a quad mapped to 1/10 width of texture map
-        float vertices[][4] = {{xx, yy, t, 1}, {xx+w, yy, t+.1f, 1}, {xx+w, yy+h, t+.1f, 0}, {xx, yy+h, t, 0}};
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-        glDrawArrays(GL_QUADS, 0, 4);
-    }
-    glBindVertexArray(0);
+    glDrawArrays(GL_TRIANGLES, 0, vertices.size());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+} // end namespace
+
+void BeginNumberBatch() { batchDepth++; }
+
+void EndNumberBatch() {
+    if (batchDepth > 0 && --batchDepth == 0)
+        Flush();
+}
+
+void Number(int x, int y, unsigned int n, vec3 color, float ptSize) {
+    Label l = {x, y, n, color, ptSize};
+    labels.push_back(l);
+    if (!batchDepth)
+        Flush();
+}
+
 void Number(vec3 p, mat4 m, unsigned int n, vec3 color, float ptSize) {
     vec2 pp = ScreenPoint(p, m);
     Number((int) pp.x, (int) pp.y, n, color, ptSize);
@@ -0,0 +1,10 @@
+// Parallel.cpp - share independent jobs among threads
+
+#include "Parallel.h"
+
+void ParallelJobs(int nJobs, ParallelJob job, void *data, int nThreads) {
+    ParallelFor(0, nJobs, 1, nThreads, [&](int b, int e) {
+        for (int i = b; i < e; i++)
+            job(i, data);
+    });
+}
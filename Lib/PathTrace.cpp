@@ -0,0 +1,394 @@
+// PathTrace.cpp - progressive path tracing with a BVH, tiles scheduled by work stealing
+
+#include <glad.h>
+#include "Misc.h"
+#include "PathTrace.h"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <float.h>
+#include <math.h>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+namespace {
+
+const int tileSize = 32;
+const float PI = 3.14159265f;
+
+// Random Numbers
+
+unsigned int Hash(unsigned int x) {
+    // integer hash (lowbias32) for per-pixel, per-pass seeds
+    x ^= x >> 16; x *= 0x7feb352du;
+    x ^= x >> 15; x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+float Random(unsigned int &state) {
+    // xorshift32, [0, 1)
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (state >> 8)*(1.f/16777216.f);
+}
+
+// Frames
+
+void Basis(vec3 n, vec3 &t, vec3 &b) {
+    // orthonormal t, b perpendicular to unit n
+    float s = n.z >= 0? 1.f : -1.f, a = -1/(s+n.z), c = n.x*n.y*a;
+    t = vec3(1+s*n.x*n.x*a, s*c, -s*n.x);
+    b = vec3(c, s+n.y*n.y*a, -n.y);
+}
+
+vec3 Local(vec3 v, vec3 n) {
+    vec3 t, b;
+    Basis(n, t, b);
+    return v.x*t+v.y*b+v.z*n;
+}
+
+float Max3(vec3 v) { return v.x > v.y? (v.x > v.z? v.x : v.z) : (v.y > v.z? v.y : v.z); }
+
+// Materials
+
+struct Sample {
+    vec3 albedo, ao;
+    float metallic, roughness;
+};
+
+const int blinnExponent = 4; // as in the shader
+
+vec3 BRDF(RasterShading &s, Sample &m, vec3 N, vec3 V, vec3 L) {
+    float NoL = dot(N, L), NoV = dot(N, V);
+    if (NoL <= 0 || NoV <= 0)
+        return vec3(0, 0, 0);
+    vec3 H = normalize(V+L);
+    float NoH = dot(N, H) > 0? dot(N, H) : 0, LoH = dot(L, H) > 0? dot(L, H) : 0;
+    vec3 f(0, 0, 0);
+    if (s.lambert || s.disney) {
+        vec3 diffuse = (1-m.metallic)/PI*m.albedo;
+        if (!s.lambert) {
+            // Burley
+            float fd90 = .5f+2*m.roughness*LoH*LoH;
+            diffuse *= (1+(fd90-1)*powf(1-NoL, 5))*(1+(fd90-1)*powf(1-NoV, 5));
+        }
+        f += s.aoMap? diffuse*m.ao : diffuse;
+    }
+    if (s.blinnPhong || s.cookTorrance) {
+        vec3 f0 = (1-m.metallic)*vec3(.04f, .04f, .04f)+m.metallic*m.albedo;
+        vec3 F = f0+powf(1-LoH, 5)*(vec3(1, 1, 1)-f0);
+        if (s.blinnPhong)
+            f += (blinnExponent+8)/(8*PI)*powf(NoH, (float) blinnExponent)*F;
+        else {
+            // GGX, a = roughness as in the shader, height-correlated Smith visibility
+            float a2 = m.roughness*m.roughness, d = NoH*NoH*(a2-1)+1;
+            float D = a2/(PI*d*d);
+            float Vis = .5f/(NoL*sqrtf(NoV*NoV*(1-a2)+a2)+NoV*sqrtf(NoL*NoL*(1-a2)+a2));
+            f += D*Vis*F;
+        }
+    }
+    return f;
+}
+
+float SpecularProbability(RasterShading &s) {
+    bool diffuse = s.lambert || s.disney, specular = s.blinnPhong || s.cookTorrance;
+    return diffuse && specular? .5f : specular? 1.f : 0.f;
+}
+
+vec3 SampleHalfVector(RasterShading &s, Sample &m, float r1, float r2) {
+    // half vector about +Z distributed as D(h) (h.z)
+    float cosTheta;
+    if (s.blinnPhong)
+        cosTheta = powf(r1, 1.f/(blinnExponent+1));
+    else {
+        float a2 = m.roughness*m.roughness;
+        cosTheta = sqrtf((1-r1)/(1+(a2-1)*r1));
+    }
+    float sinTheta = sqrtf(1-cosTheta*cosTheta > 0? 1-cosTheta*cosTheta : 0), phi = 2*PI*r2;
+    return vec3(sinTheta*cosf(phi), sinTheta*sinf(phi), cosTheta);
+}
+
+float HalfVectorPdf(RasterShading &s, Sample &m, float NoH) {
+    if (s.blinnPhong)
+        return (blinnExponent+1)/(2*PI)*powf(NoH, (float) blinnExponent);
+    float a2 = m.roughness*m.roughness, d = NoH*NoH*(a2-1)+1;
+    return a2/(PI*d*d)*NoH;
+}
+
+} // end namespace
+
+// Setup
+
+PathTracer::PathTracer(int w, int h, int n) : width(0), height(0), nThreads(1), maxBounces(4), fov(30), background(.5f, .5f, .5f) {
+    memset(&stats, 0, sizeof(stats));
+    SetThreads(n);
+    Resize(w, h);
+}
+
+void PathTracer::Resize(int w, int h) {
+    width = w;
+    height = h;
+    Reset();
+}
+
+void PathTracer::SetThreads(int n) {
+    nThreads = n > 0? n : (int) std::thread::hardware_concurrency();
+    if (nThreads < 1)
+        nThreads = 1;
+}
+
+void PathTracer::SetCamera(float f) { fov = f; }
+
+void PathTracer::SetShading(RasterShading &s) { shading = s; }
+
+void PathTracer::SetBackground(vec3 c) { background = c; }
+
+void PathTracer::SetMaxBounces(int n) { maxBounces = n; }
+
+void PathTracer::Reset() {
+    accumulation.assign(width*height, vec3(0, 0, 0));
+    memset(&stats, 0, sizeof(stats));
+}
+
+void PathTracer::AddMesh(vector<vec3> &pts, vector<vec3> &nrms, vector<vec2> &uvs, vector<int3> &tris,
+                         int firstTriangle, int nTriangles, mat4 modelview, RasterMaterial &material) {
+    if (firstTriangle+nTriangles > (int) tris.size())
+        nTriangles = (int) tris.size()-firstTriangle;
+    if (nTriangles <= 0)
+        return;
+    int materialId = materials.size();
+    materials.push_back(&material);
+    for (int t = firstTriangle; t < firstTriangle+nTriangles; t++) {
+        int3 tri = tris[t];
+        int base = points.size();
+        vec3 p[3], n[3];
+        vec2 uv[3];
+        for (int k = 0; k < 3; k++) {
+            int i = tri[k];
+            vec4 e = modelview*vec4(pts[i].x, pts[i].y, pts[i].z, 1);
+            vec3 nn = (int) nrms.size() > i? nrms[i] : vec3(0, 0, 0);
+            vec4 en = modelview*vec4(nn.x, nn.y, nn.z, 0);
+            p[k] = vec3(e.x, e.y, e.z);
+            n[k] = vec3(en.x, en.y, en.z);
+            uv[k] = (int) uvs.size() > i? uvs[i] : vec2(0, 0);
+            points.push_back(p[k]);
+        }
+        triangles.push_back(int3(base, base+1, base+2));
+        Surface s;
+        s.material = materialId;
+        s.n0 = n[0];
+        s.n1 = n[1];
+        s.n2 = n[2];
+        s.uv0 = uv[0];
+        s.uv1 = uv[1];
+        s.uv2 = uv[2];
+        // dp/du, dp/dv from the triangle's uv mapping (the shader gets these from screen derivatives)
+        vec3 dp1 = p[1]-p[0], dp2 = p[2]-p[0];
+        vec2 duv1 = uv[1]-uv[0], duv2 = uv[2]-uv[0];
+        float det = duv1.x*duv2.y-duv1.y*duv2.x, r = fabsf(det) > 1e-12f? 1/det : 0;
+        s.dpdu = r*(duv2.y*dp1-duv1.y*dp2);
+        s.dpdv = r*(duv1.x*dp2-duv2.x*dp1);
+        surfaces.push_back(s);
+    }
+}
+
+void PathTracer::Build() {
+    bvh.Build(points, triangles);
+    Reset();
+}
+
+// Tracing
+
+vec3 PathTracer::Radiance(vec3 origin, vec3 dir, unsigned int &seed, long long &nRays) {
+    bool diffuse = shading.lambert || shading.disney, specular = shading.blinnPhong || shading.cookTorrance;
+    float pSpecular = SpecularProbability(shading);
+    vec3 L(0, 0, 0), throughput(1, 1, 1);
+    vec3 lightDir(0, 0, 1), lightColor = 4*vec3(1, 1, 1);
+    vec3 spotColor = shading.spotIntensity*shading.spotColor;
+    for (int bounce = 0; bounce <= maxBounces; bounce++) {
+        BVHHit hit;
+        nRays++;
+        if (!bvh.Intersect(origin, dir, FLT_MAX, hit)) {
+            if (bounce == 0)
+                L = background;
+            break;
+        }
+        if (!diffuse && !specular)
+            return vec3(1, 0, 0); // as the shader
+        // surface
+        int3 &t = triangles[hit.triangle];
+        Surface &s = surfaces[hit.triangle];
+        RasterMaterial &mat = *materials[s.material];
+        float w = 1-hit.u-hit.v;
+        vec3 P = origin+hit.t*dir;
+        vec3 Ng = normalize(cross(points[t.i2]-points[t.i1], points[t.i3]-points[t.i1]));
+        vec3 N = w*s.n0+hit.u*s.n1+hit.v*s.n2;
+        N = dot(N, N) > 0? normalize(N) : Ng;
+        vec2 uv = w*s.uv0+hit.u*s.uv1+hit.v*s.uv2;
+        if (shading.normalMap && mat.normal && dot(s.dpdu, s.dpdu) > 0 && dot(s.dpdv, s.dpdv) > 0) {
+            vec3 b = mat.normal->Sample(uv.x, uv.y);
+            vec3 B = normalize(vec3(2*b.x-1, 2*b.y-1, b.z));
+            vec3 n = B.x*normalize(s.dpdu)+B.y*normalize(s.dpdv)+B.z*N;
+            if (dot(n, n) > 0)
+                N = normalize(n);
+        }
+        // two-sided, as the shader (abs(dot(N, E)))
+        vec3 V = -dir;
+        if (dot(Ng, V) < 0)
+            Ng = -Ng;
+        if (dot(N, V) < 0)
+            N = -N;
+        Sample m;
+        m.albedo = mat.albedo? mat.albedo->Sample(uv.x, uv.y) : vec3(0, 0, 0);
+        m.ao = mat.ao? mat.ao->Sample(uv.x, uv.y) : vec3(1, 1, 1);
+        m.metallic = mat.metallic? mat.metallic->Sample(uv.x, uv.y).x : 0;
+        m.roughness = mat.roughness? mat.roughness->Sample(uv.x, uv.y).x : .5f;
+        m.roughness = m.roughness > .02f? m.roughness : .02f; // keep GGX finite
+        vec3 Pe = P+(1e-4f*(1+fabsf(P.z)))*Ng;
+        // direct light: directional and point light, shadowed
+        if (dot(N, lightDir) > 0 && dot(Ng, lightDir) > 0) {
+            nRays++;
+            if (!bvh.Occluded(Pe, lightDir, FLT_MAX))
+                L += throughput*BRDF(shading, m, N, V, lightDir)*lightColor*dot(N, lightDir);
+        }
+        if (shading.spotLight) {
+            vec3 d = shading.light2-Pe;
+            float dist = length(d);
+            if (dist > 0) {
+                vec3 Ld = d/dist;
+                if (dot(N, Ld) > 0 && dot(Ng, Ld) > 0) {
+                    nRays++;
+                    if (!bvh.Occluded(Pe, Ld, dist))
+                        L += throughput*BRDF(shading, m, N, V, Ld)*spotColor*dot(N, Ld);
+                }
+            }
+        }
+        if (bounce == maxBounces)
+            break;
+        // next direction: mixture of cosine and half-vector sampling
+        float r0 = Random(seed), r1 = Random(seed), r2 = Random(seed);
+        vec3 next;
+        if (r0 < pSpecular) {
+            vec3 H = Local(SampleHalfVector(shading, m, r1, r2), N);
+            next = 2*dot(V, H)*H-V;
+        }
+        else {
+            float r = sqrtf(r1), phi = 2*PI*r2;
+            next = Local(vec3(r*cosf(phi), r*sinf(phi), sqrtf(1-r1 > 0? 1-r1 : 0)), N);
+        }
+        float NoL = dot(N, next);
+        if (NoL <= 0 || dot(Ng, next) <= 0)
+            break;
+        vec3 H = normalize(V+next);
+        float NoH = dot(N, H), VoH = dot(V, H);
+        float pdf = (1-pSpecular)*NoL/PI;
+        if (pSpecular > 0 && NoH > 0 && VoH > 0)
+            pdf += pSpecular*HalfVectorPdf(shading, m, NoH)/(4*VoH);
+        if (pdf <= 0)
+            break;
+        throughput *= BRDF(shading, m, N, V, next)*(NoL/pdf);
+        // Russian roulette
+        if (bounce >= 2) {
+            float q = Max3(throughput);
+            q = q < .05f? .05f : q > 1? 1 : q;
+            if (Random(seed) >= q)
+                break;
+            throughput *= 1/q;
+        }
+        origin = Pe;
+        dir = next;
+    }
+    return L;
+}
+
+long long PathTracer::TraceTile(int tile, int nxTiles) {
+    long long nRays = 0;
+    int x0 = (tile%nxTiles)*tileSize, y0 = (tile/nxTiles)*tileSize;
+    int x1 = x0+tileSize < width? x0+tileSize : width, y1 = y0+tileSize < height? y0+tileSize : height;
+    float scale = tanf(fov*PI/360), aspect = (float) width/height;
+    for (int y = y0; y < y1; y++)
+        for (int x = x0; x < x1; x++) {
+            // seed depends on pixel and pass only, so images don't depend on scheduling
+            unsigned int seed = Hash((y*width+x)*9781u+Hash(stats.nPasses+1)) | 1;
+            float sx = (x+Random(seed))/width, sy = (y+Random(seed))/height;
+            vec3 dir = normalize(vec3((2*sx-1)*scale*aspect, (2*sy-1)*scale, -1));
+            vec3 c = Radiance(vec3(0, 0, 0), dir, seed, nRays);
+            if (c.x == c.x && c.y == c.y && c.z == c.z) // drop NaN samples
+                accumulation[y*width+x] += c;
+        }
+    return nRays;
+}
+
+void PathTracer::Pass() {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int nxTiles = (width+tileSize-1)/tileSize, nyTiles = (height+tileSize-1)/tileSize, nTiles = nxTiles*nyTiles;
+    // each worker owns a deque of tiles, takes from its front, and steals from the back of others
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<int> tiles;
+    };
+    vector<WorkQueue> queues(nThreads);
+    for (int t = 0; t < nTiles; t++)
+        queues[t*nThreads/nTiles].tiles.push_back(t); // contiguous blocks, for coherence
+    std::atomic<long long> nRays(0);
+    auto work = [&](int id) {
+        long long n = 0;
+        for (;;) {
+            int tile = -1;
+            for (int k = 0; k < nThreads && tile < 0; k++) {
+                WorkQueue &q = queues[(id+k)%nThreads];
+                std::lock_guard<std::mutex> lock(q.mutex);
+                if (!q.tiles.empty()) {
+                    if (k == 0) {
+                        tile = q.tiles.front();
+                        q.tiles.pop_front();
+                    }
+                    else {
+                        tile = q.tiles.back();
+                        q.tiles.pop_back();
+                    }
+                }
+            }
+            if (tile < 0)
+                break;
+            n += TraceTile(tile, nxTiles);
+        }
+        nRays += n;
+    };
+    vector<std::thread> threads;
+    for (int i = 1; i < nThreads; i++)
+        threads.push_back(std::thread(work, i));
+    work(0);
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    stats.nPasses++;
+    stats.nRays += nRays;
+    stats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+
+// Output
+
+vec3 *PathTracer::Accumulation() { return accumulation.empty()? NULL : &accumulation[0]; }
+
+bool PathTracer::Write(const char *targaFilename) {
+    vector<unsigned char> bgr(3*width*height);
+    float scale = stats.nPasses? 1.f/stats.nPasses : 0;
+    for (int i = 0; i < width*height; i++) {
+        vec3 c = scale*accumulation[i];
+        for (int k = 0; k < 3; k++) {
+            float v = c[2-k] < 0? 0 : c[2-k] > 1? 1 : c[2-k];
+            bgr[3*i+k] = (unsigned char) (255*v+.5f);
+        }
+    }
+    return WriteTarga(targaFilename, bgr.empty()? NULL : &bgr[0], width, height);
+}
+
+TraceStats PathTracer::Stats() { return stats; }
+
+int PathTracer::Width() { return width; }
+
+int PathTracer::Height() { return height; }
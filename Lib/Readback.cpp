@@ -0,0 +1,93 @@
+// Readback.cpp - asynchronous framebuffer readback through pixel pack buffers
+
+#include "Readback.h"
+#include <stdio.h>
+
+Readback::Readback(int nBuffers) : head(0), count(0) {
+    Slot s = {0, 0, 0, 0, 0, 0, 0, NULL, NULL};
+    slots.resize(nBuffers < 1? 1 : nBuffers, s);
+}
+
+bool Readback::Request(int x, int y, int width, int height, ReadbackCallback cb, void *data, bool waitIfFull) {
+    if (width <= 0 || height <= 0)
+        return false;
+    if (count == (int) slots.size()) {
+        if (!waitIfFull)
+            return false;
+        Deliver(true);
+    }
+    Slot &s = slots[(head+count)%slots.size()];
+    int size = 3*width*height;
+    if (!s.pbo)
+        glGenBuffers(1, &s.pbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+    if (size > s.capacity)
+        glBufferData(GL_PIXEL_PACK_BUFFER, s.capacity = size, NULL, GL_STREAM_READ);
+    // byte BGR matches Targa, so no conversion; returns at once, the copy happens on the GPU
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(x, y, width, height, GL_BGR, GL_UNSIGNED_BYTE, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    s.x = x;
+    s.y = y;
+    s.width = width;
+    s.height = height;
+    s.cb = cb;
+    s.data = data;
+    count++;
+    return true;
+}
+
+bool Readback::Deliver(bool wait) {
+    // deliver oldest pending read if complete (or wait for it)
+    if (!count)
+        return false;
+    Slot &s = slots[head];
+    GLenum status = glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    while (wait && status == GL_TIMEOUT_EXPIRED)
+        status = glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    if (status == GL_TIMEOUT_EXPIRED)
+        return false;
+    if (status == GL_WAIT_FAILED)
+        printf("Readback: wait failed\n"); // mapping below still synchronizes
+    glDeleteSync(s.fence);
+    s.fence = 0;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+    unsigned char *pixels = (unsigned char *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 3*s.width*s.height, GL_MAP_READ_BIT);
+    if (pixels && s.cb)
+        s.cb(pixels, s.width, s.height, s.data);
+    if (!pixels)
+        printf("Readback: can't map pixel buffer\n");
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    head = (head+1)%slots.size();
+    count--;
+    return true;
+}
+
+int Readback::Poll(bool wait) {
+    int n = 0;
+    while (Deliver(wait))
+        n++;
+    return n;
+}
+
+void Readback::Flush() { Poll(true); }
+
+int Readback::Pending() { return count; }
+
+void Readback::Free() {
+    Flush();
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (slots[i].pbo)
+            glDeleteBuffers(1, &slots[i].pbo);
+        slots[i].pbo = 0;
+        slots[i].capacity = 0;
+    }
+}
+
+Readback &FrameReadback() {
+    static Readback readback(3);
+    return readback;
+}
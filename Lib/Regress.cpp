@@ -0,0 +1,343 @@
+// Regress.cpp - golden-image regression runs with PSNR and FLIP-style error, JSON report
+
+#include <glad.h>
+#include "Headless.h"
+#include "Misc.h"
+#include "Regress.h"
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <direct.h>
+#define MakeDirectory(name) _mkdir(name)
+#else
+#include <sys/stat.h>
+#define MakeDirectory(name) mkdir(name, 0755)
+#endif
+
+using std::string;
+using std::vector;
+
+// Color Spaces
+
+namespace {
+
+struct Color { float a, b, c; };
+
+float Linear(unsigned char c) {
+    float s = c/255.f;
+    return s <= .04045f? s/12.92f : powf((s+.055f)/1.055f, 2.4f);
+}
+
+// linear RGB <-> XYZ (D65)
+Color RGBtoXYZ(Color rgb) {
+    Color x = {.4124f*rgb.a+.3576f*rgb.b+.1805f*rgb.c, .2126f*rgb.a+.7152f*rgb.b+.0722f*rgb.c, .0193f*rgb.a+.1192f*rgb.b+.9505f*rgb.c};
+    return x;
+}
+
+Color XYZtoRGB(Color xyz) {
+    Color r = {3.2406f*xyz.a-1.5372f*xyz.b-.4986f*xyz.c, -.9689f*xyz.a+1.8758f*xyz.b+.0415f*xyz.c, .0557f*xyz.a-.2040f*xyz.b+1.0570f*xyz.c};
+    return r;
+}
+
+const float Xn = .9505f, Yn = 1.f, Zn = 1.089f;
+
+// YCxCz: linear opponent space in which FLIP filters with the contrast sensitivity functions
+Color XYZtoYCxCz(Color xyz) {
+    Color y = {116*xyz.b/Yn-16, 500*(xyz.a/Xn-xyz.b/Yn), 200*(xyz.b/Yn-xyz.c/Zn)};
+    return y;
+}
+
+Color YCxCztoXYZ(Color y) {
+    float Y = (y.a+16)/116*Yn, X = (y.b/500+Y/Yn)*Xn, Z = (Y/Yn-y.c/200)*Zn;
+    Color xyz = {X, Y, Z};
+    return xyz;
+}
+
+float LabF(float t) { return t > .008856f? cbrtf(t) : 7.787f*t+16.f/116; }
+
+// CIELab with the Hunt adjustment of chroma by lightness, as in FLIP
+Color XYZtoHuntLab(Color xyz) {
+    float fx = LabF(xyz.a/Xn), fy = LabF(xyz.b/Yn), fz = LabF(xyz.c/Zn);
+    float L = 116*fy-16, a = 500*(fx-fy), b = 200*(fy-fz);
+    Color lab = {L, .01f*L*a, .01f*L*b};
+    return lab;
+}
+
+float HyAB(Color p, Color q) {
+    float da = p.b-q.b, db = p.c-q.c;
+    return fabsf(p.a-q.a)+sqrtf(da*da+db*db);
+}
+
+float Clamp01(float f) { return f < 0? 0 : f > 1? 1 : f; }
+
+// Filtering
+
+vector<float> Gaussian(float sigma, int order) {
+    // sampled Gaussian (order 0) or its first or second derivative, radius 3 sigma
+    int r = (int) ceilf(3*sigma);
+    vector<float> k(2*r+1);
+    float sum = 0, pos = 0, neg = 0;
+    for (int i = -r; i <= r; i++) {
+        float g = expf(-i*i/(2*sigma*sigma));
+        k[i+r] = order == 0? g : order == 1? -i*g : (i*i/(sigma*sigma)-1)*g;
+    }
+    for (size_t i = 0; i < k.size(); i++) {
+        sum += k[i];
+        (k[i] > 0? pos : neg) += k[i];
+    }
+    for (size_t i = 0; i < k.size(); i++)
+        // smoothing sums to 1; derivatives have unit positive and negative lobes
+        k[i] = order == 0? k[i]/sum : k[i] > 0? k[i]/pos : neg < 0? -k[i]/neg : 0;
+    return k;
+}
+
+void Convolve(vector<float> &src, vector<float> &dst, int w, int h, vector<float> &kx, vector<float> &ky) {
+    // separable convolution, clamped borders
+    int rx = kx.size()/2, ry = ky.size()/2;
+    vector<float> tmp(w*h);
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++) {
+            float s = 0;
+            for (int i = -rx; i <= rx; i++) {
+                int xx = x+i < 0? 0 : x+i >= w? w-1 : x+i;
+                s += kx[i+rx]*src[y*w+xx];
+            }
+            tmp[y*w+x] = s;
+        }
+    dst.resize(w*h);
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++) {
+            float s = 0;
+            for (int j = -ry; j <= ry; j++) {
+                int yy = y+j < 0? 0 : y+j >= h? h-1 : y+j;
+                s += ky[j+ry]*tmp[yy*w+x];
+            }
+            dst[y*w+x] = s;
+        }
+}
+
+struct Prepared {
+    vector<Color> lab;          // filtered, Hunt-adjusted Lab
+    vector<float> edge, point;  // feature magnitudes of normalized luminance
+};
+
+void Prepare(unsigned char *bgr, int w, int h, Prepared &p) {
+    // contrast sensitivity spreads at 67 pixels/degree: achromatic, red-green, blue-yellow
+    static vector<float> csf[] = {Gaussian(1.03f, 0), Gaussian(1.10f, 0), Gaussian(3.02f, 0)};
+    // feature detectors, sigma = .5*.082*67 pixels
+    static vector<float> g = Gaussian(2.75f, 0), g1 = Gaussian(2.75f, 1), g2 = Gaussian(2.75f, 2);
+    int n = w*h;
+    vector<float> ch[3], lum(n);
+    for (int k = 0; k < 3; k++)
+        ch[k].resize(n);
+    for (int i = 0; i < n; i++) {
+        Color rgb = {Linear(bgr[3*i+2]), Linear(bgr[3*i+1]), Linear(bgr[3*i])};
+        Color y = XYZtoYCxCz(RGBtoXYZ(rgb));
+        ch[0][i] = y.a;
+        ch[1][i] = y.b;
+        ch[2][i] = y.c;
+        lum[i] = (y.a+16)/116;
+    }
+    for (int k = 0; k < 3; k++)
+        Convolve(ch[k], ch[k], w, h, csf[k], csf[k]);
+    p.lab.resize(n);
+    for (int i = 0; i < n; i++) {
+        Color y = {ch[0][i], ch[1][i], ch[2][i]}, rgb = XYZtoRGB(YCxCztoXYZ(y));
+        Color c = {Clamp01(rgb.a), Clamp01(rgb.b), Clamp01(rgb.c)};
+        p.lab[i] = XYZtoHuntLab(RGBtoXYZ(c));
+    }
+    vector<float> ex, ey, px, py;
+    Convolve(lum, ex, w, h, g1, g);
+    Convolve(lum, ey, w, h, g, g1);
+    Convolve(lum, px, w, h, g2, g);
+    Convolve(lum, py, w, h, g, g2);
+    p.edge.resize(n);
+    p.point.resize(n);
+    for (int i = 0; i < n; i++) {
+        p.edge[i] = sqrtf(ex[i]*ex[i]+ey[i]*ey[i]);
+        p.point[i] = sqrtf(px[i]*px[i]+py[i]*py[i]);
+    }
+}
+
+void HeatColor(float e, unsigned char *bgr) {
+    // black, red, yellow, white
+    float r = Clamp01(3*e), g = Clamp01(3*e-1), b = Clamp01(3*e-2);
+    bgr[0] = (unsigned char) (255*b+.5f);
+    bgr[1] = (unsigned char) (255*g+.5f);
+    bgr[2] = (unsigned char) (255*r+.5f);
+}
+
+} // end namespace
+
+bool DiffImages(unsigned char *a, unsigned char *b, int w, int h, ImageDiff &d, unsigned char *errorMap) {
+    d.psnr = 100;
+    d.flip = d.maxFlip = 0;
+    if (!a || !b || w <= 0 || h <= 0)
+        return false;
+    int n = w*h;
+    // PSNR
+    double sse = 0;
+    for (int i = 0; i < 3*n; i++) {
+        double e = (double) a[i]-b[i];
+        sse += e*e;
+    }
+    if (sse > 0) {
+        double psnr = 10*log10(255.*255./(sse/(3*n)));
+        d.psnr = psnr < 100? psnr : 100;
+    }
+    // FLIP
+    const float qc = .7f, qf = .5f, pc = .4f, pt = .95f;
+    Color green = {0, 1, 0}, blue = {0, 0, 1};
+    float cmax = powf(HyAB(XYZtoHuntLab(RGBtoXYZ(green)), XYZtoHuntLab(RGBtoXYZ(blue))), qc);
+    Prepared pa, pb;
+    Prepare(a, w, h, pa);
+    Prepare(b, w, h, pb);
+    double sum = 0;
+    for (int i = 0; i < n; i++) {
+        // color error, compressed so large differences share the top 5% of the range
+        float dc = powf(HyAB(pa.lab[i], pb.lab[i]), qc);
+        float ec = dc < pc*cmax? pt/(pc*cmax)*dc : pt+(dc-pc*cmax)/(cmax-pc*cmax)*(1-pt);
+        // feature error
+        float de = fabsf(pa.edge[i]-pb.edge[i]), dp = fabsf(pa.point[i]-pb.point[i]);
+        float ef = powf((de > dp? de : dp)/sqrtf(2.f), qf);
+        float e = powf(Clamp01(ec), 1-Clamp01(ef));
+        sum += e;
+        d.maxFlip = e > d.maxFlip? e : d.maxFlip;
+        if (errorMap)
+            HeatColor(e, errorMap+3*i);
+    }
+    d.flip = sum/n;
+    return true;
+}
+
+// Options
+
+bool ParseRegressOption(RegressOptions &o, int ac, char **av, int &i) {
+    const char *a = av[i];
+    bool arg = i+1 < ac;
+    if (!strcmp(a, "-update"))
+        o.update = true;
+    else if (!strcmp(a, "-golden") && arg)
+        o.goldenDir = av[++i];
+    else if (!strcmp(a, "-out") && arg)
+        o.outDir = av[++i];
+    else if (!strcmp(a, "-report") && arg)
+        o.reportFile = av[++i];
+    else if (!strcmp(a, "-psnr") && arg)
+        o.minPSNR = (float) atof(av[++i]);
+    else if (!strcmp(a, "-flip") && arg)
+        o.maxFlip = (float) atof(av[++i]);
+    else if (!strcmp(a, "-warmup") && arg)
+        o.nWarmup = atoi(av[++i]);
+    else if (!strcmp(a, "-frames") && arg)
+        o.nFrames = atoi(av[++i]);
+    else
+        return false;
+    return true;
+}
+
+// Runs
+
+Regress::Regress(const char *appName, RegressOptions &o) : app(appName), options(o) {
+    MakeDirectory(options.outDir.c_str());
+    MakeDirectory(options.goldenDir.c_str());
+    if (options.nFrames < 1)
+        options.nFrames = 1;
+}
+
+int Regress::NFailed() {
+    int n = 0;
+    for (size_t i = 0; i < results.size(); i++)
+        n += results[i].status == "fail" || results[i].status == "error";
+    return n;
+}
+
+bool Regress::Case(const char *name, RegressRender render, void *data, int width, int height) {
+    Result r;
+    r.name = name;
+    r.diff.psnr = 100;
+    r.diff.flip = r.diff.maxFlip = 0;
+    // time frames
+    double total = 0;
+    r.msMin = r.msMax = 0;
+    for (int f = 0; f < options.nWarmup+options.nFrames; f++) {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        render(data);
+        glFinish();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-t0).count();
+        if (f < options.nWarmup)
+            continue;
+        total += ms;
+        r.msMin = f == options.nWarmup || ms < r.msMin? ms : r.msMin;
+        r.msMax = ms > r.msMax? ms : r.msMax;
+    }
+    r.msMean = total/options.nFrames;
+    // read, save result
+    vector<unsigned char> pixels(3*width*height);
+    string rendered = options.outDir+"/"+name+".tga", golden = options.goldenDir+"/"+name+".tga";
+    if (!HeadlessRead(&pixels[0]) || !WriteTarga(rendered.c_str(), &pixels[0], width, height))
+        r.status = "error";
+    else {
+        FILE *exists = fopen(golden.c_str(), "rb");
+        if (exists)
+            fclose(exists);
+        if (options.update || !exists) {
+            r.status = !exists? "new" : "updated";
+            if (!WriteTarga(golden.c_str(), &pixels[0], width, height))
+                r.status = "error";
+        }
+        else {
+            int gw = 0, gh = 0;
+            unsigned char *g = ReadTarga(golden.c_str(), gw, gh);
+            if (!g || gw != width || gh != height) {
+                printf("%s: golden image is %ix%i, rendered %ix%i\n", name, gw, gh, width, height);
+                r.status = "fail";
+            }
+            else {
+                vector<unsigned char> heat(3*width*height);
+                DiffImages(&pixels[0], g, width, height, r.diff, &heat[0]);
+                bool pass = r.diff.psnr >= options.minPSNR && r.diff.flip <= options.maxFlip;
+                r.status = pass? "pass" : "fail";
+                if (!pass)
+                    WriteTarga((options.outDir+"/"+name+"-diff.tga").c_str(), &heat[0], width, height);
+            }
+            delete [] g;
+        }
+    }
+    printf("%-40s %-8s %7.2f ms  psnr %6.2f  flip %.4f\n", name, r.status.c_str(), r.msMean, r.diff.psnr, r.diff.flip);
+    results.push_back(r);
+    return r.status != "fail" && r.status != "error";
+}
+
+bool Regress::Finish() {
+    int nFailed = NFailed();
+    FILE *out = fopen(options.reportFile.c_str(), "w");
+    if (!out)
+        printf("can't write %s\n", options.reportFile.c_str());
+    else {
+        char date[100];
+        time_t now = time(NULL);
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+        // names are generated by the apps: no characters that need JSON escapes
+        fprintf(out, "{\n  \"app\": \"%s\",\n  \"date\": \"%s\",\n", app.c_str(), date);
+        fprintf(out, "  \"renderer\": \"%s\",\n", (const char *) glGetString(GL_RENDERER));
+        fprintf(out, "  \"thresholds\": {\"psnr\": %g, \"flip\": %g},\n", options.minPSNR, options.maxFlip);
+        fprintf(out, "  \"frames\": %i,\n  \"passed\": %i,\n  \"failed\": %i,\n  \"cases\": [\n",
+                options.nFrames, (int) results.size()-nFailed, nFailed);
+        for (size_t i = 0; i < results.size(); i++) {
+            Result &r = results[i];
+            fprintf(out, "    {\"name\": \"%s\", \"status\": \"%s\", \"ms\": %.3f, \"msMin\": %.3f, \"msMax\": %.3f, "
+                    "\"psnr\": %.2f, \"flip\": %.5f, \"maxFlip\": %.5f}%s\n",
+                    r.name.c_str(), r.status.c_str(), r.msMean, r.msMin, r.msMax,
+                    r.diff.psnr, r.diff.flip, r.diff.maxFlip, i+1 < results.size()? "," : "");
+        }
+        fprintf(out, "  ]\n}\n");
+        fclose(out);
+    }
+    printf("%i cases, %i failed; report %s\n", (int) results.size(), nFailed, options.reportFile.c_str());
+    return nFailed == 0;
+}
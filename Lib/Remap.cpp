@@ -0,0 +1,266 @@
+// Remap.cpp - image remapping (warps, projection changes): nearest, bilinear or bicubic, tiles in parallel
+
+#include "Remap.h"
+#include "Parallel.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define REMAP_SSE2
+#include <emmintrin.h>
+#endif
+
+using std::vector;
+
+namespace {
+
+const int tileSize = 64;
+
+struct Source {
+    unsigned char *pixels;
+    int width, height, bytesPerPixel;
+    bool wrapX;
+    unsigned char *Pixel(int i, int j) { return pixels+bytesPerPixel*(j*width+i); }
+};
+
+int Index(int i, int n, bool wrap) {
+    if (wrap) {
+        i %= n;
+        return i < 0? i+n : i;
+    }
+    return i < 0? 0 : i >= n? n-1 : i;
+}
+
+int Taps(Source &s, RemapFilter filter, float x, float y, int *xi, int *yi, float *wx, float *wy) {
+    // source pixels and weights along each axis: 2 (bilinear) or 4 (bicubic)
+    // positions far outside (or NaN) give the same taps as just outside: clamp them first
+    if (s.wrapX)
+        x -= s.width*floorf(x/s.width);
+    x = x >= -1? (x <= s.width? x : (float) s.width) : -1;
+    y = y >= -1? (y <= s.height? y : (float) s.height) : -1;
+    float fx = floorf(x), fy = floorf(y), tx = x-fx, ty = y-fy;
+    int n = filter == RemapBicubic? 4 : 2, x0 = (int) fx-(n == 4), y0 = (int) fy-(n == 4);
+    for (int k = 0; k < n; k++) {
+        xi[k] = Index(x0+k, s.width, s.wrapX);
+        yi[k] = Index(y0+k, s.height, false);
+    }
+    if (n == 2) {
+        wx[0] = 1-tx; wx[1] = tx;
+        wy[0] = 1-ty; wy[1] = ty;
+    }
+    else {
+        // Catmull-Rom
+        float t[] = {tx, ty}, *w[] = {wx, wy};
+        for (int a = 0; a < 2; a++) {
+            float t1 = t[a], t2 = t1*t1, t3 = t2*t1;
+            w[a][0] = -.5f*t3+t2-.5f*t1;
+            w[a][1] = 1.5f*t3-2.5f*t2+1;
+            w[a][2] = -1.5f*t3+2*t2+.5f*t1;
+            w[a][3] = .5f*t3-.5f*t2;
+        }
+    }
+    return n;
+}
+
+void SampleScalar(Source &s, RemapFilter filter, float x, float y, unsigned char *out) {
+    int bpp = s.bytesPerPixel;
+    if (filter == RemapNearest) {
+        if (s.wrapX)
+            x -= s.width*floorf(x/s.width);
+        x = x >= 0? (x <= s.width? x : (float) s.width) : 0;     // also NaN to 0
+        y = y >= 0? (y <= s.height? y : (float) s.height) : 0;
+        memcpy(out, s.Pixel(Index((int) (x+.5f), s.width, s.wrapX), Index((int) (y+.5f), s.height, false)), bpp);
+        return;
+    }
+    if (filter == RemapBilinear && x >= 0 && x < s.width-1 && y >= 0 && y < s.height-1) {
+        // all four taps inside the source
+        int i = (int) x, j = (int) y;
+        float tx = x-i, ty = y-j;
+        unsigned char *p00 = s.Pixel(i, j), *p01 = p00+bpp*s.width;
+        for (int c = 0; c < bpp; c++) {
+            float a = p00[c]+tx*(p00[c+bpp]-p00[c]), b = p01[c]+tx*(p01[c+bpp]-p01[c]);
+            out[c] = (unsigned char) (a+ty*(b-a)+.5f);
+        }
+        return;
+    }
+    int xi[4], yi[4];
+    float wx[4], wy[4];
+    int n = Taps(s, filter, x, y, xi, yi, wx, wy);
+    float sum[4] = {0, 0, 0, 0};
+    for (int b = 0; b < n; b++)
+        for (int a = 0; a < n; a++) {
+            unsigned char *p = s.Pixel(xi[a], yi[b]);
+            float w = wx[a]*wy[b];
+            for (int c = 0; c < bpp; c++)
+                sum[c] += w*p[c];
+        }
+    for (int c = 0; c < bpp; c++) {
+        float v = sum[c]+.5f;
+        out[c] = (unsigned char) (v < 0? 0 : v > 255? 255 : v);
+    }
+}
+
+#ifdef REMAP_SSE2
+template <int bpp> __m128 Load(unsigned char *p) {
+    // one texel's 3 or 4 channels as floats (3 bytes assembled: a 3-byte copy stalls the 4-byte read)
+    int v = 0;
+    if (bpp == 4)
+        memcpy(&v, p, 4);
+    else
+        v = p[0] | p[1] << 8 | p[2] << 16;
+    __m128i zero = _mm_setzero_si128(), i = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(i, zero));
+}
+
+template <int bpp> void Store(__m128 v, unsigned char *out) {
+    __m128i i = _mm_cvtps_epi32(v);                 // round, then saturate to bytes
+    i = _mm_packus_epi16(_mm_packs_epi32(i, i), i);
+    int b = _mm_cvtsi128_si32(i);
+    memcpy(out, &b, bpp);
+}
+
+template <int bpp> void SampleRowSSE(Source &s, RemapFilter filter, const float *xs, const float *ys, int n, unsigned char *out) {
+    // positions four at a time: wrap, clamp (NaN to -1), split into integer and fraction
+    // then per pixel gather the taps, with no edge tests when all lie inside the source
+    int w = s.width, h = s.height, row = bpp*w, r = filter == RemapBicubic? 1 : 0;
+    __m128 W = _mm_set1_ps((float) w), H = _mm_set1_ps((float) h), minus1 = _mm_set1_ps(-1), one = _mm_set1_ps(1);
+    int k = 0;
+    for (; k+4 <= n; k += 4, out += 4*bpp) {
+        __m128 X = _mm_loadu_ps(xs+k), Y = _mm_loadu_ps(ys+k);
+        if (s.wrapX) {
+            __m128 q = _mm_div_ps(X, W), f = _mm_cvtepi32_ps(_mm_cvttps_epi32(q));
+            f = _mm_sub_ps(f, _mm_and_ps(_mm_cmpgt_ps(f, q), one));    // floor
+            X = _mm_sub_ps(X, _mm_mul_ps(W, f));
+        }
+        X = _mm_min_ps(_mm_max_ps(X, minus1), W);
+        Y = _mm_min_ps(_mm_max_ps(Y, minus1), H);
+        X = _mm_add_ps(X, one);                     // non-negative: truncation is floor
+        Y = _mm_add_ps(Y, one);
+        __m128i IX = _mm_cvttps_epi32(X), IY = _mm_cvttps_epi32(Y);
+        int ix[4], iy[4];
+        float tx[4], ty[4];
+        _mm_storeu_ps(tx, _mm_sub_ps(X, _mm_cvtepi32_ps(IX)));
+        _mm_storeu_ps(ty, _mm_sub_ps(Y, _mm_cvtepi32_ps(IY)));
+        _mm_storeu_si128((__m128i *) ix, IX);
+        _mm_storeu_si128((__m128i *) iy, IY);
+        for (int m = 0; m < 4; m++) {
+            int x0 = ix[m]-1-r, y0 = iy[m]-1-r;
+            unsigned char *o = out+m*bpp;
+            if (filter == RemapBilinear) {
+                __m128 fx = _mm_set1_ps(tx[m]), fy = _mm_set1_ps(ty[m]);
+                unsigned char *p00, *p10, *p01, *p11;
+                if (x0 >= 0 && x0+1 < w && y0 >= 0 && y0+1 < h) {
+                    p00 = s.pixels+y0*row+x0*bpp;
+                    p10 = p00+bpp;
+                    p01 = p00+row;
+                    p11 = p01+bpp;
+                }
+                else {
+                    int i0 = Index(x0, w, s.wrapX), i1 = Index(x0+1, w, s.wrapX), j0 = Index(y0, h, false), j1 = Index(y0+1, h, false);
+                    p00 = s.Pixel(i0, j0);
+                    p10 = s.Pixel(i1, j0);
+                    p01 = s.Pixel(i0, j1);
+                    p11 = s.Pixel(i1, j1);
+                }
+                __m128 a = Load<bpp>(p00), b = Load<bpp>(p01);
+                a = _mm_add_ps(a, _mm_mul_ps(fx, _mm_sub_ps(Load<bpp>(p10), a)));
+                b = _mm_add_ps(b, _mm_mul_ps(fx, _mm_sub_ps(Load<bpp>(p11), b)));
+                Store<bpp>(_mm_add_ps(a, _mm_mul_ps(fy, _mm_sub_ps(b, a))), o);
+                continue;
+            }
+            float wx[4], wy[4], t[] = {tx[m], ty[m]}, *wt[] = {wx, wy};
+            for (int a = 0; a < 2; a++) {
+                // Catmull-Rom
+                float t1 = t[a], t2 = t1*t1, t3 = t2*t1;
+                wt[a][0] = -.5f*t3+t2-.5f*t1;
+                wt[a][1] = 1.5f*t3-2.5f*t2+1;
+                wt[a][2] = -1.5f*t3+2*t2+.5f*t1;
+                wt[a][3] = .5f*t3-.5f*t2;
+            }
+            bool inside = x0 >= 0 && x0+3 < w && y0 >= 0 && y0+3 < h;
+            int xo[4], yo[4];
+            for (int a = 0; a < 4; a++) {
+                xo[a] = bpp*(inside? x0+a : Index(x0+a, w, s.wrapX));
+                yo[a] = row*(inside? y0+a : Index(y0+a, h, false));
+            }
+            __m128 sum = _mm_setzero_ps();
+            for (int b = 0; b < 4; b++) {
+                unsigned char *p = s.pixels+yo[b];
+                __m128 v = _mm_mul_ps(_mm_set1_ps(wx[0]), Load<bpp>(p+xo[0]));
+                v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(wx[1]), Load<bpp>(p+xo[1])));
+                v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(wx[2]), Load<bpp>(p+xo[2])));
+                v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(wx[3]), Load<bpp>(p+xo[3])));
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(wy[b]), v));
+            }
+            Store<bpp>(sum, o);
+        }
+    }
+    for (; k < n; k++, out += bpp)
+        SampleScalar(s, filter, xs[k], ys[k], out);
+}
+#endif
+
+void SampleRow(Source &s, RemapFilter filter, const float *xs, const float *ys, int n, unsigned char *out) {
+#ifdef REMAP_SSE2
+    if (filter != RemapNearest && s.bytesPerPixel == 3) {
+        SampleRowSSE<3>(s, filter, xs, ys, n, out);
+        return;
+    }
+    if (filter != RemapNearest && s.bytesPerPixel == 4) {
+        SampleRowSSE<4>(s, filter, xs, ys, n, out);
+        return;
+    }
+#endif
+    for (int k = 0; k < n; k++, out += s.bytesPerPixel)
+        SampleScalar(s, filter, xs[k], ys[k], out);
+}
+
+template <class F> void ParallelTiles(int width, int height, int nThreads, F f) {
+    int nx = (width+tileSize-1)/tileSize, ny = (height+tileSize-1)/tileSize;
+    ParallelFor(0, nx*ny, 1, nThreads, [&](int t0, int t1) {
+        for (int t = t0; t < t1; t++) {
+            int i0 = (t%nx)*tileSize, j0 = (t/nx)*tileSize;
+            f(i0, j0, i0+tileSize < width? i0+tileSize : width, j0+tileSize < height? j0+tileSize : height);
+        }
+    });
+}
+
+} // end namespace
+
+void MakeRemapLUT(int width, int height, RemapFunction f, void *data, RemapLUT &lut, int nThreads) {
+    lut.width = width;
+    lut.height = height;
+    lut.x.resize(width*height);
+    lut.y.resize(width*height);
+    ParallelTiles(width, height, nThreads, [&](int i0, int j0, int i1, int j1) {
+        for (int j = j0; j < j1; j++)
+            for (int i = i0; i < i1; i++)
+                f(i, j, lut.x[j*width+i], lut.y[j*width+i], data);
+    });
+}
+
+void Remap(unsigned char *src, int srcWidth, int srcHeight, int bytesPerPixel,
+           unsigned char *dst, int dstWidth, int dstHeight, RemapFunction f, void *data,
+           RemapFilter filter, bool wrapX, int nThreads) {
+    Source s = {src, srcWidth, srcHeight, bytesPerPixel, wrapX};
+    ParallelTiles(dstWidth, dstHeight, nThreads, [&](int i0, int j0, int i1, int j1) {
+        // a tile row of positions at a time
+        float xs[tileSize], ys[tileSize];
+        for (int j = j0; j < j1; j++) {
+            for (int i = i0; i < i1; i++)
+                f(i, j, xs[i-i0], ys[i-i0], data);
+            SampleRow(s, filter, xs, ys, i1-i0, dst+bytesPerPixel*(j*dstWidth+i0));
+        }
+    });
+}
+
+void Remap(unsigned char *src, int srcWidth, int srcHeight, int bytesPerPixel, unsigned char *dst, RemapLUT &lut,
+           RemapFilter filter, bool wrapX, int nThreads) {
+    Source s = {src, srcWidth, srcHeight, bytesPerPixel, wrapX};
+    ParallelTiles(lut.width, lut.height, nThreads, [&](int i0, int j0, int i1, int j1) {
+        for (int j = j0; j < j1; j++) {
+            int k = j*lut.width+i0;
+            SampleRow(s, filter, &lut.x[k], &lut.y[k], i1-i0, dst+bytesPerPixel*k);
+        }
+    });
+}
@@ -0,0 +1,145 @@
+// SceneFile.cpp - scene files (camera modelview, then a name and transform per mesh), text or versioned binary
+
+#include "SceneFile.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+const char binaryMagic[4] = {'S', 'C', 'N', 'B'};
+const uint32_t binaryVersion = 2;     // 2: per entry parent
+const uint32_t maxNameLength = 4096;
+
+// text
+
+bool ReadMatrix(FILE *file, mat4 &m) {
+    char buf[500];
+    if (fgets(buf, 500, file) == NULL)
+        return false;
+    int nitems = sscanf(buf, "%f%f%f%f%f%f%f%f%f%f%f%f%f%f%f%f",
+        &m[0][0], &m[0][1], &m[0][2], &m[0][3],
+        &m[1][0], &m[1][1], &m[1][2], &m[1][3],
+        &m[2][0], &m[2][1], &m[2][2], &m[2][3],
+        &m[3][0], &m[3][1], &m[3][2], &m[3][3]);
+    return nitems == 16;
+}
+
+void WriteMatrix(FILE *file, mat4 &m) {
+    fprintf(file, "%f %f %f %f %f %f %f %f %f %f %f %f %f %f %f %f\n",
+        m[0][0], m[0][1], m[0][2], m[0][3],
+        m[1][0], m[1][1], m[1][2], m[1][3],
+        m[2][0], m[2][1], m[2][2], m[2][3],
+        m[3][0], m[3][1], m[3][2], m[3][3]);
+}
+
+bool ReadText(FILE *file, SceneFile &scene) {
+    char name[500];
+    if (!ReadMatrix(file, scene.modelview)) {
+        printf("Can't read modelview\n");
+        return false;
+    }
+    while (fgets(name, 500, file) != NULL) {
+        size_t len = strlen(name);
+        while (len && (name[len-1] == '\n' || name[len-1] == '\r'))
+            name[--len] = 0;
+        SceneEntry e;
+        e.name = string(name);
+        if (!ReadMatrix(file, e.xform)) {
+            printf("Can't read matrix\n");
+            return false;
+        }
+        scene.entries.push_back(e);
+    }
+    return true;
+}
+
+// binary
+
+bool ReadUint(FILE *file, uint32_t &n) { return fread(&n, sizeof(uint32_t), 1, file) == 1; }
+bool ReadMatrixBinary(FILE *file, mat4 &m) { return fread(&m[0][0], sizeof(float), 16, file) == 16; }
+bool WriteUint(FILE *file, uint32_t n) { return fwrite(&n, sizeof(uint32_t), 1, file) == 1; }
+bool WriteMatrixBinary(FILE *file, mat4 &m) { return fwrite(&m[0][0], sizeof(float), 16, file) == 16; }
+
+bool ReadBinary(FILE *file, SceneFile &scene) {
+    // magic already read
+    uint32_t version = 0, nEntries = 0;
+    if (!ReadUint(file, version) || version > binaryVersion) {
+        printf("Unsupported scene version %u\n", version);
+        return false;
+    }
+    if (!ReadUint(file, nEntries) || !ReadMatrixBinary(file, scene.modelview)) {
+        printf("Can't read scene header\n");
+        return false;
+    }
+    for (uint32_t i = 0; i < nEntries; i++) {
+        uint32_t len = 0;
+        if (!ReadUint(file, len) || len > maxNameLength) {
+            printf("Bad name in scene entry %u\n", i);
+            return false;
+        }
+        SceneEntry e;
+        e.name.resize(len);
+        uint32_t parent = ~0u;
+        if ((len && fread(&e.name[0], 1, len, file) != len) || !ReadMatrixBinary(file, e.xform) ||
+            (version >= 2 && !ReadUint(file, parent))) {
+            printf("Can't read scene entry %u\n", i);
+            return false;
+        }
+        e.parent = parent < i? (int) parent : -1;
+        scene.entries.push_back(e);
+    }
+    return true;
+}
+
+bool WriteBinary(FILE *file, SceneFile &scene) {
+    bool ok = fwrite(binaryMagic, 1, 4, file) == 4 && WriteUint(file, binaryVersion) &&
+              WriteUint(file, (uint32_t) scene.entries.size()) && WriteMatrixBinary(file, scene.modelview);
+    for (size_t i = 0; ok && i < scene.entries.size(); i++) {
+        SceneEntry &e = scene.entries[i];
+        uint32_t len = (uint32_t) e.name.size();
+        uint32_t parent = e.parent >= 0 && (size_t) e.parent < i? (uint32_t) e.parent : ~0u;
+        ok = WriteUint(file, len) && (!len || fwrite(e.name.c_str(), 1, len, file) == len) &&
+             WriteMatrixBinary(file, e.xform) && WriteUint(file, parent);
+    }
+    return ok;
+}
+
+} // end namespace
+
+bool ReadSceneFile(const char *filename, SceneFile &scene) {
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+        return false;
+    scene.entries.resize(0);
+    char magic[4];
+    bool binary = fread(magic, 1, 4, file) == 4 && !memcmp(magic, binaryMagic, 4);
+    if (!binary)
+        rewind(file);
+    bool ok = binary? ReadBinary(file, scene) : ReadText(file, scene);
+    fclose(file);
+    return ok;
+}
+
+bool WriteSceneFile(const char *filename, SceneFile &scene, bool binary) {
+    FILE *file = fopen(filename, binary? "wb" : "w");
+    if (!file) {
+        printf("Can't write %s\n", filename);
+        return false;
+    }
+    bool ok = true;
+    if (binary)
+        ok = WriteBinary(file, scene);
+    else {
+        WriteMatrix(file, scene.modelview);
+        for (size_t i = 0; i < scene.entries.size(); i++) {
+            fprintf(file, "%s\n", scene.entries[i].name.c_str());
+            WriteMatrix(file, scene.entries[i].xform);
+        }
+    }
+    if (fclose(file) != 0 || !ok) {
+        printf("Can't write %s\n", filename);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,201 @@
+// SceneGraph.cpp - transform hierarchy: flat node array in parent-before-child order, local/world matrices, dirty flags
+
+#include "SceneGraph.h"
+#include <algorithm>
+
+SceneGraph::SceneGraph() : firstDirty(0), nUpdates(0) { }
+
+int SceneGraph::Slot(int node) { return node >= 0 && node < (int) slots.size()? slots[node] : -1; }
+
+bool SceneGraph::Valid(int node) { return Slot(node) >= 0; }
+
+int SceneGraph::NNodes() { return ids.size(); }
+
+int SceneGraph::Parent(int node) {
+    int p = parents[Slot(node)];
+    return p < 0? -1 : ids[p];
+}
+
+void SceneGraph::Clear() {
+    ids.resize(0);
+    parents.resize(0);
+    ends.resize(0);
+    locals.resize(0);
+    worlds.resize(0);
+    dirty.resize(0);
+    stamps.resize(0);
+    slots.resize(0);
+    firstDirty = 0;
+}
+
+int SceneGraph::Add(int parent, const mat4 &local) {
+    // append; reorder only if the parent's subtree isn't last
+    int id = slots.size(), s = ids.size(), p = Slot(parent);
+    bool append = p < 0 || ends[p] == s;
+    ids.push_back(id);
+    parents.push_back(p);
+    ends.push_back(s+1);
+    locals.push_back(local);
+    worlds.push_back(p < 0? local : worlds[p]*local);
+    dirty.push_back(1);
+    stamps.push_back(-1);
+    slots.push_back(s);
+    firstDirty = std::min(firstDirty, s);
+    if (append)
+        for (int a = p; a >= 0; a = parents[a])
+            ends[a] = s+1;
+    else {
+        vector<int> parentIds(ids.size());
+        for (int i = 0; i < (int) ids.size(); i++)
+            parentIds[i] = parents[i] < 0? -1 : ids[parents[i]];
+        Reorder(parentIds);
+    }
+    return id;
+}
+
+void SceneGraph::Remove(int node) {
+    int s = Slot(node);
+    if (s < 0)
+        return;
+    int n = ids.size();
+    vector<int> parentIds(n);
+    for (int i = 0; i < n; i++) {
+        parentIds[i] = parents[i] < 0? -1 : ids[parents[i]];
+        if (parents[i] == s) {
+            // child keeps its world: fold removed node's local into it
+            locals[i] = locals[s]*locals[i];
+            parentIds[i] = parents[s] < 0? -1 : ids[parents[s]];
+            dirty[i] = 1;
+        }
+    }
+    slots[node] = -1;
+    ids.erase(ids.begin()+s);
+    parentIds.erase(parentIds.begin()+s);
+    locals.erase(locals.begin()+s);
+    worlds.erase(worlds.begin()+s);
+    dirty.erase(dirty.begin()+s);
+    stamps.erase(stamps.begin()+s);
+    parents.resize(n-1);
+    ends.resize(n-1);
+    for (int k = s; k < n-1; k++)
+        slots[ids[k]] = k;
+    Reorder(parentIds);
+}
+
+bool SceneGraph::SetParent(int node, int parent, bool keepWorld) {
+    int s = Slot(node), p = Slot(parent);
+    if (s < 0 || (parent >= 0 && p < 0) || (p >= s && p < ends[s]))
+        return false;
+    if (keepWorld)
+        locals[s] = p < 0? worlds[s] : AffineInverse(worlds[p])*worlds[s];
+    dirty[s] = 1;
+    vector<int> parentIds(ids.size());
+    for (int i = 0; i < (int) ids.size(); i++)
+        parentIds[i] = i == s? parent : parents[i] < 0? -1 : ids[parents[i]];
+    Reorder(parentIds);
+    return true;
+}
+
+void SceneGraph::Reorder(vector<int> &parentIds) {
+    int n = ids.size();
+    // children per slot, in current order
+    vector<int> first(n, -1), next(n, -1), last(n, -1), order, roots;
+    for (int i = 0; i < n; i++) {
+        int p = parentIds[i] < 0? -1 : slots[parentIds[i]];
+        if (p < 0)
+            roots.push_back(i);
+        else {
+            (last[p] < 0? first[p] : next[last[p]]) = i;
+            last[p] = i;
+        }
+    }
+    // depth-first
+    vector<int> stack, newSlots(n), newParents(n), newEnds(n);
+    order.reserve(n);
+    for (size_t r = 0; r < roots.size(); r++) {
+        stack.push_back(roots[r]);
+        while (!stack.empty()) {
+            int i = stack.back();
+            stack.pop_back();
+            newSlots[i] = order.size();
+            order.push_back(i);
+            int nKids = 0;
+            for (int c = first[i]; c >= 0; c = next[c], nKids++)
+                stack.push_back(c);
+            std::reverse(stack.end()-nKids, stack.end());
+        }
+    }
+    for (int k = n-1; k >= 0; k--) {
+        int i = order[k], p = parentIds[i] < 0? -1 : slots[parentIds[i]];
+        newParents[k] = p < 0? -1 : newSlots[p];
+        newEnds[k] = first[i] < 0? k+1 : newEnds[newSlots[last[i]]];
+    }
+    // permute
+    vector<int> newIds(n), newStamps(n);
+    vector<mat4> newLocals(n), newWorlds(n);
+    vector<char> newDirty(n);
+    for (int k = 0; k < n; k++) {
+        int i = order[k];
+        newIds[k] = ids[i];
+        newLocals[k] = locals[i];
+        newWorlds[k] = worlds[i];
+        newDirty[k] = dirty[i];
+        newStamps[k] = stamps[i];
+    }
+    ids.swap(newIds);
+    parents.swap(newParents);
+    ends.swap(newEnds);
+    locals.swap(newLocals);
+    worlds.swap(newWorlds);
+    dirty.swap(newDirty);
+    stamps.swap(newStamps);
+    firstDirty = n;
+    for (int k = 0; k < n; k++) {
+        slots[ids[k]] = k;
+        if (dirty[k] && firstDirty == n)
+            firstDirty = k;
+    }
+}
+
+mat4 &SceneGraph::Local(int node) { return locals[Slot(node)]; }
+
+void SceneGraph::Touch(int node) {
+    int s = Slot(node);
+    dirty[s] = 1;
+    firstDirty = std::min(firstDirty, s);
+}
+
+void SceneGraph::SetLocal(int node, const mat4 &m) {
+    locals[Slot(node)] = m;
+    Touch(node);
+}
+
+void SceneGraph::SetWorld(int node, const mat4 &m) {
+    int s = Slot(node), p = parents[s];
+    locals[s] = p < 0? m : AffineInverse(worlds[p])*m;
+    Touch(node);
+}
+
+const mat4 &SceneGraph::World(int node) { return worlds[Slot(node)]; }
+
+bool SceneGraph::Changed(int node) { return stamps[Slot(node)] == nUpdates; }
+
+int SceneGraph::Update() {
+    // a touched node's subtree is contiguous and follows it: recompute the run, skip past it
+    nUpdates++;
+    int n = ids.size(), nRecomputed = 0;
+    for (int s = firstDirty; s < n; ) {
+        if (!dirty[s]) {
+            s++;
+            continue;
+        }
+        for (int end = ends[s]; s < end; s++, nRecomputed++) {
+            int p = parents[s];
+            worlds[s] = p < 0? locals[s] : worlds[p]*locals[s];
+            dirty[s] = 0;
+            stamps[s] = nUpdates;
+        }
+    }
+    firstDirty = n;
+    return nRecomputed;
+}
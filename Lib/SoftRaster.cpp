@@ -0,0 +1,548 @@
+// SoftRaster.cpp - multithreaded tile-based CPU rasterizer, a reference for the BRDF pixel shader
+
+#include <glad.h>
+#include "Misc.h"
+#include "SoftRaster.h"
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOFT_RASTER_SSE
+#endif
+
+namespace {
+
+const int tileSize = 64;	// even, so 2x2 quads never straddle tiles
+
+// Four lanes: the pixels of a 2x2 quad (x, y), (x+1, y), (x, y+1), (x+1, y+1)
+
+#ifdef SOFT_RASTER_SSE
+
+struct F4 {
+    __m128 v;
+    F4() { }
+    F4(__m128 v) : v(v) { }
+    F4(float s) : v(_mm_set1_ps(s)) { }
+    F4(float a, float b, float c, float d) : v(_mm_setr_ps(a, b, c, d)) { }
+    void Store(float *f) const { _mm_storeu_ps(f, v); }
+};
+
+inline F4 operator + (F4 a, F4 b) { return _mm_add_ps(a.v, b.v); }
+inline F4 operator - (F4 a, F4 b) { return _mm_sub_ps(a.v, b.v); }
+inline F4 operator * (F4 a, F4 b) { return _mm_mul_ps(a.v, b.v); }
+inline F4 operator / (F4 a, F4 b) { return _mm_div_ps(a.v, b.v); }
+inline F4 Min(F4 a, F4 b) { return _mm_min_ps(a.v, b.v); }
+inline F4 Max(F4 a, F4 b) { return _mm_max_ps(a.v, b.v); }	// Max(NaN, b) = b
+inline F4 Sqrt(F4 a) { return _mm_sqrt_ps(a.v); }
+inline F4 Abs(F4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a.v); }
+inline F4 Greater(F4 a, F4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline F4 GreaterEqual(F4 a, F4 b) { return _mm_cmpge_ps(a.v, b.v); }
+inline F4 And(F4 a, F4 b) { return _mm_and_ps(a.v, b.v); }
+inline F4 Or(F4 a, F4 b) { return _mm_or_ps(a.v, b.v); }
+inline F4 Select(F4 mask, F4 a, F4 b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+inline int Bits(F4 mask) { return _mm_movemask_ps(mask.v); }
+
+#else
+
+// scalar fallback with identical results
+struct F4 {
+    float v[4];
+    F4() { }
+    F4(float s) { v[0] = v[1] = v[2] = v[3] = s; }
+    F4(float a, float b, float c, float d) { v[0] = a; v[1] = b; v[2] = c; v[3] = d; }
+    void Store(float *f) const { memcpy(f, v, sizeof(v)); }
+};
+
+#define F4_OP(expr) F4 r; for (int i = 0; i < 4; i++) r.v[i] = expr; return r;
+inline float MaskValue(bool b) { unsigned int u = b? 0xFFFFFFFFu : 0; float f; memcpy(&f, &u, 4); return f; }
+inline unsigned int MaskBits(float f) { unsigned int u; memcpy(&u, &f, 4); return u; }
+inline F4 operator + (F4 a, F4 b) { F4_OP(a.v[i]+b.v[i]) }
+inline F4 operator - (F4 a, F4 b) { F4_OP(a.v[i]-b.v[i]) }
+inline F4 operator * (F4 a, F4 b) { F4_OP(a.v[i]*b.v[i]) }
+inline F4 operator / (F4 a, F4 b) { F4_OP(a.v[i]/b.v[i]) }
+inline F4 Min(F4 a, F4 b) { F4_OP(a.v[i] < b.v[i]? a.v[i] : b.v[i]) }
+inline F4 Max(F4 a, F4 b) { F4_OP(a.v[i] > b.v[i]? a.v[i] : b.v[i]) }
+inline F4 Sqrt(F4 a) { F4_OP(sqrtf(a.v[i])) }
+inline F4 Abs(F4 a) { F4_OP(fabsf(a.v[i])) }
+inline F4 Greater(F4 a, F4 b) { F4_OP(MaskValue(a.v[i] > b.v[i])) }
+inline F4 GreaterEqual(F4 a, F4 b) { F4_OP(MaskValue(a.v[i] >= b.v[i])) }
+inline F4 And(F4 a, F4 b) { F4_OP(MaskValue(MaskBits(a.v[i]) && MaskBits(b.v[i]))) }
+inline F4 Or(F4 a, F4 b) { F4_OP(MaskValue(MaskBits(a.v[i]) || MaskBits(b.v[i]))) }
+inline F4 Select(F4 m, F4 a, F4 b) { F4_OP(MaskBits(m.v[i])? a.v[i] : b.v[i]) }
+inline int Bits(F4 m) { int b = 0; for (int i = 0; i < 4; i++) if (MaskBits(m.v[i])) b |= 1 << i; return b; }
+
+#endif
+
+inline F4 Clamp(F4 a, float lo, float hi) { return Min(Max(a, F4(lo)), F4(hi)); }
+inline F4 Pow4(F4 a) { F4 a2 = a*a; return a2*a2; }
+inline F4 Pow5(F4 a) { return Pow4(a)*a; }
+
+struct V4 {
+    F4 x, y, z;
+    V4() { }
+    V4(F4 x, F4 y, F4 z) : x(x), y(y), z(z) { }
+    V4(vec3 v) : x(v.x), y(v.y), z(v.z) { }
+};
+
+inline V4 operator + (const V4 &a, const V4 &b) { return V4(a.x+b.x, a.y+b.y, a.z+b.z); }
+inline V4 operator - (const V4 &a, const V4 &b) { return V4(a.x-b.x, a.y-b.y, a.z-b.z); }
+inline V4 operator * (const V4 &a, const V4 &b) { return V4(a.x*b.x, a.y*b.y, a.z*b.z); }
+inline V4 operator * (const V4 &a, F4 s) { return V4(a.x*s, a.y*s, a.z*s); }
+inline V4 operator / (F4 s, const V4 &a) { return V4(s/a.x, s/a.y, s/a.z); }
+inline F4 Dot(const V4 &a, const V4 &b) { return a.x*b.x+a.y*b.y+a.z*b.z; }
+inline V4 Sqrt(const V4 &a) { return V4(Sqrt(a.x), Sqrt(a.y), Sqrt(a.z)); }
+
+inline V4 Normalize(const V4 &a) {
+    // zero vectors stay zero (GLSL leaves them undefined)
+    F4 len = Sqrt(Dot(a, a)), ok = Greater(len, F4(0));
+    F4 s = Select(ok, F4(1)/Select(ok, len, F4(1)), F4(0));
+    return a*s;
+}
+
+// Texture
+
+V4 Sample(const RasterTexture *t, F4 u, F4 v) {
+    float us[4], vs[4], r[4], g[4], b[4];
+    u.Store(us);
+    v.Store(vs);
+    for (int i = 0; i < 4; i++) {
+        vec3 c = t? t->Sample(us[i], vs[i]) : vec3(0, 0, 0);
+        r[i] = c.x;
+        g[i] = c.y;
+        b[i] = c.z;
+    }
+    return V4(F4(r[0], r[1], r[2], r[3]), F4(g[0], g[1], g[2], g[3]), F4(b[0], b[1], b[2], b[3]));
+}
+
+// Shading: port of the 15-Solution pixel shader, four pixels at a time
+
+F4 FSchlick(F4 VoH, F4 f0, F4 f90) { return f0+(f90-f0)*Pow5(F4(1)-VoH); }
+
+F4 DisneyDiffuse(F4 NoE, F4 NoL, F4 LoH, F4 roughness) {
+    F4 PI(3.1652f); // as in shader
+    F4 f90 = F4(.5f)+F4(2)*roughness*LoH*LoH;
+    return FSchlick(NoL, F4(1), f90)*FSchlick(NoE, F4(1), f90)*(F4(1)/PI);
+}
+
+V4 GeometryFunction(F4 NoV, F4 NoL, const V4 &a) {
+    V4 a2 = a*a;
+    V4 GGXL = Sqrt((a2*(F4(0)-NoL)+V4(NoL, NoL, NoL))*NoL+a2)*NoV;
+    V4 GGXV = Sqrt((a2*(F4(0)-NoV)+V4(NoV, NoV, NoV))*NoV+a2)*NoL;
+    return F4(.5f)/(GGXV+GGXL);
+}
+
+V4 DistributionFunction(F4 NoH, const V4 &a) {
+    V4 a2 = a*a;
+    V4 f = (a2*NoH-V4(NoH, NoH, NoH))*NoH+V4(1, 1, 1);
+    V4 d = f*f*F4(3.141592f);
+    return V4(a2.x/d.x, a2.y/d.y, a2.z/d.z);
+}
+
+struct QuadInput {
+    V4 point, normal;
+    F4 u, v;
+};
+
+V4 Shade(QuadInput &q, const RasterMaterial &m, const RasterShading &s) {
+    V4 AOTexture = Sample(m.ao, q.u, q.v);
+    V4 albedo = Sample(m.albedo, q.u, q.v);
+    // the shader samples Metallic_Map only for f0, which no branch uses
+    V4 roughness = Sample(m.roughness, q.u, q.v);
+    V4 N = Normalize(q.normal);
+    if (s.normalMap) {
+        // coarse quad derivatives: dFdx = lane 1 - lane 0, dFdy = lane 2 - lane 0
+        float u[4], v[4], px[4], py[4], pz[4];
+        q.u.Store(u); q.v.Store(v); q.point.x.Store(px); q.point.y.Store(py); q.point.z.Store(pz);
+        vec2 du(u[2]-u[0], v[2]-v[0]), dv(u[1]-u[0], v[1]-v[0]);
+        vec3 dx(px[2]-px[0], py[2]-py[0], pz[2]-pz[0]), dy(px[1]-px[0], py[1]-py[0], pz[1]-pz[0]);
+        V4 U = Normalize(V4(du.x*dx+du.y*dy)), V = Normalize(V4(dv.x*dx+dv.y*dy));
+        V4 bump = Sample(m.normal, q.u, q.v);
+        V4 B = Normalize(V4(F4(2)*bump.x-F4(1), F4(2)*bump.y-F4(1), bump.z));
+        N = Normalize(U*B.x+V*B.y+N*B.z);
+    }
+    F4 PI(3.1415f);
+    V4 L1 = Normalize(V4(s.light2)-q.point);
+    V4 E = Normalize(q.point);
+    // directional light
+    V4 L(vec3(0, 0, 1)), lightDirColor(vec3(1, 1, 1));
+    F4 lightDirIntensity(4);
+    V4 H = Normalize(E+L);
+    F4 NoL = Clamp(Dot(N, L), 0, 1), NoE = Max(F4(0), Abs(Dot(N, E)));
+    F4 NoH = Clamp(Dot(N, H), 0, 1), LoH = Max(Dot(L, H), F4(0));
+    // point light 1
+    V4 lightPoint1Color = s.spotLight? V4(s.spotColor) : V4(vec3(1, 1, 1));
+    F4 lightPoint1Intensity(s.spotLight? s.spotIntensity : 0);
+    V4 H1 = Normalize(E+L1);
+    F4 NoL1 = Clamp(Dot(N, L1), 0, 1), NoH1 = Clamp(Dot(N, H1), 0, 1), LoH1 = Max(Dot(L1, H1), F4(0));
+    // diffuse; as in the shader's branch order, Lambert wins over Disney and Blinn-Phong over Cook-Torrance
+    F4 lambert = F4(1)/PI;
+    F4 dTerm = lambert, dTerm1 = lambert;
+    if (!s.lambert && s.disney) {
+        dTerm = DisneyDiffuse(NoE, NoL, LoH, roughness.x);
+        dTerm1 = DisneyDiffuse(NoE, NoL1, LoH1, roughness.x);
+    }
+    V4 diffuse = albedo*lightDirColor*(lightDirIntensity*dTerm);
+    V4 diffuse1 = albedo*lightPoint1Color*(lightPoint1Intensity*dTerm1);
+    bool hasDiffuse = s.lambert || s.disney, hasSpecular = s.blinnPhong || s.cookTorrance;
+    // specular
+    V4 specular, specular1;
+    if (s.blinnPhong) {
+        F4 blinn = Clamp(Pow4(NoH), 0, 1), blinn1 = Clamp(Pow4(NoH1), 0, 1);
+        specular = s.lambert? V4(blinn, blinn, blinn) : lightDirColor*blinn;
+        specular1 = s.lambert? V4(blinn1, blinn1, blinn1) : lightPoint1Color*blinn1;
+    }
+    else if (s.cookTorrance) {
+        F4 f90 = F4(.5f)+F4(2)*roughness.x*LoH*LoH, f901 = F4(.5f)+F4(2)*roughness.x*LoH1*LoH1;
+        specular = DistributionFunction(NoH, roughness)*GeometryFunction(NoE, NoL, roughness)*FSchlick(NoL, F4(1), f90);
+        specular1 = DistributionFunction(NoH1, roughness)*GeometryFunction(NoE, NoL1, roughness)*FSchlick(NoL1, F4(1), f901);
+        if (!hasDiffuse) {
+            specular = specular*lightDirColor;
+            specular1 = specular1*lightPoint1Color;
+        }
+    }
+    if (hasDiffuse && hasSpecular) {
+        V4 direct = (diffuse+specular)*NoL, direct1 = (diffuse1+specular1)*NoL1;
+        V4 c = s.spotLight? direct+direct1 : direct;
+        return s.aoMap? c*AOTexture : c;
+    }
+    if (hasSpecular)
+        return s.spotLight? specular+specular1 : specular;
+    if (hasDiffuse)
+        return s.spotLight? diffuse+diffuse1 : diffuse;
+    return V4(vec3(1, 0, 0));
+}
+
+} // end namespace
+
+// Texture
+
+bool RasterTexture::Read(const char *targaFilename) {
+    unsigned char *pixels = ReadTarga(targaFilename, width, height);
+    if (!pixels) {
+        width = height = 0;
+        bgr.resize(0);
+        return false;
+    }
+    bgr.assign(pixels, pixels+3*width*height);
+    delete [] pixels;
+    return true;
+}
+
+vec3 RasterTexture::Sample(float u, float v) const {
+    // bilinear, repeat wrap
+    if (bgr.empty())
+        return vec3(0, 0, 0);
+    float x = u*width-.5f, y = v*height-.5f;
+    if (!(x > -1e6f && x < 1e6f)) x = 0; // guard NaN, huge values
+    if (!(y > -1e6f && y < 1e6f)) y = 0;
+    float fx = floorf(x), fy = floorf(y), ax = x-fx, ay = y-fy;
+    int x0 = (int) fx%width, y0 = (int) fy%height;
+    x0 += x0 < 0? width : 0;
+    y0 += y0 < 0? height : 0;
+    int x1 = x0+1 < width? x0+1 : 0, y1 = y0+1 < height? y0+1 : 0;
+    const unsigned char *p00 = &bgr[3*(y0*width+x0)], *p10 = &bgr[3*(y0*width+x1)];
+    const unsigned char *p01 = &bgr[3*(y1*width+x0)], *p11 = &bgr[3*(y1*width+x1)];
+    float c[3];
+    for (int k = 0; k < 3; k++) {
+        float lo = p00[k]+ax*(p10[k]-p00[k]), hi = p01[k]+ax*(p11[k]-p01[k]);
+        c[k] = (lo+ay*(hi-lo))/255.f;
+    }
+    return vec3(c[2], c[1], c[0]);
+}
+
+// Triangle setup
+
+struct SoftRaster::Triangle {
+    // screen space edge functions, e = a*x+b*y+c, one per vertex (zero on the opposite edge)
+    float a[3], b[3], c[3];
+    bool topLeft[3];			// fill convention for pixels exactly on an edge
+    float z[3], invW[3];
+    float attr[3][8];			// point, normal, uv, each divided by w
+    int x0, y0, x1, y1;			// pixel bounds, inclusive
+    int draw;
+};
+
+namespace {
+
+struct ClipVertex {
+    vec4 clip;
+    float attr[8];
+};
+
+ClipVertex Lerp(const ClipVertex &a, const ClipVertex &b, float t) {
+    ClipVertex v;
+    v.clip = a.clip+t*(b.clip-a.clip);
+    for (int k = 0; k < 8; k++)
+        v.attr[k] = a.attr[k]+t*(b.attr[k]-a.attr[k]);
+    return v;
+}
+
+int ClipNear(ClipVertex *in, ClipVertex *out) {
+    // clip triangle to z >= -w (GL near plane), return # vertices (0, 3, or 4)
+    int n = 0;
+    for (int i = 0; i < 3; i++) {
+        ClipVertex &p = in[i], &q = in[(i+1)%3];
+        float dp = p.clip.z+p.clip.w, dq = q.clip.z+q.clip.w;
+        if (dp >= 0)
+            out[n++] = p;
+        if ((dp >= 0) != (dq >= 0))
+            out[n++] = Lerp(p, q, dp/(dp-dq));
+    }
+    return n;
+}
+
+} // end namespace
+
+void SoftRaster::SetupTriangles(DrawCall &d, int first, int count, vector<Triangle> &out) {
+    vector<vec3> &pts = *d.points, &nrms = *d.normals;
+    vector<vec2> &uvs = *d.uvs;
+    mat4 full = d.persp*d.modelview;
+    for (int t = first; t < first+count; t++) {
+        int3 tri = (*d.triangles)[t];
+        ClipVertex in[3], poly[4];
+        for (int k = 0; k < 3; k++) {
+            int i = tri[k];
+            vec4 p((float) pts[i].x, pts[i].y, pts[i].z, 1);
+            vec4 eye = d.modelview*p;
+            vec3 n = (int) nrms.size() > i? nrms[i] : vec3(0, 0, 1);
+            vec4 en = d.modelview*vec4(n.x, n.y, n.z, 0);
+            vec2 uv = (int) uvs.size() > i? uvs[i] : vec2(0, 0);
+            in[k].clip = full*p;
+            float a[] = {eye.x, eye.y, eye.z, en.x, en.y, en.z, uv.x, uv.y};
+            memcpy(in[k].attr, a, sizeof(a));
+        }
+        int n = ClipNear(in, poly);
+        for (int f = 1; f+1 < n; f++) {
+            ClipVertex *v[] = {&poly[0], &poly[f], &poly[f+1]};
+            Triangle r;
+            float sx[3], sy[3];
+            for (int k = 0; k < 3; k++) {
+                float w = v[k]->clip.w, iw = 1/w;
+                sx[k] = (v[k]->clip.x*iw*.5f+.5f)*width;
+                sy[k] = (v[k]->clip.y*iw*.5f+.5f)*height;
+                r.z[k] = v[k]->clip.z*iw*.5f+.5f;
+                r.invW[k] = iw;
+                for (int j = 0; j < 8; j++)
+                    r.attr[k][j] = v[k]->attr[j]*iw;
+            }
+            float area = (sx[1]-sx[0])*(sy[2]-sy[0])-(sx[2]-sx[0])*(sy[1]-sy[0]);
+            if (area == 0 || !(area == area))
+                continue;
+            float sign = area > 0? 1.f : -1.f; // no culling: either winding
+            for (int k = 0; k < 3; k++) {
+                int i = (k+1)%3, j = (k+2)%3;
+                // edge i->j, positive on the side of vertex k
+                float a = sign*(sy[i]-sy[j]), b = sign*(sx[j]-sx[i]);
+                r.a[k] = a;
+                r.b[k] = b;
+                r.c[k] = -(a*sx[i]+b*sy[i]);
+                r.topLeft[k] = a > 0 || (a == 0 && b < 0);
+            }
+            float minX = sx[0], maxX = sx[0], minY = sy[0], maxY = sy[0];
+            for (int k = 1; k < 3; k++) {
+                minX = sx[k] < minX? sx[k] : minX;
+                maxX = sx[k] > maxX? sx[k] : maxX;
+                minY = sy[k] < minY? sy[k] : minY;
+                maxY = sy[k] > maxY? sy[k] : maxY;
+            }
+            // pixels whose centers (x+.5, y+.5) may be covered, clamped to screen
+            r.x0 = minX < 0? 0 : (int) ceilf(minX-.5f);
+            r.y0 = minY < 0? 0 : (int) ceilf(minY-.5f);
+            r.x1 = maxX > width? width-1 : (int) floorf(maxX-.5f);
+            r.y1 = maxY > height? height-1 : (int) floorf(maxY-.5f);
+            if (r.x0 > r.x1 || r.y0 > r.y1)
+                continue;
+            r.draw = &d-&draws[0];
+            out.push_back(r);
+        }
+    }
+}
+
+// Shading
+
+long long SoftRaster::ShadeTile(int tile, vector<Triangle> &tris, vector<vector<int>> &bins) {
+    long long nShaded = 0;
+    int tx0 = (tile%nxTiles)*tileSize, ty0 = (tile/nxTiles)*tileSize;
+    int tx1 = tx0+tileSize-1 < width-1? tx0+tileSize-1 : width-1;
+    int ty1 = ty0+tileSize-1 < height-1? ty0+tileSize-1 : height-1;
+    vector<int> &bin = bins[tile];
+    for (size_t b = 0; b < bin.size(); b++) {
+        Triangle &t = tris[bin[b]];
+        DrawCall &d = draws[t.draw];
+        int x0 = (t.x0 > tx0? t.x0 : tx0) & ~1, y0 = (t.y0 > ty0? t.y0 : ty0) & ~1;
+        int x1 = t.x1 < tx1? t.x1 : tx1, y1 = t.y1 < ty1? t.y1 : ty1;
+        for (int y = y0; y <= y1; y += 2)
+            for (int x = x0; x <= x1; x += 2) {
+                F4 px(x+.5f, x+1.5f, x+.5f, x+1.5f), py(y+.5f, y+.5f, y+1.5f, y+1.5f);
+                F4 e[3], inside = GreaterEqual(F4(0), F4(0)); // all lanes set
+                for (int k = 0; k < 3; k++) {
+                    e[k] = F4(t.a[k])*px+F4(t.b[k])*py+F4(t.c[k]);
+                    F4 in = t.topLeft[k]? GreaterEqual(e[k], F4(0)) : Greater(e[k], F4(0));
+                    inside = And(inside, in);
+                }
+                // lanes outside the screen are helpers only
+                F4 onScreen = And(Greater(F4((float) width), px), Greater(F4((float) height), py));
+                inside = And(inside, onScreen);
+                if (!Bits(inside))
+                    continue;
+                // barycentrics (from edge functions, helpers extrapolate)
+                F4 sum = e[0]+e[1]+e[2];
+                F4 l0 = e[0]/sum, l1 = e[1]/sum, l2 = e[2]/sum;
+                F4 z = l0*F4(t.z[0])+l1*F4(t.z[1])+l2*F4(t.z[2]);
+                // depth test, less than (as GL_LESS); GL clips to the far plane
+                float zs[4], dOld[4];
+                z.Store(zs);
+                int mask = Bits(inside), pass = 0;
+                for (int i = 0; i < 4; i++) {
+                    int xi = x+(i&1), yi = y+(i>>1);
+                    dOld[i] = (mask & (1 << i))? depth[yi*width+xi] : 0;
+                    if ((mask & (1 << i)) && zs[i] < dOld[i] && zs[i] <= 1)
+                        pass |= 1 << i;
+                }
+                if (!pass)
+                    continue;
+                // perspective-correct attributes for all four lanes (helpers give derivatives)
+                F4 iw = l0*F4(t.invW[0])+l1*F4(t.invW[1])+l2*F4(t.invW[2]), w = F4(1)/iw;
+                F4 a[8];
+                for (int j = 0; j < 8; j++)
+                    a[j] = (l0*F4(t.attr[0][j])+l1*F4(t.attr[1][j])+l2*F4(t.attr[2][j]))*w;
+                QuadInput q;
+                q.point = V4(a[0], a[1], a[2]);
+                q.normal = V4(a[3], a[4], a[5]);
+                q.u = a[6];
+                q.v = a[7];
+                V4 c = Shade(q, *d.material, *d.shading);
+                float r[4], g[4], bl[4];
+                Clamp(c.x, 0, 1).Store(r);
+                Clamp(c.y, 0, 1).Store(g);
+                Clamp(c.z, 0, 1).Store(bl);
+                for (int i = 0; i < 4; i++)
+                    if (pass & (1 << i)) {
+                        int p = (y+(i>>1))*width+x+(i&1);
+                        depth[p] = zs[i];
+                        unsigned char *dst = &color[3*p];
+                        dst[0] = (unsigned char) (bl[i]*255.f+.5f);
+                        dst[1] = (unsigned char) (g[i]*255.f+.5f);
+                        dst[2] = (unsigned char) (r[i]*255.f+.5f);
+                        nShaded++;
+                    }
+            }
+    }
+    return nShaded;
+}
+
+// Interface
+
+SoftRaster::SoftRaster(int w, int h, int n) : width(0), height(0), nThreads(1), nxTiles(0), nyTiles(0) {
+    memset(&stats, 0, sizeof(stats));
+    SetThreads(n);
+    Resize(w, h);
+}
+
+void SoftRaster::SetThreads(int n) {
+    nThreads = n > 0? n : (int) std::thread::hardware_concurrency();
+    if (nThreads < 1)
+        nThreads = 1;
+}
+
+void SoftRaster::Resize(int w, int h) {
+    width = w;
+    height = h;
+    nxTiles = (w+tileSize-1)/tileSize;
+    nyTiles = (h+tileSize-1)/tileSize;
+    color.resize(3*w*h);
+    depth.resize(w*h);
+}
+
+void SoftRaster::Clear(vec3 c, float d) {
+    unsigned char bgr[] = {(unsigned char) (c.z*255.f+.5f), (unsigned char) (c.y*255.f+.5f), (unsigned char) (c.x*255.f+.5f)};
+    for (int i = 0; i < width*height; i++) {
+        memcpy(&color[3*i], bgr, 3);
+        depth[i] = d;
+    }
+}
+
+void SoftRaster::Draw(vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles,
+                      int firstTriangle, int nTriangles, mat4 modelview, mat4 persp,
+                      RasterMaterial &material, RasterShading &shading) {
+    if (firstTriangle+nTriangles > (int) triangles.size())
+        nTriangles = (int) triangles.size()-firstTriangle;
+    if (nTriangles <= 0)
+        return;
+    DrawCall d = {&points, &normals, &uvs, &triangles, firstTriangle, nTriangles, modelview, persp, &material, &shading};
+    draws.push_back(d);
+}
+
+void SoftRaster::Finish() {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    memset(&stats, 0, sizeof(stats));
+    // setup in fixed-size chunks, in parallel; chunk order preserves submission order
+    const int chunkSize = 4096;
+    struct Chunk { int draw, first, count; };
+    vector<Chunk> chunks;
+    for (size_t i = 0; i < draws.size(); i++) {
+        stats.nTriangles += draws[i].nTriangles;
+        for (int t = 0; t < draws[i].nTriangles; t += chunkSize) {
+            int n = draws[i].nTriangles-t < chunkSize? draws[i].nTriangles-t : chunkSize;
+            Chunk c = {(int) i, draws[i].firstTriangle+t, n};
+            chunks.push_back(c);
+        }
+    }
+    vector<vector<Triangle>> chunkTris(chunks.size());
+    std::atomic<int> next(0);
+    auto setup = [&]() {
+        for (int c; (c = next++) < (int) chunks.size(); )
+            SetupTriangles(draws[chunks[c].draw], chunks[c].first, chunks[c].count, chunkTris[c]);
+    };
+    vector<std::thread> threads;
+    for (int i = 1; i < nThreads; i++)
+        threads.push_back(std::thread(setup));
+    setup();
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    threads.resize(0);
+    // bin triangles to tiles, in order
+    vector<Triangle> tris;
+    for (size_t c = 0; c < chunkTris.size(); c++)
+        tris.insert(tris.end(), chunkTris[c].begin(), chunkTris[c].end());
+    stats.nSetup = tris.size();
+    vector<vector<int>> bins(nxTiles*nyTiles);
+    for (size_t i = 0; i < tris.size(); i++) {
+        Triangle &t = tris[i];
+        for (int ty = t.y0/tileSize; ty <= t.y1/tileSize; ty++)
+            for (int tx = t.x0/tileSize; tx <= t.x1/tileSize; tx++)
+                bins[ty*nxTiles+tx].push_back(i);
+    }
+    // shade tiles in parallel; tiles are disjoint, so no locking
+    std::atomic<int> nextTile(0);
+    std::atomic<long long> nPixels(0);
+    auto shade = [&]() {
+        long long n = 0;
+        for (int tile; (tile = nextTile++) < nxTiles*nyTiles; )
+            n += ShadeTile(tile, tris, bins);
+        nPixels += n;
+    };
+    for (int i = 1; i < nThreads; i++)
+        threads.push_back(std::thread(shade));
+    shade();
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    stats.nPixels = nPixels;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    draws.resize(0);
+}
+
+unsigned char *SoftRaster::Pixels() { return color.empty()? NULL : &color[0]; }
+
+bool SoftRaster::Write(const char *targaFilename) { return WriteTarga(targaFilename, Pixels(), width, height); }
+
+RasterStats SoftRaster::Stats() { return stats; }
+
+int SoftRaster::Width() { return width; }
+
+int SoftRaster::Height() { return height; }
@@ -0,0 +1,602 @@
+// TexCompress.cpp - block-compressed textures: BC1/BC3/BC4/BC5/BC7 encoder, KTX cache, GL upload
+
+#include "TexCompress.h"
+#include "MipGen.h"
+#include "Misc.h"
+#include "Parallel.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define MakeDirectory(name) _mkdir(name)
+#else
+#define MakeDirectory(name) mkdir(name, 0755)
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEX_COMPRESS_SSE
+#endif
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// 4x4 Blocks
+
+struct Block {
+    float c[4][16];         // r, g, b, a in [0, 255], texel y*4+x
+};
+
+void GetBlock(unsigned char *pixels, int width, int height, int bytesPerPixel, int bx, int by, Block &b) {
+    // texels beyond the image repeat the last row or column
+    for (int y = 0; y < 4; y++) {
+        int j = by*4+y < height? by*4+y : height-1;
+        for (int x = 0; x < 4; x++) {
+            int i = bx*4+x < width? bx*4+x : width-1, k = y*4+x;
+            unsigned char *p = pixels+bytesPerPixel*(j*width+i);
+            if (bytesPerPixel == 1)
+                b.c[0][k] = b.c[1][k] = b.c[2][k] = p[0];
+            else {
+                b.c[0][k] = p[2];
+                b.c[1][k] = p[1];
+                b.c[2][k] = p[0];
+            }
+            b.c[3][k] = bytesPerPixel == 4? p[3] : 255;
+        }
+    }
+}
+
+float BestIndices(const Block &b, const float palette[][4], int n, const float weight[4], int *indices) {
+    // nearest palette entry per texel (weighted squared distance); return total error
+#ifdef TEX_COMPRESS_SSE
+    __m128 total = _mm_setzero_ps();
+    for (int g = 0; g < 16; g += 4) {
+        __m128 best = _mm_set1_ps(1e30f), bestIndex = _mm_setzero_ps();
+        for (int k = 0; k < n; k++) {
+            __m128 d = _mm_setzero_ps();
+            for (int ch = 0; ch < 4; ch++) {
+                __m128 e = _mm_sub_ps(_mm_loadu_ps(&b.c[ch][g]), _mm_set1_ps(palette[k][ch]));
+                d = _mm_add_ps(d, _mm_mul_ps(_mm_mul_ps(e, e), _mm_set1_ps(weight[ch])));
+            }
+            __m128 closer = _mm_cmplt_ps(d, best);
+            best = _mm_min_ps(d, best);
+            bestIndex = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps((float) k)), _mm_andnot_ps(closer, bestIndex));
+        }
+        total = _mm_add_ps(total, best);
+        __m128i i = _mm_cvttps_epi32(bestIndex);
+        _mm_storeu_si128((__m128i *) (indices+g), i);
+    }
+    float t[4];
+    _mm_storeu_ps(t, total);
+    return t[0]+t[1]+t[2]+t[3];
+#else
+    float total = 0;
+    for (int i = 0; i < 16; i++) {
+        float best = 1e30f;
+        for (int k = 0; k < n; k++) {
+            float d = 0;
+            for (int ch = 0; ch < 4; ch++) {
+                float e = b.c[ch][i]-palette[k][ch];
+                d += weight[ch]*e*e;
+            }
+            if (d < best) {
+                best = d;
+                indices[i] = k;
+            }
+        }
+        total += best;
+    }
+    return total;
+#endif
+}
+
+void PrincipalEndpoints(const Block &b, int nChannels, float e0[4], float e1[4]) {
+    // endpoints along the principal axis of the texel colors, inset by 1/32 of their extent
+    float mean[4] = {0, 0, 0, 0}, cov[4][4] = {{0}}, axis[4] = {0, 0, 0, 0};
+    for (int ch = 0; ch < nChannels; ch++) {
+        float lo = 255, hi = 0;
+        for (int i = 0; i < 16; i++) {
+            mean[ch] += b.c[ch][i]/16;
+            lo = b.c[ch][i] < lo? b.c[ch][i] : lo;
+            hi = b.c[ch][i] > hi? b.c[ch][i] : hi;
+        }
+        axis[ch] = hi-lo;
+    }
+    for (int i = 0; i < 16; i++)
+        for (int r = 0; r < nChannels; r++)
+            for (int c = 0; c < nChannels; c++)
+                cov[r][c] += (b.c[r][i]-mean[r])*(b.c[c][i]-mean[c]);
+    for (int iter = 0; iter < 8; iter++) {
+        float v[4] = {0, 0, 0, 0}, len = 0;
+        for (int r = 0; r < nChannels; r++) {
+            for (int c = 0; c < nChannels; c++)
+                v[r] += cov[r][c]*axis[c];
+            len += v[r]*v[r];
+        }
+        if (len < 1e-12f)
+            break;
+        len = 1/sqrtf(len);
+        for (int r = 0; r < nChannels; r++)
+            axis[r] = v[r]*len;
+    }
+    float len = 0;
+    for (int ch = 0; ch < nChannels; ch++)
+        len += axis[ch]*axis[ch];
+    float tMin = 0, tMax = 0;
+    if (len > 1e-12f) {
+        len = 1/sqrtf(len);
+        for (int ch = 0; ch < nChannels; ch++)
+            axis[ch] *= len;
+        tMin = 1e30f;
+        tMax = -1e30f;
+        for (int i = 0; i < 16; i++) {
+            float t = 0;
+            for (int ch = 0; ch < nChannels; ch++)
+                t += (b.c[ch][i]-mean[ch])*axis[ch];
+            tMin = t < tMin? t : tMin;
+            tMax = t > tMax? t : tMax;
+        }
+        float inset = (tMax-tMin)/32;
+        tMin += inset;
+        tMax -= inset;
+    }
+    for (int ch = 0; ch < 4; ch++) {
+        float a = ch < nChannels? mean[ch]+tMin*axis[ch] : 255, z = ch < nChannels? mean[ch]+tMax*axis[ch] : 255;
+        e0[ch] = a < 0? 0 : a > 255? 255 : a;
+        e1[ch] = z < 0? 0 : z > 255? 255 : z;
+    }
+}
+
+bool FitEndpoints(const Block &b, int nChannels, const float *weights, const int *indices, float e0[4], float e1[4]) {
+    // least-squares endpoints for fixed indices: texel ~ (1-w)e0+w e1
+    float aa = 0, ab = 0, bb = 0, ax[4] = {0, 0, 0, 0}, bx[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 16; i++) {
+        float w = weights[indices[i]], a = 1-w;
+        aa += a*a;
+        ab += a*w;
+        bb += w*w;
+        for (int ch = 0; ch < nChannels; ch++) {
+            ax[ch] += a*b.c[ch][i];
+            bx[ch] += w*b.c[ch][i];
+        }
+    }
+    float det = aa*bb-ab*ab;
+    if (fabsf(det) < 1e-6f)
+        return false;
+    for (int ch = 0; ch < nChannels; ch++) {
+        float a = (bb*ax[ch]-ab*bx[ch])/det, z = (aa*bx[ch]-ab*ax[ch])/det;
+        e0[ch] = a < 0? 0 : a > 255? 255 : a;
+        e1[ch] = z < 0? 0 : z > 255? 255 : z;
+    }
+    return true;
+}
+
+// BC1 (color block of BC3)
+
+int Pack565(const float c[4]) {
+    int r = (int) (c[0]*31/255+.5f), g = (int) (c[1]*63/255+.5f), b = (int) (c[2]*31/255+.5f);
+    return (r << 11) | (g << 5) | b;
+}
+
+void Unpack565(int v, float c[4]) {
+    int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+    c[0] = (float) ((r << 3) | (r >> 2));
+    c[1] = (float) ((g << 2) | (g >> 4));
+    c[2] = (float) ((b << 3) | (b >> 2));
+    c[3] = 255;
+}
+
+bool ColorPalette(float e0[4], float e1[4], int &c0, int &c1, float palette[4][4]) {
+    // quantize endpoints, order for four-color mode (c0 > c1); return false if they coincide
+    c0 = Pack565(e0);
+    c1 = Pack565(e1);
+    if (c0 < c1) {
+        int t = c0; c0 = c1; c1 = t;
+    }
+    Unpack565(c0, palette[0]);
+    Unpack565(c1, palette[1]);
+    for (int ch = 0; ch < 4; ch++) {
+        palette[2][ch] = (2*palette[0][ch]+palette[1][ch])/3;
+        palette[3][ch] = (palette[0][ch]+2*palette[1][ch])/3;
+    }
+    return c0 != c1;
+}
+
+void EncodeBC1(const Block &b, unsigned char *out) {
+    static const float weight[] = {1, 1, 1, 0}, w[] = {0, 1, 1.f/3, 2.f/3};
+    float e0[4], e1[4], palette[4][4];
+    int c0, c1, indices[16], best[16];
+    PrincipalEndpoints(b, 3, e0, e1);
+    bool distinct = ColorPalette(e0, e1, c0, c1, palette);
+    float error = BestIndices(b, palette, distinct? 4 : 1, weight, best);
+    int bestC0 = c0, bestC1 = c1;
+    // refit endpoints to the chosen indices, keep if better
+    if (distinct && FitEndpoints(b, 3, w, best, e0, e1) && ColorPalette(e0, e1, c0, c1, palette)) {
+        float e = BestIndices(b, palette, 4, weight, indices);
+        if (e < error) {
+            error = e;
+            bestC0 = c0;
+            bestC1 = c1;
+            memcpy(best, indices, sizeof(best));
+        }
+    }
+    unsigned int bits = 0;
+    for (int i = 0; i < 16; i++)
+        bits |= (unsigned int) (bestC0 == bestC1? 0 : best[i]) << (2*i);
+    out[0] = bestC0 & 255; out[1] = bestC0 >> 8;
+    out[2] = bestC1 & 255; out[3] = bestC1 >> 8;
+    for (int k = 0; k < 4; k++)
+        out[4+k] = (bits >> (8*k)) & 255;
+}
+
+// BC4 (alpha block of BC3, channels of BC5)
+
+void EncodeBC4(const float *v, unsigned char *out) {
+    // eight-value mode: a0 > a1, index 0: a0, 1: a1, 2-7: a0+(i-1)(a1-a0)/7
+    float lo = 255, hi = 0;
+    for (int i = 0; i < 16; i++) {
+        lo = v[i] < lo? v[i] : lo;
+        hi = v[i] > hi? v[i] : hi;
+    }
+    int a0 = (int) (hi+.5f), a1 = (int) (lo+.5f);
+    unsigned long long bits = 0;
+    if (a0 > a1)
+        for (int i = 0; i < 16; i++) {
+            int step = (int) ((a0-v[i])*7/(a0-a1)+.5f);
+            step = step < 0? 0 : step > 7? 7 : step;
+            int index = step == 0? 0 : step == 7? 1 : step+1;
+            bits |= (unsigned long long) index << (3*i);
+        }
+    out[0] = (unsigned char) a0;
+    out[1] = (unsigned char) a1;
+    for (int k = 0; k < 6; k++)
+        out[2+k] = (bits >> (8*k)) & 255;
+}
+
+// BC7 mode 6: one subset, rgba endpoints 7 bits + p-bit, 4-bit indices
+
+const int bc7Weights[] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+void QuantizeBC7(const float e[4], int q[4], int &p) {
+    // 7-bit channels sharing a low bit: choose the p-bit with less error
+    float bestError = 1e30f;
+    for (int pbit = 0; pbit < 2; pbit++) {
+        int t[4];
+        float error = 0;
+        for (int ch = 0; ch < 4; ch++) {
+            int v = (int) floorf((e[ch]-pbit)/2+.5f);
+            t[ch] = v < 0? 0 : v > 127? 127 : v;
+            float d = e[ch]-(float) ((t[ch] << 1) | pbit);
+            error += d*d;
+        }
+        if (error < bestError) {
+            bestError = error;
+            memcpy(q, t, sizeof(t));
+            p = pbit;
+        }
+    }
+}
+
+void BC7Palette(const int q0[4], int p0, const int q1[4], int p1, float palette[16][4]) {
+    for (int ch = 0; ch < 4; ch++) {
+        int a = (q0[ch] << 1) | p0, z = (q1[ch] << 1) | p1;
+        for (int k = 0; k < 16; k++)
+            palette[k][ch] = (float) (((64-bc7Weights[k])*a+bc7Weights[k]*z+32) >> 6);
+    }
+}
+
+void EncodeBC7(const Block &b, unsigned char *out) {
+    static const float weight[] = {1, 1, 1, 1};
+    float w[16], e0[4], e1[4], palette[16][4];
+    for (int k = 0; k < 16; k++)
+        w[k] = bc7Weights[k]/64.f;
+    int q0[4], q1[4], p0, p1, indices[16];
+    int bq0[4], bq1[4], bp0, bp1, best[16];
+    PrincipalEndpoints(b, 4, e0, e1);
+    QuantizeBC7(e0, bq0, bp0);
+    QuantizeBC7(e1, bq1, bp1);
+    BC7Palette(bq0, bp0, bq1, bp1, palette);
+    float error = BestIndices(b, palette, 16, weight, best);
+    if (FitEndpoints(b, 4, w, best, e0, e1)) {
+        QuantizeBC7(e0, q0, p0);
+        QuantizeBC7(e1, q1, p1);
+        BC7Palette(q0, p0, q1, p1, palette);
+        float e = BestIndices(b, palette, 16, weight, indices);
+        if (e < error) {
+            memcpy(bq0, q0, sizeof(q0)); bp0 = p0;
+            memcpy(bq1, q1, sizeof(q1)); bp1 = p1;
+            memcpy(best, indices, sizeof(best));
+        }
+    }
+    // the anchor (texel 0) index has an implicit high bit of 0: swap endpoints if needed
+    if (best[0] > 7) {
+        for (int ch = 0; ch < 4; ch++) {
+            int t = bq0[ch]; bq0[ch] = bq1[ch]; bq1[ch] = t;
+        }
+        int t = bp0; bp0 = bp1; bp1 = t;
+        for (int i = 0; i < 16; i++)
+            best[i] = 15-best[i];
+    }
+    memset(out, 0, 16);
+    int pos = 0;
+    auto put = [&](int value, int nBits) {
+        for (int k = 0; k < nBits; k++, pos++)
+            if ((value >> k) & 1)
+                out[pos >> 3] |= 1 << (pos & 7);
+    };
+    put(1 << 6, 7);                     // mode 6
+    for (int ch = 0; ch < 4; ch++) {
+        put(bq0[ch], 7);
+        put(bq1[ch], 7);
+    }
+    put(bp0, 1);
+    put(bp1, 1);
+    for (int i = 0; i < 16; i++)
+        put(best[i], i == 0? 3 : 4);
+}
+
+void EncodeBlock(const Block &b, TexFormat format, unsigned char *out) {
+    if (format == TexBC1)
+        EncodeBC1(b, out);
+    if (format == TexBC3) {
+        EncodeBC4(b.c[3], out);
+        EncodeBC1(b, out+8);
+    }
+    if (format == TexBC4)
+        EncodeBC4(b.c[0], out);
+    if (format == TexBC5) {
+        EncodeBC4(b.c[0], out);
+        EncodeBC4(b.c[1], out+8);
+    }
+    if (format == TexBC7)
+        EncodeBC7(b, out);
+}
+
+// KTX
+
+const unsigned char ktxIdentifier[] = {0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+GLenum BaseFormat(TexFormat f) {
+    return f == TexBC1? GL_RGB : f == TexBC4? GL_RED : f == TexBC5? GL_RG : GL_RGBA;
+}
+
+bool Newer(const char *a, const char *b) {
+    // true if file a exists and was modified no earlier than file b
+    struct stat sa, sb;
+    if (stat(a, &sa) != 0)
+        return false;
+    return stat(b, &sb) != 0 || sa.st_mtime >= sb.st_mtime;
+}
+
+} // end namespace
+
+// Encoding
+
+int TexBlockBytes(TexFormat format) {
+    return format == TexBC1 || format == TexBC4? 8 : 16;
+}
+
+GLenum TexFormatGL(TexFormat format) {
+    GLenum formats[] = {GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+                        GL_COMPRESSED_RED_RGTC1, GL_COMPRESSED_RG_RGTC2, GL_COMPRESSED_RGBA_BPTC_UNORM};
+    return format < TexUncompressed? formats[format] : 0;
+}
+
+const char *TexFormatName(TexFormat format) {
+    const char *names[] = {"BC1", "BC3", "BC4", "BC5", "BC7", "uncompressed"};
+    return names[format];
+}
+
+TexFormat SelectTexFormat(TexMap map, unsigned char *pixels, int width, int height, int bytesPerPixel, unsigned formats) {
+    bool gray = bytesPerPixel == 1, opaque = bytesPerPixel != 4;
+    if (bytesPerPixel > 1 && (map == TexMapGray || map == TexMapRoughness)) {
+        // BC4 keeps one channel: use it only if the map is gray
+        gray = true;
+        for (int i = 0, n = width*height; i < n && gray; i++) {
+            unsigned char *p = pixels+bytesPerPixel*i;
+            gray = abs(p[0]-p[2]) <= 2 && abs(p[1]-p[2]) <= 2;
+        }
+    }
+    if (!opaque) {
+        opaque = true;
+        for (int i = 0, n = width*height; i < n && opaque; i++)
+            opaque = pixels[4*i+3] == 255;
+    }
+    TexFormat choice[3];
+    int n = 0;
+    if (map == TexMapNormal && bytesPerPixel > 1)
+        choice[n++] = TexBC5;
+    if ((map == TexMapGray || map == TexMapRoughness) && gray)
+        choice[n++] = TexBC4;
+    if (map != TexMapNormal) {
+        choice[n++] = TexBC7;
+        choice[n++] = opaque? TexBC1 : TexBC3;
+    }
+    for (int i = 0; i < n; i++)
+        if (formats & (1 << choice[i]))
+            return choice[i];
+    return TexUncompressed;
+}
+
+void CompressBlocks(unsigned char *pixels, int width, int height, int bytesPerPixel, TexFormat format,
+                    unsigned char *blocks, int nThreads) {
+    int nx = (width+3)/4, ny = (height+3)/4, blockBytes = TexBlockBytes(format);
+    nThreads = ThreadCount(nThreads);
+    if (nThreads > ny/4)
+        nThreads = ny/4 > 1? ny/4 : 1;  // small levels: not worth a thread
+    ParallelFor(0, ny, 1, nThreads, [&](int by0, int by1) {
+        Block b;
+        for (int by = by0; by < by1; by++)
+            for (int bx = 0; bx < nx; bx++) {
+                GetBlock(pixels, width, height, bytesPerPixel, bx, by, b);
+                EncodeBlock(b, format, blocks+blockBytes*(by*nx+bx));
+            }
+    });
+}
+
+bool CompressTexture(unsigned char *pixels, int width, int height, int bytesPerPixel, TexFormat format,
+                     CompressedTexture &c, bool mipmap, int nThreads, MipOptions *mips) {
+    if (format >= TexUncompressed || !pixels || width < 1 || height < 1)
+        return false;
+    vector<MipLevel> levels(1);
+    if (mipmap) {
+        MipOptions linear;
+        GenerateMips(pixels, width, height, bytesPerPixel, mips? *mips : linear, levels, nThreads);
+    }
+    else {
+        levels[0].width = width;
+        levels[0].height = height;
+        levels[0].pixels.assign(pixels, pixels+width*height*bytesPerPixel);
+    }
+    c.format = format;
+    c.levels.resize(levels.size());
+    int size = 0;
+    for (size_t i = 0; i < levels.size(); i++) {
+        int w = levels[i].width, h = levels[i].height;
+        CompressedLevel l = {w, h, size, ((w+3)/4)*((h+3)/4)*TexBlockBytes(format)};
+        c.levels[i] = l;
+        size += l.size;
+    }
+    c.data.resize(size);
+    for (size_t i = 0; i < levels.size(); i++)
+        CompressBlocks(&levels[i].pixels[0], levels[i].width, levels[i].height, bytesPerPixel, format,
+                       &c.data[c.levels[i].offset], nThreads);
+    return true;
+}
+
+// KTX Files
+
+bool WriteKTX(const char *filename, CompressedTexture &c) {
+    if (c.format >= TexUncompressed || c.levels.empty())
+        return false;
+    FILE *out = fopen(filename, "wb");
+    if (!out)
+        return false;
+    unsigned int header[13] = {0x04030201, 0, 1, 0, TexFormatGL(c.format), BaseFormat(c.format),
+        (unsigned int) c.levels[0].width, (unsigned int) c.levels[0].height, 0, 0, 1, (unsigned int) c.levels.size(), 0};
+    bool ok = fwrite(ktxIdentifier, 12, 1, out) == 1 && fwrite(header, sizeof(header), 1, out) == 1;
+    for (size_t i = 0; i < c.levels.size() && ok; i++) {
+        // block sizes are multiples of 4: no padding
+        unsigned int size = c.levels[i].size;
+        ok = fwrite(&size, 4, 1, out) == 1 && fwrite(&c.data[c.levels[i].offset], size, 1, out) == 1;
+    }
+    return fclose(out) == 0 && ok;
+}
+
+bool ReadKTX(const char *filename, CompressedTexture &c) {
+    FILE *in = fopen(filename, "rb");
+    if (!in)
+        return false;
+    unsigned char id[12];
+    unsigned int header[13];
+    bool ok = fread(id, 12, 1, in) == 1 && !memcmp(id, ktxIdentifier, 12) &&
+              fread(header, sizeof(header), 1, in) == 1 && header[0] == 0x04030201 && header[1] == 0;
+    c.format = TexUncompressed;
+    for (int f = 0; ok && f < TexUncompressed; f++)
+        if (header[4] == TexFormatGL((TexFormat) f))
+            c.format = (TexFormat) f;
+    ok = ok && c.format != TexUncompressed && header[10] == 1 && header[11] > 0 && fseek(in, header[12], SEEK_CUR) == 0;
+    c.levels.resize(0);
+    c.data.resize(0);
+    int w = ok? header[6] : 0, h = ok? header[7] : 0;
+    for (unsigned int i = 0; ok && i < header[11]; i++) {
+        unsigned int size = 0;
+        CompressedLevel l = {w, h, (int) c.data.size(), ((w+3)/4)*((h+3)/4)*TexBlockBytes(c.format)};
+        ok = fread(&size, 4, 1, in) == 1 && size == (unsigned int) l.size;
+        if (ok) {
+            c.data.resize(l.offset+l.size);
+            ok = fread(&c.data[l.offset], l.size, 1, in) == 1;
+            c.levels.push_back(l);
+        }
+        w = w > 1? w/2 : 1;
+        h = h > 1? h/2 : 1;
+    }
+    fclose(in);
+    return ok;
+}
+
+bool ReadCompressedTexture(const char *filename, TexMap map, unsigned formats, CompressedTexture &c,
+                           bool mipmap, const char *cacheDir, int nThreads, const char *normalMapFilename) {
+    const char *mapNames[] = {"color", "normal", "gray", "roughness"};
+    const char *slash = strrchr(filename, '/'), *bslash = strrchr(filename, '\\');
+    const char *base = slash > bslash? slash+1 : bslash? bslash+1 : filename;
+    string name(base);
+    if (name.rfind('.') != string::npos)
+        name.erase(name.rfind('.'));
+    // key on a hash of the full path too, lest same-named files in different directories collide
+    unsigned hash = 2166136261u; // FNV-1a
+    for (const char *s = filename; *s; s++)
+        hash = (hash^(unsigned char) (*s == '\\'? '/' : *s))*16777619u;
+    char hex[10];
+    snprintf(hex, sizeof(hex), "-%08x", hash);
+    string cacheName = string(cacheDir)+"/"+name+hex+"."+mapNames[map]+".ktx";
+    bool toksvig = map == TexMapRoughness && normalMapFilename && mipmap;
+    if (Newer(cacheName.c_str(), filename) && (!toksvig || Newer(cacheName.c_str(), normalMapFilename)) &&
+        ReadKTX(cacheName.c_str(), c) && (formats & (1 << c.format)) && (c.levels.size() > 1) == mipmap)
+        return true;
+    int width, height, bytesPerPixel;
+    unsigned char *pixels = ReadTarga(filename, width, height, bytesPerPixel);
+    if (!pixels)
+        return false;
+    // mips filtered in the map's space (see MipGen.h)
+    MipKind kinds[] = {MipColor, MipNormal, MipLinear, MipRoughness};
+    MipOptions mips(kinds[map]);
+    if (toksvig)
+        mips.normals = ReadTarga(normalMapFilename, mips.normalWidth, mips.normalHeight, mips.normalBytesPerPixel);
+    TexFormat format = SelectTexFormat(map, pixels, width, height, bytesPerPixel, formats);
+    bool ok = CompressTexture(pixels, width, height, bytesPerPixel, format, c, mipmap, nThreads, &mips);
+    delete [] pixels;
+    delete [] mips.normals;
+    if (ok) {
+        MakeDirectory(cacheDir);
+        if (!WriteKTX(cacheName.c_str(), c))
+            printf("can't write %s\n", cacheName.c_str());
+    }
+    return ok;
+}
+
+// GL
+
+unsigned CompressedFormatsSupported() {
+    // RGTC (BC4, BC5) is core in GL 3.0, BPTC (BC7) in 4.2; S3TC (BC1, BC3) is an extension
+    bool s3tc = false, bptc = GLAD_GL_VERSION_4_2 != 0;
+    GLint n = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+    for (int i = 0; i < n; i++) {
+        const char *e = (const char *) glGetStringi(GL_EXTENSIONS, i);
+        s3tc = s3tc || (e && !strcmp(e, "GL_EXT_texture_compression_s3tc"));
+        bptc = bptc || (e && !strcmp(e, "GL_ARB_texture_compression_bptc"));
+    }
+    return (1 << TexBC4) | (1 << TexBC5) | (s3tc? (1 << TexBC1) | (1 << TexBC3) : 0) | (bptc? 1 << TexBC7 : 0);
+}
+
+void LoadCompressedTexture(CompressedTexture &c, GLuint textureUnit, GLuint textureName, bool fromUnpackBuffer) {
+    GLint rgba[] = {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA}, gray[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+    GLint normal[] = {GL_RED, GL_GREEN, GL_ONE, GL_ONE};    // z = 1 before the shader normalizes
+    glActiveTexture(GL_TEXTURE0+textureUnit);
+    glBindTexture(GL_TEXTURE_2D, textureName);
+    GLenum format = TexFormatGL(c.format);
+    for (size_t i = 0; i < c.levels.size(); i++) {
+        CompressedLevel &l = c.levels[i];
+        const void *data = fromUnpackBuffer? (const void *) (size_t) l.offset : (const void *) &c.data[l.offset];
+        glCompressedTexImage2D(GL_TEXTURE_2D, (GLint) i, format, l.width, l.height, 0, l.size, data);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint) c.levels.size()-1);
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, c.format == TexBC4? gray : c.format == TexBC5? normal : rgba);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, c.levels.size() > 1? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+GLuint LoadCompressedTexture(CompressedTexture &c, GLuint textureUnit) {
+    GLuint textureName = 0;
+    glGenTextures(1, &textureName);
+    LoadCompressedTexture(c, textureUnit, textureName);
+    return textureName;
+}
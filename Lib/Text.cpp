@@ -7,6 +7,8 @@
 #include "Text.h"
 #include <map>
 #include <stdio.h>
+#include <string.h>
+#include <vector>
 
 // if FreeType not linked, comment next line:
 #define FREETYPE_OK
@@ -15,12 +17,20 @@ CharacterSet *SetFont(const char *fontName, int charRese, int pixelRes) { return
 void Text(int x, int y, vec3 color, float scale, const char *format, ...) { }
 void Text(vec3 p, mat4 m, vec3 color, float scale, const char *format, ...) { }
 void RenderText(const char *text, float x, float y, vec3 color, float scale, mat4 view) { }
+void BeginTextBatch() { }
+void EndTextBatch() { }
 #else
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
+// private copy of the rect packer (imgui_draw.cpp keeps its own static copy)
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "imstb_rectpack.h"
+
 using std::string;
+using std::vector;
 
 static GLuint textShaderProgram = 0, textVertexBuffer = 0;
 
@@ -31,6 +41,51 @@ struct Compare { bool operator() (const string &a, const string &b) const { retu
 typedef std::map<string, CharacterSet, Compare> CharacterSets;
 CharacterSets fonts;
 
+// Unicode ranges loaded into the atlas (glyphs missing from the font are skipped)
+static unsigned glyphRanges[][2] = {
+	{0x0020, 0x007E},	// ASCII
+	{0x00A0, 0x017F},	// Latin-1 Supplement, Latin Extended-A
+	{0x0391, 0x03C9},	// Greek
+	{0x2013, 0x2026},	// dashes, quotes, bullet, ellipsis
+	{0x2190, 0x2193},	// arrows
+	{0x2212, 0x221E},	// minus ... infinity
+	{0x2248, 0x2248},	// approximately equal
+	{0x2260, 0x2265}	// not equal, less/greater or equal
+};
+
+const Character *CharacterSet::Find(unsigned codepoint) const {
+	if (codepoint < 128)
+		return ascii[codepoint].advance? &ascii[codepoint] : NULL;
+	std::map<unsigned, Character>::const_iterator it = extended.find(codepoint);
+	return it == extended.end()? NULL : &it->second;
+}
+
+static unsigned NextCodepoint(const char *&s) {
+	// decode UTF-8 code point, advance s; malformed bytes are returned as is
+	const unsigned char *u = (const unsigned char *) s;
+	unsigned c = *u;
+	int n = c >= 0xF0? 3 : c >= 0xE0? 2 : c >= 0xC0? 1 : 0;
+	if (n) {
+		unsigned code = c & (0x3F >> n);
+		int i = 1;
+		for (; i <= n && (u[i] & 0xC0) == 0x80; i++)
+			code = (code << 6) | (u[i] & 0x3F);
+		if (i > n) {
+			s += n+1;
+			return code;
+		}
+	}
+	s++;
+	return c;
+}
+
+struct GlyphImage {
+	unsigned codepoint;
+	int2 gSize, bearing;
+	GLuint advance;
+	vector<unsigned char> pixels;
+};
+
 void SetCharacterSet(CharacterSet &cs, const char *fontName, int charRes, int pixelRes) {
 	cs.charRes = charRes;
 	// init FreeType, load font face
@@ -43,37 +98,83 @@ void SetCharacterSet(CharacterSet &cs, const char *fontName, int charRes, int pi
 			printf("problem with FreeType, font load, or font face\n");
 			return;
 	}
-	// load glyphs
+	// render glyphs to memory
+	FT_Select_Charmap(face, FT_ENCODING_UNICODE);
 	FT_GlyphSlot g = face->glyph;
-	for (GLubyte c = 0; c < 128; c++) {
-		if (FT_Load_Char(face, c, FT_LOAD_RENDER))
-			printf("FreeType: failed to load Glyph\n");
-		else {
-			// generate texture
-			GLuint texture;
-			glGenTextures(1, &texture);
-			glBindTexture(GL_TEXTURE_2D, texture);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, g->bitmap.width, g->bitmap.rows, 0, GL_RED, GL_UNSIGNED_BYTE, g->bitmap.buffer);
-			// texture options
-			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			// store character
-			cs.characters[c] = Character(texture, int2(g->bitmap.width, g->bitmap.rows), int2(g->bitmap_left, g->bitmap_top), (GLuint) g->advance.x);
+	vector<GlyphImage> glyphs;
+	for (size_t r = 0; r < sizeof(glyphRanges)/sizeof(glyphRanges[0]); r++)
+		for (unsigned c = glyphRanges[r][0]; c <= glyphRanges[r][1]; c++) {
+			if (!FT_Get_Char_Index(face, c))
+				continue;
+			if (FT_Load_Char(face, c, FT_LOAD_RENDER)) {
+				printf("FreeType: failed to load Glyph %i\n", c);
+				continue;
+			}
+			GlyphImage gi;
+			gi.codepoint = c;
+			gi.gSize = int2(g->bitmap.width, g->bitmap.rows);
+			gi.bearing = int2(g->bitmap_left, g->bitmap_top);
+			gi.advance = (GLuint) g->advance.x;
+			gi.pixels.resize(gi.gSize.i1*gi.gSize.i2);
+			for (int row = 0; row < gi.gSize.i2; row++)
+				memcpy(&gi.pixels[row*gi.gSize.i1], g->bitmap.buffer+row*g->bitmap.pitch, gi.gSize.i1);
+			glyphs.push_back(gi);
 		}
-	}
 	FT_Done_Face(face);
 	FT_Done_FreeType(ft);
+	// pack glyphs with 1 pixel gutter, doubling atlas height until all fit
+	int nGlyphs = glyphs.size(), width = pixelRes > 48? 1024 : 512, height = 64;
+	vector<stbrp_rect> rects(nGlyphs);
+	vector<stbrp_node> nodes(width);
+	for (bool packed = false; !packed; height *= 2) {
+		if (height > 4096) {
+			printf("SetCharacterSet: glyphs do not fit in %ix%i atlas\n", width, height/2);
+			return;
+		}
+		for (int i = 0; i < nGlyphs; i++) {
+			rects[i].id = i;
+			rects[i].w = glyphs[i].gSize.i1+1;
+			rects[i].h = glyphs[i].gSize.i2+1;
+		}
+		stbrp_context context;
+		stbrp_init_target(&context, width, height, &nodes[0], width);
+		packed = nGlyphs == 0 || stbrp_pack_rects(&context, &rects[0], nGlyphs) != 0;
+		if (packed)
+			break;
+	}
+	// copy glyphs to atlas, store characters
+	vector<unsigned char> atlas(width*height, 0);
+	for (int i = 0; i < nGlyphs; i++) {
+		GlyphImage &gi = glyphs[rects[i].id];
+		int x = rects[i].x, y = rects[i].y, w = gi.gSize.i1, h = gi.gSize.i2;
+		for (int row = 0; row < h; row++)
+			memcpy(&atlas[(y+row)*width+x], &gi.pixels[row*w], w);
+		vec2 uv0((float) x/width, (float) y/height), uv1((float) (x+w)/width, (float) (y+h)/height);
+		Character ch(uv0, uv1, gi.gSize, gi.bearing, gi.advance);
+		if (gi.codepoint < 128)
+			cs.ascii[gi.codepoint] = ch;
+		else
+			cs.extended[gi.codepoint] = ch;
+	}
+	// generate texture
+	glGenTextures(1, &cs.atlas);
+	glBindTexture(GL_TEXTURE_2D, cs.atlas);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, &atlas[0]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	// texture options
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	cs.atlasSize = int2(width, height);
 }
 
 CharacterSet *SetFont(const char *fontName, int charRes, int pixelRes) {
 	CharacterSets::iterator it = fonts.find(fontName);
 	if (it == fonts.end()) {
-		CharacterSet cs;
-		SetCharacterSet(cs, fontName, charRes, pixelRes);
-		fonts[string(fontName)] = cs;
+		SetCharacterSet(fonts[string(fontName)], fontName, charRes, pixelRes);
 		it = fonts.find(fontName);
 	}
 	currentFont = &it->second;
@@ -83,59 +184,128 @@ CharacterSet *SetFont(const char *fontName, int charRes, int pixelRes) {
 static const char *textVertexShader = "\
 	#version 130									\n\
 	in vec4 point;									\n\
+	in vec2 uv;										\n\
+	in vec3 color;									\n\
 	out vec2 vUv;									\n\
-	uniform mat4 view;								\n\
+	out vec3 vColor;								\n\
 	void main() {									\n\
-		gl_Position = view*vec4(point.xy, 0, 1);	\n\
-		vUv = point.zw;								\n\
+		gl_Position = point;						\n\
+		vUv = uv;									\n\
+		vColor = color;								\n\
 	}												\n";
 
 static const char *textPixelShader = "\
 	#version 130									\n\
 	in vec2 vUv;									\n\
+	in vec3 vColor;									\n\
 	out vec4 pColor;								\n\
 	uniform sampler2D textureImage;					\n\
-	uniform vec3 color;								\n\
 	void main() {									\n\
 		float a = texture(textureImage, vUv).r;		\n\
-		pColor = vec4(color, a);					\n\
+		pColor = vec4(vColor, a);					\n\
 	}												\n";
 
-void RenderText(const char *text, float x, float y, vec3 color, float scale, mat4 view) {
+// Batching
+
+// vertices are transformed on the CPU, so strings with different views and colors share a draw
+struct TextVertex {
+	vec4 point;		// clip space
+	vec2 uv;
+	vec3 color;
+};
+
+struct TextBatch {
+	GLuint atlas;
+	vector<TextVertex> vertices;
+};
+
+static vector<TextBatch> textBatches;
+static int textBatchDepth = 0;
+
+static void FlushText() {
+	bool any = false;
+	for (size_t b = 0; b < textBatches.size(); b++)
+		any = any || !textBatches[b].vertices.empty();
+	if (!any)
+		return;
 	if (!textShaderProgram)
 		textShaderProgram = LinkProgramViaCode(&textVertexShader, &textPixelShader);
 	glUseProgram(textShaderProgram);
-	if (!currentFont) {
-		SetFont("C:/Fonts/OpenSans/OpenSans-Regular.ttf", 15, 30);	// unsure exact effect of charRes, pixelRes
-	//	return;
-	}
-	scale /= (float) currentFont->charRes;
-	// create quad vertex buffer and build characters
 	if (textVertexBuffer == 0)
 		glGenBuffers(1, &textVertexBuffer);
 	glBindBuffer(GL_ARRAY_BUFFER, textVertexBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*6*4, NULL, GL_DYNAMIC_DRAW);
-	VertexAttribPointer(textShaderProgram, "point", 4, 4*sizeof(float), 0);
-	SetUniform(textShaderProgram, "view", view);
-	SetUniform(textShaderProgram, "color", color);
-	// SetUniform(textShaderProgram, "textureImage", (int) textureID); // not needed? (defaults to 0?)
-    glActiveTexture(GL_TEXTURE0);
-    glBindBuffer(GL_ARRAY_BUFFER, textVertexBuffer);
+	glActiveTexture(GL_TEXTURE0);
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    for (const char *c = text; *c; c++) {
-        Character ch = currentFont->characters[(int)*c];
-        float xpos = x+ch.bearing.i1*scale, ypos = y-(ch.gSize.i2-ch.bearing.i2)*scale;
-        float w = ch.gSize.i1*scale, h = ch.gSize.i2*scale;
-        glBindTexture(GL_TEXTURE_2D, ch.textureID);
-        // update vertex memory
-        float vertices[][4] = {{xpos, ypos+h, 0, 0}, {xpos+w, ypos+h, 1, 0}, {xpos+w, ypos, 1, 1}, {xpos, ypos, 0, 1}};
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-        glDrawArrays(GL_QUADS, 0, 4);	// render glyph texture with quad
-        x += (ch.advance >> 6)*scale;	// advance character position in terms of 1/64 pixel
-    }
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
+	int stride = sizeof(TextVertex);
+	for (size_t b = 0; b < textBatches.size(); b++) {
+		vector<TextVertex> &v = textBatches[b].vertices;
+		if (v.empty())
+			continue;
+		// orphan previous contents, then one upload and one draw per font
+		glBufferData(GL_ARRAY_BUFFER, v.size()*stride, &v[0], GL_STREAM_DRAW);
+		VertexAttribPointer(textShaderProgram, "point", 4, stride, 0);
+		VertexAttribPointer(textShaderProgram, "uv", 2, stride, (void *) sizeof(vec4));
+		VertexAttribPointer(textShaderProgram, "color", 3, stride, (void *) (sizeof(vec4)+sizeof(vec2)));
+		glBindTexture(GL_TEXTURE_2D, textBatches[b].atlas);
+		glDrawArrays(GL_TRIANGLES, 0, v.size());
+		v.resize(0);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void BeginTextBatch() { textBatchDepth++; }
+
+void EndTextBatch() {
+	if (textBatchDepth > 0 && --textBatchDepth == 0)
+		FlushText();
+}
+
+static vector<TextVertex> &TextVertices(GLuint atlas) {
+	for (size_t b = 0; b < textBatches.size(); b++)
+		if (textBatches[b].atlas == atlas)
+			return textBatches[b].vertices;
+	TextBatch b;
+	b.atlas = atlas;
+	textBatches.push_back(b);
+	return textBatches.back().vertices;
+}
+
+void RenderText(const char *text, float x, float y, vec3 color, float scale, mat4 view) {
+	if (!currentFont) {
+		SetFont("C:/Fonts/OpenSans/OpenSans-Regular.ttf", 15, 30);	// unsure exact effect of charRes, pixelRes
+	//	return;
+	}
+	if (!currentFont->atlas)
+		return;
+	scale /= (float) currentFont->charRes;
+	vector<TextVertex> &v = TextVertices(currentFont->atlas);
+	const Character *missing = currentFont->Find('?');
+	for (const char *c = text; *c; ) {
+		unsigned code = NextCodepoint(c);
+		const Character *ch = currentFont->Find(code);
+		if (!ch && code < 32)
+			continue;
+		if (!ch && !(ch = missing))
+			continue;
+		float xpos = x+ch->bearing.i1*scale, ypos = y-(ch->gSize.i2-ch->bearing.i2)*scale;
+		float w = ch->gSize.i1*scale, h = ch->gSize.i2*scale;
+		if (w > 0 && h > 0) {
+			// two triangles per glyph
+			vec2 p[] = {vec2(xpos, ypos+h), vec2(xpos+w, ypos+h), vec2(xpos+w, ypos), vec2(xpos, ypos)};
+			vec2 uv[] = {ch->uv0, vec2(ch->uv1.x, ch->uv0.y), ch->uv1, vec2(ch->uv0.x, ch->uv1.y)};
+			int corners[] = {0, 1, 2, 0, 2, 3};
+			for (int k = 0; k < 6; k++) {
+				int i = corners[k];
+				TextVertex tv = {view*vec4(p[i].x, p[i].y, 0, 1), uv[i], color};
+				v.push_back(tv);
+			}
+		}
+		x += (ch->advance >> 6)*scale;	// advance character position in terms of 1/64 pixel
+	}
+	if (!textBatchDepth)
+		FlushText();
 }
 
 #define FormatString(buffer, maxBufferSize, format) {  \
@@ -155,9 +325,12 @@ float TextWidth(float scale, const char *format, ...) {
 	if (!currentFont)
 		SetFont("C:/Fonts/OpenSans/OpenSans-Regular.ttf", 15, 30);	// unsure exact affect of charRes, pixelRes
 	scale /= (float) currentFont->charRes;
-    for (const char *c = text; *c; c++) {
-        Character ch = currentFont->characters[(int)*c];
-        w += (ch.advance >> 6)*scale;
+	const Character *missing = currentFont->Find('?');
+    for (const char *c = text; *c; ) {
+		unsigned code = NextCodepoint(c);
+		const Character *ch = currentFont->Find(code);
+		if (ch || (code >= 32 && (ch = missing)))
+			w += (ch->advance >> 6)*scale;
     }
 //    printf("wid of %s = %4.3f\n", text, w);
     return w;
@@ -0,0 +1,285 @@
+// TextureStream.cpp - asynchronous texture loading: worker-thread decode, bounded per-frame upload through PBOs
+
+#include "TextureStream.h"
+#include "Misc.h"
+#include <algorithm>
+#include <chrono>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+double Now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string Extension(const char *filename) {
+    const char *dot = strrchr(filename, '.');
+    std::string e(dot? dot : "");
+    for (size_t i = 0; i < e.size(); i++)
+        e[i] = (char) tolower(e[i]);
+    return e;
+}
+
+unsigned char *DecodeTarga(const char *filename, int &width, int &height, int &bytesPerPixel) {
+    return ReadTarga(filename, width, height, bytesPerPixel);
+}
+
+} // end namespace
+
+TextureStreamer::TextureStreamer(int n) : stopping(false), compressedFormats(0), startTime(-1), endTime(-1) {
+    nThreads = n > 0? n : std::min(4, (int) std::thread::hardware_concurrency());
+    if (nThreads < 1)
+        nThreads = 1;
+    decoders[".tga"] = DecodeTarga;
+}
+
+TextureStreamer::~TextureStreamer() {
+    // no GL calls: the context may be gone; Free releases buffers
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queueChanged.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    for (size_t i = 0; i < textures.size(); i++) {
+        delete [] textures[i]->pixels;
+        delete textures[i];
+    }
+}
+
+void TextureStreamer::AddDecoder(const char *extension, TextureDecoder decoder) {
+    std::string e = extension[0] == '.'? extension : std::string(".")+extension;
+    std::lock_guard<std::mutex> lock(mutex);
+    decoders[Extension(e.c_str())] = decoder;
+}
+
+void TextureStreamer::EnableCompression(const char *dir) {
+    std::lock_guard<std::mutex> lock(mutex);
+    compressedFormats = CompressedFormatsSupported();
+    cacheDir = dir;
+}
+
+GLuint TextureStreamer::Request(const char *filename, GLuint textureUnit, const unsigned char *placeholderRGB, bool mipmap,
+                                TexMap map, const char *normalMapFilename) {
+    std::map<std::string, Texture *>::iterator it = byFilename.find(filename);
+    if (it != byFilename.end())
+        return it->second->name;
+    unsigned char gray[] = {128, 128, 128};
+    Texture *t = new Texture();
+    t->filename = filename;
+    t->unit = textureUnit;
+    t->pbo = 0;
+    t->mipmap = mipmap;
+    t->map = map;
+    t->normalMap = normalMapFilename? normalMapFilename : "";
+    t->state = Queued;
+    t->width = t->height = t->bytesPerPixel = t->size = t->staged = 0;
+    t->pixels = NULL;
+    t->name = LoadTexture((unsigned char *) (placeholderRGB? placeholderRGB : gray), 1, 1, textureUnit, false, false);
+    bool idle = Pending() == 0;      // time from the first request after an idle period
+    textures.push_back(t);
+    byFilename[t->filename] = t;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (idle)
+            startTime = Now();
+        queue.push_back(t);
+        // workers start with the first request and remain until Free
+        while ((int) workers.size() < nThreads && !stopping)
+            workers.push_back(std::thread(&TextureStreamer::Decode, this));
+    }
+    queueChanged.notify_one();
+    return t->name;
+}
+
+void TextureStreamer::Decode() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        queueChanged.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (stopping)
+            return;
+        Texture *t = queue.front();
+        queue.pop_front();
+        t->state = Decoding;
+        std::string extension = Extension(t->filename.c_str());
+        std::map<std::string, TextureDecoder>::iterator d = decoders.find(extension);
+        TextureDecoder decoder = d != decoders.end()? d->second : DecodeTarga;
+        unsigned formats = extension == ".tga"? compressedFormats : 0;
+        std::string dir = cacheDir;
+        lock.unlock();
+        int width = 0, height = 0, bytesPerPixel = 0, size = 0;
+        unsigned char *pixels = NULL;
+        bool ok = false;
+        if (formats) {
+            // compress on this worker alone: the other workers are busy with other files
+            ok = ReadCompressedTexture(t->filename.c_str(), t->map, formats, t->compressed, t->mipmap, dir.c_str(), 1,
+                                       t->normalMap.empty()? NULL : t->normalMap.c_str());
+            ok = ok && t->compressed.format != TexUncompressed;
+            if (ok) {
+                width = t->compressed.levels[0].width;
+                height = t->compressed.levels[0].height;
+                size = (int) t->compressed.data.size();
+            }
+        }
+        if (!ok) {
+            pixels = decoder(t->filename.c_str(), width, height, bytesPerPixel);
+            ok = pixels && width > 0 && height > 0 && (bytesPerPixel == 1 || bytesPerPixel == 3 || bytesPerPixel == 4);
+            size = width*height*bytesPerPixel;
+            if (!ok) {
+                printf("can't read %s\n", t->filename.c_str());
+                delete [] pixels;
+                pixels = NULL;
+            }
+        }
+        lock.lock();
+        t->pixels = pixels;
+        t->width = width;
+        t->height = height;
+        t->bytesPerPixel = bytesPerPixel;
+        t->size = size;
+        t->state = ok? Decoded : Failed;
+        decoded.notify_all();
+    }
+}
+
+bool TextureStreamer::Stage(Texture *t, int &budget) {
+    // copy up to budget bytes into the texture's unpack buffer; once full, replace the placeholder
+    int size = t->size;
+    unsigned char *source = t->pixels? t->pixels : &t->compressed.data[0];
+    if (!t->pbo) {
+        glGenBuffers(1, &t->pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, t->pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+        std::lock_guard<std::mutex> lock(mutex);
+        t->state = Staging;
+    }
+    else
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, t->pbo);
+    int n = std::min(budget, size-t->staged);
+    if (n > 0) {
+        // the buffer is not yet read by GL, so an unsynchronized map does not stall
+        void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, t->staged, n,
+                                     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (dst) {
+            memcpy(dst, source+t->staged, n);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        else
+            glBufferSubData(GL_PIXEL_UNPACK_BUFFER, t->staged, n, source+t->staged);
+        t->staged += n;
+        budget -= n;
+    }
+    if (t->staged < size) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return false;
+    }
+    // source is the bound unpack buffer; the copy proceeds asynchronously
+    if (t->pixels)
+        LoadTexture(NULL, t->width, t->height, t->unit, t->name, true, t->mipmap, t->bytesPerPixel); // Targa is BGR(A)
+    else
+        LoadCompressedTexture(t->compressed, t->unit, t->name, true);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &t->pbo);        // storage released once the copy completes
+    t->pbo = 0;
+    delete [] t->pixels;
+    t->pixels = NULL;
+    std::vector<unsigned char>().swap(t->compressed.data);
+    std::lock_guard<std::mutex> lock(mutex);
+    t->state = Resident;
+    endTime = Now();
+    return true;
+}
+
+int TextureStreamer::Update(int maxBytes) {
+    int budget = maxBytes, nResident = 0;
+    // finish partly staged textures first, then start others in request order
+    for (int pass = 0; pass < 2 && budget > 0; pass++)
+        for (size_t i = 0; i < textures.size() && budget > 0; i++) {
+            Texture *t = textures[i];
+            State s;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                s = t->state;
+            }
+            if (s == (pass == 0? Staging : Decoded) && Stage(t, budget))
+                nResident++;
+        }
+    return nResident;
+}
+
+void TextureStreamer::Finish() {
+    for (;;) {
+        Update(0x7fffffff);
+        std::unique_lock<std::mutex> lock(mutex);
+        bool busy = false, ready = false;
+        for (size_t i = 0; i < textures.size(); i++) {
+            State s = textures[i]->state;
+            busy = busy || s == Queued || s == Decoding;
+            ready = ready || s == Decoded || s == Staging;
+        }
+        if (ready)
+            continue;
+        if (!busy)
+            return;
+        decoded.wait(lock);
+    }
+}
+
+int TextureStreamer::Pending() {
+    std::lock_guard<std::mutex> lock(mutex);
+    int n = 0;
+    for (size_t i = 0; i < textures.size(); i++)
+        if (textures[i]->state != Resident && textures[i]->state != Failed)
+            n++;
+    return n;
+}
+
+bool TextureStreamer::IsResident(GLuint textureName) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < textures.size(); i++)
+        if (textures[i]->name == textureName)
+            return textures[i]->state == Resident;
+    return false;
+}
+
+TextureStreamStats TextureStreamer::Stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    TextureStreamStats s = {(int) textures.size(), 0, 0, 0, 0};
+    for (size_t i = 0; i < textures.size(); i++) {
+        Texture *t = textures[i];
+        if (t->state == Resident) {
+            s.nResident++;
+            s.megabytes += t->size/(1024.*1024.);
+        }
+        s.nFailed += t->state == Failed? 1 : 0;
+    }
+    s.seconds = startTime >= 0 && endTime >= startTime? endTime-startTime : 0;
+    return s;
+}
+
+void TextureStreamer::Free() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        queue.clear();
+    }
+    queueChanged.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    workers.resize(0);
+    for (size_t i = 0; i < textures.size(); i++) {
+        Texture *t = textures[i];
+        if (t->pbo)
+            glDeleteBuffers(1, &t->pbo);
+        t->pbo = 0;
+        delete [] t->pixels;
+        t->pixels = NULL;
+        std::vector<unsigned char>().swap(t->compressed.data);
+        if (t->state != Resident)
+            t->state = Failed;
+    }
+    stopping = false;
+}
@@ -391,6 +391,12 @@ bool Magnifier::Hit(int x, int y) {
 	return x >= srcLoc[0] && y >= srcLoc[1] && x <= srcLoc[0]+nxBlocks-1 && y <= srcLoc[1]+nyBlocks-1;
 }
 
+void Magnifier::Receive(unsigned char *bgr, int width, int height, void *magnifier) {
+	Magnifier *m = (Magnifier *) magnifier;
+	m->pixels.assign(bgr, bgr+3*width*height);
+	m->pixelsSize = int2(width, height);
+}
+
 void Magnifier::Display(int2 displayLoc, bool showSrcWindow) {
 	class Helper { public:
 		void Rect(int x, int y, int w, int h, bool solid, vec3 col) {
@@ -400,17 +406,22 @@ void Magnifier::Display(int2 displayLoc, bool showSrcWindow) {
 	} h;
 	int nxBlocks = displaySize[0]/blockSize, nyBlocks = displaySize[1]/blockSize;
 	int dy = displaySize[1]-nyBlocks*blockSize;
-	float *pixels = new float[nxBlocks*nyBlocks*3];
-	glReadPixels(srcLoc[0], srcLoc[1], nxBlocks, nyBlocks, GL_RGB, GL_FLOAT, pixels);
-	for (int i = 0; i < nxBlocks; i++)
-		for (int j = 0; j < nyBlocks; j++) {
-			float *pixel = pixels+3*(i*nyBlocks+j);
-			vec3 col(pixel[0], pixel[1], pixel[2]);
-			h.Rect(displayLoc[0]+blockSize*i, displayLoc[1]+blockSize*j+dy, blockSize, blockSize, true, col);
-		}
+	// queue read of source window, display the most recent completed read
+	readback.Request(srcLoc[0], srcLoc[1], nxBlocks, nyBlocks, Receive, this, false);
+	readback.Poll();
+	BeginDrawBatch();
+	if (pixelsSize[0] == nxBlocks && pixelsSize[1] == nyBlocks)
+		for (int j = 0; j < nyBlocks; j++)
+			for (int i = 0; i < nxBlocks; i++) {
+				unsigned char *pixel = &pixels[3*(j*nxBlocks+i)];
+				vec3 col(pixel[2]/255.f, pixel[1]/255.f, pixel[0]/255.f);
+				h.Rect(displayLoc[0]+blockSize*i, displayLoc[1]+blockSize*j+dy, blockSize, blockSize, true, col);
+			}
+	EndDrawBatch();
 	glDisable(GL_BLEND);
 	if (showSrcWindow)
 		h.Rect(srcLoc[0], srcLoc[1], nxBlocks-1, nyBlocks-1, false, vec3(0, 1, 1));
 	h.Rect(displayLoc[0], displayLoc[1]+dy, nxBlocks*blockSize, nyBlocks*blockSize, false, vec3(0, 1, 1));
-	delete [] pixels;
 }
+
+void Magnifier::Free() { readback.Free(); }